@@ -0,0 +1,532 @@
+﻿//==============================================================================
+//
+// ベンチマーク
+//
+//  DPMS, DPMF と mi:: の画像処理クラスの処理時間を計測して CSV / JSON で出力する
+//
+//  使い方: make bench [BENCHFLAGS="--json --reps 21 --output bench.json"]
+//    --csv         CSV で出力する (既定)
+//    --json        JSON で出力する
+//    --reps N      1条件あたりの計測回数 (既定 11)
+//    --quick       計測回数と条件を減らす
+//    --output FILE 出力先 (既定は標準出力)
+//    --trace FILE  処理ごとの時間を Chrome trace の JSON で出力し, 集計を標準エラーに出す
+//                  (make PROFILE=1 でビルドしたときだけ)
+//
+//==============================================================================
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "ThreadPool.h"
+#include "DPMS.h"
+#include "DPMF.h"
+#include "miImage/miImage.h"
+#include "miImage/miImageProcessing.h"
+#include "miImage/miDepthProcessing.h"
+#include "miImage/miFilterPipeline.h"
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// 計測条件と結果
+//-----------------------------------------------------------------------------
+struct Result {
+    std::string group;  // dpms, sgm, dpmf, filter
+    std::string name;   // 処理名
+    int width     = 0;
+    int height    = 0;
+    int disparity = 0;  // leftRange (DPMS, SGM のみ)
+    int skip      = 0;
+    int rowRange  = 0;  // DPMS, SGM のみ
+    int threads   = 0;
+    int reps      = 0;
+    double medianMs = 0;
+    double p99Ms    = 0;
+    double mpixPerS = 0;
+    long peakRssKB  = 0;
+};
+
+//-----------------------------------------------------------------------------
+// オプション
+//-----------------------------------------------------------------------------
+struct Options {
+    bool json  = false;
+    bool quick = false;
+    int  reps  = 11;
+    std::string output;
+    std::string trace;
+};
+
+//-----------------------------------------------------------------------------
+// @brief プロセスの最大常駐メモリ (KB) を返す
+//-----------------------------------------------------------------------------
+long PeakRssKB()
+{
+#if defined(__APPLE__)
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024;  // macOS はバイト単位
+#elif defined(__unix__)
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#else
+    return 0;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// @brief 処理を reps 回計測して結果に書き込む (最初に 1 回空回しする)
+// @param result 結果の書き込み先
+// @param pixels 1回の処理の画素数
+// @param reps   計測回数
+// @param prepare 計測しない前処理 (入力のコピーなど)
+// @param run     計測する処理
+//-----------------------------------------------------------------------------
+void Measure(Result& result, long pixels, int reps,
+             const std::function<void()>& prepare, const std::function<void()>& run)
+{
+    std::vector<double> times;
+
+    for(int i=-1; i<reps; i++)
+    {
+        prepare();
+
+        auto start = std::chrono::steady_clock::now();
+        run();
+        auto end   = std::chrono::steady_clock::now();
+
+        if(i >= 0) {
+            times.push_back(std::chrono::duration<double, std::milli>(end-start).count());
+        }
+    }
+
+    std::sort(times.begin(), times.end());
+
+    // 最近傍順位で求める
+    auto percentile = [&](double p) {
+        int rank = (int)std::ceil(p * times.size()) - 1;
+        return times[std::max(0, std::min(rank, (int)times.size()-1))];
+    };
+
+    result.reps     = reps;
+    result.medianMs = percentile(0.5);
+    result.p99Ms    = percentile(0.99);
+    result.mpixPerS = result.medianMs > 0 ? pixels / (result.medianMs * 1000.0) : 0;
+    result.peakRssKB= PeakRssKB();
+}
+
+//-----------------------------------------------------------------------------
+// @brief 画像を scale 倍に変更したコピーを返す
+//-----------------------------------------------------------------------------
+mi::Image Scaled(const mi::Image& image, double scale)
+{
+    mi::Image scaled = image;
+    if(scale != 1.0) {
+        scaled.Resize((int)(image.Width()*scale), (int)(image.Height()*scale));
+    }
+    return scaled;
+}
+
+//-----------------------------------------------------------------------------
+// @brief 計測するスレッド数 (1 から hardware_concurrency まで 2 倍ずつ)
+//-----------------------------------------------------------------------------
+std::vector<int> ThreadCounts()
+{
+    int hardware = std::max(1, (int)std::thread::hardware_concurrency());
+
+    std::vector<int> counts;
+    for(int n=1; n<hardware; n*=2) {
+        counts.push_back(n);
+    }
+    counts.push_back(hardware);
+    return counts;
+}
+
+//-----------------------------------------------------------------------------
+// @brief DPMS の計測
+//   基準の条件から 1 つずつパラメータを変えて計測する
+//-----------------------------------------------------------------------------
+void BenchDPMS(std::vector<Result>& results, const Options& options,
+               const mi::Image& left, const mi::Image& right)
+{
+    struct Case { double scale; int disparity, skip, rowRange, threads; };
+
+    const int hardware = ThreadCounts().back();
+    const Case base = { 1.0, 40, 8, 4, hardware };
+
+    std::vector<Case> cases = { base };
+
+    std::vector<double> scales   = options.quick ? std::vector<double>{0.5}     : std::vector<double>{0.5, 2.0};
+    std::vector<int> disparities = options.quick ? std::vector<int>{16}        : std::vector<int>{16, 64, 96};
+    std::vector<int> skips       = options.quick ? std::vector<int>{4}         : std::vector<int>{2, 4, 16};
+    std::vector<int> rowRanges   = options.quick ? std::vector<int>{1}         : std::vector<int>{1, 2, 8};
+
+    for(double s : scales)      { Case c = base; c.scale = s;     cases.push_back(c); }
+    for(int d : disparities)    { Case c = base; c.disparity = d; cases.push_back(c); }
+    for(int s : skips)          { Case c = base; c.skip = s;      cases.push_back(c); }
+    for(int r : rowRanges)      { Case c = base; c.rowRange = r;  cases.push_back(c); }
+    for(int t : ThreadCounts()) { if(t == hardware) continue; Case c = base; c.threads = t; cases.push_back(c); }
+
+    for(const Case& c : cases)
+    {
+        mi::Image l = Scaled(left,  c.scale);
+        mi::Image r = Scaled(right, c.scale);
+
+        DPMS dpms(l, r, c.threads);
+
+        Result result;
+        result.group     = "dpms";
+        result.name      = "DPMS::dp";
+        result.width     = l.Width();
+        result.height    = l.Height();
+        result.disparity = (int)(c.disparity * c.scale);
+        result.skip      = c.skip;
+        result.rowRange  = c.rowRange;
+        result.threads   = c.threads;
+
+        Measure(result, l.Size(), options.reps, []{}, [&]{
+            dpms.dp(c.skip, 13, c.rowRange, 80, result.disparity);
+        });
+
+        results.push_back(result);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// @brief DPMS::sgm() の計測
+//   経路の数と, 全体のコストを持つか 1 行ずつ流すかを変えて計測する
+//-----------------------------------------------------------------------------
+void BenchSGM(std::vector<Result>& results, const Options& options,
+              const mi::Image& left, const mi::Image& right)
+{
+    struct Case { int paths; bool streaming; };
+
+    std::vector<Case> cases = { {8, false}, {4, false}, {8, true} };
+    if(options.quick) cases.resize(1);
+
+    const int threads = ThreadCounts().back();
+
+    for(const Case& c : cases)
+    {
+        DPMS dpms(left.View(), right.View(), threads);
+        dpms.semiGlobal.paths     = c.paths;
+        dpms.semiGlobal.streaming = c.streaming;
+
+        Result result;
+        result.group     = "sgm";
+        result.name      = std::string("DPMS::sgm/") + std::to_string(c.paths) + (c.streaming ? "/stream" : "");
+        result.width     = left.Width();
+        result.height    = left.Height();
+        result.disparity = 40;
+        result.skip      = 1;
+        result.rowRange  = 4;
+        result.threads   = threads;
+
+        Measure(result, left.Size(), options.reps, []{}, [&]{
+            dpms.sgm(result.rowRange, 80, result.disparity);
+        });
+
+        results.push_back(result);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// @brief DPMF の計測
+//   DPMS の視差画像と, それをぼかした画像を統合する
+//-----------------------------------------------------------------------------
+void BenchDPMF(std::vector<Result>& results, const Options& options,
+               const mi::Image& left, const mi::Image& right)
+{
+    struct Case { double scale; int skip, threads; };
+
+    const int hardware = ThreadCounts().back();
+    const Case base = { 1.0, 8, hardware };
+
+    std::vector<Case> cases = { base };
+    for(double s : {0.5})     { Case c = base; c.scale = s; cases.push_back(c); }
+    for(int s : {4, 16})      { Case c = base; c.skip = s;  cases.push_back(c); }
+    for(int t : ThreadCounts()) { if(t == hardware) continue; Case c = base; c.threads = t; cases.push_back(c); }
+
+    if(options.quick) cases.resize(2);
+
+    for(const Case& c : cases)
+    {
+        mi::Image l = Scaled(left,  c.scale);
+        mi::Image r = Scaled(right, c.scale);
+
+        // 視差画像 (カメラ) と, それをぼかした画像 (レーザの代わり)
+        mi::Image camera(l.Bit(), l.Width(), l.Height());
+        {
+            DPMS dpms(l, r, c.threads);
+            dpms.dp(8, 13, 4, 80, 40);
+
+            for(int iY=0; iY<camera.Height(); iY++) {
+                const std::vector<int>& match = dpms.getMatchPattern(iY);
+                for(int iX=0; iX<camera.Width(); iX++) {
+                    unsigned char d = (unsigned char)std::min(std::abs(match[iX]-iX) * 255.0 / 40, 255.0);
+                    camera.data[iY*camera.Width() + iX] = mi::RGB(d, d, d);
+                }
+            }
+        }
+        mi::Image laser = camera;
+        mi::GaussianFilter::Process(laser, 9, 8.0);
+
+        DPMF dpmf(camera, laser, c.threads);
+
+        Result result;
+        result.group   = "dpmf";
+        result.name    = "DPMF::dp";
+        result.width   = camera.Width();
+        result.height  = camera.Height();
+        result.skip    = c.skip;
+        result.threads = c.threads;
+
+        Measure(result, camera.Size(), options.reps, []{}, [&]{
+            dpmf.dp(c.skip, 0.30, 0.03);
+        });
+
+        results.push_back(result);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// @brief 画像処理クラスの計測
+//-----------------------------------------------------------------------------
+void BenchFilters(std::vector<Result>& results, const Options& options,
+                  const mi::Image& left, const mi::Image& right)
+{
+    struct Filter {
+        const char* name;
+        std::function<void(mi::Image& image, mi::Image& reference)> process;
+    };
+
+    const std::vector<Filter> filters = {
+        { "Monochrome",              [](mi::Image& im, mi::Image&){ mi::Monochrome::Process(im); } },
+        { "DitheringErrorDiffusion", [](mi::Image& im, mi::Image&){ mi::DitheringErrorDiffusion::Process(im); } },
+        { "Binarize",                [](mi::Image& im, mi::Image&){ mi::Binarize::Process(im, 128); } },
+        { "MedianFilter",            [](mi::Image& im, mi::Image&){ mi::MedianFilter::Process(im, 5); } },
+        { "MedianFilter15",          [](mi::Image& im, mi::Image&){ mi::MedianFilter::Process(im, 15); } },
+        { "AverageFilter",           [](mi::Image& im, mi::Image&){ mi::AverageFilter::Process(im, 5); } },
+        { "GaussianFilter",          [](mi::Image& im, mi::Image&){ mi::GaussianFilter::Process(im, 5, 2.0); } },
+        { "GaussianFilterPlane8",    [](mi::Image& im, mi::Image&){
+                                         // R チャンネルだけを 1 チャンネルの画像で処理する
+                                         static mi::Plane8 plane;
+                                         mi::ExtractChannel(im, 0, plane);
+                                         mi::GaussianFilter::Process(plane, plane, 5, 2.0); } },
+        { "BilateralFilter",         [](mi::Image& im, mi::Image&){ mi::BilateralFilter::Process(im, 5, 3.0, 20.0); } },
+        { "BilateralFilterGrid",     [](mi::Image& im, mi::Image&){
+                                         mi::BilateralFilter::Process(im, 25, 4.0, 20.0, mi::BILATERAL_GRID); } },
+        { "SobelFilter",             [](mi::Image& im, mi::Image&){ mi::SobelFilter::Process(im); } },
+        { "LaplacianFilter",         [](mi::Image& im, mi::Image&){ mi::LaplacianFilter::Process(im); } },
+        { "HistgramEqualization",    [](mi::Image& im, mi::Image&){ mi::HistgramEqualization::Process(im); } },
+        { "HistgramExtention",       [](mi::Image& im, mi::Image&){ mi::HistgramExtention::Process(im); } },
+        { "AlphaBlend",              [](mi::Image& im, mi::Image& ref){ mi::AlphaBlend::Process(im, ref, 0.5); } },
+        { "GammaCollection",         [](mi::Image& im, mi::Image&){ mi::GammaCollection::Process(im, 2.2); } },
+        { "LogisticFilter",          [](mi::Image& im, mi::Image&){ mi::LogisticFilter::Process(im, 0.05, 128); } },
+        { "MedianTSFilter",          [](mi::Image& im, mi::Image& ref){
+                                         std::vector<mi::Image> inputs = { im, ref, im };
+                                         mi::MedianTSFilter::Process(im, inputs, 3); } },
+        { "MedianTSFilter15",        [](mi::Image& im, mi::Image& ref){
+                                         std::vector<mi::Image> inputs = { im, ref, im, ref, im };
+                                         mi::MedianTSFilter::Process(im, inputs, 15); } },
+        { "TrilateralFilter",        [](mi::Image& im, mi::Image& ref){ mi::TrilateralFilter::Process(im, ref, 5, 3.0, 20.0); } },
+        { "TrilateralFilterGrid",    [](mi::Image& im, mi::Image& ref){
+                                         mi::TrilateralFilter::Process(im, ref, 25, 4.0, 20.0, mi::BILATERAL_GRID); } },
+        { "QuadrilateralFilter",     [](mi::Image& im, mi::Image& ref){
+                                         mi::QuadrilateralFilter::Process(im, ref, im, ref, 5); } },
+        { "FilterPipeline",          [](mi::Image& im, mi::Image&){
+                                         // Monochrome -> Median -> Gamma (画素ごとの処理はまとめて掛かる)
+                                         static mi::FilterPipeline pipeline;
+                                         static bool initialized = false;
+                                         if(!initialized) {
+                                             pipeline.Point(mi::Monochrome::Operation())
+                                                     .Filter([](const mi::Image& src, mi::Image& dst){ mi::MedianFilter::Process(src, dst, 5); })
+                                                     .Point(mi::GammaCollection::Operation(2.2));
+                                             initialized = true;
+                                         }
+                                         pipeline.Process(im, im); } },
+    };
+
+    std::vector<double> scales = options.quick ? std::vector<double>{1.0} : std::vector<double>{0.5, 1.0, 2.0};
+    std::vector<int> threads   = options.quick ? std::vector<int>{ThreadCounts().back()} : ThreadCounts();
+
+    for(double scale : scales)
+    {
+        mi::Image l = Scaled(left,  scale);
+        mi::Image r = Scaled(right, scale);
+
+        for(int t : threads)
+        {
+            ThreadPool threadPool(t);
+            mi::IImageProcessing::SetThreadPool(&threadPool);
+
+            for(const Filter& filter : filters)
+            {
+                mi::Image image, reference;
+
+                Result result;
+                result.group   = "filter";
+                result.name    = filter.name;
+                result.width   = l.Width();
+                result.height  = l.Height();
+                result.threads = t;
+
+                Measure(result, l.Size(), options.reps,
+                        [&]{ image = l; reference = r; },
+                        [&]{ filter.process(image, reference); });
+
+                results.push_back(result);
+            }
+
+            mi::IImageProcessing::SetThreadPool(nullptr);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// @brief 結果を CSV で書き出す
+//-----------------------------------------------------------------------------
+void WriteCSV(FILE* fp, const std::vector<Result>& results)
+{
+    fprintf(fp, "group,name,width,height,disparity,skip,row_range,threads,reps,"
+                "median_ms,p99_ms,mpix_per_s,peak_rss_kb\n");
+
+    for(const Result& r : results) {
+        fprintf(fp, "%s,%s,%d,%d,%d,%d,%d,%d,%d,%.3f,%.3f,%.3f,%ld\n",
+                r.group.c_str(), r.name.c_str(), r.width, r.height, r.disparity, r.skip,
+                r.rowRange, r.threads, r.reps, r.medianMs, r.p99Ms, r.mpixPerS, r.peakRssKB);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// @brief 結果を JSON で書き出す
+//-----------------------------------------------------------------------------
+void WriteJSON(FILE* fp, const std::vector<Result>& results)
+{
+    fprintf(fp, "[\n");
+
+    for(size_t i=0; i<results.size(); i++) {
+        const Result& r = results[i];
+        fprintf(fp, "  {\"group\": \"%s\", \"name\": \"%s\", \"width\": %d, \"height\": %d, "
+                    "\"disparity\": %d, \"skip\": %d, \"row_range\": %d, \"threads\": %d, \"reps\": %d, "
+                    "\"median_ms\": %.3f, \"p99_ms\": %.3f, \"mpix_per_s\": %.3f, \"peak_rss_kb\": %ld}%s\n",
+                r.group.c_str(), r.name.c_str(), r.width, r.height, r.disparity, r.skip,
+                r.rowRange, r.threads, r.reps, r.medianMs, r.p99Ms, r.mpixPerS, r.peakRssKB,
+                i+1 < results.size() ? "," : "");
+    }
+
+    fprintf(fp, "]\n");
+}
+
+//-----------------------------------------------------------------------------
+// @brief DPProfile の記録を Chrome trace に書き出し, 処理ごとの集計を標準エラーに出す
+//-----------------------------------------------------------------------------
+void WriteTrace(const std::string& file)
+{
+    if(!DPProfile::Enabled()) {
+        fprintf(stderr, "--trace: build with make PROFILE=1\n");
+        return;
+    }
+
+    std::ofstream os(file.c_str());
+    if(!os) {
+        fprintf(stderr, "cannot open %s\n", file.c_str());
+        return;
+    }
+    DPProfile::WriteChromeTrace(os);
+
+    DPProfile::Report report = DPProfile::GetReport();
+
+    fprintf(stderr, "%-16s %12s %10s\n", "phase", "total[ms]", "calls");
+    for(int k=0; k<DPProfile::PhaseCount; k++) {
+        fprintf(stderr, "%-16s %12.3f %10llu\n", DPProfile::PhaseName((DPProfile::Phase)k),
+                report.total.phaseNs[k] * 1e-6, (unsigned long long)report.total.phaseCalls[k]);
+    }
+    for(int k=0; k<DPProfile::CounterCount; k++) {
+        fprintf(stderr, "%-16s %12llu\n", DPProfile::CounterName((DPProfile::Counter)k),
+                (unsigned long long)report.total.counters[k]);
+    }
+    if(report.total.droppedEvents > 0) {
+        fprintf(stderr, "%-16s %12llu (not in %s)\n", "dropped_events",
+                (unsigned long long)report.total.droppedEvents, file.c_str());
+    }
+}
+
+//-----------------------------------------------------------------------------
+// @brief コマンドライン引数の解析
+//-----------------------------------------------------------------------------
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for(int i=1; i<argc; i++)
+    {
+        if(!strcmp(argv[i], "--json"))                  options.json  = true;
+        else if(!strcmp(argv[i], "--csv"))              options.json  = false;
+        else if(!strcmp(argv[i], "--quick"))            options.quick = true;
+        else if(!strcmp(argv[i], "--reps")   && i+1<argc) options.reps  = std::max(1, atoi(argv[++i]));
+        else if(!strcmp(argv[i], "--output") && i+1<argc) options.output= argv[++i];
+        else if(!strcmp(argv[i], "--trace")  && i+1<argc) options.trace = argv[++i];
+        else {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            return false;
+        }
+    }
+
+    if(options.quick) {
+        options.reps = std::min(options.reps, 3);
+    }
+    return true;
+}
+
+}
+
+//-----------------------------------------------------------------------------
+// @brief main 関数
+//-----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    Options options;
+    if(!ParseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    mi::Image left("input/tsukuba/color_left.bmp");
+    mi::Image right("input/tsukuba/color_right.bmp");
+
+    std::vector<Result> results;
+
+    BenchDPMS(results, options, left, right);
+    BenchSGM(results, options, left, right);
+    BenchDPMF(results, options, left, right);
+    BenchFilters(results, options, left, right);
+
+    FILE* fp = options.output.empty() ? stdout : fopen(options.output.c_str(), "w");
+    if(!fp) {
+        fprintf(stderr, "cannot open %s\n", options.output.c_str());
+        return 1;
+    }
+
+    if(options.json) WriteJSON(fp, results);
+    else             WriteCSV(fp, results);
+
+    if(fp != stdout) fclose(fp);
+
+    if(!options.trace.empty()) {
+        WriteTrace(options.trace);
+    }
+
+    return 0;
+}
@@ -0,0 +1,561 @@
+﻿//==============================================================================
+//
+// 動作確認
+//
+//  画像の保存と読み込みが元の画素に戻るか, DP の結果がスレッド数や
+//  並列化の方法 (走査線の分割, 前の結果の再利用, バッチ, 動画) に依らないかを確かめる
+//
+//  使い方: make check
+//    失敗した項目を標準エラーに出し, 1 つでも失敗したら 1 を返す
+//
+//==============================================================================
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "miImage/miImage.h"
+#include "miImage/miImageCodec.h"
+#include "miImage/miRawImage.h"
+#include "miImage/miFilterPipeline.h"
+
+#include "DPMS.h"
+#include "DPMF.h"
+#include "StereoBatch.h"
+#include "StereoStream.h"
+
+namespace {
+
+int failures = 0;
+
+//-----------------------------------------------------------------------------
+// @brief 項目を実行して結果を出力する
+// @param name 項目名
+// @param test 成功したら true を返す関数
+//-----------------------------------------------------------------------------
+void Check(const char* name, const std::function<bool()>& test) {
+
+    bool ok = false;
+
+    try {
+        ok = test();
+    }
+    catch(const char* error) {
+        std::fprintf(stderr, "  exception: %s\n", error);
+    }
+
+    std::fprintf(ok ? stdout : stderr, "%s %s\n", ok ? "ok  " : "FAIL", name);
+    if(!ok) failures++;
+}
+
+//-----------------------------------------------------------------------------
+// @brief 保存して読み込んだ画像が元の画像と一致するか (幅が 4 の倍数でない画像も試す)
+// @param bit      bit数
+// @param fileName 一時ファイルの名前
+//-----------------------------------------------------------------------------
+bool RoundTrip(int bit, const char* fileName) {
+
+    for(int width : {8, 5, 7}) {
+        const int height = 3;
+
+        mi::Image image(bit, width, height);
+
+        for(int i=0; i<image.Size(); i++) {
+            unsigned char value = (unsigned char)(i * 37 + 11);
+            image.data[i].r = bit == 8 ? value : (unsigned char)(value + 1);
+            image.data[i].g = bit == 8 ? value : (unsigned char)(value + 2);
+            image.data[i].b = value;
+        }
+
+        image.Save(fileName);
+
+        mi::Image loaded(fileName);
+        std::remove(fileName);
+
+        if(loaded.Width() != width || loaded.Height() != height || loaded.Bit() != bit) {
+            std::fprintf(stderr, "  %d: size %dx%d %dbit\n", width, loaded.Width(), loaded.Height(), loaded.Bit());
+            return false;
+        }
+
+        int wrong = 0;
+        for(int i=0; i<image.Size(); i++) {
+            const mi::RGB& a = image.data[i];
+            const mi::RGB& b = loaded.data[i];
+            if(a.r != b.r || a.g != b.g || a.b != b.b) wrong++;
+        }
+
+        if(wrong > 0) {
+            std::fprintf(stderr, "  %d: %d of %d pixels differ\n", width, wrong, image.Size());
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// @brief 途中で終わっている raw 画像を読み込むと残りの画素が 0 になるか
+//   読み込む先は大きさが同じで bit 数が違う画像にして, ファイルの bit 数になることも確かめる
+// @param fileName 一時ファイルの名前
+//-----------------------------------------------------------------------------
+bool TruncatedRaw(const char* fileName) {
+
+    const int width = 4, height = 4;
+
+    mi::Image image(24, width, height);
+    for(int i=0; i<image.Size(); i++) {
+        image.data[i] = mi::RGB(10, 20, 30);
+    }
+    image.Save(fileName);
+
+    // ヘッダ (64 byte) と 1 行 (64 byte) だけ残す
+    std::vector<char> bytes(64 + 64);
+    {
+        std::ifstream file(fileName, std::ios::binary);
+        file.read(bytes.data(), bytes.size());
+    }
+    {
+        std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), bytes.size());
+    }
+
+    mi::Image loaded(8, width, height);
+    for(int i=0; i<loaded.Size(); i++) {
+        loaded.data[i] = mi::RGB(255, 255, 255);
+    }
+    loaded.Load(fileName);
+    std::remove(fileName);
+
+    if(loaded.Bit() != 24) {
+        std::fprintf(stderr, "  loaded as %dbit\n", loaded.Bit());
+        return false;
+    }
+
+    for(int i=0; i<loaded.Size(); i++) {
+        const mi::RGB& a = loaded.data[i];
+        const int expected = i < width ? 10 : 0;
+        if(a.r != expected) {
+            std::fprintf(stderr, "  pixel %d: %d (expected %d)\n", i, a.r, expected);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// @brief 大きさが Image に収まらないヘッダのファイルを読み込むと例外になるか
+// @param fileName 一時ファイルの名前
+// @param bytes    ファイルの中身
+//-----------------------------------------------------------------------------
+bool Oversized(const char* fileName, const std::string& bytes) {
+
+    {
+        std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), bytes.size());
+    }
+
+    bool rejected = false;
+    try {
+        mi::Image loaded(fileName);
+    }
+    catch(const char*) {
+        rejected = true;
+    }
+    std::remove(fileName);
+
+    if(!rejected) {
+        std::fprintf(stderr, "  %s: loaded\n", fileName);
+    }
+    return rejected;
+}
+
+// 65536 x 65536 の raw 画像のヘッダと 8 byte の画素
+std::string OversizedRaw() {
+
+    mi::RawImageCodec::Header header;
+    header.width  = 65536;
+    header.height = 65536;
+    header.stride = 65536;
+
+    std::string bytes((const char*)&header, sizeof(header));
+    return bytes + std::string(8, '\0');
+}
+
+
+//-----------------------------------------------------------------------------
+// @brief 2 つの画像の画素が全て同じか
+//-----------------------------------------------------------------------------
+bool SamePixels(const mi::Image& a, const mi::Image& b) {
+
+    if(a.Width() != b.Width() || a.Height() != b.Height()) {
+        std::fprintf(stderr, "  size %dx%d != %dx%d\n", a.Width(), a.Height(), b.Width(), b.Height());
+        return false;
+    }
+
+    int wrong = 0;
+    for(int i=0; i<a.Size(); i++) {
+        if(a.data[i].r != b.data[i].r || a.data[i].g != b.data[i].g || a.data[i].b != b.data[i].b) wrong++;
+    }
+    if(wrong > 0) {
+        std::fprintf(stderr, "  %d of %d pixels differ\n", wrong, a.Size());
+    }
+    return wrong == 0;
+}
+
+//-----------------------------------------------------------------------------
+// @brief パイプラインの結果が処理を 1 つずつ掛けた結果と同じか (出力が入力と同じ画像の場合も)
+//-----------------------------------------------------------------------------
+bool Pipeline() {
+
+    mi::Image input(24, 37, 23);
+    for(int i=0; i<input.Size(); i++) {
+        input.data[i] = mi::RGB((unsigned char)(i * 37), (unsigned char)(i * 11 + 5), (unsigned char)(i * 53 + 7));
+    }
+
+    // 1 つずつ
+    mi::Image expected = input, median;
+    mi::Monochrome::Process(expected);
+    mi::MedianFilter::Process(expected, median, 3);
+    mi::GammaCollection::Process(median, 2.2);
+
+    mi::FilterPipeline pipeline;
+    pipeline.Point(mi::Monochrome::Operation())
+            .Filter([](const mi::Image& src, mi::Image& dst){ mi::MedianFilter::Process(src, dst, 3); })
+            .Point(mi::GammaCollection::Operation(2.2));
+
+    mi::Image output;
+    pipeline.Process(input, output);
+
+    mi::Image inPlace = input;
+    pipeline.Process(inPlace, inPlace);
+
+    return SamePixels(median, output) && SamePixels(median, inPlace);
+}
+
+
+//-----------------------------------------------------------------------------
+// @brief 1 チャンネルの画像を保存して読み込んだ値が元と一致するか
+// @param fileName 一時ファイルの名前 (拡張子で形式を選ぶ)
+// @param maxValue 値の最大値
+//-----------------------------------------------------------------------------
+template<class T>
+bool PlaneRoundTrip(const char* fileName, double maxValue) {
+
+    for(int width : {8, 5, 7}) {
+        const int height = 3;
+
+        mi::Plane<T> plane(width, height);
+        for(int iY=0; iY<height; iY++) {
+            for(int iX=0; iX<width; iX++) {
+                plane.Row(iY)[iX] = (T)(((iY * width + iX) * 7919 % 1000) * maxValue / 999);
+            }
+        }
+
+        mi::SavePlane(fileName, plane);
+
+        mi::Plane<T> loaded;
+        mi::LoadPlane(fileName, loaded);
+        std::remove(fileName);
+
+        if(loaded.Width() != width || loaded.Height() != height) {
+            std::fprintf(stderr, "  %d: size %dx%d\n", width, loaded.Width(), loaded.Height());
+            return false;
+        }
+
+        for(int iY=0; iY<height; iY++) {
+            if(std::memcmp(plane.Row(iY), loaded.Row(iY), width * sizeof(T)) != 0) {
+                std::fprintf(stderr, "  %d: row %d differs\n", width, iY);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// ステレオ画像 (全ての項目で共有する)
+//-----------------------------------------------------------------------------
+const char* LeftFile  = "input/tsukuba/color_left.bmp";
+const char* RightFile = "input/tsukuba/color_right.bmp";
+
+mi::Image& Left()  { static mi::Image image(LeftFile);  return image; }
+mi::Image& Right() { static mi::Image image(RightFile); return image; }
+
+// DPMS::dp() のパラメタ (main と同じ)
+void StereoDP(DPMS& dpms) { dpms.dp(8, 13, 4, 80, 40); }
+
+//-----------------------------------------------------------------------------
+// @brief 全ての走査線のマッチング結果を並べる
+//-----------------------------------------------------------------------------
+std::vector<int> Matches(DPM& dpm, int height) {
+
+    std::vector<int> matches;
+    for(int iY=0; iY<height; iY++) {
+        const std::vector<int>& match = dpm.getMatchPattern(iY);
+        matches.insert(matches.end(), match.begin(), match.end());
+    }
+    return matches;
+}
+
+//-----------------------------------------------------------------------------
+// @brief 2 つの結果が同じか (違えば what と違う要素の数を出力する)
+//-----------------------------------------------------------------------------
+template<class T>
+bool Same(const char* what, const std::vector<T>& a, const std::vector<T>& b) {
+
+    if(a.size() != b.size()) {
+        std::fprintf(stderr, "  %s: %d != %d elements\n", what, (int)a.size(), (int)b.size());
+        return false;
+    }
+
+    // float は NaN も比べるのでバイトで比べる
+    int wrong = 0;
+    for(size_t i=0; i<a.size(); i++) {
+        if(std::memcmp(&a[i], &b[i], sizeof(T)) != 0) wrong++;
+    }
+    if(wrong > 0) {
+        std::fprintf(stderr, "  %s: %d of %d elements differ\n", what, wrong, (int)a.size());
+    }
+    return wrong == 0;
+}
+
+std::vector<uint16_t> Pixels(const mi::Plane16& plane) {
+
+    std::vector<uint16_t> pixels;
+    for(int iY=0; iY<plane.Height(); iY++) {
+        pixels.insert(pixels.end(), plane.Row(iY), plane.Row(iY) + plane.Width());
+    }
+    return pixels;
+}
+
+//-----------------------------------------------------------------------------
+// @brief DPMS の結果 (サブピクセルの視差と信頼度を含む)
+// @param threads スレッド数
+// @param split   飛び越した走査線の分割数
+//-----------------------------------------------------------------------------
+struct StereoResult {
+    std::vector<int>   matches;
+    std::vector<float> disparity;
+    std::vector<float> confidence;
+};
+
+StereoResult RunDPMS(int threads, int split) {
+
+    const int W = Left().Width(), H = Left().Height();
+
+    StereoResult result;
+    result.disparity.resize(W * H);
+    result.confidence.resize(W * H);
+
+    DPMS dpms(Left(), Right(), threads);
+    dpms.scanlineSplit = split;
+    dpms.setSubpixelOutput(result.disparity.data(), result.confidence.data());
+    StereoDP(dpms);
+
+    result.matches = Matches(dpms, H);
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// @brief DPMS の結果がスレッド数と走査線の分割に依らないか
+//-----------------------------------------------------------------------------
+bool StereoThreads() {
+
+    const StereoResult expected = RunDPMS(1, 1);
+
+    bool ok = true;
+    for(int threads : {2, 8}) {
+        const StereoResult result = RunDPMS(threads, 1);
+        ok &= Same("matches", expected.matches, result.matches);
+        ok &= Same("disparity", expected.disparity, result.disparity);
+        ok &= Same("confidence", expected.confidence, result.confidence);
+    }
+    return ok;
+}
+
+bool StereoSplit() {
+
+    const StereoResult expected = RunDPMS(8, 1);
+
+    bool ok = true;
+    for(int split : {3, 4}) {
+        const StereoResult result = RunDPMS(8, split);
+        ok &= Same("matches", expected.matches, result.matches);
+        ok &= Same("disparity", expected.disparity, result.disparity);
+        ok &= Same("confidence", expected.confidence, result.confidence);
+    }
+    return ok;
+}
+
+//-----------------------------------------------------------------------------
+// @brief 前の結果を使った (探索範囲は絞らない) 結果が, 始めから DP した結果と同じか
+//   いくつかの行を変えた次のフレームで確かめる
+//-----------------------------------------------------------------------------
+bool StereoTemporal() {
+
+    mi::Image changed = Left();
+    for(int iY=100; iY<110; iY++) {
+        for(int iX=0; iX<changed.Width(); iX++) {
+            mi::RGB& pixel = changed.data[iY * changed.Width() + iX];
+            pixel = mi::RGB(255 - pixel.r, 255 - pixel.g, 255 - pixel.b);
+        }
+    }
+
+    DPMS fresh(changed, Right(), 8);
+    StereoDP(fresh);
+    const std::vector<int> expected = Matches(fresh, changed.Height());
+
+    mi::Image frame = Left();
+    DPMS dpms(frame, Right(), 8);
+    dpms.temporal       = true;
+    dpms.temporalMargin = -1;
+    StereoDP(dpms);
+
+    frame = changed; // 同じ大きさなので領域はそのまま
+    StereoDP(dpms);
+
+    if(dpms.getReusedScanlines() == 0) {
+        std::fprintf(stderr, "  no scanline reused\n");
+        return false;
+    }
+    return Same("matches", expected, Matches(dpms, changed.Height()));
+}
+
+//-----------------------------------------------------------------------------
+// @brief SGM の 1 行ずつ流す計算が, コストボリュームを持つ計算と同じか
+//-----------------------------------------------------------------------------
+bool StereoSGM() {
+
+    std::vector<int> results[2];
+
+    for(int streaming : {0, 1}) {
+        DPMS dpms(Left(), Right(), 8);
+        dpms.semiGlobal.streaming = streaming != 0;
+        dpms.sgm(4, 80, 40);
+        results[streaming] = Matches(dpms, Left().Height());
+    }
+    return Same("matches", results[0], results[1]);
+}
+
+//-----------------------------------------------------------------------------
+// @brief DPMF の結果がスレッド数に依らないか (最初の段を並列にする場合も)
+//   入力は DPMS の視差画像, 参照は左画像
+//-----------------------------------------------------------------------------
+bool FusionThreads() {
+
+    DPMS dpms(Left(), Right(), 8);
+    StereoDP(dpms);
+
+    mi::Plane16 disparity;
+    dpms.getDisparity(disparity);
+
+    mi::Image depth(24, disparity.Width(), disparity.Height());
+    for(int iY=0; iY<depth.Height(); iY++) {
+        for(int iX=0; iX<depth.Width(); iX++) {
+            unsigned char value = (unsigned char)std::min(disparity.Row(iY)[iX] * 255 / 40, 255);
+            depth.data[iY * depth.Width() + iX] = mi::RGB(value, value, value);
+        }
+    }
+
+    bool ok = true;
+    for(bool parallel : {false, true}) {
+        std::vector<int> results[2];
+
+        for(int i=0; i<2; i++) {
+            DPMF dpmf(depth, Left(), i == 0 ? 1 : 8);
+            dpmf.parallelFirstLevel = parallel;
+            dpmf.dp(8, 0.30, 0.03);
+            results[i] = Matches(dpmf, depth.Height());
+        }
+        ok &= Same(parallel ? "parallel first level" : "matches", results[0], results[1]);
+    }
+    return ok;
+}
+
+//-----------------------------------------------------------------------------
+// @brief StereoBatch と StereoStream の視差画像が, DPMS を 1 回ずつ使った結果と同じか
+//-----------------------------------------------------------------------------
+std::vector<uint16_t> ExpectedDisparity() {
+
+    DPMS dpms(Left(), Right(), 8);
+    StereoDP(dpms);
+
+    mi::Plane16 disparity;
+    dpms.getDisparity(disparity);
+    return Pixels(disparity);
+}
+
+bool StereoBatchPairs() {
+
+    const std::vector<uint16_t> expected = ExpectedDisparity();
+
+    std::vector<StereoBatch::Pair> pairs(4, StereoBatch::Pair{ LeftFile, RightFile, "" });
+    std::vector<std::vector<uint16_t> > results(pairs.size());
+
+    StereoBatch batch(8);
+    size_t done = batch.Run(pairs, [&](size_t index, const StereoBatch::Pair&, const mi::Plane16& disparity) {
+        results[index] = Pixels(disparity);
+    });
+
+    bool ok = done == pairs.size();
+    for(const std::vector<uint16_t>& result : results) {
+        ok &= Same("disparity", expected, result);
+    }
+    return ok;
+}
+
+bool StereoStreamFrames() {
+
+    const std::vector<uint16_t> expected = ExpectedDisparity();
+    const int frames = 3;
+
+    std::vector<std::vector<uint16_t> > results;
+
+    StereoStream stream(8);
+    int done = stream.Run([&](int frame, mi::Image& left, mi::Image& right) {
+        if(frame >= frames) return false;
+        left  = Left();
+        right = Right();
+        return true;
+    }, [&](int frame, const mi::Plane16& disparity) {
+        results.push_back(Pixels(disparity));
+    });
+
+    bool ok = done == frames && (int)results.size() == frames;
+    for(const std::vector<uint16_t>& result : results) {
+        ok &= Same("disparity", expected, result);
+    }
+    return ok;
+}
+
+}
+
+int main() {
+
+    Check("bmp 8bit round trip",  []{ return RoundTrip(8,  "check_8bit.bmp"); });
+    Check("bmp 24bit round trip", []{ return RoundTrip(24, "check_24bit.bmp"); });
+    Check("pgm 8bit round trip",  []{ return RoundTrip(8,  "check_8bit.pgm"); });
+    Check("ppm 24bit round trip", []{ return RoundTrip(24, "check_24bit.ppm"); });
+    Check("pfm 24bit round trip", []{ return RoundTrip(24, "check_24bit.pfm"); });
+    Check("pgm plane8 round trip",  []{ return PlaneRoundTrip<unsigned char>("check_plane8.pgm", 255); });
+    Check("pgm plane16 round trip", []{ return PlaneRoundTrip<uint16_t>("check_plane16.pgm", 65535); });
+    Check("pfm planeF round trip",  []{ return PlaneRoundTrip<float>("check_planeF.pfm", 1.5); });
+    Check("raw plane16 round trip", []{ return PlaneRoundTrip<uint16_t>("check_plane16.raw", 65535); });
+    Check("raw planeF round trip",  []{ return PlaneRoundTrip<float>("check_planeF.raw", 1.5); });
+    Check("raw truncated read",   []{ return TruncatedRaw("check_truncated.raw"); });
+    Check("pgm oversized header", []{ return Oversized("check_oversized.pgm", std::string("P5\n65536 65536\n255\n") + std::string(8, '\0')); });
+    Check("raw oversized header", []{ return Oversized("check_oversized.raw", OversizedRaw()); });
+    Check("filter pipeline",      []{ return Pipeline(); });
+    Check("dpms threads 1/2/8",   []{ return StereoThreads(); });
+    Check("dpms scanlineSplit 3/4", []{ return StereoSplit(); });
+    Check("dpms temporal reuse",  []{ return StereoTemporal(); });
+    Check("sgm streaming",        []{ return StereoSGM(); });
+    Check("dpmf threads 1/8",     []{ return FusionThreads(); });
+    Check("stereo batch",         []{ return StereoBatchPairs(); });
+    Check("stereo stream",        []{ return StereoStreamFrames(); });
+
+    return failures > 0 ? 1 : 0;
+}
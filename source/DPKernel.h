@@ -0,0 +1,499 @@
+﻿//==============================================================================
+//
+// DP Kernel
+//
+//  DPテーブルの経路探索 (1行分のコスト更新) をおこなうカーネル
+//
+//==============================================================================
+#ifndef _DP_KERNEL_H_
+#define _DP_KERNEL_H_
+
+#include <cstdint>
+#include <algorithm>
+
+#include "DPNodeTable.h"
+
+// 使用できる命令セット
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #if defined(__GNUC__) || defined(_MSC_VER)
+        #define DP_KERNEL_AVX2
+        #define DP_KERNEL_AVX512
+        #include <immintrin.h>
+        #if defined(_MSC_VER) && !defined(__clang__)
+            #include <intrin.h>
+            #define DP_TARGET_AVX2
+            #define DP_TARGET_AVX512
+        #else
+            #define DP_TARGET_AVX2   __attribute__((target("avx2")))
+            #define DP_TARGET_AVX512 __attribute__((target("avx512f")))
+        #endif
+    #endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #define DP_KERNEL_NEON
+    #include <arm_neon.h>
+#endif
+
+//------------------------------------------------------------------------------
+//
+// DP Kernel
+//
+//  1行分のノードについて 縦・横・斜 のうち最小コストのパスを選ぶ.
+//
+//  縦と斜のパスは1つ前の行のノードにしか依存しないので, 行方向にまとめて
+//  SIMD で計算できる (MinVerticalDiagonal). 横のパスは同じ行の左隣に依存するため
+//  その結果を使って左から順に確定させる (RelaxRow).
+//  どの実装でも加算と比較の順序は変わらないので結果は参照実装と一致する.
+//
+//  SIMD の実装は関数ごとに命令セットを指定してコンパイルし, 実行時に CPU が対応する
+//  最も新しいものを選ぶ (ビルドの -march に関係なく同じバイナリで使える).
+//
+//  T : コストの型
+//------------------------------------------------------------------------------
+namespace dpkernel {
+
+// 使用する実装
+enum ISA {
+    SCALAR,
+    AVX2,
+    NEON,
+    AVX512,
+};
+
+//------------------------------------------------------------------------------
+// @brief 実行中の CPU (と OS) が命令セットに対応しているか
+//------------------------------------------------------------------------------
+inline bool SupportsISA(ISA type)
+{
+    if(type == SCALAR) return true;
+
+#if defined(DP_KERNEL_AVX2)
+  #if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1<<27)) != 0;
+    bool avx     = (info[2] & (1<<28)) != 0;
+    if(!osxsave || !avx) return false;
+    unsigned long long xcr0 = _xgetbv(0);
+    if((xcr0 & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    if(type == AVX2)   return (info[1] & (1<<5)) != 0;
+    if(type == AVX512) return (info[1] & (1<<16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+    return false;
+  #else
+    __builtin_cpu_init();
+    if(type == AVX2)   return __builtin_cpu_supports("avx2");
+    if(type == AVX512) return __builtin_cpu_supports("avx512f");
+    return false;
+  #endif
+#elif defined(DP_KERNEL_NEON)
+    return type == NEON;
+#else
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// @brief 実行中の CPU で使える最も新しい命令セットを調べる
+//------------------------------------------------------------------------------
+inline ISA DetectISA()
+{
+    for(ISA type : {AVX512, AVX2, NEON})
+    {
+        if(SupportsISA(type)) return type;
+    }
+    return SCALAR;
+}
+
+//------------------------------------------------------------------------------
+// @brief 縦・斜のパスのうち小さい方を選ぶ (スカラー)
+// @param out   選んだコストの書き込み先
+// @param up    1つ上の行のノードのコスト (up[-1] が斜め)
+// @param vPath 縦のパスのコスト
+// @param dPath 斜のパスのコスト
+// @param diag  斜を選んだら 1, 縦を選んだら 0 が入る
+// @param n     ノード数
+//------------------------------------------------------------------------------
+template<typename T>
+inline void MinVerticalDiagonalScalar(T* out, const T* up, const T* vPath, const T* dPath,
+                                      unsigned char* diag, int n)
+{
+    for(int k=0; k<n; k++)
+    {
+        T vCost = DPCost<T>::Add(vPath[k], up[k]);
+        T dCost = DPCost<T>::Add(dPath[k], up[k-1]);
+        diag[k] = dCost <= vCost;
+        out[k]  = diag[k] ? dCost : vCost;
+    }
+}
+
+#if defined(DP_KERNEL_AVX2)
+//------------------------------------------------------------------------------
+// @brief 縦・斜のパスのうち小さい方を選ぶ (AVX2)
+//------------------------------------------------------------------------------
+DP_TARGET_AVX2
+inline void MinVerticalDiagonalAVX2(double* out, const double* up, const double* vPath,
+                                    const double* dPath, unsigned char* diag, int n)
+{
+    int k = 0;
+    for(; k+4<=n; k+=4)
+    {
+        __m256d vCost = _mm256_add_pd(_mm256_loadu_pd(vPath+k), _mm256_loadu_pd(up+k));
+        __m256d dCost = _mm256_add_pd(_mm256_loadu_pd(dPath+k), _mm256_loadu_pd(up+k-1));
+        __m256d mask  = _mm256_cmp_pd(dCost, vCost, _CMP_LE_OQ);
+        _mm256_storeu_pd(out+k, _mm256_blendv_pd(vCost, dCost, mask));
+
+        int bits = _mm256_movemask_pd(mask);
+        for(int j=0; j<4; j++) diag[k+j] = (bits >> j) & 1;
+    }
+    MinVerticalDiagonalScalar(out+k, up+k, vPath+k, dPath+k, diag+k, n-k);
+}
+
+DP_TARGET_AVX2
+inline void MinVerticalDiagonalAVX2(float* out, const float* up, const float* vPath,
+                                    const float* dPath, unsigned char* diag, int n)
+{
+    int k = 0;
+    for(; k+8<=n; k+=8)
+    {
+        __m256 vCost = _mm256_add_ps(_mm256_loadu_ps(vPath+k), _mm256_loadu_ps(up+k));
+        __m256 dCost = _mm256_add_ps(_mm256_loadu_ps(dPath+k), _mm256_loadu_ps(up+k-1));
+        __m256 mask  = _mm256_cmp_ps(dCost, vCost, _CMP_LE_OQ);
+        _mm256_storeu_ps(out+k, _mm256_blendv_ps(vCost, dCost, mask));
+
+        int bits = _mm256_movemask_ps(mask);
+        for(int j=0; j<8; j++) diag[k+j] = (bits >> j) & 1;
+    }
+    MinVerticalDiagonalScalar(out+k, up+k, vPath+k, dPath+k, diag+k, n-k);
+}
+
+DP_TARGET_AVX2
+inline void MinVerticalDiagonalAVX2(int32_t* out, const int32_t* up, const int32_t* vPath,
+                                    const int32_t* dPath, unsigned char* diag, int n)
+{
+    // 飽和加算 min(a+b, MAX) : a,b <= MAX なので桁あふれはしない
+    const __m256i max = _mm256_set1_epi32(DPCost<int32_t>::Max());
+
+    int k = 0;
+    for(; k+8<=n; k+=8)
+    {
+        __m256i vCost = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(vPath+k)),
+                                         _mm256_loadu_si256((const __m256i*)(up+k)));
+        __m256i dCost = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(dPath+k)),
+                                         _mm256_loadu_si256((const __m256i*)(up+k-1)));
+        vCost = _mm256_min_epi32(vCost, max);
+        dCost = _mm256_min_epi32(dCost, max);
+
+        // dCost <= vCost
+        __m256i mask = _mm256_xor_si256(_mm256_cmpgt_epi32(dCost, vCost), _mm256_set1_epi32(-1));
+        _mm256_storeu_si256((__m256i*)(out+k), _mm256_blendv_epi8(vCost, dCost, mask));
+
+        int bits = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+        for(int j=0; j<8; j++) diag[k+j] = (bits >> j) & 1;
+    }
+    MinVerticalDiagonalScalar(out+k, up+k, vPath+k, dPath+k, diag+k, n-k);
+}
+
+// 対応していない型はスカラーで計算する
+template<typename T>
+inline void MinVerticalDiagonalAVX2(T* out, const T* up, const T* vPath, const T* dPath,
+                                    unsigned char* diag, int n)
+{
+    MinVerticalDiagonalScalar(out, up, vPath, dPath, diag, n);
+}
+#endif
+
+#if defined(DP_KERNEL_AVX512)
+//------------------------------------------------------------------------------
+// @brief 縦・斜のパスのうち小さい方を選ぶ (AVX-512)
+//------------------------------------------------------------------------------
+DP_TARGET_AVX512
+inline void MinVerticalDiagonalAVX512(double* out, const double* up, const double* vPath,
+                                      const double* dPath, unsigned char* diag, int n)
+{
+    int k = 0;
+    for(; k+8<=n; k+=8)
+    {
+        __m512d vCost = _mm512_add_pd(_mm512_loadu_pd(vPath+k), _mm512_loadu_pd(up+k));
+        __m512d dCost = _mm512_add_pd(_mm512_loadu_pd(dPath+k), _mm512_loadu_pd(up+k-1));
+        __mmask8 mask = _mm512_cmp_pd_mask(dCost, vCost, _CMP_LE_OQ);
+        _mm512_storeu_pd(out+k, _mm512_mask_blend_pd(mask, vCost, dCost));
+
+        for(int j=0; j<8; j++) diag[k+j] = (mask >> j) & 1;
+    }
+    MinVerticalDiagonalScalar(out+k, up+k, vPath+k, dPath+k, diag+k, n-k);
+}
+
+DP_TARGET_AVX512
+inline void MinVerticalDiagonalAVX512(float* out, const float* up, const float* vPath,
+                                      const float* dPath, unsigned char* diag, int n)
+{
+    int k = 0;
+    for(; k+16<=n; k+=16)
+    {
+        __m512 vCost = _mm512_add_ps(_mm512_loadu_ps(vPath+k), _mm512_loadu_ps(up+k));
+        __m512 dCost = _mm512_add_ps(_mm512_loadu_ps(dPath+k), _mm512_loadu_ps(up+k-1));
+        __mmask16 mask = _mm512_cmp_ps_mask(dCost, vCost, _CMP_LE_OQ);
+        _mm512_storeu_ps(out+k, _mm512_mask_blend_ps(mask, vCost, dCost));
+
+        for(int j=0; j<16; j++) diag[k+j] = (mask >> j) & 1;
+    }
+    MinVerticalDiagonalScalar(out+k, up+k, vPath+k, dPath+k, diag+k, n-k);
+}
+
+DP_TARGET_AVX512
+inline void MinVerticalDiagonalAVX512(int32_t* out, const int32_t* up, const int32_t* vPath,
+                                      const int32_t* dPath, unsigned char* diag, int n)
+{
+    // 飽和加算 min(a+b, MAX) : a,b <= MAX なので桁あふれはしない
+    const __m512i max = _mm512_set1_epi32(DPCost<int32_t>::Max());
+
+    int k = 0;
+    for(; k+16<=n; k+=16)
+    {
+        __m512i vCost = _mm512_add_epi32(_mm512_loadu_si512(vPath+k), _mm512_loadu_si512(up+k));
+        __m512i dCost = _mm512_add_epi32(_mm512_loadu_si512(dPath+k), _mm512_loadu_si512(up+k-1));
+        vCost = _mm512_mask_mov_epi32(vCost, _mm512_cmpgt_epi32_mask(vCost, max), max);
+        dCost = _mm512_mask_mov_epi32(dCost, _mm512_cmpgt_epi32_mask(dCost, max), max);
+
+        __mmask16 mask = _mm512_cmple_epi32_mask(dCost, vCost);
+        _mm512_storeu_si512(out+k, _mm512_mask_blend_epi32(mask, vCost, dCost));
+
+        for(int j=0; j<16; j++) diag[k+j] = (mask >> j) & 1;
+    }
+    MinVerticalDiagonalScalar(out+k, up+k, vPath+k, dPath+k, diag+k, n-k);
+}
+
+// 対応していない型は AVX2 の実装で計算する
+template<typename T>
+inline void MinVerticalDiagonalAVX512(T* out, const T* up, const T* vPath, const T* dPath,
+                                      unsigned char* diag, int n)
+{
+    MinVerticalDiagonalAVX2(out, up, vPath, dPath, diag, n);
+}
+#endif
+
+#if defined(DP_KERNEL_NEON)
+//------------------------------------------------------------------------------
+// @brief 縦・斜のパスのうち小さい方を選ぶ (NEON)
+//------------------------------------------------------------------------------
+inline void MinVerticalDiagonalNEON(float* out, const float* up, const float* vPath,
+                                    const float* dPath, unsigned char* diag, int n)
+{
+    int k = 0;
+    for(; k+4<=n; k+=4)
+    {
+        float32x4_t vCost = vaddq_f32(vld1q_f32(vPath+k), vld1q_f32(up+k));
+        float32x4_t dCost = vaddq_f32(vld1q_f32(dPath+k), vld1q_f32(up+k-1));
+        uint32x4_t  mask  = vcleq_f32(dCost, vCost);
+        vst1q_f32(out+k, vbslq_f32(mask, dCost, vCost));
+
+        uint32_t bits[4];
+        vst1q_u32(bits, mask);
+        for(int j=0; j<4; j++) diag[k+j] = bits[j] & 1;
+    }
+    MinVerticalDiagonalScalar(out+k, up+k, vPath+k, dPath+k, diag+k, n-k);
+}
+
+#if defined(__aarch64__)
+inline void MinVerticalDiagonalNEON(double* out, const double* up, const double* vPath,
+                                    const double* dPath, unsigned char* diag, int n)
+{
+    int k = 0;
+    for(; k+2<=n; k+=2)
+    {
+        float64x2_t vCost = vaddq_f64(vld1q_f64(vPath+k), vld1q_f64(up+k));
+        float64x2_t dCost = vaddq_f64(vld1q_f64(dPath+k), vld1q_f64(up+k-1));
+        uint64x2_t  mask  = vcleq_f64(dCost, vCost);
+        vst1q_f64(out+k, vbslq_f64(mask, dCost, vCost));
+
+        diag[k+0] = vgetq_lane_u64(mask, 0) & 1;
+        diag[k+1] = vgetq_lane_u64(mask, 1) & 1;
+    }
+    MinVerticalDiagonalScalar(out+k, up+k, vPath+k, dPath+k, diag+k, n-k);
+}
+#endif
+
+inline void MinVerticalDiagonalNEON(int32_t* out, const int32_t* up, const int32_t* vPath,
+                                    const int32_t* dPath, unsigned char* diag, int n)
+{
+    const int32x4_t max = vdupq_n_s32(DPCost<int32_t>::Max());
+
+    int k = 0;
+    for(; k+4<=n; k+=4)
+    {
+        int32x4_t vCost = vminq_s32(vaddq_s32(vld1q_s32(vPath+k), vld1q_s32(up+k)),   max);
+        int32x4_t dCost = vminq_s32(vaddq_s32(vld1q_s32(dPath+k), vld1q_s32(up+k-1)), max);
+        uint32x4_t mask = vcleq_s32(dCost, vCost);
+        vst1q_s32(out+k, vbslq_s32(mask, dCost, vCost));
+
+        uint32_t bits[4];
+        vst1q_u32(bits, mask);
+        for(int j=0; j<4; j++) diag[k+j] = bits[j] & 1;
+    }
+    MinVerticalDiagonalScalar(out+k, up+k, vPath+k, dPath+k, diag+k, n-k);
+}
+
+// 対応していない型はスカラーで計算する
+template<typename T>
+inline void MinVerticalDiagonalNEON(T* out, const T* up, const T* vPath, const T* dPath,
+                                    unsigned char* diag, int n)
+{
+    MinVerticalDiagonalScalar(out, up, vPath, dPath, diag, n);
+}
+#endif
+
+}
+
+
+//------------------------------------------------------------------------------
+//
+// DP Kernel
+//
+//------------------------------------------------------------------------------
+template<typename T>
+class DPKernel
+{
+public:
+
+    typedef DPNodeTable<T> Table;
+
+    //--------------------------------------------------------------------------
+    // @brief 1行分のノードの最小コストのパスを選ぶ (参照実装)
+    // @param node テーブル
+    // @param i    行の先頭のノードのインデックス
+    // @param n    ノード数
+    //--------------------------------------------------------------------------
+    static void RelaxRowScalar(Table& node, int i, int n)
+    {
+        T* cost        = node.cost.data();
+        const T* vPath = node.verticalPathCost.data();
+        const T* hPath = node.horizontalPathCost.data();
+        const T* dPath = node.diagonalPathCost.data();
+        const int rowStep = node.RowStep();
+
+        for(int ni=i; ni<i+n; ni++)
+        {
+            // ノードのインデックスを計算 (縦,横,斜め)
+            int nv = ni - rowStep;
+            int nh = ni - 1;
+            int nd = ni - rowStep - 1;
+
+            // コスト計算
+            T vCost = DPCost<T>::Add(vPath[ni], cost[nv]);
+            T hCost = DPCost<T>::Add(hPath[ni], cost[nh]);
+            T dCost = DPCost<T>::Add(dPath[ni], cost[nd]);
+
+            // 最小コスト計算
+            cost[ni] = std::min({vCost,hCost,dCost});
+
+            // 選んだパスを記録
+            //   浮動小数点型でも計算はしていないので bit が一致する
+            if(cost[ni] == dCost) {
+                node.SetPathDir(ni, Table::DIAGONAL);
+            }
+            else
+            if(cost[ni] == vCost) {
+                node.SetPathDir(ni, Table::VERTICAL);
+            }
+            else
+            if(cost[ni] == hCost) {
+                node.SetPathDir(ni, Table::HORIZONTAL);
+            }
+            else {
+                throw "NaN";
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 1行分のノードの最小コストのパスを選ぶ (SIMD)
+    // @param node テーブル
+    // @param i    行の先頭のノードのインデックス
+    // @param n    ノード数
+    // @param diag 作業領域 (n 要素)
+    //--------------------------------------------------------------------------
+    static void RelaxRow(Table& node, int i, int n, unsigned char* diag)
+    {
+        T* cost = node.cost.data();
+        const T* up = cost + i - node.RowStep();
+
+        // 縦・斜 (行方向に独立)
+        minVerticalDiagonal(cost+i, up, node.verticalPathCost.data()+i,
+                            node.diagonalPathCost.data()+i, diag, n);
+
+        // 横 (左隣に依存)
+        const T* hPath = node.horizontalPathCost.data();
+
+        for(int k=0; k<n; k++)
+        {
+            int ni = i + k;
+            T hCost = DPCost<T>::Add(hPath[ni], cost[ni-1]);
+
+            if(hCost < cost[ni]) {
+                cost[ni] = hCost;
+                node.SetPathDir(ni, Table::HORIZONTAL);
+            }
+            else
+            if(cost[ni] <= hCost) {
+                node.SetPathDir(ni, diag[k] ? Table::DIAGONAL : Table::VERTICAL);
+            }
+            else {
+                throw "NaN";
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 使用している命令セット
+    //--------------------------------------------------------------------------
+    static dpkernel::ISA GetISA() { return isa; }
+
+    //--------------------------------------------------------------------------
+    // @brief 使用する命令セットを変更する (対応していない場合はスカラー)
+    //--------------------------------------------------------------------------
+    static void SetISA(dpkernel::ISA type)
+    {
+        if(!dpkernel::SupportsISA(type))
+        {
+            type = dpkernel::SCALAR;
+        }
+
+        isa = type;
+        minVerticalDiagonal = select(type);
+    }
+
+private:
+
+    typedef void (*MinVerticalDiagonalFunc)(T*, const T*, const T*, const T*, unsigned char*, int);
+
+    static MinVerticalDiagonalFunc select(dpkernel::ISA type)
+    {
+        switch(type)
+        {
+#if defined(DP_KERNEL_AVX2)
+            case dpkernel::AVX2: return &dpkernel::MinVerticalDiagonalAVX2;
+#endif
+#if defined(DP_KERNEL_AVX512)
+            case dpkernel::AVX512: return &dpkernel::MinVerticalDiagonalAVX512;
+#endif
+#if defined(DP_KERNEL_NEON)
+            case dpkernel::NEON: return &dpkernel::MinVerticalDiagonalNEON;
+#endif
+            default: return &dpkernel::MinVerticalDiagonalScalar<T>;
+        }
+    }
+
+    static dpkernel::ISA isa;
+    static MinVerticalDiagonalFunc minVerticalDiagonal;
+};
+
+template<typename T>
+dpkernel::ISA DPKernel<T>::isa = dpkernel::DetectISA();
+
+template<typename T>
+typename DPKernel<T>::MinVerticalDiagonalFunc
+DPKernel<T>::minVerticalDiagonal = DPKernel<T>::select(dpkernel::DetectISA());
+
+#endif
@@ -11,9 +11,17 @@
 #include <iostream>
 #include <algorithm>
 #include <vector>
+#include <climits>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
 
 #include "ThreadPool.h"
+#include "TaskGraph.h"
+#include "DPNodeTable.h"
+#include "DPMatcher.h"
 #include "miImage/miImage.h"
 
 //------------------------------------------------------------------------------
@@ -21,6 +29,10 @@
 // DP Matching
 //
 //  このクラスを継承して CalcCost() を実装することで用途にあわせて拡張できる.
+//  * 1行分のコストをまとめて計算できる場合は,
+//    calcCostRow(), pathCostRow() をオーバーライドすると仮想関数の呼び出しが減る.
+//  * 仮想関数の呼び出しをなくしたい場合は, コストを DPCostPolicy, DPBiasPolicy で実装し
+//    matching() をオーバーライドして DPMatcher で計算すること (DPMS, DPMF を参照).
 //  * 追加でパラメータを与えたい場合は,
 //    継承したクラスで DP() をオーバーライドして, その中でこのクラスの DP() を呼ぶこと.
 //  * パスによってコストに偏らせたい場合は,
@@ -32,40 +44,89 @@ public:
     int leftRange = 40; // 対象画素から見た対応点の探索範囲左限界までの画素数
     int rightRange= 40; // 対象画素から見た対応点の探索範囲右限界までの画素数
 
+    // 時間方向の再利用 (動画で前のフレームの結果を使う)
+    //   temporal が true なら, 入力と参照画像の行 (コスト計算で読む上下の行を含む) が
+    //   前の dp() から変わっていない走査線は, 前のマッチング結果をそのまま使う.
+    //   temporalMargin が 0 以上なら, 変わった走査線の探索範囲を
+    //   前の結果の視差の範囲 ± temporalMargin に絞る (結果は全範囲の探索と変わりうる)
+    bool temporal      = false;
+    int temporalMargin = -1;
+
+    // 走査線の中の並列化
+    //   2 以上なら, 飛び越した走査線の DP を X 方向に scanlineSplit 個のタスクに分ける
+    //   (走査線の数よりスレッドが多い場合に使う. 結果は分けない場合と同じ)
+    int scanlineSplit = 1;
+
     //--------------------------------------------------------------------------
     // @brief コンストラクタ
-    // @param input     入力画像
-    // @param reference 正確な距離情報の参照画像
+    // @param input     入力画像 (部分画像でもよい)
+    // @param reference 正確な距離情報の参照画像 (input と同じ高さ)
     // @param threads   スレッド数
+    //
+    //   画像は画素をコピーせずに参照するので, 同じ画像に次のフレームを読み込めばそのまま dp() できる
     //--------------------------------------------------------------------------
-    DPM(mi::Image& input, mi::Image& reference, int threads = std::thread::hardware_concurrency())
+    DPM(const mi::ImageView& input, const mi::ImageView& reference, int threads = std::thread::hardware_concurrency())
         : input(input)
         , refer(reference)
-        , threadPool(threads)
+        , ownThreadPool(new ThreadPool(threads))
+        , threadPool(*ownThreadPool)
     {
+        allocate();
+    }
 
-        length    = input.Width() * refer.Width();
-        nScanlines= input.Height();
+    //--------------------------------------------------------------------------
+    // @brief 他の DPM や画像処理とスレッドプールを共有するコンストラクタ
+    // @param threadPool 使用するスレッドプール (この DPM より後に破棄すること)
+    //
+    //   別々のスレッドから同じプールを使う DPM の dp() を同時に呼んでよい.
+    //   ワーカーごとの作業領域は DPM ごとに持つので, 走査線のタスクが混ざっても結果は変わらない
+    //--------------------------------------------------------------------------
+    DPM(const mi::ImageView& input, const mi::ImageView& reference, ThreadPool& threadPool)
+        : input(input)
+        , refer(reference)
+        , threadPool(threadPool)
+    {
+        allocate();
+    }
 
-        X = input.Width();
-        Y = refer.Width();
+    virtual ~DPM() {}
 
-        // ノードの確保
-        nodes.resize(threadPool.GetNumThread());
-        for(int i=0; i<nodes.size(); i++)
-        {
-            nodes[i].resize(length);
-        }
+    //--------------------------------------------------------------------------
+    // @brief 画像を差し替える (動画の次のフレームなど)
+    //   大きさが同じなら DP テーブルやマッチング結果の領域をそのまま使う
+    // @param input     入力画像 (部分画像でもよい)
+    // @param reference 参照画像 (input と同じ高さ)
+    //--------------------------------------------------------------------------
+    virtual void setImages(const mi::ImageView& input, const mi::ImageView& reference)
+    {
+        bool resized = input.Width()!=X || reference.Width()!=Y || input.Height()!=nScanlines;
 
-        // マッチング結果の格納場所を確保
-        matchPatterns.resize(nScanlines);
-        for(int i=0; i<nScanlines; i++)
+        this->input = input;
+        this->refer = reference;
+
+        if(resized)
         {
-            matchPatterns[i].resize(X);
-            std::fill(matchPatterns[i].begin(),matchPatterns[i].end(), -1);
+            allocate();
         }
     }
 
+    //--------------------------------------------------------------------------
+    // @brief 前の dp() の結果を使わないようにする
+    //   継承したクラスでコストのパラメータが変わった場合に呼ぶ
+    //--------------------------------------------------------------------------
+    void invalidateTemporal()
+    {
+        temporalValid = false;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 直前の dp() で前の結果をそのまま使った走査線の数
+    //--------------------------------------------------------------------------
+    int getReusedScanlines() const
+    {
+        return (int)std::count(reused.begin(), reused.end(), 1);
+    }
+
     //--------------------------------------------------------------------------
     // @brief マッチングしたパターンを取得
     // @param column 取得するスキャンライン
@@ -76,53 +137,141 @@ public:
     }
 
 
+    //--------------------------------------------------------------------------
+    // @brief サブピクセルの視差と信頼度の書き込み先を設定する
+    //   次の dp() から, 走査線 column の Backtrace で disparity + column*stride の行に
+    //   マッチング結果と同じ位置の視差 (x - 対応点) と信頼度を書き込む (DPSubpixel を参照).
+    //   補間した画素は前の走査線の値を写し, DP で書き込まれない画素 (マッチング結果が -1) は
+    //   視差を NaN, 信頼度を 0 にする. 領域は dp() から戻るまで有効にしておくこと.
+    //   前の結果をそのまま使う走査線 (temporal) には書き込まないので, 動画では同じ領域を使い続けること
+    //   (書き込み先を変えた次の dp() は前の結果を使わない)
+    // @param disparity  視差の書き込み先 (X x 走査線の数. nullptr なら書き込まない)
+    // @param confidence 信頼度の書き込み先 (nullptr なら書き込まない)
+    // @param stride     行の間隔 [要素] (0 なら X)
+    //--------------------------------------------------------------------------
+    void setSubpixelOutput(float* disparity, float* confidence, int stride = 0)
+    {
+        subpixelDisparity  = disparity;
+        subpixelConfidence = confidence;
+        subpixelStride     = stride > 0 ? stride : X;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief スレッドプールを取得
+    //   mi::IImageProcessing::SetThreadPool() に渡すと画像処理と共有できる
+    //--------------------------------------------------------------------------
+    ThreadPool& getThreadPool()
+    {
+        return threadPool;
+    }
+
     //--------------------------------------------------------------------------
     // @brief DP マッチングによる対応付けをおこなう
     // @param skip 飛び越し量
     //--------------------------------------------------------------------------
     virtual void dp(int skip)
     {
+        // 探索範囲が変わっていたらノードを確保しなおす
+        if(leftRange!=nodes[0].LeftRange() || rightRange!=nodes[0].RightRange())
+        {
+            allocateNodes();
+        }
+
+        // サブピクセルの書き込み先が変われば, 前の結果を使う走査線の値が書き込まれていない
+        if(subpixelDisparity!=previousDisparity || subpixelConfidence!=previousConfidence ||
+           subpixelStride!=previousStride)
+        {
+            temporalValid = false;
+        }
+
+        firstSkip = skip;
+
+        // 前の結果を使うか調べる
+        prepareTemporal(skip);
+
+        // 通路を走査線の探索範囲に合わせる
+        prepareCorridor();
+
+        // 依存関係を作り直す
+        DP_PROFILE_START(scheduleStart);
+
+        scanlineGraph.Clear();
+        lastWriter.assign(nScanlines, -1);
+        readers.resize(nScanlines);
+        for(std::vector<int>& r : readers) r.clear();
+        usedSplitSlots = 0;
+
         for(int i=0; i<nScanlines; i+=skip)
         {
-            threadPool.Request([&,i,skip](int id){
-                matching(0, 0, X-1, Y-1, i, skip, id);
+            int p, n;
+            referredScanlines(i, skip, p, n);
+
+            if(reuseScanline(i, skip, p, n)) continue;
+
+            addScanline(i, p, n, [&,i,skip](int id){
+                DP_PROFILE_SCOPE(Scanline);
+                DP_PROFILE_COUNT(ScanlinesMatched, 1);
+                matching(0, 0, X-1, Y-1, i, skip, id, matchPatterns[i]);
             });
         }
 
         skipDP(skip/2);
-    }
 
-protected:
-    //--------------------------------------------------------------------------
-    // Node
-    //--------------------------------------------------------------------------
-    struct Node {
+        // マッチング結果を初期化する
+        // (走査線の端など DP で書き込まない要素があるので, 前の dp() の結果が残ると結果が変わる)
+        for(int i=0; i<nScanlines; i++)
+        {
+            if(reused[i]) continue;
+            std::fill(matchPatterns[i].begin(),matchPatterns[i].end(), -1);
 
-        enum PathDir : char {
-            HORIZONTAL = 'h',
-            VERTICAL   = 'v',
-            DIAGONAL   = 'd',
-            NONE       = 'n',
-        };
+            if(subpixelDisparity)
+            {
+                std::fill_n(subpixelDisparity + i*subpixelStride, X, std::numeric_limits<float>::quiet_NaN());
+            }
+            if(subpixelConfidence)
+            {
+                std::fill_n(subpixelConfidence + i*subpixelStride, X, 0.0f);
+            }
+        }
 
-        const double MAX_COST = 1.7976931348623158e+308;
+        // 次の dp() で使う
+        previousRowHashes.swap(rowHashes);
+        previousSkip  = skip;
+        previousLeft  = leftRange;
+        previousRight = rightRange;
+        previousDisparity  = subpixelDisparity;
+        previousConfidence = subpixelConfidence;
+        previousStride     = subpixelStride;
+        temporalValid = temporal;
 
-        double cost = MAX_COST;
+#if defined(DP_PROFILE)
+        DPProfile::Record(DPProfile::Schedule, scheduleStart, DPProfile::Now());
+        DPProfile::Count(DPProfile::ScanlinesReused, getReusedScanlines());
+#endif
 
-        double verticalPathCost  = MAX_COST;
-        double horizontalPathCost= MAX_COST;
-        double diagonalPathCost  = MAX_COST;
+        // 親の走査線が終わったものから実行し, この DPM の走査線が全て終わるのを待つ
+        // (プールを共有する他の DPM のタスクは待たない)
+        scanlineGraph.Run(threadPool);
+        scanlineGraph.Wait();
+    }
 
-        char selectedPathDir = NONE;
-    };
+protected:
+    //--------------------------------------------------------------------------
+    // Node
+    //   コストの精度は DPNodeTable のテンプレート引数で選択する
+    //--------------------------------------------------------------------------
+    typedef double Cost;
+    typedef DPNodeTable<Cost> NodeTable;
+    typedef DPCost<Cost> CostOp;
 
 
     // 画像
-    mi::Image& input;
-    mi::Image& refer;
+    mi::ImageView input;
+    mi::ImageView refer;
 
-    // スレッドプール
-    ThreadPool threadPool;
+    // スレッドプール (共有しない場合は ownThreadPool が持つ)
+    std::unique_ptr<ThreadPool> ownThreadPool;
+    ThreadPool& threadPool;
 
     // DPテーブルに関する値
     int nScanlines; // スキャンラインの数
@@ -130,7 +279,453 @@ protected:
     int X, Y;       // DPテーブルの横縦の長さ
 
     // DPテーブル
-    std::vector<std::vector<Node> > nodes;
+    std::vector<NodeTable> nodes;
+
+    // 1行分のコスト (スレッドごと)
+    std::vector<std::vector<double> > costRows;
+
+    //--------------------------------------------------------------------------
+    // @brief 画像の大きさに合わせて作業領域を確保する
+    //--------------------------------------------------------------------------
+    void allocate()
+    {
+        length    = input.Width() * refer.Width();
+        nScanlines= input.Height();
+
+        X = input.Width();
+        Y = refer.Width();
+
+        // ノードの確保
+        allocateNodes();
+
+        // コスト計算用の作業領域を確保
+        costRows.resize(threadPool.GetNumThread());
+        splitRows.resize(threadPool.GetNumThread());
+        splitDisparity.resize(threadPool.GetNumThread());
+        splitConfidence.resize(threadPool.GetNumThread());
+        for(int i=0; i<costRows.size(); i++)
+        {
+            costRows[i].resize(X);
+            splitRows[i].resize(X);
+            splitDisparity[i].resize(X);
+            splitConfidence[i].resize(X);
+        }
+
+        // 大きさが変われば書き込み先も設定し直す
+        setSubpixelOutput(nullptr, nullptr);
+
+        // マッチング結果の格納場所を確保
+        matchPatterns.resize(nScanlines);
+        for(int i=0; i<nScanlines; i++)
+        {
+            matchPatterns[i].resize(X);
+            std::fill(matchPatterns[i].begin(),matchPatterns[i].end(), -1);
+        }
+
+        // 走査線ごとの探索範囲
+        scanlineLeft.assign(nScanlines, leftRange);
+        scanlineRight.assign(nScanlines, rightRange);
+        reused.assign(nScanlines, 0);
+
+        clearCorridor();
+        invalidateTemporal();
+    }
+
+    //--------------------------------------------------------------------------
+    // 時間方向の再利用
+    //--------------------------------------------------------------------------
+    std::vector<int>  scanlineLeft;           // 走査線ごとの探索範囲 (matching() で使う)
+    std::vector<int>  scanlineRight;
+    std::vector<char> reused;                 // 前の結果をそのまま使う走査線
+    std::vector<char> scheduled;              // 再利用またはタスクの追加を決めた走査線
+    std::vector<char> readUnwritten;          // 書き込まれる前に (初期値のまま) 読まれる走査線
+    std::vector<uint64_t> rowHashes;          // 行ごとの入力と参照画像のハッシュ
+    std::vector<uint64_t> previousRowHashes;  // 前の dp() のハッシュ
+    bool temporalValid = false;               // 前の dp() の結果が使える
+    int previousSkip  = 0;                    // 前の dp() の条件
+    int previousLeft  = 0;
+    int previousRight = 0;
+    const float* previousDisparity  = nullptr;
+    const float* previousConfidence = nullptr;
+    int previousStride = 0;
+
+    //--------------------------------------------------------------------------
+    // @brief 走査線の探索範囲
+    //   matching() で DPMatcher に渡す (temporalMargin で絞った範囲)
+    //--------------------------------------------------------------------------
+    void searchRange(int column, int& left, int& right) const
+    {
+        left  = scanlineLeft[column];
+        right = scanlineRight[column];
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 行のハッシュ
+    //   既定では入力と参照画像の行の画素. 別の画像でコストを計算する場合はオーバーライドする
+    //--------------------------------------------------------------------------
+    virtual uint64_t rowHash(int row)
+    {
+        uint64_t hash = hashBytes(14695981039346656037ULL, input.Row(row), input.Width() * sizeof(mi::RGB));
+        return hashBytes(hash, refer.Row(row), refer.Width() * sizeof(mi::RGB));
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief コスト計算で読む行の範囲
+    //   既定では走査線の行だけ. 上下の行を読む場合はオーバーライドする
+    // @param column DPする走査線の位置
+    // @param skip   飛び越し量
+    // @param first  読む最初の行
+    // @param last   読む最後の行
+    //--------------------------------------------------------------------------
+    virtual void referredRows(int column, int skip, int& first, int& last)
+    {
+        first = last = column;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 8 byte ずつ混ぜるハッシュ
+    //--------------------------------------------------------------------------
+    static uint64_t hashBytes(uint64_t hash, const void* data, size_t bytes)
+    {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+
+        for(; bytes>=8; bytes-=8, p+=8)
+        {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            hash = (hash ^ word) * 1099511628211ULL;
+            hash ^= hash >> 29;
+        }
+        for(; bytes>0; bytes--, p++)
+        {
+            hash = (hash ^ *p) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief dp() の始めに前の結果を使えるか調べ, 走査線ごとの探索範囲を決める
+    //--------------------------------------------------------------------------
+    void prepareTemporal(int skip)
+    {
+        reused.assign(nScanlines, 0);
+        scheduled.assign(nScanlines, 0);
+        readUnwritten.assign(nScanlines, 0);
+        scanlineLeft.assign(nScanlines, leftRange);
+        scanlineRight.assign(nScanlines, rightRange);
+
+        if(!temporal)
+        {
+            temporalValid = false;
+            return;
+        }
+
+        if(skip!=previousSkip || leftRange!=previousLeft || rightRange!=previousRight)
+        {
+            temporalValid = false;
+        }
+
+        rowHashes.resize(nScanlines);
+        for(int i=0; i<nScanlines; i++)
+        {
+            rowHashes[i] = rowHash(i);
+
+            // 通路が変われば結果も変わる
+            if(!corridorLower.empty())
+            {
+                rowHashes[i] = hashBytes(rowHashes[i], corridorLower[i].data(), X * sizeof(int));
+                rowHashes[i] = hashBytes(rowHashes[i], corridorUpper[i].data(), X * sizeof(int));
+            }
+        }
+
+        if(!temporalValid || temporalMargin < 0)
+        {
+            return;
+        }
+
+        // 前の結果の視差 (x - y) の範囲 ± temporalMargin に絞る
+        for(int i=0; i<nScanlines; i++)
+        {
+            const std::vector<int>& match = matchPatterns[i];
+            int dMin = 0, dMax = 0;
+
+            for(int iX=0; iX<X; iX++)
+            {
+                if(match[iX] < 0) continue;
+                dMin = std::min(dMin, iX - match[iX]);
+                dMax = std::max(dMax, iX - match[iX]);
+            }
+
+            scanlineLeft[i]  = std::min(leftRange,  dMax + temporalMargin);
+            scanlineRight[i] = std::min(rightRange, -dMin + temporalMargin);
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 前の結果をそのまま使えるか (タスクを追加する順に呼ぶ)
+    //   コスト計算で読む行が変わっておらず, 参考にする走査線も前と同じ値の場合.
+    //   まだ書き込まれていない走査線は初期値 (-1) を読むので前と同じ値になる.
+    //   ただし, 計算し直すタスクが初期値を読む走査線は, 前の結果を残すと値が変わるので使わない
+    // @param column DPする走査線の位置
+    // @param skip   飛び越し量
+    // @param prev   参考にする走査線の位置 (負の数なら使わない)
+    // @param next   参考にする走査線の位置 (負の数なら使わない)
+    //--------------------------------------------------------------------------
+    bool reuseScanline(int column, int skip, int prev, int next)
+    {
+        bool reuse = temporalValid && !readUnwritten[column];
+
+        for(int r : {prev, next})
+        {
+            if(r >= 0 && scheduled[r] && !reused[r]) reuse = false;
+        }
+
+        if(reuse)
+        {
+            int first, last;
+            referredRows(column, skip, first, last);
+
+            for(int i=std::max(first,0); i<=std::min(last,nScanlines-1); i++)
+            {
+                if(rowHashes[i] != previousRowHashes[i]) { reuse = false; break; }
+            }
+        }
+
+        if(!reuse)
+        {
+            for(int r : {prev, next})
+            {
+                if(r >= 0 && !scheduled[r]) readUnwritten[r] = 1;
+            }
+        }
+
+        scheduled[column] = 1;
+        reused[column]    = reuse;
+        return reuse;
+    }
+
+    //--------------------------------------------------------------------------
+    // 通路 (粗い段の結果の周りだけを探索する)
+    //--------------------------------------------------------------------------
+    std::vector<std::vector<int> > corridorLower;   // setCorridor() で決めた X ごとの Y の範囲
+    std::vector<std::vector<int> > corridorUpper;
+    std::vector<std::vector<int> > scanlineLower;   // 走査線の探索範囲に収めた通路 (matching() で使う)
+    std::vector<std::vector<int> > scanlineUpper;
+    std::vector<std::vector<int> > scanlineFirst;   // Y ごとの X の範囲
+    std::vector<std::vector<int> > scanlineLast;
+
+    //--------------------------------------------------------------------------
+    // @brief 粗い段のマッチング結果から探索する通路を決める
+    //   縦横を縮小した画像で dp() した coarse の対応点の変位 (y - x) を拡大し,
+    //   近傍 (走査線と X の前後 1 つずつ) の変位の範囲 ± margin を通路にする.
+    //   次の dp() から clearCorridor() するまで使う
+    // @param coarse 縮小した画像でマッチングした DPM
+    // @param margin 通路の幅 (拡大した変位からの画素数)
+    //--------------------------------------------------------------------------
+    void setCorridor(const DPM& coarse, int margin)
+    {
+        corridorLower.resize(nScanlines);
+        corridorUpper.resize(nScanlines);
+
+        const double scale = (double)X / coarse.X;
+
+        for(int i=0; i<nScanlines; i++)
+        {
+            std::vector<int>& lower = corridorLower[i];
+            std::vector<int>& upper = corridorUpper[i];
+            lower.resize(X);
+            upper.resize(X);
+
+            int row = std::min(coarse.nScanlines-1, i * coarse.nScanlines / nScanlines);
+
+            for(int iX=0; iX<X; iX++)
+            {
+                int cx = std::min(coarse.X-1, iX * coarse.X / X);
+                int dMin = INT_MAX, dMax = INT_MIN;
+
+                for(int r=std::max(0,row-1); r<=std::min(coarse.nScanlines-1,row+1); r++)
+                {
+                    const std::vector<int>& match = coarse.matchPatterns[r];
+
+                    for(int x=std::max(0,cx-1); x<=std::min(coarse.X-1,cx+1); x++)
+                    {
+                        if(match[x] < 0) continue;
+                        dMin = std::min(dMin, match[x] - x);
+                        dMax = std::max(dMax, match[x] - x);
+                    }
+                }
+
+                // 結果がなければ帯全体
+                if(dMin > dMax)
+                {
+                    lower[iX] = 0;
+                    upper[iX] = Y-1;
+                    continue;
+                }
+
+                lower[iX] = iX + (int)std::floor(dMin * scale) - margin;
+                upper[iX] = iX + (int)std::ceil(dMax * scale)  + margin;
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 通路を使わない (帯全体を探索する)
+    //--------------------------------------------------------------------------
+    void clearCorridor()
+    {
+        corridorLower.clear();
+        corridorUpper.clear();
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief setCorridor() の通路を走査線の探索範囲に合わせる (dp() の始めに呼ぶ)
+    //   帯に収め, 始点と終点を含み, 単調で隣の X とつながるように広げる
+    //--------------------------------------------------------------------------
+    void prepareCorridor()
+    {
+        if(corridorLower.empty())
+        {
+            return;
+        }
+
+        scanlineLower.resize(nScanlines);
+        scanlineUpper.resize(nScanlines);
+        scanlineFirst.resize(nScanlines);
+        scanlineLast.resize(nScanlines);
+
+        for(int i=0; i<nScanlines; i++)
+        {
+            std::vector<int>& lower = scanlineLower[i];
+            std::vector<int>& upper = scanlineUpper[i];
+            lower.resize(X);
+            upper.resize(X);
+
+            int left  = scanlineLeft[i];
+            int right = scanlineRight[i];
+
+            // 帯に収める
+            for(int iX=0; iX<X; iX++)
+            {
+                int bandLower = std::max(0, iX-left);
+                int bandUpper = std::min(Y-1, iX+right);
+                lower[iX] = std::min(bandUpper, std::max(bandLower, corridorLower[i][iX]));
+                upper[iX] = std::min(bandUpper, std::max(bandLower, corridorUpper[i][iX]));
+            }
+
+            // 始点と終点
+            lower[0]   = 0;
+            upper[X-1] = std::min(Y-1, X-1+right);
+
+            // 単調にする
+            for(int iX=1; iX<X; iX++)    upper[iX] = std::max(upper[iX], upper[iX-1]);
+            for(int iX=X-2; iX>=0; iX--) lower[iX] = std::min(lower[iX], lower[iX+1]);
+
+            // 隣の X と斜めのパスでつながるようにする
+            for(int iX=1; iX<X; iX++)    lower[iX] = std::min(lower[iX], upper[iX-1]+1);
+
+            // Y ごとの X の範囲
+            std::vector<int>& first = scanlineFirst[i];
+            std::vector<int>& last  = scanlineLast[i];
+            first.resize(Y);
+            last.resize(Y);
+
+            for(int iY=0, iX=0; iY<Y; iY++)
+            {
+                while(iX < X && upper[iX] < iY) iX++;
+                first[iY] = iX;
+            }
+            for(int iY=Y-1, iX=X-1; iY>=0; iY--)
+            {
+                while(iX >= 0 && lower[iX] > iY) iX--;
+                last[iY] = iX;
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 走査線の通路
+    //   matching() で DPMatcher に渡す (通路を使わなければ nullptr)
+    // @param column   DPする走査線の位置
+    // @param corridor 通路の書き込み先
+    //--------------------------------------------------------------------------
+    const DPCorridor* searchCorridor(int column, DPCorridor& corridor) const
+    {
+        if(corridorLower.empty())
+        {
+            return nullptr;
+        }
+
+        corridor.lower = scanlineLower[column].data();
+        corridor.upper = scanlineUpper[column].data();
+        corridor.first = scanlineFirst[column].data();
+        corridor.last  = scanlineLast[column].data();
+        return &corridor;
+    }
+
+    //--------------------------------------------------------------------------
+    // サブピクセルの視差 (setSubpixelOutput() で設定する書き込み先)
+    //--------------------------------------------------------------------------
+    float* subpixelDisparity  = nullptr;
+    float* subpixelConfidence = nullptr;
+    int    subpixelStride     = 0;
+
+    //--------------------------------------------------------------------------
+    // @brief 走査線のサブピクセルの視差の書き込み先
+    //   matching() で DPMatcher に渡す (書き込まなければ nullptr).
+    //   走査線を分けた DP (matchPattern が splitRows) ではスレッドごとの作業領域に書き込む
+    // @param column       DPする走査線の位置
+    // @param id           スレッド番号
+    // @param matchPattern matching() に渡されたマッチング結果の格納先
+    // @param subpixel     書き込み先を格納する領域
+    //--------------------------------------------------------------------------
+    const DPSubpixel* searchSubpixel(int column, int id, const std::vector<int>& matchPattern,
+                                     DPSubpixel& subpixel)
+    {
+        if(!subpixelDisparity && !subpixelConfidence)
+        {
+            return nullptr;
+        }
+
+        if(&matchPattern == &splitRows[id])
+        {
+            subpixel.disparity  = subpixelDisparity  ? splitDisparity[id].data()  : nullptr;
+            subpixel.confidence = subpixelConfidence ? splitConfidence[id].data() : nullptr;
+        }
+        else
+        {
+            subpixel.disparity  = subpixelDisparity  ? subpixelDisparity  + column*subpixelStride : nullptr;
+            subpixel.confidence = subpixelConfidence ? subpixelConfidence + column*subpixelStride : nullptr;
+        }
+        return &subpixel;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 補間した画素のサブピクセルの視差と信頼度を前の走査線から写す
+    //--------------------------------------------------------------------------
+    void copySubpixel(int from, int to, int iX)
+    {
+        if(subpixelDisparity)
+        {
+            subpixelDisparity[to*subpixelStride + iX] = subpixelDisparity[from*subpixelStride + iX];
+        }
+        if(subpixelConfidence)
+        {
+            subpixelConfidence[to*subpixelStride + iX] = subpixelConfidence[from*subpixelStride + iX];
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 探索範囲に合わせてノードを確保する
+    //--------------------------------------------------------------------------
+    void allocateNodes()
+    {
+        nodes.resize(threadPool.GetNumThread());
+        for(int i=0; i<nodes.size(); i++)
+        {
+            nodes[i].Allocate(X, Y, leftRange, rightRange);
+        }
+    }
 
     // 各走査線のマッチング結果
     std::vector<std::vector<int> > matchPatterns;
@@ -148,38 +743,34 @@ protected:
 
         for(int i=skip; i<nScanlines; i+=(skip*2))
         {
-            threadPool.Request([&,i,skip](int id){
+            int p = std::max(i-skip,0);
+            int n = std::min(i+skip,nScanlines-1);
+
+            if(reuseScanline(i, skip, p, n)) continue;
 
-                std::vector<int>& prev    = matchPatterns[std::max(i-skip,0)];
-                std::vector<int>& next    = matchPatterns[std::min(i+skip,nScanlines-1)];
+            if(scanlineSplit > 1)
+            {
+                splitScanline(i, skip, p, n);
+                continue;
+            }
+
+            // 前後の走査線が終わってから実行する
+            addScanline(i, p, n, [&,i,skip,p,n](int id){
+                DP_PROFILE_SCOPE(SkipScanline);
+
+                std::vector<int>& prev    = matchPatterns[p];
                 std::vector<int>& current = matchPatterns[i];
 
-                for(int iX=0; iX<X; iX++)
-                {
-                    // 補間
-                    if(std::abs(std::abs(prev[iX]-iX) - std::abs(next[iX]-iX)) < 5)
-                    {
+                skipSegments(prev, matchPatterns[n],
+                    [&](int iX){
+                        DP_PROFILE_COUNT(SkipInterpolated, 1);
                         current[iX] = prev[iX];
-                    }
-                    // 計算
-                    else
-                    {
-                        int sx = std::max(0,iX-1);
-                        int ex = [&]{
-                            for(int jX=iX+1; jX<X; jX++)
-                            {
-                                if(prev[jX] == next[jX])
-                                {
-                                    return jX;
-                                }
-                            }
-                            return X-1;
-                        }();
-
-                        matching(sx, 0, ex, Y-1, i, skip, id);
-                        iX = ex;
-                    }
-                }
+                        copySubpixel(p, i, iX);
+                    },
+                    [&](int iX, int sx, int ex){
+                        DP_PROFILE_COUNT(SkipMatched, ex-sx+1);
+                        matching(sx, 0, ex, Y-1, i, skip, id, current);
+                    });
             });
         }
 
@@ -187,128 +778,318 @@ protected:
     }
 
     //--------------------------------------------------------------------------
-    // @brief マッチングしてパターンを格納
-    // @param sx     DPテーブルの始点 X 座標
-    // @param sy     DPテーブルの始点 Y 座標
-    // @param ex     DPテーブルの終点 X 座標
-    // @param ex     DPテーブルの終点 Y 座標
-    // @param column DPする走査線の位置
-    // @param skip   飛び越した量(マッチング済みの走査線までの距離)
-    // @param id     スレッド番号
+    // @brief 飛び越した走査線を前後の走査線から補間し, 補間できない区間を列挙する
+    //   前後の対応点の視差が近ければ補間, 遠ければ前後の対応点が一致する位置までを DP する
+    // @param prev        前の走査線のマッチング結果
+    // @param next        次の走査線のマッチング結果
+    // @param interpolate 補間する位置 iX で呼ぶ関数
+    // @param match       DP する区間 (sx, ex) で呼ぶ関数 (iX は区間を見つけた位置)
+    //--------------------------------------------------------------------------
+    template<class Interpolate, class Match>
+    void skipSegments(const std::vector<int>& prev, const std::vector<int>& next,
+                      Interpolate interpolate, Match match)
+    {
+        for(int iX=0; iX<X; iX++)
+        {
+            // 補間
+            if(std::abs(std::abs(prev[iX]-iX) - std::abs(next[iX]-iX)) < 5)
+            {
+                interpolate(iX);
+            }
+            // 計算
+            else
+            {
+                int sx = std::max(0,iX-1);
+                int ex = [&]{
+                    for(int jX=iX+1; jX<X; jX++)
+                    {
+                        if(prev[jX] == next[jX])
+                        {
+                            return jX;
+                        }
+                    }
+                    return X-1;
+                }();
+
+                match(iX, sx, ex);
+                iX = ex;
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // 走査線を分けた DP
     //--------------------------------------------------------------------------
-    void matching(int sx, int sy, int ex, int ey, int column, int skip, int id)
+    struct SkipSegment {
+        int sx;                  // DP した区間の始点
+        std::vector<int> match;  // 区間のマッチング結果 (match[x-sx]. 書き込まれなかった要素は NotWritten)
+        std::vector<float> disparity;  // 区間のサブピクセルの視差と信頼度 (書き込む場合だけ)
+        std::vector<float> confidence;
+    };
+
+    enum { NotWritten = INT_MIN };
+
+    std::vector<std::vector<SkipSegment> > splitSegments; // 分けたタスクごとの区間の結果 (縮めずに使い回す)
+    std::vector<size_t> splitCounts;                       // splitSegments のうち今回書き込んだ区間の数
+    int usedSplitSlots = 0;                                // dp() で使った splitSegments の数
+    std::vector<std::vector<int> > splitRows;             // 区間の DP の書き込み先 (スレッドごと)
+    std::vector<std::vector<float> > splitDisparity;      // 区間のサブピクセルの視差と信頼度の書き込み先 (スレッドごと)
+    std::vector<std::vector<float> > splitConfidence;
+
+    //--------------------------------------------------------------------------
+    // @brief 飛び越した走査線を X 方向に分けたタスクを追加する
+    //
+    //   補間できない区間は前後の走査線の対応点が一致する位置で区切られていて, 互いに独立に DP できる.
+    //   区間を見つける位置で scanlineSplit 個のタスクに分け, それぞれ作業領域に DP する.
+    //   最後のタスクで補間と区間の結果を X の順に書き込むので, 分けない場合と同じ結果になる
+    //
+    // @param column 書き込む走査線の位置
+    // @param skip   飛び越し量
+    // @param prev   前の走査線の位置
+    // @param next   次の走査線の位置
+    //--------------------------------------------------------------------------
+    void splitScanline(int column, int skip, int prev, int next)
     {
-        std::vector<Node>& node = nodes[id];
+        const int first = usedSplitSlots;
+        usedSplitSlots += scanlineSplit;
 
-        // 探索範囲を考慮した値に更新
-        sy = std::min(sx+rightRange, std::max(sx-leftRange, sy));
-        ey = std::min(ex+rightRange, std::max(ex-leftRange, ey));
+        if((int)splitSegments.size() < usedSplitSlots)
+        {
+            splitSegments.resize(usedSplitSlots);
+            splitCounts.resize(usedSplitSlots);
+        }
 
+        // 区間のタスクは続けて追加するので番号は firstPart から連続する
+        int firstPart = -1;
 
-        // ノードの初期化 --------------------------------------------------------
-        for(int iY=sy; iY<=ey; iY++)
+        for(int k=0; k<scanlineSplit; k++)
         {
-            int start = std::max(sx,iY-rightRange);
-            int end   = std::min(ex,iY+leftRange);
+            const int slot  = first + k;
+            const int begin = k * X / scanlineSplit;
+            const int end   = (k + 1) * X / scanlineSplit;
 
-            for(int iX=start; iX<=end; iX++)
-            {
-                int i = iX + iY*X;
+            int part = addReader(prev, next, [&,column,skip,prev,next,slot,begin,end](int id){
+                DP_PROFILE_SCOPE(SkipScanline);
 
-                // コスト計算
-                double cost = calcCost(iX,iY,column,skip);
+                std::vector<SkipSegment>& segments = splitSegments[slot];
+                std::vector<int>& work = splitRows[id];
+                size_t count = 0;
 
-                node[i].verticalPathCost  = verticalCost(iX, iY, column, cost);
-                node[i].horizontalPathCost= horizontalCost(iX, iY, column, cost);
-                node[i].diagonalPathCost  = diagonalCost(iX, iY, column, cost);
-            }
+                skipSegments(matchPatterns[prev], matchPatterns[next],
+                    [](int iX){},
+                    [&](int iX, int sx, int ex){
+
+                        if(iX < begin || iX >= end) return;
+
+                        std::fill(work.begin()+sx, work.begin()+ex+1, NotWritten);
+                        matching(sx, 0, ex, Y-1, column, skip, id, work);
+
+                        if(segments.size() <= count) segments.emplace_back();
+                        segments[count].sx = sx;
+                        segments[count].match.assign(work.begin()+sx, work.begin()+ex+1);
+
+                        if(subpixelDisparity)
+                        {
+                            const std::vector<float>& d = splitDisparity[id];
+                            segments[count].disparity.assign(d.begin()+sx, d.begin()+ex+1);
+                        }
+                        if(subpixelConfidence)
+                        {
+                            const std::vector<float>& c = splitConfidence[id];
+                            segments[count].confidence.assign(c.begin()+sx, c.begin()+ex+1);
+                        }
+                        count++;
+                    });
+
+                splitCounts[slot] = count;
+            });
+
+            if(k == 0) firstPart = part;
         }
 
-        // DPM による最短経路探索 -------------------------------------------------
-        // 始点の計算
-        node[sx+sy*X].cost = 0;
+        // 補間と区間の結果を順に書き込む
+        int merge = addScanline(column, prev, next, [&,column,prev,next,first](int id){
+            DP_PROFILE_SCOPE(SkipScanline);
+
+            std::vector<int>& prevMatch = matchPatterns[prev];
+            std::vector<int>& current   = matchPatterns[column];
+
+            int slot = first;
+            size_t index = 0;
+
+            skipSegments(prevMatch, matchPatterns[next],
+                [&](int iX){
+                    DP_PROFILE_COUNT(SkipInterpolated, 1);
+                    current[iX] = prevMatch[iX];
+                    copySubpixel(prev, column, iX);
+                },
+                [&](int iX, int sx, int ex){
+                    DP_PROFILE_COUNT(SkipMatched, ex-sx+1);
+
+                    while(index >= splitCounts[slot]) { slot++; index = 0; }
+
+                    const SkipSegment& segment = splitSegments[slot][index++];
+
+                    for(int x=sx; x<=ex; x++)
+                    {
+                        if(segment.match[x-sx] == NotWritten) continue;
+
+                        current[x] = segment.match[x-sx];
+
+                        if(subpixelDisparity)  subpixelDisparity[column*subpixelStride + x]  = segment.disparity[x-sx];
+                        if(subpixelConfidence) subpixelConfidence[column*subpixelStride + x] = segment.confidence[x-sx];
+                    }
+                });
+        });
 
-        // 下端の計算
-        for(int iX=sx+1; iX<=leftRange; iX++)
+        for(int k=0; k<scanlineSplit; k++)
         {
-            node[iX].cost = node[iX].horizontalPathCost + node[iX-1].cost;
-            node[iX].selectedPathDir = Node::HORIZONTAL;
+            scanlineGraph.Depend(merge, firstPart + k);
         }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 最初の段の走査線のマッチングでコスト計算に使う走査線
+    //   既定では使わない (最初の段の走査線は並べて DP する).
+    //   同じ段の走査線を返すと, その走査線が終わるまで待つので段が直列になる (DPMF の粘性)
+    // @param column DPする走査線の位置
+    // @param skip   飛び越し量
+    // @param prev   使う走査線の位置 (使わなければ負の数)
+    // @param next   使う走査線の位置 (使わなければ負の数)
+    //--------------------------------------------------------------------------
+    virtual void referredScanlines(int column, int skip, int& prev, int& next)
+    {
+        prev = next = -1;
+    }
 
-        // 左端の計算
-        for(int iY=sy+1; iY<=rightRange; iY++)
+    //--------------------------------------------------------------------------
+    // @brief 走査線のタスクを依存関係つきで追加する
+    //
+    //   追加した順に実行した場合と同じ結果になるように,
+    //   読む走査線を最後に書いたタスク, 書く走査線を読む・書く先のタスクに依存させる
+    //
+    // @param column 書き込む走査線の位置
+    // @param prev   読み込む走査線の位置 (負の数なら読まない)
+    // @param next   読み込む走査線の位置 (負の数なら読まない)
+    // @param task   タスク
+    // @return       タスクの番号
+    //--------------------------------------------------------------------------
+    template<class F>
+    int addScanline(int column, int prev, int next, F&& task)
+    {
+        int t = scanlineGraph.Add(std::forward<F>(task));
+
+        for(int r : {prev, next})
         {
-            node[sx+iY*X].cost = node[sx+iY*X].verticalPathCost + node[sx+(iY-1)*X].cost;
-            node[sx+iY*X].selectedPathDir = Node::VERTICAL;
+            if(r < 0) continue;
+            scanlineGraph.Depend(t, lastWriter[r]);
         }
 
-        // 経路探索
-        for(int iY=sy+1; iY<=ey; iY++)
+        scanlineGraph.Depend(t, lastWriter[column]);
+        for(int reader : readers[column])
         {
-            int start = std::max(sx+1,iY-rightRange);
-            int end   = std::min(ex,iY+leftRange);
+            scanlineGraph.Depend(t, reader);
+        }
 
-            for(int iX=start; iX<=end; iX++)
-            {
-                // ノードのインデックスを計算 (現在,縦,横,斜め)
-                int ni = iX + iY * X;
-                int nv = iX + (iY-1)*X;
-                int nh = (iX-1) + iY*X;
-                int nd = (iX-1) + (iY-1)*X;
-
-                // コスト計算
-                double vCost = node[ni].verticalPathCost   + node[nv].cost;
-                double hCost = node[ni].horizontalPathCost + node[nh].cost;
-                double dCost = node[ni].diagonalPathCost   + node[nd].cost;
-
-                // 最小コスト計算
-                node[ni].cost = std::min({vCost,hCost,dCost});
-
-                // 選んだパスを記録
-                //   double型だが計算はしていないので bit が一致する
-                if(node[ni].cost == dCost) {
-                    node[ni].selectedPathDir = Node::DIAGONAL;
-                }
-                else
-                if(node[ni].cost == vCost) {
-                    node[ni].selectedPathDir = Node::VERTICAL;
-                }
-                else
-                if(node[ni].cost == hCost) {
-                    node[ni].selectedPathDir = Node::HORIZONTAL;
-                }
-                else {
-                    throw "NaN";
-                }
-            }
+        for(int r : {prev, next})
+        {
+            if(r < 0 || r == column) continue;
+            readers[r].push_back(t);
+        }
+
+        lastWriter[column] = t;
+        readers[column].clear();
+        return t;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 走査線を読むだけのタスクを追加する (書き込むのは作業領域だけ)
+    // @param prev 読み込む走査線の位置 (負の数なら読まない)
+    // @param next 読み込む走査線の位置 (負の数なら読まない)
+    // @param task タスク
+    // @return     タスクの番号
+    //--------------------------------------------------------------------------
+    template<class F>
+    int addReader(int prev, int next, F&& task)
+    {
+        int t = scanlineGraph.Add(std::forward<F>(task));
+
+        for(int r : {prev, next})
+        {
+            if(r < 0) continue;
+            scanlineGraph.Depend(t, lastWriter[r]);
+            readers[r].push_back(t);
         }
 
+        return t;
+    }
 
-        // Backtrace -----------------------------------------------------------
-        int iX = ex;
-        int iY = ey;
+    // 走査線のタスクの依存関係
+    TaskGraph scanlineGraph;
+    std::vector<int> lastWriter;               // 走査線を最後に書いたタスク
+    std::vector<std::vector<int> > readers;    // 最後に書かれてから走査線を読んだタスク
+    int firstSkip = 0;                         // dp() の最初の段の飛び越し量 (これより小さい段は飛び越した走査線)
 
-        std::vector<int>& matchPattern = matchPatterns[column];
+    //--------------------------------------------------------------------------
+    // @brief マッチングしてパターンを格納
+    // @param sx     DPテーブルの始点 X 座標
+    // @param sy     DPテーブルの始点 Y 座標
+    // @param ex     DPテーブルの終点 X 座標
+    // @param ex     DPテーブルの終点 Y 座標
+    // @param column DPする走査線の位置
+    // @param skip   飛び越した量(マッチング済みの走査線までの距離)
+    // @param id     スレッド番号
+    // @param matchPattern マッチング結果の格納先 (走査線を分けて DP する場合は作業領域)
+    //--------------------------------------------------------------------------
+    virtual void matching(int sx, int sy, int ex, int ey, int column, int skip, int id,
+                          std::vector<int>& matchPattern)
+    {
+        VirtualCostPolicy costPolicy(*this);
+        VirtualBiasPolicy biasPolicy(*this);
 
-        while( iX>sx || iY>sy )
+        int left, right;
+        searchRange(column, left, right);
+
+        DPCorridor corridor;
+        DPSubpixel subpixel;
+
+        DPMatcher<VirtualCostPolicy, VirtualBiasPolicy, Cost>
+            matcher(costPolicy, biasPolicy, left, right);
+
+        matcher.Matching(nodes[id], costRows[id].data(),
+                         sx, sy, ex, ey, column, skip, matchPattern,
+                         searchCorridor(column, corridor),
+                         searchSubpixel(column, id, matchPattern, subpixel));
+    }
+
+    //--------------------------------------------------------------------------
+    // 仮想関数でコストを計算するポリシー
+    //   DPMatcher から calcCostRow(), pathCostRow() を呼ぶ
+    //--------------------------------------------------------------------------
+    struct VirtualCostPolicy : DPCostPolicy<VirtualCostPolicy>
+    {
+        DPM& dpm;
+
+        VirtualCostPolicy(DPM& dpm) : dpm(dpm) {}
+
+        void CostRow(int y, int column, int skip, int sx, int ex, double* out)
         {
-            matchPattern[iX] = iY;
+            dpm.calcCostRow(y, column, skip, sx, ex, out);
+        }
+    };
 
-            switch( node[iX+iY*X].selectedPathDir )
-            {
-                case Node::VERTICAL  : iY--; break;
-                case Node::HORIZONTAL: iX--; break;
-                case Node::DIAGONAL  : iX--; iY--; break;
-                case Node::NONE :
-                    std::cout<<sx<<" "<<sy<<" "<<ex<<" "<<ey<<" ";
-                    std::cout<<iX<<" "<<iY<<" "<<node[iX+iY*X].selectedPathDir<<std::endl;
-                default:
-                    if(iX<=sx && iY>sy) iY--;
-                    if(iY<=sy && iX>sx) iX--;
-                    break;
-            }
+    struct VirtualBiasPolicy : DPBiasPolicy<VirtualBiasPolicy>
+    {
+        DPM& dpm;
+
+        VirtualBiasPolicy(DPM& dpm) : dpm(dpm) {}
+
+        void PathCostRow(int y, int column, int sx, int ex, const double* cost,
+                         Cost* v, Cost* h, Cost* d)
+        {
+            dpm.pathCostRow(y, column, sx, ex, cost, v, h, d);
         }
-    }
+    };
 
     //--------------------------------------------------------------------------
     // @brief コスト計算
@@ -329,6 +1110,44 @@ protected:
     virtual double verticalCost(int x, int y, int column, double cost)  { return cost; }
     virtual double horizontalCost(int x, int y, int column, double cost){ return cost; }
     virtual double diagonalCost(int x, int y, int column,  double cost) { return cost; }
+
+    //--------------------------------------------------------------------------
+    // @brief 1行分のコスト計算
+    // @param y      DPテーブルY方向の系列の位置
+    // @param column DPする走査線の位置
+    // @param skip   マッチング済みの走査線までの距離
+    // @param sx     DPテーブルX方向の開始位置
+    // @param ex     DPテーブルX方向の終了位置
+    // @param out    コストの書き込み先 (out[x-sx])
+    //--------------------------------------------------------------------------
+    virtual void calcCostRow(int y, int column, int skip, int sx, int ex, double* out)
+    {
+        for(int x=sx; x<=ex; x++)
+        {
+            out[x-sx] = calcCost(x, y, column, skip);
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 1行分の縦・横・斜, それぞれのパスに設定するコスト
+    // @param y      DPテーブルY方向の系列の位置
+    // @param column DPする走査線の位置
+    // @param sx     DPテーブルX方向の開始位置
+    // @param ex     DPテーブルX方向の終了位置
+    // @param cost   calcCostRow() で計算されたコスト
+    // @param v,h,d  縦・横・斜のパスのコストの書き込み先 (v[x-sx])
+    //--------------------------------------------------------------------------
+    virtual void pathCostRow(int y, int column, int sx, int ex, const double* cost,
+                             Cost* v, Cost* h, Cost* d)
+    {
+        for(int x=sx; x<=ex; x++)
+        {
+            double c = cost[x-sx];
+            v[x-sx] = CostOp::FromDouble(verticalCost(x, y, column, c));
+            h[x-sx] = CostOp::FromDouble(horizontalCost(x, y, column, c));
+            d[x-sx] = CostOp::FromDouble(diagonalCost(x, y, column, c));
+        }
+    }
 };
 
 
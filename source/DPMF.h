@@ -7,6 +7,162 @@
 #define _DPMF_H_
 
 #include "DPM.h"
+#include "miImage/miPlane.h"
+
+#include <limits>
+
+//------------------------------------------------------------------------------
+//
+// フュージョンのコスト
+//
+//  隣接画素との勾配の差と, 飛び越した走査線の対応付け結果との距離 (粘性)
+//  粘性は skip 前の走査線の結果だけを読む. firstSkip が 0 でなければ,
+//  最初の段 (skip == firstSkip) の走査線は互いの結果を読まない (粘性なし)
+//  T は画素の型 (8bit / 16bit の深度画像). 画素値は T の最大値で 0~1 に正規化する
+//------------------------------------------------------------------------------
+template<class T = unsigned char>
+struct FusionCostPolicy : DPCostPolicy<FusionCostPolicy<T> >
+{
+    // R チャンネルだけ使うので 1 チャンネルの画像で持つ
+    const mi::Plane<T>& input;
+    const mi::Plane<T>& refer;
+
+    // 各走査線のマッチング結果
+    const std::vector<std::vector<int> >& matchPatterns;
+
+    int nScanlines; // スキャンラインの数
+    int length;     // DPテーブルの長さ(幅x高さ)
+    int firstSkip;  // 粘性を使わない最初の段の飛び越し量 (0 なら全ての段で使う)
+
+    double sig;     // 2*CostSigmaC^2
+    double sig2;    // 2*CostSigmaG^2
+
+    FusionCostPolicy(const mi::Plane<T>& input, const mi::Plane<T>& refer,
+                     const std::vector<std::vector<int> >& matchPatterns,
+                     int nScanlines, int length, int firstSkip, double sigmaC, double sigmaG)
+        : input(input), refer(refer), matchPatterns(matchPatterns)
+        , nScanlines(nScanlines), length(length), firstSkip(firstSkip)
+        , sig(2*sigmaC*sigmaC), sig2(2*sigmaG*sigmaG)
+    {
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief コスト計算
+    //--------------------------------------------------------------------------
+    double Cost(int x, int y, int column, int skip)
+    {
+        // 隣接するピクセルとの勾配が、レーザーとステレオで差(f)が大きいほど exp() は小さくなる
+        // 結果 1-exp() コストは, 大きくなる.
+        double f = std::abs(Gradient(input,x,column) - Gradient(refer,y,column));
+
+        return (1.0 - std::exp(-f*f/sig)) + GlueyCost(y, column, skip);
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 1行分のコスト計算
+    //--------------------------------------------------------------------------
+    void CostRow(int y, int column, int skip, int sx, int ex, double* out)
+    {
+        // 参照画像側の勾配と粘性は行内で共通
+        const double cB = Gradient(refer, y, column);
+        const double gCost = GlueyCost(y, column, skip);
+
+        for(int x=sx; x<=ex; x++)
+        {
+            double f = std::abs(Gradient(input,x,column) - cB);
+            out[x-sx] = (1.0 - std::exp(-f*f/sig)) + gCost;
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 隣接するピクセルとの勾配
+    //--------------------------------------------------------------------------
+    static inline double Gradient(const mi::Plane<T>& image, int x, int column)
+    {
+        const auto i = 1;
+        const T* pixel = image.Row(column);
+
+        if(x-i<0) return ((double)pixel[x]-pixel[x+i]) / Range();
+        else      return ((double)pixel[x]-pixel[x-i]) / Range();
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 画素値の最大値 (8bit なら 255)
+    //--------------------------------------------------------------------------
+    static inline double Range()
+    {
+        return (double)std::numeric_limits<T>::max();
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 粘性のコスト
+    // @param y      DPテーブルY方向の系列の位置
+    // @param column DPする走査線の位置
+    // @param skip   参考にする走査線までの距離(マッチング済みの走査線までの距離)
+    //--------------------------------------------------------------------------
+    inline double GlueyCost(int y, int column, int skip)
+    {
+        // 粘性計算
+        double gluey=0.0;
+
+        // (上下端の走査線は粘性を使わない)
+        if((firstSkip==0 || skip<firstSkip) && column-skip >=0 && column+skip<nScanlines)
+        {
+            const std::vector<int>& matchPrev = matchPatterns[column-skip];
+
+            double prev    = refer(y, column-skip);
+            double current = refer(y, column+0);
+
+
+            // 上の列の対応付けの結果における移動(伸縮)距離
+            // 対応付け結果との距離が大きいほど g が大きくなり exp(g*g)が小さくなる
+            // つまり, 1-exp(g*g) が大きなるためこの対応付けは回避される
+            double distPrev = 1.0 * (matchPrev[y]-y) / length;
+
+            // 上のピクセルとの類似度(値が1に近いほど似ている)
+            double simPrev = 1.0 - std::abs(prev-current) / Range();
+
+            // 上のピクセルとの非類似度が低い(=類似度が高い)ほど
+            // 上の列の対応付けの結果に近い対応のノードになるほどglueyの値が大きくなる
+            gluey = std::abs(distPrev*simPrev) / 1.0;
+        }
+
+
+        // 上の列の対応付けの結果から大きく離れる(gが大きい)ほど exp() は小さくなる
+        // 結果 1-exp() コストは, 大きくなる.
+
+        double g = gluey;
+
+        return (1.0 - std::exp(-g*g/sig2));
+    }
+};
+
+
+//------------------------------------------------------------------------------
+//
+// フュージョンのパスの偏り
+//
+//  対角線から離れるほど縦・横のパスのコストを大きくする
+//------------------------------------------------------------------------------
+struct FusionBiasPolicy : DPBiasPolicy<FusionBiasPolicy>
+{
+    int X; // DPテーブルの横の長さ
+
+    FusionBiasPolicy(int X) : X(X) {}
+
+    double Vertical(int x, int y, int column, double cost)
+    {
+        double bias = (x-y)/X;
+        return cost + bias*bias;
+    }
+
+    double Horizontal(int x, int y, int column, double cost)
+    {
+        double bias = (x-y)/X;
+        return cost + bias*bias;
+    }
+};
+
 
 //------------------------------------------------------------------------------
 //
@@ -21,6 +177,11 @@ public:
     double CostSigmaC = 0.01; //
     double CostSigmaG = 0.1;  //
 
+    // 最初の段の並列化
+    //   false なら, 最初の段の走査線も skip 前の走査線の結果を粘性に使うので, 上から順に DP する.
+    //   true なら, 最初の段の走査線は粘性を使わずに並べて DP する (速いが結果は変わる)
+    bool parallelFirstLevel = false;
+
 
     //--------------------------------------------------------------------------
     // @brief コンストラクタ
@@ -28,11 +189,36 @@ public:
     // @param reference 正確な距離情報の参照画像
     // @param threads   スレッド数
     //--------------------------------------------------------------------------
-    DPMF(mi::Image& input, mi::Image& reference, int threads = std::thread::hardware_concurrency())
+    DPMF(const mi::ImageView& input, const mi::ImageView& reference, int threads = std::thread::hardware_concurrency())
         : DPM(input, reference, threads)
     {
     }
 
+    // スレッドプールを共有する
+    DPMF(const mi::ImageView& input, const mi::ImageView& reference, ThreadPool& threadPool)
+        : DPM(input, reference, threadPool)
+    {
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief コンストラクタ (深度画像を 1 チャンネルの画像で渡す)
+    //   RGB の画像から R チャンネルを取り出さずにそのまま使う
+    //   16bit の深度画像は 8bit に量子化せずに使う
+    //--------------------------------------------------------------------------
+    DPMF(const mi::Plane8& input, const mi::Plane8& reference, int threads = std::thread::hardware_concurrency())
+        : DPM(planeView(input), planeView(reference), threads)
+        , inputSource(&input)
+        , referSource(&reference)
+    {
+    }
+
+    DPMF(const mi::Plane16& input, const mi::Plane16& reference, int threads = std::thread::hardware_concurrency())
+        : DPM(planeView(input), planeView(reference), threads)
+        , inputSource16(&input)
+        , referSource16(&reference)
+    {
+    }
+
 
     //--------------------------------------------------------------------------
     // @brief DP マッチングによる対応付けをおこなう
@@ -42,15 +228,62 @@ public:
     //--------------------------------------------------------------------------
     virtual void dp(int skip, double sigmaC, double sigmaG)
     {
+        // コストのパラメータが変わったら前の結果は使えない
+        if(sigmaC!=CostSigmaC || sigmaG!=CostSigmaG || parallelFirstLevel!=previousParallelFirstLevel)
+        {
+            invalidateTemporal();
+        }
+        previousParallelFirstLevel = parallelFirstLevel;
+
         CostSigmaC = sigmaC;
         CostSigmaG = sigmaG;
 
-        DPM::dp(skip);
+        // コストは R チャンネルしか読まないので, 先に取り出しておく
+        if(!inputSource && !inputSource16) {
+            mi::ExtractChannel(input, 0, inputPlane);
+            mi::ExtractChannel(refer, 0, referPlane);
+        }
 
-        threadPool.Join();
+        DPM::dp(skip);
     }
 
 protected:
+    //--------------------------------------------------------------------------
+    // @brief マッチングしてパターンを格納
+    //   FusionCostPolicy, FusionBiasPolicy を展開した DPMatcher で計算する
+    //--------------------------------------------------------------------------
+    virtual void matching(int sx, int sy, int ex, int ey, int column, int skip, int id,
+                          std::vector<int>& matchPattern)
+    {
+        if(inputSource16) {
+            matching(fusionCostPolicy(*inputSource16, *referSource16), sx, sy, ex, ey, column, skip, id, matchPattern);
+        }
+        else {
+            matching(fusionCostPolicy(), sx, sy, ex, ey, column, skip, id, matchPattern);
+        }
+    }
+
+    template<class T>
+    void matching(FusionCostPolicy<T> costPolicy, int sx, int sy, int ex, int ey, int column, int skip, int id,
+                  std::vector<int>& matchPattern)
+    {
+        FusionBiasPolicy biasPolicy(X);
+
+        int left, right;
+        searchRange(column, left, right);
+
+        DPCorridor corridor;
+        DPSubpixel subpixel;
+
+        DPMatcher<FusionCostPolicy<T>, FusionBiasPolicy, Cost>
+            matcher(costPolicy, biasPolicy, left, right);
+
+        matcher.Matching(nodes[id], costRows[id].data(),
+                         sx, sy, ex, ey, column, skip, matchPattern,
+                         searchCorridor(column, corridor),
+                         searchSubpixel(column, id, matchPattern, subpixel));
+    }
+
     //--------------------------------------------------------------------------
     // @brief コスト計算
     // @param x      DPテーブルX方向の系列の位置
@@ -60,82 +293,109 @@ protected:
     //--------------------------------------------------------------------------
     virtual double calcCost(int x, int y, int column, int skip)
     {
-        const auto i = 1;
-        const auto sig = 2*CostSigmaC*CostSigmaC;
-        const auto sig2= 2*CostSigmaG*CostSigmaG;
-
-        auto cA = 0.0;
-        auto cB = 0.0;
-        auto cC = 0.0;
-
-        if(x-i<0) cA = (input.pixel[x][column].r-input.pixel[x+i][column].r) / 255.0;
-        else      cA = (input.pixel[x][column].r-input.pixel[x-i][column].r) / 255.0;
-
+        if(inputSource16) {
+            return fusionCostPolicy(*inputSource16, *referSource16).Cost(x, y, column, skip);
+        }
+        return fusionCostPolicy().Cost(x, y, column, skip);
+    }
 
-        if(y-i<0) cB = (refer.pixel[y][column].r-refer.pixel[y+i][column].r) / 255.0;
-        else      cB = (refer.pixel[y][column].r-refer.pixel[y-i][column].r) / 255.0;
+    //--------------------------------------------------------------------------
+    // @brief 縦・横・斜, それぞれのパスに設定するコスト
+    // @param x      DPテーブルX方向の系列の位置
+    // @param y      DPテーブルY方向の系列の位置
+    // @param column DPする走査線の位置
+    // @param cost   CalcCost() で計算されたコスト
+    //--------------------------------------------------------------------------
+    virtual double verticalCost(int x, int y, int column, double cost)
+    {
+        return FusionBiasPolicy(X).Vertical(x, y, column, cost);
+    }
 
+    virtual double horizontalCost(int x, int y, int column, double cost)
+    {
+        return FusionBiasPolicy(X).Horizontal(x, y, column, cost);
+    }
 
-        // 粘性計算
-        double gluey=0.0;
+    //--------------------------------------------------------------------------
+    // @brief 最初の段の走査線のマッチングでコスト計算に使う走査線
+    //   粘性の計算で skip 前の走査線の結果を使う (parallelFirstLevel なら使わない)
+    //--------------------------------------------------------------------------
+    virtual void referredScanlines(int column, int skip, int& prev, int& next)
+    {
+        prev = next = -1;
 
-        if(column-skip >=0 && column+skip<nScanlines)
+        if(!parallelFirstLevel && column-skip >=0 && column+skip<nScanlines)
         {
-            std::vector<int>& matchPrev = matchPatterns[column-skip];
-            std::vector<int>& matchNext = matchPatterns[column+skip];
-
-            double prev    = refer.pixel[y][column-skip].r;
-            double current = refer.pixel[y][column+0].r;
-            double next    = refer.pixel[y][column+skip].r;
-
-
-            // 上下の列の対応付けの結果における移動(伸縮)距離
-            // 対応付け結果との距離が大きいほど g が大きくなり exp(g*g)が小さくなる
-            // つまり, 1-exp(g*g) が大きなるためこの対応付けは回避される
-            double distPrev = 1.0 * (matchPrev[y]-y) / length;
-            double distNext = 1.0 * (matchNext[y]-y) / length;
-
-            // 上下のピクセルとの類似度(値が1に近いほど似ている)
-            double simPrev = 1.0 - std::abs(prev-current) / 255.0;
-            double simNext = 1.0 - std::abs(next-current) / 255.0;
-
-            // 上下のピクセルとの非類似度が低い(=類似度が高い)ほど
-            // 上の列の対応付けの結果に近い対応のノードになるほどglueyの値が大きくなる
-            gluey = std::abs(distPrev*simPrev) / 1.0;
+            prev = column-skip;
         }
+    }
 
+    //--------------------------------------------------------------------------
+    // @brief コスト計算で読む行の範囲
+    //   粘性の計算で skip 離れた上の行の参照画像を読む
+    //--------------------------------------------------------------------------
+    virtual void referredRows(int column, int skip, int& first, int& last)
+    {
+        first = parallelFirstLevel && skip>=firstSkip ? column : column - skip;
+        last  = column;
+    }
 
-        // 上の列の対応付けの結果から大きく離れる(gが大きい)ほど exp() は小さくなる
-        // 結果 1-exp() コストは, 大きくなる.
-
-        double g = gluey;
-
-        // 隣接するピクセルとの勾配が、レーザーとステレオで差(f)が大きいほど exp() は小さくなる
-        // 結果 1-exp() コストは, 大きくなる.
-        double f = std::abs(cA-cB);
-
+    //--------------------------------------------------------------------------
+    // @brief 行のハッシュ (コストを計算する 1 チャンネルの画像の行)
+    //--------------------------------------------------------------------------
+    virtual uint64_t rowHash(int row)
+    {
+        if(inputSource16) return planeRowHash(*inputSource16, *referSource16, row);
+        if(inputSource)   return planeRowHash(*inputSource, *referSource, row);
+        return planeRowHash(inputPlane, referPlane, row);
+    }
 
-        return (1.0 - std::exp(-f*f/sig)) + (1.0 - std::exp(-g*g/sig2));
+    template<class T>
+    static uint64_t planeRowHash(const mi::Plane<T>& input, const mi::Plane<T>& refer, int row)
+    {
+        uint64_t hash = hashBytes(14695981039346656037ULL, input.Row(row), input.Width() * sizeof(T));
+        return hashBytes(hash, refer.Row(row), refer.Width() * sizeof(T));
     }
 
     //--------------------------------------------------------------------------
-    // @brief 縦・横・斜, それぞれのパスに設定するコスト
-    // @param x      DPテーブルX方向の系列の位置
-    // @param y      DPテーブルY方向の系列の位置
-    // @param column DPする走査線の位置
-    // @param cost   CalcCost() で計算されたコスト
+    // @brief 現在のパラメータでコストのポリシーを作る
     //--------------------------------------------------------------------------
-    virtual double verticalCost(int x, int y, int column, double cost)
+    inline FusionCostPolicy<> fusionCostPolicy()
     {
-        double bias = (x-y)/X;
-        return cost + bias*bias;
+        return fusionCostPolicy(inputSource ? *inputSource : inputPlane,
+                                referSource ? *referSource : referPlane);
     }
 
-    virtual double horizontalCost(int x, int y, int column, double cost)
+    template<class T>
+    inline FusionCostPolicy<T> fusionCostPolicy(const mi::Plane<T>& input, const mi::Plane<T>& refer)
     {
-        double bias = (x-y)/X;
-        return cost + bias*bias;
+        return FusionCostPolicy<T>(input, refer, matchPatterns, nScanlines, length,
+                                   parallelFirstLevel ? firstSkip : 0, CostSigmaC, CostSigmaG);
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief DPM に渡す大きさだけの画像 (画素は plane から読む)
+    //--------------------------------------------------------------------------
+    template<class T>
+    static mi::ImageView planeView(const mi::Plane<T>& plane)
+    {
+        return mi::ImageView(nullptr, plane.Width(), plane.Height(), plane.Width());
     }
+
+    // 1 チャンネルの画像で渡された入力 (RGB の画像で渡された場合は nullptr)
+    const mi::Plane8* inputSource = nullptr;
+    const mi::Plane8* referSource = nullptr;
+
+    // 16bit の深度画像で渡された入力
+    const mi::Plane16* inputSource16 = nullptr;
+    const mi::Plane16* referSource16 = nullptr;
+
+    // RGB の画像から取り出した R チャンネル
+    mi::Plane8 inputPlane;
+    mi::Plane8 referPlane;
+
+    // 前の dp() の parallelFirstLevel (変われば前の結果は使えない)
+    bool previousParallelFirstLevel = false;
 };
 
 
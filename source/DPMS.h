@@ -6,7 +6,148 @@
 #ifndef _DPMS_H_
 #define _DPMS_H_
 
+#include <cstdlib>
+#include <memory>
+
 #include "DPM.h"
+#include "SGMatcher.h"
+#include "miImage/miPlane.h"
+
+//------------------------------------------------------------------------------
+//
+// ステレオマッチングのコスト
+//
+//  対象画素と, エッジが続く上下の画素の色の距離の平均
+//------------------------------------------------------------------------------
+struct StereoCostPolicy : DPCostPolicy<StereoCostPolicy>
+{
+    mi::ImageView input;
+    mi::ImageView refer;
+
+    // 上下に参照する画素数 (DPMS::edgeRun() で計算する)
+    const int* edgeUp;
+    const int* edgeDown;
+
+    // 色の距離の 2 乗からノルムを引く表 (NormTable())
+    const double* norms;
+
+    StereoCostPolicy(const mi::ImageView& input, const mi::ImageView& refer,
+                     const int* edgeUp, const int* edgeDown)
+        : input(input), refer(refer), edgeUp(edgeUp), edgeDown(edgeDown), norms(NormTable())
+    {
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief コスト計算
+    //--------------------------------------------------------------------------
+    double Cost(int x, int y, int column, int skip)
+    {
+        double cost;
+        CostRow(y, column, skip, x, x, &cost);
+        return cost;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 1行分のコスト計算
+    //--------------------------------------------------------------------------
+    void CostRow(int y, int column, int skip, int sx, int ex, double* out)
+    {
+        const int inputWidth = input.Width();
+        const int inputStride= input.Stride();
+        const int referStride= refer.Stride();
+
+        const mi::RGB* inputPixel = input.Row(column);
+        const mi::RGB* referPixel = refer.Row(column) + y;
+
+        const int* up   = edgeUp   + column*inputWidth;
+        const int* down = edgeDown + column*inputWidth;
+
+        for(int x=sx; x<=ex; x++)
+        {
+            // 対象画素
+            double _d = norm(inputPixel[x], *referPixel);
+
+            // 下方向
+            for(int i=1; i<=down[x]; i++)
+            {
+                _d += norm(inputPixel[x + i*inputStride], referPixel[i*referStride]);
+            }
+
+            // 上方向
+            for(int i=1; i<=up[x]; i++)
+            {
+                _d += norm(inputPixel[x - i*inputStride], referPixel[-i*referStride]);
+            }
+
+            // 局所距離 d
+            out[x-sx] = _d / (1 + down[x] + up[x]);
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief ノルムの計算
+    //--------------------------------------------------------------------------
+    static inline double Norm(const mi::RGB& inputPixel, const mi::RGB& referPixel)
+    {
+        return NormTable()[SquaredDistance(inputPixel, referPixel)];
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 色の距離の 2 乗 (0 ～ 3*255*255)
+    //--------------------------------------------------------------------------
+    static inline int SquaredDistance(const mi::RGB& inputPixel, const mi::RGB& referPixel)
+    {
+        int r = inputPixel.r-referPixel.r;
+        int g = inputPixel.g-referPixel.g;
+        int b = inputPixel.b-referPixel.b;
+        return r*r+g*g+b*b;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 色の距離の 2 乗 k のノルム sqrt(k) / 255 の表
+    //   k は整数なので, 毎回 sqrt() と割り算をするのと同じ値になる
+    //--------------------------------------------------------------------------
+    static const double* NormTable()
+    {
+        static const std::vector<double> table = []{
+            std::vector<double> t(3*255*255 + 1);
+            for(size_t k=0; k<t.size(); k++)
+            {
+                t[k] = sqrt((double)k) / 255.0;
+            }
+            return t;
+        }();
+        return table.data();
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief ノルムの計算 (表をメンバに持っておく)
+    //--------------------------------------------------------------------------
+    inline double norm(const mi::RGB& inputPixel, const mi::RGB& referPixel) const
+    {
+        return norms[SquaredDistance(inputPixel, referPixel)];
+    }
+};
+
+
+//------------------------------------------------------------------------------
+//
+// ステレオマッチングのパスの偏り
+//
+//  斜 (対応する) パスのコストを weight * cost^2 にする
+//------------------------------------------------------------------------------
+struct StereoBiasPolicy : DPBiasPolicy<StereoBiasPolicy>
+{
+    double weight;
+
+    StereoBiasPolicy(double weight) : weight(weight) {}
+
+    double Diagonal(int x, int y, int column, double cost)
+    {
+        return weight * cost * cost;
+    }
+};
+
 
 //------------------------------------------------------------------------------
 //
@@ -17,16 +158,31 @@ class DPMS : public DPM
 {
 public:
 
+    // ピラミッド (視差の範囲が広くても計算量を抑える)
+    //   pyramidLevels が 1 以上なら, 縦横を 1/2 に面積平均で縮小した画像で
+    //   (pyramidLevels-1 段のピラミッドを使って) 先に DP し, その結果を拡大した視差 ± pyramidMargin の
+    //   通路だけを探索する. 結果は全範囲の探索と変わりうる
+    int pyramidLevels = 0;
+    int pyramidMargin = 3;
+
+    // Semi-Global Matching のパラメタ (sgm() で使う)
+    SemiGlobalMatcher semiGlobal;
+
     //--------------------------------------------------------------------------
     // @brief コンストラクタ
-    // @param input     主画像(左カメラを想定)
+    // @param input     主画像(左カメラを想定. 部分画像でもよい)
     // @param reference 副画像(右カメラを想定)
     // @param threads   スレッド数
     //--------------------------------------------------------------------------
-    DPMS(mi::Image& input, mi::Image& reference,
+    DPMS(const mi::ImageView& input, const mi::ImageView& reference,
          int threads = std::thread::hardware_concurrency())
-        : DPM(input, reference, threads),
-          edge(input.Bit(), input.Width(), input.Height())
+        : DPM(input, reference, threads)
+    {
+    }
+
+    // スレッドプールを共有する (StereoBatch のように複数の画像の組を並行に処理する場合)
+    DPMS(const mi::ImageView& input, const mi::ImageView& reference, ThreadPool& threadPool)
+        : DPM(input, reference, threadPool)
     {
     }
 
@@ -41,34 +197,150 @@ public:
     //--------------------------------------------------------------------------
     virtual void dp(int skip, double weight, int rowRange, int threshold, int maxDisparity)
     {
+        // コストのパラメータが変わったら前の結果は使えない
+        if(weight!=this->weight)
+        {
+            invalidateTemporal();
+        }
+
         this->weight = weight;
-        this->rowRange = rowRange;
-        this->threshold = threshold;
 
         // 最大視差設定
         leftRange = maxDisparity;
         rightRange= 0;
 
+        prepareCost(rowRange, threshold);
+
+        // 粗い段の結果から探索する通路を決める
+        if(pyramidLevels > 0 && input.Width() >= MinPyramidSize*2 && input.Height() >= MinPyramidSize*2)
+        {
+            matchCoarse(skip, maxDisparity);
+        }
+        else
+        {
+            clearCorridor();
+        }
+
+        DPM::dp(skip);
+
+        return;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 複数方向のパスでコストを集約して対応付けをおこなう (Semi-Global Matching)
+    //   dp() と同じコスト (エッジが続く上下の画素の色の距離の平均) で,
+    //   semiGlobal.paths 方向に集約する. 走査線の飛び越しはせず, 全ての画素を並列に計算する
+    // @param rowRange     コスト計算時に参照する上下の画素数
+    // @param threshold    コスト計算時に上下の画素の参照を打ち切る閾値
+    // @param maxDisparity 想定する最大の視差
+    //--------------------------------------------------------------------------
+    void sgm(int rowRange, int threshold, int maxDisparity)
+    {
+        leftRange = maxDisparity;
+        rightRange= 0;
+
+        prepareCost(rowRange, threshold);
+
+        semiGlobal.Matching(threadPool, stereoCostPolicy(), X, Y, nScanlines,
+                            leftRange, rightRange, matchPatterns);
+
+        // DP の結果ではないので, 次の dp() では使わない
+        invalidateTemporal();
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 直前の dp() / sgm() の結果から視差 (対応点までの画素数) の画像を作る
+    // @param disparity 書き込み先 (同じ大きさなら確保し直さない)
+    //--------------------------------------------------------------------------
+    void getDisparity(mi::Plane16& disparity)
+    {
+        disparity.Initialize(X, nScanlines);
+
+        for(int iY=0; iY<nScanlines; iY++)
+        {
+            const std::vector<int>& match = matchPatterns[iY];
+            uint16_t* row = disparity.Row(iY);
+
+            for(int iX=0; iX<X; iX++)
+            {
+                row[iX] = (uint16_t)std::abs(match[iX] - iX);
+            }
+        }
+    }
+
+protected:
+
+    //--------------------------------------------------------------------------
+    // @brief コスト計算の準備 (エッジ抽出と上下に参照する画素数)
+    // @param rowRange  コスト計算時に参照する上下の画素数
+    // @param threshold コスト計算時に上下の画素の参照を打ち切る閾値
+    //--------------------------------------------------------------------------
+    void prepareCost(int rowRange, int threshold)
+    {
+        DP_PROFILE_SCOPE(Prepare);
+
+        // コストのパラメータが変わったら前の結果は使えない
+        if(rowRange!=this->rowRange || threshold!=this->threshold)
+        {
+            invalidateTemporal();
+        }
+
+        this->rowRange = rowRange;
+        this->threshold = threshold;
+
         // エッジ抽出
-        edge = input;
+        // sobel() が書き込まない端の画素は入力の G 要素のままにする (前のフレームの領域を使い回す)
+        mi::ExtractChannel(input, 1, edge);
 
         int nThreads = threadPool.GetNumThread();
         int length   = input.Height() / nThreads;
 
+        // プールを共有する他の DPM のタスクは待たない
+        TaskLatch latch;
+
         for(int i=0; i<nThreads; i++) {
-            threadPool.Request([&,i,length](int id){ sobel(i*length, length);});
+            threadPool.Request(latch, [&,i,length](int id){ sobel(i*length, length);});
         }
 
-        threadPool.Join();
+        latch.Wait();
 
-        DPM::dp(skip);
+        // 上下に参照する画素数を求める
+        edgeUp.resize(input.Size());
+        edgeDown.resize(input.Size());
 
-        threadPool.Join();
+        int width = (input.Width() + nThreads - 1) / nThreads;
 
-        return;
+        for(int i=0; i<nThreads; i++) {
+            threadPool.Request(latch, [&,i,width](int id){ edgeRun(i*width, width);});
+        }
+
+        latch.Wait();
     }
 
-protected:
+    //--------------------------------------------------------------------------
+    // @brief マッチングしてパターンを格納
+    //   StereoCostPolicy, StereoBiasPolicy を展開した DPMatcher で計算する
+    //--------------------------------------------------------------------------
+    virtual void matching(int sx, int sy, int ex, int ey, int column, int skip, int id,
+                          std::vector<int>& matchPattern)
+    {
+        StereoCostPolicy costPolicy = stereoCostPolicy();
+        StereoBiasPolicy biasPolicy(weight);
+
+        int left, right;
+        searchRange(column, left, right);
+
+        DPCorridor corridor;
+        DPSubpixel subpixel;
+
+        DPMatcher<StereoCostPolicy, StereoBiasPolicy, Cost>
+            matcher(costPolicy, biasPolicy, left, right);
+
+        matcher.Matching(nodes[id], costRows[id].data(),
+                         sx, sy, ex, ey, column, skip, matchPattern,
+                         searchCorridor(column, corridor),
+                         searchSubpixel(column, id, matchPattern, subpixel));
+    }
 
     //--------------------------------------------------------------------------
     // @brief コスト計算
@@ -79,28 +351,7 @@ protected:
     //--------------------------------------------------------------------------
     virtual double calcCost(int x, int y, int column, int skip)
     {
-        // 画素数
-        int count = 1;
-
-        // 対象画素
-        double _d = norm(x, y, column);
-
-        // 下方向
-        for(int i=1; column+i<nScanlines && edge.pixel[x][column+i].g && i<rowRange; i++)
-        {
-            _d += norm(x, y, column+i);
-            count++;
-        }
-
-        // 上方向
-        for(int i=1; column-i>=0 && edge.pixel[x][column-i].g && i<rowRange; i++)
-        {
-            _d += norm(x, y, column-i);
-            count++;
-        }
-
-        // 局所距離 d
-        return _d/count;
+        return stereoCostPolicy().Cost(x, y, column, skip);
     }
 
     //--------------------------------------------------------------------------
@@ -112,45 +363,80 @@ protected:
     //--------------------------------------------------------------------------
     virtual double diagonalCost(int x, int y, int column, double cost)
     {
-        return weight * cost * cost;
+        return StereoBiasPolicy(weight).Diagonal(x, y, column, cost);
     }
 
     //--------------------------------------------------------------------------
-    // @brief ノルムの計算
+    // @brief コスト計算で読む行の範囲
+    //   上下に rowRange-1 画素まで, そのエッジの判定にさらに上下 1 画素を読む
+    //--------------------------------------------------------------------------
+    virtual void referredRows(int column, int skip, int& first, int& last)
+    {
+        first = column - rowRange;
+        last  = column + rowRange;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 縮小した画像でマッチングして通路を決める
+    //   粗い段の DPMS と縮小画像は次の dp() でも使い回す (スレッドプールはこの DPMS と共有する)
+    //--------------------------------------------------------------------------
+    void matchCoarse(int skip, int maxDisparity)
+    {
+        mi::Resize(input, coarseInput, (input.Width()+1)/2, (input.Height()+1)/2);
+        mi::Resize(refer, coarseRefer, (refer.Width()+1)/2, (refer.Height()+1)/2);
+
+        if(!coarse)
+        {
+            coarse.reset(new DPMS(coarseInput, coarseRefer, threadPool));
+        }
+        else
+        {
+            coarse->setImages(coarseInput, coarseRefer);
+        }
+
+        coarse->pyramidLevels  = pyramidLevels - 1;
+        coarse->pyramidMargin  = pyramidMargin;
+        coarse->temporal       = temporal;
+        coarse->temporalMargin = temporalMargin;
+
+        coarse->dp(std::max(1, skip/2), weight, rowRange, threshold, (maxDisparity+1)/2);
+
+        setCorridor(*coarse, pyramidMargin);
+    }
+
     //--------------------------------------------------------------------------
-    inline double norm(int x, int y, int column)
+    // @brief 現在のパラメータでコストのポリシーを作る
+    //--------------------------------------------------------------------------
+    inline StereoCostPolicy stereoCostPolicy()
     {
-        const mi::RGB& inputPixel = input.pixel[x][column];
-        const mi::RGB& referPixel = refer.pixel[y][column];
-        double r = inputPixel.r-referPixel.r;
-        double g = inputPixel.g-referPixel.g;
-        double b = inputPixel.b-referPixel.b;
-        return sqrt(r*r+g*g+b*b) / 255.0;
+        return StereoCostPolicy(input, refer, edgeUp.data(), edgeDown.data());
     }
 
     //--------------------------------------------------------------------------
-    // @brief エッジ抽出  G要素には閾値より大きければ 1 が入る
+    // @brief エッジ抽出  閾値より大きければ 1 が入る
     //--------------------------------------------------------------------------
     inline void sobel(int start, int length)
     {
+        DP_PROFILE_SCOPE(Sobel);
+
         const int w = input.Width() - 1;
         const int h = input.Height()- 1;
 
-        if(start==0) start = 1;
+        if(start==0) { start = 1; length--; }
         if(start+length>h-1) length = h - 1 - start;
 
         for(int iY=start; iY<start+length; iY++) {
             for(int iX=1; iX<w-1; iX++){
 
-                const mi::RGB& rt = input.pixel[iX+1][iY-1]; // right top
-                const mi::RGB& lt = input.pixel[iX-1][iY-1]; // left top
-                const mi::RGB& rb = input.pixel[iX+1][iY+1]; // right bottom
-                const mi::RGB& lb = input.pixel[iX-1][iY+1]; // left bottom
+                const mi::RGB& rt = input(iX+1, iY-1); // right top
+                const mi::RGB& lt = input(iX-1, iY-1); // left top
+                const mi::RGB& rb = input(iX+1, iY+1); // right bottom
+                const mi::RGB& lb = input(iX-1, iY+1); // left bottom
 
-                const mi::RGB& rm = input.pixel[iX+1][iY]; // right middle
-                const mi::RGB& lm = input.pixel[iX-1][iY]; // left middle
-                const mi::RGB& ct = input.pixel[iX][iY-1]; // center top
-                const mi::RGB& cb = input.pixel[iX][iY+1]; // center bottom
+                const mi::RGB& rm = input(iX+1, iY); // right middle
+                const mi::RGB& lm = input(iX-1, iY); // left middle
+                const mi::RGB& ct = input(iX, iY-1); // center top
+                const mi::RGB& cb = input(iX, iY+1); // center bottom
 
                 int pxr = (rt.r - lt.r) + (rb.r - lb.r) + 2 * (rm.r - lm.r);
                 int pxg = (rt.g - lt.g) + (rb.g - lb.g) + 2 * (rm.g - lm.g);
@@ -162,19 +448,62 @@ protected:
 
                 int k = (pxr*pxr+pyr*pyr + pxg*pxg+pyg*pyg + pxb*pxb+pyb*pyb)/9;
 
-                edge.pixel[iX][iY].r = (unsigned char)std::min(sqrt(k), 255.0);
-                edge.pixel[iX][iY].g = edge.pixel[iX][iY].r > threshold ? 1 : 0;
+                unsigned char magnitude = (unsigned char)std::min(sqrt(k), 255.0);
+                edge(iX, iY) = magnitude > threshold ? 1 : 0;
             }
         }
     }
 
-    // パラメータ
-    double weight;
-    int rowRange;
-    int threshold;
+    //--------------------------------------------------------------------------
+    // @brief コスト計算時に上下に参照する画素数を求める
+    //
+    //   calcCost() と同じくエッジの画素が続く間, rowRange-1 画素まで参照する
+    //--------------------------------------------------------------------------
+    inline void edgeRun(int start, int length)
+    {
+        DP_PROFILE_SCOPE(EdgeRun);
+
+        const int w = input.Width();
+        const int h = input.Height();
+        const int maxRun = std::max(0, rowRange - 1);
+
+        int end = std::min(start+length, w);
+
+        for(int iX=start; iX<end; iX++) {
+
+            // 上方向
+            edgeUp[iX] = 0;
+            for(int iY=1; iY<h; iY++) {
+                int i = iX + iY*w;
+                edgeUp[i] = edge(iX, iY-1) ? std::min(edgeUp[i-w]+1, maxRun) : 0;
+            }
 
-    // エッジ画像
-    mi::Image edge;
+            // 下方向
+            edgeDown[iX + (h-1)*w] = 0;
+            for(int iY=h-2; iY>=0; iY--) {
+                int i = iX + iY*w;
+                edgeDown[i] = edge(iX, iY+1) ? std::min(edgeDown[i+w]+1, maxRun) : 0;
+            }
+        }
+    }
+
+    // パラメータ
+    double weight = 0;
+    int rowRange  = 0;
+    int threshold = 0;
+
+    // エッジ画像 (エッジなら 0 以外)
+    mi::Plane8 edge;
+
+    // コスト計算時に上下に参照する画素数
+    std::vector<int> edgeUp;
+    std::vector<int> edgeDown;
+
+    // ピラミッドの粗い段 (縮小した画像とそのマッチング)
+    static const int MinPyramidSize = 16;
+    mi::Image coarseInput;
+    mi::Image coarseRefer;
+    std::unique_ptr<DPMS> coarse;
 };
 
 
@@ -0,0 +1,415 @@
+﻿//==============================================================================
+//
+// DP Matcher
+//
+//  コスト計算をテンプレート引数 (ポリシー) で与える DPマッチングの本体
+//
+//==============================================================================
+#ifndef _DP_MATCHER_H_
+#define _DP_MATCHER_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "DPNodeTable.h"
+#include "DPKernel.h"
+#include "DPProfile.h"
+
+//------------------------------------------------------------------------------
+//
+// コストのポリシー
+//
+//  このクラスを CRTP で継承して Cost() を実装する.
+//  1行分をまとめて計算できる場合は CostRow() も実装すること.
+//------------------------------------------------------------------------------
+template<class Derived>
+struct DPCostPolicy
+{
+    //--------------------------------------------------------------------------
+    // @brief 1行分のコスト計算
+    // @param y      DPテーブルY方向の系列の位置
+    // @param column DPする走査線の位置
+    // @param skip   マッチング済みの走査線までの距離
+    // @param sx     DPテーブルX方向の開始位置
+    // @param ex     DPテーブルX方向の終了位置
+    // @param out    コストの書き込み先 (out[x-sx])
+    //--------------------------------------------------------------------------
+    void CostRow(int y, int column, int skip, int sx, int ex, double* out)
+    {
+        Derived& self = static_cast<Derived&>(*this);
+
+        for(int x=sx; x<=ex; x++)
+        {
+            out[x-sx] = self.Cost(x, y, column, skip);
+        }
+    }
+};
+
+
+//------------------------------------------------------------------------------
+//
+// パスの偏りのポリシー
+//
+//  このクラスを CRTP で継承して Vertical(), Horizontal(), Diagonal() のうち
+//  必要なものを実装する.
+//------------------------------------------------------------------------------
+template<class Derived>
+struct DPBiasPolicy
+{
+    //--------------------------------------------------------------------------
+    // @brief 縦・横・斜, それぞれのパスに設定するコスト
+    // @param x      DPテーブルX方向の系列の位置
+    // @param y      DPテーブルY方向の系列の位置
+    // @param column DPする走査線の位置
+    // @param cost   CostRow() で計算されたコスト
+    //--------------------------------------------------------------------------
+    double Vertical(int x, int y, int column, double cost)  { return cost; }
+    double Horizontal(int x, int y, int column, double cost){ return cost; }
+    double Diagonal(int x, int y, int column, double cost)  { return cost; }
+
+    //--------------------------------------------------------------------------
+    // @brief 1行分の縦・横・斜, それぞれのパスに設定するコスト
+    // @param y      DPテーブルY方向の系列の位置
+    // @param column DPする走査線の位置
+    // @param sx     DPテーブルX方向の開始位置
+    // @param ex     DPテーブルX方向の終了位置
+    // @param cost   CostRow() で計算されたコスト
+    // @param v,h,d  縦・横・斜のパスのコストの書き込み先 (v[x-sx])
+    //--------------------------------------------------------------------------
+    template<typename T>
+    void PathCostRow(int y, int column, int sx, int ex, const double* cost, T* v, T* h, T* d)
+    {
+        Derived& self = static_cast<Derived&>(*this);
+
+        for(int x=sx; x<=ex; x++)
+        {
+            double c = cost[x-sx];
+            v[x-sx] = DPCost<T>::FromDouble(self.Vertical(x, y, column, c));
+            h[x-sx] = DPCost<T>::FromDouble(self.Horizontal(x, y, column, c));
+            d[x-sx] = DPCost<T>::FromDouble(self.Diagonal(x, y, column, c));
+        }
+    }
+};
+
+
+//------------------------------------------------------------------------------
+//
+// 探索する通路
+//
+//  探索範囲の帯の中で, さらに探索するノードを絞る (ピラミッドの粗い段の結果の周りなど).
+//  X ごとの Y の範囲 [lower, upper] と, Y ごとの X の範囲 [first, last] を持つ.
+//  lower, upper は単調非減少で lower[x+1] <= upper[x]+1 (隣の X と斜めのパスでつながる),
+//  帯の中に収まっていること (DPM::prepareCorridor() で作る)
+//------------------------------------------------------------------------------
+struct DPCorridor
+{
+    const int* lower;
+    const int* upper;
+    const int* first;
+    const int* last;
+};
+
+
+//------------------------------------------------------------------------------
+//
+// サブピクセルの視差の書き込み先
+//
+//  Backtrace で matchPattern と同じ位置 (disparity[x]) に書き込む.
+//  視差は x - (対応点の Y 座標) で, 対応点の斜めのパスのコストと Y の前後のノードのコストに
+//  放物線を当てはめて ±0.5 の範囲で補正する.
+//  信頼度は前後のノードのコストの小さい方と対応点のコストの差 (負なら 0).
+//  前後のノードが探索範囲の外なら, 補正せずに探索範囲の中のノードだけで信頼度を求める
+//------------------------------------------------------------------------------
+struct DPSubpixel
+{
+    float* disparity;   // 視差 (nullptr なら書き込まない)
+    float* confidence;  // 信頼度 (nullptr なら書き込まない)
+};
+
+
+//------------------------------------------------------------------------------
+//
+// DP Matcher
+//
+//  CostPolicy : DPCostPolicy を継承したコストのポリシー
+//  BiasPolicy : DPBiasPolicy を継承したパスの偏りのポリシー
+//  T          : コストの型
+//------------------------------------------------------------------------------
+template<class CostPolicy, class BiasPolicy, typename T = double>
+class DPMatcher
+{
+public:
+
+    typedef T Cost;
+    typedef DPNodeTable<T> NodeTable;
+    typedef DPCost<T> CostOp;
+
+    //--------------------------------------------------------------------------
+    // @brief コンストラクタ
+    // @param costPolicy コストのポリシー
+    // @param biasPolicy パスの偏りのポリシー
+    // @param leftRange  対応点の探索範囲左限界までの画素数
+    // @param rightRange 対応点の探索範囲右限界までの画素数
+    //--------------------------------------------------------------------------
+    DPMatcher(CostPolicy& costPolicy, BiasPolicy& biasPolicy, int leftRange, int rightRange)
+        : costPolicy(costPolicy)
+        , biasPolicy(biasPolicy)
+        , leftRange(leftRange)
+        , rightRange(rightRange)
+    {
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief マッチングしてパターンを格納
+    // @param node         DPテーブル
+    // @param costRow      1行分のコストの作業領域 (DPテーブルの幅)
+    // @param sx           DPテーブルの始点 X 座標
+    // @param sy           DPテーブルの始点 Y 座標
+    // @param ex           DPテーブルの終点 X 座標
+    // @param ey           DPテーブルの終点 Y 座標
+    // @param column       DPする走査線の位置
+    // @param skip         飛び越した量(マッチング済みの走査線までの距離)
+    // @param matchPattern マッチング結果の格納先
+    // @param corridor     探索する通路 (nullptr なら帯全体. 始点と終点は通路の中に移す)
+    // @param subpixel     サブピクセルの視差と信頼度の書き込み先 (nullptr なら書き込まない)
+    //--------------------------------------------------------------------------
+    void Matching(NodeTable& node, double* costRow,
+                  int sx, int sy, int ex, int ey, int column, int skip,
+                  std::vector<int>& matchPattern, const DPCorridor* corridor = nullptr,
+                  const DPSubpixel* subpixel = nullptr)
+    {
+        // 右側を探索しない場合 (ステレオ) は専用の実装を使う
+        if(rightRange == 0)
+        {
+            matching<true>(node, costRow, sx, sy, ex, ey, column, skip, matchPattern, corridor, subpixel);
+        }
+        else
+        {
+            matching<false>(node, costRow, sx, sy, ex, ey, column, skip, matchPattern, corridor, subpixel);
+        }
+    }
+
+private:
+
+    CostPolicy& costPolicy;
+    BiasPolicy& biasPolicy;
+
+    int leftRange;
+    int rightRange;
+
+    //--------------------------------------------------------------------------
+    // @brief マッチングしてパターンを格納
+    //   NoRight : rightRange が 0 であることがコンパイル時にわかっている
+    //--------------------------------------------------------------------------
+    template<bool NoRight>
+    void matching(NodeTable& node, double* costRow,
+                  int sx, int sy, int ex, int ey, int column, int skip,
+                  std::vector<int>& matchPattern, const DPCorridor* corridor,
+                  const DPSubpixel* subpixel)
+    {
+        const int left = leftRange;
+        const int right= NoRight ? 0 : rightRange;
+
+        Cost* cost        = node.cost.data();
+        Cost* vPathCost   = node.verticalPathCost.data();
+        Cost* hPathCost   = node.horizontalPathCost.data();
+        Cost* dPathCost   = node.diagonalPathCost.data();
+        const int rowStep = node.RowStep();
+
+        // 探索範囲を考慮した値に更新
+        sy = std::min(sx+right, std::max(sx-left, sy));
+        ey = std::min(ex+right, std::max(ex-left, ey));
+
+        if(corridor)
+        {
+            sy = std::min(corridor->upper[sx], std::max(corridor->lower[sx], sy));
+            ey = std::min(corridor->upper[ex], std::max(corridor->lower[ex], ey));
+        }
+
+        // 行ごとの探索範囲 (帯と通路の重なり)
+        auto rowStart = [&](int iY) {
+            int start = std::max(sx,iY-right);
+            return corridor ? std::max(start, corridor->first[iY]) : start;
+        };
+        auto rowEnd = [&](int iY) {
+            int end = std::min(ex,iY+left);
+            return corridor ? std::min(end, corridor->last[iY]) : end;
+        };
+
+
+        // ノードの初期化 --------------------------------------------------------
+        {
+        DP_PROFILE_SCOPE(CostInit);
+
+        for(int iY=sy; iY<=ey; iY++)
+        {
+            int start = rowStart(iY);
+            int end   = rowEnd(iY);
+
+            if(start > end) continue;
+
+            int i = node.Index(start, iY);
+            DP_PROFILE_COUNT(CellsEvaluated, end-start+1);
+
+            // コスト計算
+            costPolicy.CostRow(iY, column, skip, start, end, costRow);
+
+            biasPolicy.PathCostRow(iY, column, start, end, costRow,
+                                   vPathCost+i, hPathCost+i, dPathCost+i);
+        }
+
+        // 探索範囲のすぐ外側のノードは到達できないノードとする
+        // (テーブルより狭い範囲で探索すると, 他の走査線で計算した値が残っている)
+        for(int iY=sy; iY<=ey; iY++)
+        {
+            int start = std::max(sx+1,rowStart(iY));
+            int end   = rowEnd(iY);
+
+            if(start-1 > sx && start-1 <= ex) cost[node.Index(start-1, iY)] = NodeTable::MaxCost();
+            if(end+1 > sx && end+1 <= ex)     cost[node.Index(end+1, iY)]   = NodeTable::MaxCost();
+
+            // 通路は次の行で右に 2 つ以上広がることがあるので, 次の行から読む分も埋める
+            if(corridor && iY < ey)
+            {
+                int next = std::min({rowEnd(iY+1), ex, iY+left+1});
+                for(int iX=std::max(end+2, sx+1); iX<=next; iX++)
+                {
+                    cost[node.Index(iX, iY)] = NodeTable::MaxCost();
+                }
+            }
+        }
+        }
+
+        // DPM による最短経路探索 -------------------------------------------------
+        {
+        DP_PROFILE_SCOPE(Relax);
+
+        // 始点の計算
+        cost[node.Index(sx,sy)] = 0;
+
+        // 下端の計算
+        for(int iX=sx+1; iX<=rowEnd(sy); iX++)
+        {
+            int i = node.Index(iX, sy);
+            cost[i] = CostOp::Add(hPathCost[i], cost[i-1]);
+            node.SetPathDir(i, NodeTable::HORIZONTAL);
+        }
+
+        // 左端の計算
+        //   通路では始点から縦に進めないと次の列の通路に届かないことがある
+        int top = std::max(sy, std::min(ey,right));
+        if(corridor) top = std::max(sy, std::min({ey, sx+right, corridor->upper[sx]}));
+
+        for(int iY=sy+1; iY<=top; iY++)
+        {
+            int i = node.Index(sx, iY);
+            cost[i] = CostOp::Add(vPathCost[i], cost[i-rowStep]);
+            node.SetPathDir(i, NodeTable::VERTICAL);
+        }
+
+        // 左端の残りは到達できないノードとする
+        // (前に同じテーブルで計算した値を読むと, 実行したスレッドで結果が変わる)
+        for(int iY=top+1; iY<=std::min(ey,sx+right); iY++)
+        {
+            int i = node.Index(sx, iY);
+            cost[i] = NodeTable::MaxCost();
+            node.SetPathDir(i, NodeTable::NONE);
+        }
+
+        // 経路探索
+        for(int iY=sy+1; iY<=ey; iY++)
+        {
+            int start = std::max(sx+1,rowStart(iY));
+            int end   = rowEnd(iY);
+
+            if(start > end) continue;
+
+            DPKernel<Cost>::RelaxRow(node, node.Index(start,iY), end-start+1, node.RowBuffer());
+        }
+        }
+
+
+        // Backtrace -----------------------------------------------------------
+        DP_PROFILE_SCOPE(Backtrace);
+
+        int iX = ex;
+        int iY = ey;
+
+        // 今回コストを計算したノードか
+        auto evaluated = [&](int x, int y) {
+            return y >= sy && y <= ey && x >= rowStart(y) && x <= rowEnd(y);
+        };
+
+        while( iX>sx || iY>sy )
+        {
+            matchPattern[iX] = iY;
+
+            // 縦のパスで同じ X を続けて通る場合も matchPattern と同じく最後に通ったノードの値が残る
+            if(subpixel)
+            {
+                refine(node, dPathCost, iX, iY, *subpixel, evaluated);
+            }
+
+            // 帯の外側のノードは格納されていないので未選択として扱う
+            int dir = node.InBand(iX,iY) ? node.GetPathDir(node.Index(iX,iY)) : NodeTable::NONE;
+
+            switch( dir )
+            {
+                case NodeTable::VERTICAL  : iY--; break;
+                case NodeTable::HORIZONTAL: iX--; break;
+                case NodeTable::DIAGONAL  : iX--; iY--; break;
+                case NodeTable::NONE :
+                    // パスが選ばれていないノード (帯や通路の外側) は, DP の範囲の端に沿って戻る
+                    // fall through
+                default:
+                    if(iX<=sx && iY>sy) iY--;
+                    if(iY<=sy && iX>sx) iX--;
+                    break;
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 対応点 (iX, iY) のサブピクセルの視差と信頼度を書き込む
+    //   Y の前後のノードの斜めのパスのコスト (初期化で計算済み) に放物線を当てはめる
+    //--------------------------------------------------------------------------
+    template<class Evaluated>
+    void refine(const NodeTable& node, const Cost* dPathCost, int iX, int iY,
+                const DPSubpixel& subpixel, Evaluated evaluated)
+    {
+        const bool hasLower = evaluated(iX, iY-1);
+        const bool hasUpper = evaluated(iX, iY+1);
+
+        const double c0 = CostOp::ToDouble(dPathCost[node.Index(iX, iY)]);
+        const double cl = hasLower ? CostOp::ToDouble(dPathCost[node.Index(iX, iY-1)]) : 0;
+        const double cu = hasUpper ? CostOp::ToDouble(dPathCost[node.Index(iX, iY+1)]) : 0;
+
+        double offset = 0;
+
+        if(hasLower && hasUpper)
+        {
+            double curvature = cl - 2*c0 + cu;
+            if(curvature > 0)
+            {
+                offset = std::min(0.5, std::max(-0.5, (cl - cu) / (2*curvature)));
+            }
+        }
+
+        if(subpixel.disparity)
+        {
+            subpixel.disparity[iX] = (float)(iX - (iY + offset));
+        }
+
+        if(subpixel.confidence)
+        {
+            double margin = 0;
+            if(hasLower && hasUpper) margin = std::min(cl, cu) - c0;
+            else if(hasLower)        margin = cl - c0;
+            else if(hasUpper)        margin = cu - c0;
+
+            subpixel.confidence[iX] = (float)std::max(0.0, margin);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,193 @@
+﻿//==============================================================================
+//
+// DP Node Table
+//
+//  DPマッチングのノードを Structure of Arrays で格納するテーブル
+//
+//==============================================================================
+#ifndef _DP_NODE_TABLE_H_
+#define _DP_NODE_TABLE_H_
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+//------------------------------------------------------------------------------
+//
+// コストの精度ごとの演算
+//
+//  浮動小数点型はそのまま, 整数型は 2^FRACTION_BITS 倍した固定小数点として扱う.
+//  整数型の場合は加算が飽和するように MAX_COST を型の最大値の半分にしている.
+//------------------------------------------------------------------------------
+template<typename T, bool = std::is_floating_point<T>::value>
+struct DPCost
+{
+    static T Max() { return std::numeric_limits<T>::max(); }
+
+    static T FromDouble(double value) { return (T)value; }
+
+    static double ToDouble(T value) { return (double)value; }
+
+    static T Add(T a, T b) { return a + b; }
+};
+
+template<typename T>
+struct DPCost<T, false>
+{
+    static const int FRACTION_BITS = sizeof(T) >= 4 ? 10 : 4;
+
+    static T Max() { return std::numeric_limits<T>::max() / 2; }
+
+    static T FromDouble(double value)
+    {
+        double fixed = value * (1 << FRACTION_BITS) + 0.5;
+        return (T)std::max(0.0, std::min(fixed, (double)Max()));
+    }
+
+    static double ToDouble(T value) { return (double)value / (1 << FRACTION_BITS); }
+
+    static T Add(T a, T b) { return (T)std::min<T>(a + b, Max()); }
+};
+
+
+//------------------------------------------------------------------------------
+//
+// DP Node Table
+//
+//  コストごとに別の配列 (プレーン) を持ち, 選択したパスは 2bit に詰めて格納する.
+//
+//  探索範囲の帯 [y-rightRange, y+leftRange] だけを格納する.
+//  1行は帯幅の両端に番兵を1つずつ加えた長さで, 斜め方向に隣接するノードが
+//  同じ列に並ぶので Index(x,y) = y*rowStep + x + base と書ける.
+//  帯幅が画像幅以上になる場合は (幅x高さ) の全体を格納する.
+//
+//  T : コストの型 (double, float, または固定小数点として扱う整数型)
+//------------------------------------------------------------------------------
+template<typename T>
+class DPNodeTable
+{
+public:
+
+    typedef T Cost;
+
+    // 選択したパスの方向 (2bit)
+    enum PathDir : unsigned char {
+        NONE       = 0,
+        VERTICAL   = 1,
+        HORIZONTAL = 2,
+        DIAGONAL   = 3,
+    };
+
+    // 各ノードの累積コスト
+    std::vector<T> cost;
+
+    // 縦・横・斜, それぞれのパスのコスト
+    std::vector<T> verticalPathCost;
+    std::vector<T> horizontalPathCost;
+    std::vector<T> diagonalPathCost;
+
+    //--------------------------------------------------------------------------
+    // @brief 最大コスト
+    //--------------------------------------------------------------------------
+    static T MaxCost() { return DPCost<T>::Max(); }
+
+    //--------------------------------------------------------------------------
+    // @brief 探索範囲に合わせてノードを確保する
+    // @param x          DPテーブルの横の長さ
+    // @param y          DPテーブルの縦の長さ
+    // @param leftRange  探索範囲左限界までの画素数
+    // @param rightRange 探索範囲右限界までの画素数
+    //--------------------------------------------------------------------------
+    void Allocate(int x, int y, int leftRange, int rightRange)
+    {
+        X = x;
+        Y = y;
+        left = leftRange;
+        right= rightRange;
+
+        // 画像からはみ出る分は探索範囲に含めない
+        int l = std::max(0, std::min(leftRange, X-1));
+        int r = std::max(0, std::min(rightRange,Y-1));
+        int band = l + r + 1;
+
+        if(band + 2 < X)
+        {
+            rowStep = band + 1;
+            base    = r + 1;
+            size    = Y * (band + 2);
+        }
+        else
+        {
+            rowStep = X;
+            base    = 0;
+            size    = X * Y;
+        }
+
+        cost.assign(size, MaxCost());
+        verticalPathCost.assign(size, MaxCost());
+        horizontalPathCost.assign(size, MaxCost());
+        diagonalPathCost.assign(size, MaxCost());
+        pathDir.assign((size + 3) / 4, 0);
+        rowBuffer.assign(rowStep, 0);
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief DPテーブル上の座標からノードのインデックスを計算
+    //--------------------------------------------------------------------------
+    inline int Index(int x, int y) const
+    {
+        return y * rowStep + x + base;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 座標が探索範囲の帯に含まれるか
+    //--------------------------------------------------------------------------
+    inline bool InBand(int x, int y) const
+    {
+        return x >= y - right && x <= y + left;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 選択したパスの取得・設定
+    //--------------------------------------------------------------------------
+    inline PathDir GetPathDir(int i) const
+    {
+        return (PathDir)((pathDir[i>>2] >> ((i&3)*2)) & 0x3);
+    }
+
+    inline void SetPathDir(int i, PathDir dir)
+    {
+        unsigned char& packed = pathDir[i>>2];
+        int shift = (i&3)*2;
+        packed = (unsigned char)((packed & ~(0x3 << shift)) | (dir << shift));
+    }
+
+    //--------------------------------------------------------------------------
+    // Getter
+    //--------------------------------------------------------------------------
+    int RowStep()    const { return rowStep; }
+    int Size()       const { return size; }
+    int LeftRange()  const { return left; }
+    int RightRange() const { return right; }
+
+    // 1行分の作業領域
+    unsigned char* RowBuffer() { return rowBuffer.data(); }
+
+private:
+
+    // 選択したパス (1byte に 4ノード分)
+    std::vector<unsigned char> pathDir;
+
+    // 1行分の作業領域
+    std::vector<unsigned char> rowBuffer;
+
+    int X = 0, Y = 0;   // DPテーブルの横縦の長さ
+    int left  = -1;     // 確保時の leftRange
+    int right = -1;     // 確保時の rightRange
+    int rowStep = 0;    // 1行進んだときのインデックスの増分
+    int base    = 0;    // インデックスのオフセット
+    int size    = 0;    // ノード数
+};
+
+#endif
@@ -0,0 +1,329 @@
+﻿//==============================================================================
+//
+// DP Profile
+//
+//  DP マッチングの処理の時間と回数を計測する
+//
+//==============================================================================
+#ifndef _DP_PROFILE_H_
+#define _DP_PROFILE_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+//
+// 計測のマクロ
+//
+//  DP_PROFILE を定義してコンパイルしたときだけ計測する (make PROFILE=1).
+//  定義しなければマクロは空になり, 計測のコードは残らない.
+//
+//    DP_PROFILE_SCOPE(phase)           : スコープを抜けるまでの時間を phase に記録する
+//    DP_PROFILE_COUNT(counter, n)      : このスレッドの counter に n を足す
+//    DP_PROFILE_START(var)             : 時刻を var に覚える
+//    DP_PROFILE_ELAPSED(counter, var)  : DP_PROFILE_START(var) からの時間 [ns] を counter に足す
+//------------------------------------------------------------------------------
+#if defined(DP_PROFILE)
+#define DP_PROFILE_CONCAT_(a, b) a##b
+#define DP_PROFILE_CONCAT(a, b)  DP_PROFILE_CONCAT_(a, b)
+#define DP_PROFILE_SCOPE(phase)          DPProfile::Scope DP_PROFILE_CONCAT(dpProfileScope, __LINE__)(DPProfile::phase)
+#define DP_PROFILE_COUNT(counter, n)     DPProfile::Count(DPProfile::counter, (n))
+#define DP_PROFILE_START(var)            const uint64_t var = DPProfile::Now()
+#define DP_PROFILE_ELAPSED(counter, var) DPProfile::Count(DPProfile::counter, DPProfile::Now() - var)
+#else
+#define DP_PROFILE_SCOPE(phase)          ((void)0)
+#define DP_PROFILE_COUNT(counter, n)     ((void)0)
+#define DP_PROFILE_START(var)            ((void)0)
+#define DP_PROFILE_ELAPSED(counter, var) ((void)0)
+#endif
+
+
+//------------------------------------------------------------------------------
+//
+// DP Profile
+//
+//  スレッドごとにカウンタと処理 (phase) の時間を持つ. 記録はそのスレッドだけが書くのでロックしない.
+//  GetReport(), WriteChromeTrace() は計測する処理が終わってから (ThreadPool::Join() の後に) 呼ぶこと.
+//  入れ子の処理の時間は外側の処理の時間にも含まれる.
+//------------------------------------------------------------------------------
+class DPProfile
+{
+public:
+
+    // カウンタ
+    enum Counter {
+        CellsEvaluated,     // コストを計算したノード数
+        ScanlinesMatched,   // 全体を DP した走査線の数
+        ScanlinesReused,    // 前のフレームの結果を使った走査線の数
+        SkipInterpolated,   // 飛び越した走査線で補間した画素数
+        SkipMatched,        // 飛び越した走査線で DP した画素数
+        TasksQueued,        // スレッドプールに追加したタスク数
+        TasksExecuted,      // 実行したタスク数
+        TasksStolen,        // 他のスレッドのキューから盗んだタスク数
+        IdleNs,             // ワーカーがタスクを待って眠っていた時間 [ns]
+        JoinWaitNs,         // Join() で待っていた時間 [ns]
+        CounterCount
+    };
+
+    // 処理
+    enum Phase {
+        Prepare,      // DPMS: コスト計算の準備 (エッジ抽出と上下に参照する画素数)
+        Sobel,        // DPMS: エッジ抽出
+        EdgeRun,      // DPMS: 上下に参照する画素数
+        Schedule,     // 走査線のタスクの依存関係を作る
+        Scanline,     // 走査線全体の DP
+        SkipScanline, // 飛び越した走査線の補間と DP
+        CostInit,     // DPMatcher: コスト計算とノードの初期化
+        Relax,        // DPMatcher: 経路探索
+        Backtrace,    // DPMatcher: 経路の復元
+        PhaseCount
+    };
+
+    // スレッドごとの集計
+    struct ThreadReport {
+        int      thread = 0;                    // 記録した順の番号 (Chrome trace の tid)
+        uint64_t counters[CounterCount] = {};
+        uint64_t phaseNs[PhaseCount]    = {};   // 処理の合計時間 [ns]
+        uint64_t phaseCalls[PhaseCount] = {};   // 処理の回数
+        uint64_t droppedEvents = 0;             // 上限を超えて Chrome trace に書かない処理の数
+    };
+
+    // 集計
+    struct Report {
+        std::vector<ThreadReport> threads;
+        ThreadReport total;                     // 全スレッドの合計 (thread は -1)
+    };
+
+    //--------------------------------------------------------------------------
+    // @brief 計測が有効か (DP_PROFILE を定義してコンパイルしたか)
+    //--------------------------------------------------------------------------
+    static bool Enabled()
+    {
+#if defined(DP_PROFILE)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief このスレッドのカウンタに足す
+    //--------------------------------------------------------------------------
+    static void Count(Counter counter, uint64_t n)
+    {
+        local().counters[counter] += n;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 処理の時間を記録する
+    //   start, end は Now() の値
+    //--------------------------------------------------------------------------
+    static void Record(Phase phase, uint64_t start, uint64_t end)
+    {
+        Thread& t = local();
+        t.phaseNs[phase] += end - start;
+        t.phaseCalls[phase]++;
+
+        if(t.events.size() < MaxEvents) t.events.push_back({ phase, start, end });
+        else                            t.dropped++;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 時刻 [ns] (計測の起点から)
+    //--------------------------------------------------------------------------
+    static uint64_t Now()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - registry().origin).count();
+    }
+
+    //--------------------------------------------------------------------------
+    // Scope
+    //   コンストラクタからデストラクタまでの時間を記録する
+    //--------------------------------------------------------------------------
+    class Scope
+    {
+    public:
+        explicit Scope(Phase phase) : phase(phase), start(Now()) {}
+        ~Scope() { Record(phase, start, Now()); }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Phase    phase;
+        uint64_t start;
+    };
+
+    //--------------------------------------------------------------------------
+    // @brief 全スレッドの記録を消す
+    //--------------------------------------------------------------------------
+    static void Reset()
+    {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+
+        for(auto& t : r.threads)
+        {
+            std::fill(t->counters, t->counters + CounterCount, 0);
+            std::fill(t->phaseNs,  t->phaseNs  + PhaseCount,   0);
+            std::fill(t->phaseCalls, t->phaseCalls + PhaseCount, 0);
+            t->events.clear();
+            t->dropped = 0;
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 集計を返す
+    //--------------------------------------------------------------------------
+    static Report GetReport()
+    {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+
+        Report report;
+        report.total.thread = -1;
+
+        for(int i=0; i<(int)r.threads.size(); i++)
+        {
+            const Thread& t = *r.threads[i];
+
+            ThreadReport thread;
+            thread.thread = i;
+
+            for(int k=0; k<CounterCount; k++)
+            {
+                thread.counters[k] = t.counters[k];
+                report.total.counters[k] += t.counters[k];
+            }
+            for(int k=0; k<PhaseCount; k++)
+            {
+                thread.phaseNs[k]    = t.phaseNs[k];
+                thread.phaseCalls[k] = t.phaseCalls[k];
+                report.total.phaseNs[k]    += t.phaseNs[k];
+                report.total.phaseCalls[k] += t.phaseCalls[k];
+            }
+            thread.droppedEvents = t.dropped;
+            report.total.droppedEvents += t.dropped;
+            report.threads.push_back(thread);
+        }
+        return report;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief Chrome trace (chrome://tracing, Perfetto) の JSON を書き出す
+    //   処理は "X" イベント, カウンタの合計と書かなかったイベントの数は otherData に書く
+    //--------------------------------------------------------------------------
+    static void WriteChromeTrace(std::ostream& os)
+    {
+        Report report = GetReport();
+
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+
+        os << "{\"traceEvents\":[\n";
+
+        bool first = true;
+        auto separator = [&]{ if(!first) os << ",\n"; first = false; };
+
+        for(int i=0; i<(int)r.threads.size(); i++)
+        {
+            separator();
+            os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i
+               << ",\"args\":{\"name\":\"thread " << i << "\"}}";
+
+            for(const Event& e : r.threads[i]->events)
+            {
+                separator();
+                os << "{\"name\":\"" << PhaseName(e.phase) << "\",\"cat\":\"dpm\",\"ph\":\"X\",\"pid\":1,\"tid\":" << i
+                   << ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << (e.end - e.start) / 1000.0 << "}";
+            }
+        }
+
+        os << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{";
+        for(int k=0; k<CounterCount; k++)
+        {
+            os << (k ? "," : "") << "\"" << CounterName((Counter)k) << "\":" << report.total.counters[k];
+        }
+        os << ",\"dropped_events\":" << report.total.droppedEvents;
+        os << "}}\n";
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 名前
+    //--------------------------------------------------------------------------
+    static const char* CounterName(Counter counter)
+    {
+        static const char* names[CounterCount] = {
+            "cells_evaluated", "scanlines_matched", "scanlines_reused",
+            "skip_interpolated", "skip_matched",
+            "tasks_queued", "tasks_executed", "tasks_stolen", "idle_ns", "join_wait_ns"
+        };
+        return names[counter];
+    }
+
+    static const char* PhaseName(Phase phase)
+    {
+        static const char* names[PhaseCount] = {
+            "prepare", "sobel", "edge_run", "schedule", "scanline", "skip_scanline",
+            "cost_init", "relax", "backtrace"
+        };
+        return names[phase];
+    }
+
+private:
+
+    // Chrome trace に書くイベントの上限 (スレッドごと)
+    static const size_t MaxEvents = 1 << 20;
+
+    struct Event {
+        Phase    phase;
+        uint64_t start;
+        uint64_t end;
+    };
+
+    // スレッドの記録
+    struct Thread {
+        uint64_t counters[CounterCount] = {};
+        uint64_t phaseNs[PhaseCount]    = {};
+        uint64_t phaseCalls[PhaseCount] = {};
+        std::vector<Event> events;
+        size_t dropped = 0;
+    };
+
+    // 全スレッドの記録 (スレッドが終わっても残す)
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Thread> > threads;
+        std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    };
+
+    static Registry& registry()
+    {
+        static Registry r;
+        return r;
+    }
+
+    // このスレッドの記録 (最初に使ったときに登録する)
+    static Thread& local()
+    {
+        static thread_local Thread* t = nullptr;
+
+        if(!t)
+        {
+            Registry& r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.threads.emplace_back(new Thread);
+            t = r.threads.back().get();
+        }
+        return *t;
+    }
+};
+
+#endif
@@ -0,0 +1,256 @@
+﻿//==============================================================================
+//
+// SGM Kernel
+//
+//  Semi-Global Matching の経路コストの更新 (1画素分) をおこなうカーネル
+//
+//==============================================================================
+#ifndef _SGM_KERNEL_H_
+#define _SGM_KERNEL_H_
+
+#include <cstdint>
+#include <algorithm>
+
+#include "DPKernel.h"
+
+//------------------------------------------------------------------------------
+//
+// SGM Kernel
+//
+//  経路 r の 1 つ前の画素の経路コスト prev から, この画素の経路コストを求める.
+//
+//    L(d) = C(d) + min(prev(d), prev(d-1)+P1, prev(d+1)+P1, min(prev)+P2) - min(prev)
+//
+//  コストは uint16 で, 加算は 0xFFFF で飽和させる (到達できない視差は 0xFFFF).
+//  視差の数 n は 16 の倍数とし, prev[-1], prev[n] には 0xFFFF を置くこと.
+//  どの実装でも結果は一致する.
+//------------------------------------------------------------------------------
+namespace sgmkernel {
+
+//------------------------------------------------------------------------------
+// @brief 経路コストを更新して集約コストに足す (参照実装)
+// @param cost    画素のコスト (n 要素)
+// @param prev    1 つ前の画素の経路コスト
+// @param prevMin prev の最小値
+// @param p1, p2  視差が 1 変わる, 2 以上変わるときのペナルティ
+// @param out     この画素の経路コストの書き込み先 (n 要素)
+// @param sum     集約コスト (out を足す)
+// @param n       視差の数
+// @return        out の最小値
+//------------------------------------------------------------------------------
+inline uint16_t AggregateScalar(const uint16_t* cost, const uint16_t* prev, uint16_t prevMin,
+                                uint16_t p1, uint16_t p2, uint16_t* out, uint16_t* sum, int n)
+{
+    auto adds = [](int a, int b) { return (uint16_t)std::min(a + b, 0xFFFF); };
+
+    const uint16_t jump = adds(prevMin, p2);
+    uint16_t minimum = 0xFFFF;
+
+    for(int k=0; k<n; k++)
+    {
+        uint16_t m = std::min({prev[k], adds(prev[k-1], p1), adds(prev[k+1], p1), jump});
+        uint16_t l = adds(cost[k], m - prevMin);
+
+        out[k] = l;
+        sum[k] = adds(sum[k], l);
+        minimum = std::min(minimum, l);
+    }
+    return minimum;
+}
+
+//------------------------------------------------------------------------------
+// @brief 最小の集約コストの視差 (同じなら小さい方) を返す (参照実装)
+//------------------------------------------------------------------------------
+inline int MinIndexScalar(const uint16_t* sum, int n)
+{
+    return (int)(std::min_element(sum, sum + n) - sum);
+}
+
+#if defined(DP_KERNEL_AVX2)
+//------------------------------------------------------------------------------
+// @brief 経路コストを更新して集約コストに足す (AVX2)
+//------------------------------------------------------------------------------
+DP_TARGET_AVX2
+inline uint16_t AggregateAVX2(const uint16_t* cost, const uint16_t* prev, uint16_t prevMin,
+                              uint16_t p1, uint16_t p2, uint16_t* out, uint16_t* sum, int n)
+{
+    const __m256i penalty = _mm256_set1_epi16((short)p1);
+    const __m256i base    = _mm256_set1_epi16((short)prevMin);
+    const __m256i jump    = _mm256_adds_epu16(base, _mm256_set1_epi16((short)p2));
+    __m256i minimum = _mm256_set1_epi16(-1);
+
+    for(int k=0; k<n; k+=16)
+    {
+        __m256i m = _mm256_loadu_si256((const __m256i*)(prev+k));
+        m = _mm256_min_epu16(m, _mm256_adds_epu16(_mm256_loadu_si256((const __m256i*)(prev+k-1)), penalty));
+        m = _mm256_min_epu16(m, _mm256_adds_epu16(_mm256_loadu_si256((const __m256i*)(prev+k+1)), penalty));
+        m = _mm256_min_epu16(m, jump);
+
+        __m256i l = _mm256_adds_epu16(_mm256_loadu_si256((const __m256i*)(cost+k)), _mm256_subs_epu16(m, base));
+        _mm256_storeu_si256((__m256i*)(out+k), l);
+        _mm256_storeu_si256((__m256i*)(sum+k), _mm256_adds_epu16(_mm256_loadu_si256((const __m256i*)(sum+k)), l));
+
+        minimum = _mm256_min_epu16(minimum, l);
+    }
+
+    // 16 要素の最小値
+    __m128i half = _mm_min_epu16(_mm256_castsi256_si128(minimum), _mm256_extracti128_si256(minimum, 1));
+    return (uint16_t)_mm_cvtsi128_si32(_mm_minpos_epu16(half));
+}
+
+DP_TARGET_AVX2
+inline int MinIndexAVX2(const uint16_t* sum, int n)
+{
+    __m256i minimum = _mm256_set1_epi16(-1);
+    int k = 0;
+    for(; k+16<=n; k+=16)
+    {
+        minimum = _mm256_min_epu16(minimum, _mm256_loadu_si256((const __m256i*)(sum+k)));
+    }
+
+    __m128i half = _mm_min_epu16(_mm256_castsi256_si128(minimum), _mm256_extracti128_si256(minimum, 1));
+    uint16_t value = (uint16_t)_mm_cvtsi128_si32(_mm_minpos_epu16(half));
+
+    for(; k<n; k++) value = std::min(value, sum[k]);
+
+    return (int)(std::find(sum, sum + n, value) - sum);
+}
+#endif
+
+#if defined(DP_KERNEL_NEON)
+//------------------------------------------------------------------------------
+// @brief 経路コストを更新して集約コストに足す (NEON)
+//------------------------------------------------------------------------------
+inline uint16_t MinLanes(uint16x8_t v)
+{
+#if defined(__aarch64__)
+    return vminvq_u16(v);
+#else
+    uint16x4_t m = vmin_u16(vget_low_u16(v), vget_high_u16(v));
+    m = vpmin_u16(m, m);
+    m = vpmin_u16(m, m);
+    return vget_lane_u16(m, 0);
+#endif
+}
+
+inline uint16_t AggregateNEON(const uint16_t* cost, const uint16_t* prev, uint16_t prevMin,
+                              uint16_t p1, uint16_t p2, uint16_t* out, uint16_t* sum, int n)
+{
+    const uint16x8_t penalty = vdupq_n_u16(p1);
+    const uint16x8_t base    = vdupq_n_u16(prevMin);
+    const uint16x8_t jump    = vqaddq_u16(base, vdupq_n_u16(p2));
+    uint16x8_t minimum = vdupq_n_u16(0xFFFF);
+
+    for(int k=0; k<n; k+=8)
+    {
+        uint16x8_t m = vld1q_u16(prev+k);
+        m = vminq_u16(m, vqaddq_u16(vld1q_u16(prev+k-1), penalty));
+        m = vminq_u16(m, vqaddq_u16(vld1q_u16(prev+k+1), penalty));
+        m = vminq_u16(m, jump);
+
+        uint16x8_t l = vqaddq_u16(vld1q_u16(cost+k), vqsubq_u16(m, base));
+        vst1q_u16(out+k, l);
+        vst1q_u16(sum+k, vqaddq_u16(vld1q_u16(sum+k), l));
+
+        minimum = vminq_u16(minimum, l);
+    }
+    return MinLanes(minimum);
+}
+
+inline int MinIndexNEON(const uint16_t* sum, int n)
+{
+    uint16x8_t minimum = vdupq_n_u16(0xFFFF);
+    int k = 0;
+    for(; k+8<=n; k+=8)
+    {
+        minimum = vminq_u16(minimum, vld1q_u16(sum+k));
+    }
+
+    uint16_t value = MinLanes(minimum);
+    for(; k<n; k++) value = std::min(value, sum[k]);
+
+    return (int)(std::find(sum, sum + n, value) - sum);
+}
+#endif
+
+}
+
+
+//------------------------------------------------------------------------------
+//
+// SGM Kernel
+//
+//------------------------------------------------------------------------------
+class SGMKernel
+{
+public:
+
+    //--------------------------------------------------------------------------
+    // @brief 経路コストを更新して集約コストに足す
+    //   引数は sgmkernel::AggregateScalar() と同じ
+    //--------------------------------------------------------------------------
+    static uint16_t Aggregate(const uint16_t* cost, const uint16_t* prev, uint16_t prevMin,
+                              uint16_t p1, uint16_t p2, uint16_t* out, uint16_t* sum, int n)
+    {
+        return functions().aggregate(cost, prev, prevMin, p1, p2, out, sum, n);
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 最小の集約コストの視差を返す
+    //--------------------------------------------------------------------------
+    static int MinIndex(const uint16_t* sum, int n)
+    {
+        return functions().minIndex(sum, n);
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 使用している命令セット
+    //--------------------------------------------------------------------------
+    static dpkernel::ISA GetISA() { return functions().isa; }
+
+    //--------------------------------------------------------------------------
+    // @brief 使用する命令セットを変更する (対応していない場合はスカラー)
+    //--------------------------------------------------------------------------
+    static void SetISA(dpkernel::ISA type)
+    {
+        if(!dpkernel::SupportsISA(type))
+        {
+            type = dpkernel::SCALAR;
+        }
+
+        functions() = select(type);
+    }
+
+private:
+
+    struct Functions {
+        dpkernel::ISA isa;
+        uint16_t (*aggregate)(const uint16_t*, const uint16_t*, uint16_t, uint16_t, uint16_t,
+                              uint16_t*, uint16_t*, int);
+        int (*minIndex)(const uint16_t*, int);
+    };
+
+    static Functions select(dpkernel::ISA type)
+    {
+        switch(type)
+        {
+#if defined(DP_KERNEL_AVX2)
+            // AVX-512 の実装はないので AVX2 を使う
+            case dpkernel::AVX512:
+            case dpkernel::AVX2: return { dpkernel::AVX2, &sgmkernel::AggregateAVX2, &sgmkernel::MinIndexAVX2 };
+#endif
+#if defined(DP_KERNEL_NEON)
+            case dpkernel::NEON: return { type, &sgmkernel::AggregateNEON, &sgmkernel::MinIndexNEON };
+#endif
+            default: return { dpkernel::SCALAR, &sgmkernel::AggregateScalar, &sgmkernel::MinIndexScalar };
+        }
+    }
+
+    static Functions& functions()
+    {
+        static Functions f = select(dpkernel::DetectISA());
+        return f;
+    }
+};
+
+#endif
@@ -0,0 +1,498 @@
+﻿//==============================================================================
+//
+// SGM (Semi-Global Matching)
+//
+//  DPMatcher と同じコストのポリシーで, 複数方向のパスでコストを集約する
+//
+//==============================================================================
+#ifndef _SG_MATCHER_H_
+#define _SG_MATCHER_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "SGMKernel.h"
+#include "miImage/miArena.h"
+
+//------------------------------------------------------------------------------
+//
+// Semi-Global Matcher
+//
+//  走査線ごとの DP の代わりに, 4 方向 (縦横) または 8 方向 (斜めを含む) の
+//  1 次元の DP でコストを集約し, 画素ごとに集約コストが最小の視差を選ぶ.
+//
+//  * コストは DPCostPolicy を継承したポリシーの CostRow() で計算し, costScale 倍して uint16 にする.
+//    DP テーブルの (x, y) が視差 d = x - y に対応する (探索範囲は DPM と同じ -rightRange ~ leftRange).
+//  * コストボリュームと集約コストは 画素ごとに視差が並ぶ uint16 の配列で, 同じ大きさなら使い回す.
+//  * 方向ごとに, 互いに独立なパス (画像の端から端までの線) をスレッドに分けて計算する.
+//    タスクの作業領域はスレッドごとのアリーナ (mi::Arena::Local()) から借りる.
+//  * streaming が true なら, コストボリュームを持たずに行ごとにコストを計算し,
+//    上から下 (右向き・下向きのパス) と下から上 (残りのパス) の 2 回に分けて集約する.
+//    メモリは集約コストの分だけになるが, コストの計算が 2 回になる.
+//------------------------------------------------------------------------------
+class SemiGlobalMatcher
+{
+public:
+
+    // パラメタ
+    int    paths     = 8;     // 集約する方向の数 (4: 縦横, 8: 斜めを含む)
+    int    penalty1  = 8;     // 視差が 1 変わるときのペナルティ (uint16 にしたコストの単位)
+    int    penalty2  = 96;    // 視差が 2 以上変わるときのペナルティ
+    double costScale = 256;   // コストを uint16 にする倍率
+    bool   streaming = false; // コストボリュームを持たずに行ごとにコストを計算する
+
+    //--------------------------------------------------------------------------
+    // @brief マッチングしてパターンを格納
+    // @param threadPool    計算するスレッドプール (ワーカースレッドから呼ばないこと)
+    // @param costPolicy    コストのポリシー (タスクごとにコピーして使う)
+    // @param x, y          DPテーブルの横縦の長さ (入力と参照画像の幅)
+    // @param nScanlines    走査線の数
+    // @param leftRange     対応点の探索範囲左限界までの画素数
+    // @param rightRange    対応点の探索範囲右限界までの画素数
+    // @param matchPatterns マッチング結果の格納先 (走査線ごとに x 要素)
+    //--------------------------------------------------------------------------
+    template<class CostPolicy>
+    void Matching(ThreadPool& threadPool, const CostPolicy& costPolicy,
+                  int x, int y, int nScanlines, int leftRange, int rightRange,
+                  std::vector<std::vector<int> >& matchPatterns)
+    {
+        pool = &threadPool;
+        allocate(x, y, nScanlines, std::max(0, leftRange), std::max(0, rightRange));
+
+        std::fill(sumVolume.begin(), sumVolume.end(), 0);
+
+        if(streaming)
+        {
+            aggregateRows(costPolicy,  1);
+            aggregateRows(costPolicy, -1);
+        }
+        else
+        {
+            computeVolume(costPolicy);
+
+            Direction all[MaxPaths];
+            int n = directions(0, all);
+
+            for(int i=0; i<n; i++)
+            {
+                aggregateLines(all[i]);
+            }
+        }
+
+        selectDisparity(matchPatterns);
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 集約コスト (走査線 row, 位置 x の視差ごとのコスト)
+    //   視差 d の値は [d + rightRange]. 直前の Matching() の結果
+    //--------------------------------------------------------------------------
+    const uint16_t* SumCost(int row, int x) const
+    {
+        return sumVolume.data() + ((size_t)row * X + x) * Dp;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 使用しているメモリ (byte)
+    //--------------------------------------------------------------------------
+    size_t MemoryBytes() const
+    {
+        return (costVolume.size() + sumVolume.size() + rowCost.size() + rowSum.size() +
+                rowPaths[0].size() + rowPaths[1].size()) * sizeof(uint16_t);
+    }
+
+private:
+
+    // パスの方向 (1 つ前の画素は (x-dx, y-dy))
+    struct Direction { int dx, dy; };
+
+    enum {
+        MaxCost      = 0xFFFF, // 到達できない視差のコスト
+        MaxValidCost = 4095,   // 到達できない視差と区別するためのコストの上限
+        Pad          = 16,     // 経路コストの前後に置く番兵の数
+        MaxPaths     = 8,      // 方向の数の上限
+    };
+
+    // 大きさ
+    int X = 0, Y = 0, H = 0;
+    int left = -1, right = -1;
+    int D  = 0;  // 視差の数
+    int Dp = 0;  // 視差の数 (16 の倍数)
+    int Ls = 0;  // 経路コスト 1 画素分の長さ (前後の番兵を含む)
+
+    // タスクを追加するスレッドプール (終わりは TaskLatch で待ち, プールを共有する他の処理は待たない)
+    ThreadPool* pool = nullptr;
+
+    // コストボリュームと集約コスト (((row*X + x)*Dp + d)
+    std::vector<uint16_t> costVolume;
+    std::vector<uint16_t> sumVolume;
+
+    // パスの始点に使う経路コスト (全て 0)
+    std::vector<uint16_t> startPath;
+
+    // streaming で使う行ごとの作業領域
+    std::vector<uint16_t> rowCost;      // 行のコスト
+    std::vector<uint16_t> rowSum;       // 横方向のパスの集約コスト
+    std::vector<uint16_t> rowPaths[2];  // 縦・斜めのパスの経路コスト (前の行, この行)
+    std::vector<uint16_t> rowMins[2];   // その最小値
+
+    // aggregateLines() のパスの始点
+    std::vector<std::pair<int,int> > starts;
+
+    //--------------------------------------------------------------------------
+    // @brief 集約する方向
+    //   先頭は横方向のパス
+    // @param pass 0: 全て, 1: 上から下に計算できる方向, -1: 下から上に計算できる方向
+    // @param out  方向の書き込み先 (MaxPaths 要素)
+    // @return     方向の数
+    //--------------------------------------------------------------------------
+    int directions(int pass, Direction* out) const
+    {
+        static const Direction forward[]  = { {1,0},  {0,1},  {1,1},   {-1,1} };
+        static const Direction backward[] = { {-1,0}, {0,-1}, {-1,-1}, {1,-1} };
+
+        const int n = paths > 4 ? 4 : 2;
+        int count = 0;
+
+        if(pass >= 0) count = (int)(std::copy(forward,  forward  + n, out + count) - out);
+        if(pass <= 0) count = (int)(std::copy(backward, backward + n, out + count) - out);
+
+        return count;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 作業領域を確保する (大きさが同じなら使い回す)
+    //--------------------------------------------------------------------------
+    void allocate(int x, int y, int nScanlines, int leftRange, int rightRange)
+    {
+        bool resized = x!=X || y!=Y || nScanlines!=H || leftRange!=left || rightRange!=right;
+
+        X = x;
+        Y = y;
+        H = nScanlines;
+        left  = leftRange;
+        right = rightRange;
+        D  = left + right + 1;
+        Dp = (D + 15) / 16 * 16;
+        Ls = Dp + Pad*2;
+
+        size_t volume = (size_t)H * X * Dp;
+
+        if(resized || sumVolume.size() != volume)
+        {
+            // 到達できない視差は最大のコストのまま (毎回同じ要素だけ書き込む)
+            sumVolume.assign(volume, 0);
+            costVolume.clear();
+            rowCost.clear();
+
+            startPath.assign(Ls, MaxCost);
+            std::fill(startPath.begin()+Pad, startPath.begin()+Pad+Dp, 0);
+        }
+
+        if(streaming)
+        {
+            std::vector<uint16_t>().swap(costVolume);
+
+            // 縦・斜めのパスは 1 回に (paths/2 - 1) 方向
+            Direction all[MaxPaths];
+            size_t nPaths = directions(1, all) - 1;
+
+            if(rowCost.empty() || rowPaths[0].size() != nPaths * X * Ls)
+            {
+                rowCost.assign((size_t)X * Dp, MaxCost);
+                rowSum.assign((size_t)X * Dp, 0);
+                for(int i=0; i<2; i++)
+                {
+                    rowPaths[i].assign(nPaths * X * Ls, MaxCost);
+                    rowMins[i].assign(nPaths * X, 0);
+                }
+            }
+        }
+        else
+        {
+            std::vector<uint16_t>().swap(rowCost);
+            std::vector<uint16_t>().swap(rowSum);
+            for(int i=0; i<2; i++)
+            {
+                std::vector<uint16_t>().swap(rowPaths[i]);
+                std::vector<uint16_t>().swap(rowMins[i]);
+            }
+
+            if(costVolume.size() != volume)
+            {
+                costVolume.assign(volume, MaxCost);
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 走査線 row の参照画像の位置 [y0, y1) のコストを書き込む
+    // @param out 走査線のコスト (x*Dp + d)
+    //--------------------------------------------------------------------------
+    template<class CostPolicy>
+    void computeRowCost(CostPolicy& costPolicy, int row, int y0, int y1, uint16_t* out, double* buffer)
+    {
+        for(int y=y0; y<y1; y++)
+        {
+            int sx = std::max(0, y - right);
+            int ex = std::min(X-1, y + left);
+
+            if(sx > ex) continue;
+
+            costPolicy.CostRow(y, row, 0, sx, ex, buffer);
+
+            for(int x=sx; x<=ex; x++)
+            {
+                double c = buffer[x-sx] * costScale + 0.5;
+                out[(size_t)x*Dp + (x - y + right)] = (uint16_t)std::min(c, (double)MaxValidCost);
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief コストボリュームを計算する (走査線ごとに並列)
+    //--------------------------------------------------------------------------
+    template<class CostPolicy>
+    void computeVolume(const CostPolicy& costPolicy)
+    {
+        int nTasks = std::min(H, pool->GetNumThread() * 4);
+        TaskLatch latch;
+
+        for(int t=0; t<nTasks; t++)
+        {
+            int begin = t * H / nTasks;
+            int end   = (t + 1) * H / nTasks;
+
+            pool->Request(latch, [&,begin,end](int id){
+                CostPolicy policy = costPolicy;
+
+                mi::Arena& arena = mi::Arena::Local();
+                mi::Arena::Scope scope(arena);
+                double* buffer = arena.Allocate<double>(X);
+
+                for(int row=begin; row<end; row++)
+                {
+                    computeRowCost(policy, row, 0, Y, costVolume.data() + (size_t)row * X * Dp, buffer);
+                }
+            });
+        }
+
+        latch.Wait();
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 方向 r のパスで集約する (パスごとに並列)
+    //--------------------------------------------------------------------------
+    void aggregateLines(Direction r)
+    {
+        // パスの始点 (1 つ前の画素が画像の外になる画素)
+        starts.clear();
+
+        for(int y=0; y<H; y++)
+        {
+            for(int x=0; x<X; x++)
+            {
+                int px = x - r.dx, py = y - r.dy;
+                if(px < 0 || px >= X || py < 0 || py >= H) starts.push_back({x, y});
+            }
+        }
+
+        int nTasks = std::min((int)starts.size(), pool->GetNumThread() * 4);
+        TaskLatch latch;
+
+        for(int t=0; t<nTasks; t++)
+        {
+            size_t begin = t * starts.size() / nTasks;
+            size_t end   = (t + 1) * starts.size() / nTasks;
+
+            pool->Request(latch, [&,r,begin,end](int id){
+
+                mi::Arena& arena = mi::Arena::Local();
+                mi::Arena::Scope scope(arena);
+                uint16_t* buffer[2] = { startBuffer(arena), startBuffer(arena) };
+
+                for(size_t i=begin; i<end; i++)
+                {
+                    const uint16_t* prev = startPath.data() + Pad;
+                    uint16_t prevMin = 0;
+                    int k = 0;
+
+                    for(int x=starts[i].first, y=starts[i].second;
+                        x>=0 && x<X && y>=0 && y<H; x+=r.dx, y+=r.dy, k^=1)
+                    {
+                        size_t p = ((size_t)y * X + x) * Dp;
+                        uint16_t* out = buffer[k] + Pad;
+
+                        prevMin = SGMKernel::Aggregate(costVolume.data() + p, prev, prevMin,
+                                                       penalty1, penalty2, out, sumVolume.data() + p, Dp);
+                        prev = out;
+                    }
+                }
+            });
+        }
+
+        latch.Wait();
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 行ごとにコストを計算して集約する (streaming)
+    // @param pass 1: 上から下 (右向き・下向きのパス), -1: 下から上 (残りのパス)
+    //--------------------------------------------------------------------------
+    template<class CostPolicy>
+    void aggregateRows(const CostPolicy& costPolicy, int pass)
+    {
+        Direction all[MaxPaths];
+        const int nVertical = directions(pass, all) - 1;
+        const Direction  horizontal = all[0];
+        const Direction* vertical   = all + 1;
+
+        const int nTasks = std::max(1, std::min(X, pool->GetNumThread()));
+        TaskLatch latch;
+
+        int previous = -1;
+
+        for(int k=0; k<H; k++)
+        {
+            const int row = pass > 0 ? k : H-1-k;
+
+            // この行のコストと, 前の行の横方向のパスの集約コストの書き込み
+            for(int t=0; t<nTasks; t++)
+            {
+                int begin = t * Y / nTasks;
+                int end   = (t + 1) * Y / nTasks;
+
+                pool->Request(latch, [&,row,begin,end](int id){
+                    CostPolicy policy = costPolicy;
+
+                    mi::Arena& arena = mi::Arena::Local();
+                    mi::Arena::Scope scope(arena);
+                    computeRowCost(policy, row, begin, end, rowCost.data(), arena.Allocate<double>(X));
+                });
+            }
+
+            if(previous >= 0)
+            {
+                pool->Request(latch, [&,previous](int id){ addRowSum(previous); });
+            }
+
+            latch.Wait();
+
+            // 横方向のパス (同じ行の隣に依存する)
+            pool->Request(latch, [&](int id){
+
+                std::fill(rowSum.begin(), rowSum.end(), 0);
+
+                mi::Arena& arena = mi::Arena::Local();
+                mi::Arena::Scope scope(arena);
+                uint16_t* buffer[2] = { startBuffer(arena), startBuffer(arena) };
+                const uint16_t* prev = startPath.data() + Pad;
+                uint16_t prevMin = 0;
+
+                for(int i=0; i<X; i++)
+                {
+                    int x = horizontal.dx > 0 ? i : X-1-i;
+                    uint16_t* out = buffer[i&1] + Pad;
+
+                    prevMin = SGMKernel::Aggregate(rowCost.data() + (size_t)x*Dp, prev, prevMin,
+                                                   penalty1, penalty2, out, rowSum.data() + (size_t)x*Dp, Dp);
+                    prev = out;
+                }
+            });
+
+            // 縦・斜めのパス (前の行にだけ依存するので X 方向に分ける)
+            for(int t=0; t<nTasks; t++)
+            {
+                int begin = t * X / nTasks;
+                int end   = (t + 1) * X / nTasks;
+
+                pool->Request(latch, [&,k,row,begin,end](int id){
+
+                    for(int x=begin; x<end; x++)
+                    {
+                        size_t p = ((size_t)row * X + x) * Dp;
+
+                        for(int j=0; j<nVertical; j++)
+                        {
+                            int px = x - vertical[j].dx;
+                            bool first = k == 0 || px < 0 || px >= X;
+
+                            const uint16_t* prev = first ? startPath.data() + Pad : pathRow(0, j, px);
+                            uint16_t prevMin     = first ? 0 : rowMins[0][(size_t)j*X + px];
+
+                            rowMins[1][(size_t)j*X + x] =
+                                SGMKernel::Aggregate(rowCost.data() + (size_t)x*Dp, prev, prevMin,
+                                                     penalty1, penalty2, pathRow(1, j, x), sumVolume.data() + p, Dp);
+                        }
+                    }
+                });
+            }
+
+            latch.Wait();
+
+            rowPaths[0].swap(rowPaths[1]);
+            rowMins[0].swap(rowMins[1]);
+            previous = row;
+        }
+
+        addRowSum(previous);
+    }
+
+    // 経路コストの作業領域 (startPath で初期化して arena から切り出す)
+    uint16_t* startBuffer(mi::Arena& arena) const
+    {
+        uint16_t* buffer = arena.Allocate<uint16_t>(Ls);
+        std::copy(startPath.begin(), startPath.end(), buffer);
+        return buffer;
+    }
+
+    // streaming の縦・斜めのパス j の x の経路コスト
+    uint16_t* pathRow(int buffer, int j, int x)
+    {
+        return rowPaths[buffer].data() + ((size_t)j * X + x) * Ls + Pad;
+    }
+
+    // 横方向のパスの集約コストを足す
+    void addRowSum(int row)
+    {
+        uint16_t* sum = sumVolume.data() + (size_t)row * X * Dp;
+
+        for(size_t i=0; i<(size_t)X*Dp; i++)
+        {
+            sum[i] = (uint16_t)std::min(sum[i] + rowSum[i], (int)MaxCost);
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 集約コストが最小の視差を選ぶ (走査線ごとに並列)
+    //--------------------------------------------------------------------------
+    void selectDisparity(std::vector<std::vector<int> >& matchPatterns)
+    {
+        int nTasks = std::min(H, pool->GetNumThread() * 4);
+        TaskLatch latch;
+
+        for(int t=0; t<nTasks; t++)
+        {
+            int begin = t * H / nTasks;
+            int end   = (t + 1) * H / nTasks;
+
+            pool->Request(latch, [&,begin,end](int id){
+                for(int row=begin; row<end; row++)
+                {
+                    std::vector<int>& match = matchPatterns[row];
+
+                    for(int x=0; x<X; x++)
+                    {
+                        int d = SGMKernel::MinIndex(SumCost(row, x), D) - right;
+                        match[x] = std::min(Y-1, std::max(0, x - d));
+                    }
+                }
+            });
+        }
+
+        latch.Wait();
+    }
+};
+
+#endif
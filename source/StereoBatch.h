@@ -0,0 +1,369 @@
+﻿//==============================================================================
+//
+// StereoBatch
+//
+//  独立した多数の画像の組のステレオマッチング
+//
+//==============================================================================
+#ifndef _STEREO_BATCH_H_
+#define _STEREO_BATCH_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DPMS.h"
+#include "ThreadPool.h"
+#include "miImage/miImageCodec.h"
+#include "miImage/miPlane.h"
+
+//------------------------------------------------------------------------------
+//
+// 画像の組のバッチ処理
+//
+//  1 つのスレッドプールで, 組ごとの並列 (pairsInFlight 組を同時に DP する) と
+//  走査線ごとの並列 (各組の走査線のタスク) をおこなう.
+//
+//  * 読み込みスレッドが prefetch 組先まで画像を読み込み, 書き込み (Run() を呼んだスレッド) は
+//    DP と並行して視差画像を保存する.
+//  * 同時に DP する組ごとに DPMS を持ち, 次の組でも DP テーブルやマッチング結果の領域を使い回す
+//    (大きさが違う組が来ても, 領域はそれまでで最も大きい組の分から縮めない).
+//  * 画像と視差画像の領域も pairsInFlight + prefetch + 1 組分を使い回す.
+//------------------------------------------------------------------------------
+class StereoBatch
+{
+public:
+
+    // パラメタ (DPMS::dp() の引数)
+    int    skip         = 8;  // 飛び越し量
+    double weight       = 13; // コストの重みパラメータ
+    int    rowRange     = 4;  // コスト計算時に参照する上下の画素数
+    int    threshold    = 80; // コスト計算時に上下の画素の参照を打ち切る閾値
+    int    maxDisparity = 40; // 想定する最大の視差
+
+    // 並列化
+    int pairsInFlight = 2;    // 同時に DP する組の数
+    int prefetch      = 2;    // DP の前に読み込んでおく組の数
+
+    //--------------------------------------------------------------------------
+    // @brief DPMS を作ったときに呼ぶ関数 (pyramidLevels などを設定する)
+    //--------------------------------------------------------------------------
+    std::function<void(DPMS& dpms)> configure;
+
+    //--------------------------------------------------------------------------
+    // 画像の組
+    //--------------------------------------------------------------------------
+    struct Pair {
+        std::string left;   // 左画像 (主画像) のファイル名
+        std::string right;  // 右画像 (副画像) のファイル名
+        std::string output; // 視差画像の保存先 (空なら保存しない. 形式は拡張子で選ぶ)
+    };
+
+    //--------------------------------------------------------------------------
+    // @brief 視差画像を受け取る関数
+    //   終わった順に書き込みスレッド (Run() を呼んだスレッド) から呼ばれる.
+    //   disparity は戻った後に別の組で書き換わる
+    //--------------------------------------------------------------------------
+    typedef std::function<void(size_t index, const Pair& pair, const mi::Plane16& disparity)> ResultCallback;
+
+
+    //--------------------------------------------------------------------------
+    // @brief コンストラクタ
+    // @param threads スレッドプールのスレッド数
+    //--------------------------------------------------------------------------
+    StereoBatch(int threads = std::thread::hardware_concurrency())
+        : threadPool(threads)
+    {
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 全ての組をステレオマッチングする
+    // @param pairs    画像の組
+    // @param callback 視差画像を受け取る関数 (なくてもよい)
+    // @return 処理した組の数
+    //
+    //   読み込み・DP・書き込みのどこかで例外が投げられたら, 残りの組は処理せずに
+    //   最初の例外を投げ直す
+    //--------------------------------------------------------------------------
+    size_t Run(const std::vector<Pair>& pairs, ResultCallback callback = ResultCallback())
+    {
+        const int nMatchers = std::max(1, pairsInFlight);
+        const int nJobs     = nMatchers + std::max(0, prefetch) + 1;
+
+        while((int)jobs.size() < nJobs)
+        {
+            jobs.emplace_back(new Job);
+        }
+        if((int)matchers.size() < nMatchers)
+        {
+            matchers.resize(nMatchers);
+        }
+
+        Channel<Job*> free, loaded, matched;
+        for(int i=0; i<nJobs; i++)
+        {
+            free.Push(jobs[i].get());
+        }
+
+        // 最初の例外を覚えて, 全てのスレッドを止める
+        std::mutex errorMutex;
+        std::exception_ptr error;
+
+        auto guard = [&](const std::function<void()>& body) {
+            try {
+                body();
+            }
+            catch(...) {
+                std::unique_lock<std::mutex> lock(errorMutex);
+                if(!error) error = std::current_exception();
+                free.Abort();
+                loaded.Abort();
+                matched.Abort();
+            }
+        };
+
+        // 読み込み
+        std::thread reader([&]{
+            guard([&]{
+                Job* job;
+                for(size_t i=0; i<pairs.size() && free.Pop(job); i++)
+                {
+                    job->index = i;
+                    job->left.Load(pairs[i].left.c_str());
+                    job->right.Load(pairs[i].right.c_str());
+                    loaded.Push(job);
+                }
+            });
+            loaded.Close();
+        });
+
+        // DP (組ごとのスレッドが dp() を呼び, 走査線のタスクは共有のスレッドプールで実行する)
+        std::vector<std::thread> workers;
+        std::atomic<int> running{nMatchers};
+
+        for(int k=0; k<nMatchers; k++)
+        {
+            workers.emplace_back([&,k]{
+                guard([&]{
+                    Job* job;
+                    while(loaded.Pop(job))
+                    {
+                        match(k, *job);
+                        matched.Push(job);
+                    }
+                });
+                if(--running == 0) matched.Close();
+            });
+        }
+
+        // 書き込み
+        size_t done = 0;
+
+        guard([&]{
+            Job* job;
+            while(matched.Pop(job))
+            {
+                const Pair& pair = pairs[job->index];
+
+                if(!pair.output.empty())
+                {
+                    mi::SavePlane(pair.output.c_str(), job->disparity);
+                }
+                if(callback)
+                {
+                    callback(job->index, pair, job->disparity);
+                }
+
+                done++;
+                free.Push(job);
+            }
+        });
+
+        reader.join();
+        for(std::thread& worker : workers)
+        {
+            worker.join();
+        }
+
+        if(error)
+        {
+            std::rethrow_exception(error);
+        }
+
+        return done;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 画像の組の一覧 (マニフェスト) を読み込む
+    // @param fileName マニフェストのファイル名
+    //
+    //   1 行に "左画像 右画像 [視差画像の保存先]" を空白で区切って書く.
+    //   空行と # で始まる行は読み飛ばす. 相対パスはマニフェストのあるディレクトリから辿る
+    //--------------------------------------------------------------------------
+    static std::vector<Pair> ReadManifest(const std::string& fileName)
+    {
+        std::ifstream file(fileName.c_str());
+
+        if(!file)
+        {
+            std::cerr<<"Error: Can't Open Manifest "<<fileName<<std::endl;
+            throw "File Open Error";
+        }
+
+        const size_t slash = fileName.find_last_of("/\\");
+        const std::string directory = slash == std::string::npos ? "" : fileName.substr(0, slash + 1);
+
+        std::vector<Pair> pairs;
+        std::string line;
+
+        while(std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            Pair pair;
+
+            if(!(fields >> pair.left) || pair.left[0] == '#') continue;
+
+            if(!(fields >> pair.right))
+            {
+                std::cerr<<"Error: Manifest Line Has No Right Image: "<<line<<std::endl;
+                throw "File Format Error";
+            }
+            fields >> pair.output;
+
+            pair.left   = resolve(directory, pair.left);
+            pair.right  = resolve(directory, pair.right);
+            pair.output = pair.output.empty() ? "" : resolve(directory, pair.output);
+
+            pairs.push_back(pair);
+        }
+
+        return pairs;
+    }
+
+    //--------------------------------------------------------------------------
+    // Getter
+    //--------------------------------------------------------------------------
+    ThreadPool& getThreadPool() { return threadPool; }
+
+private:
+
+    // 1 組分の画像と視差画像 (使い回す)
+    struct Job {
+        size_t index = 0;
+        mi::Image left;
+        mi::Image right;
+        mi::Plane16 disparity;
+    };
+
+    //--------------------------------------------------------------------------
+    // スレッド間でジョブを受け渡すキュー
+    //   Close() の後は残りを取り出し終えたら Pop() が false を返す.
+    //   Abort() は残りを捨てて, すぐに Pop() が false を返すようにする
+    //--------------------------------------------------------------------------
+    template<class T>
+    class Channel
+    {
+    public:
+        void Push(T value)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if(closed) return;
+                values.push_back(value);
+            }
+            condition.notify_one();
+        }
+
+        bool Pop(T& value)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while(values.empty() && !closed)
+            {
+                condition.wait(lock);
+            }
+            if(values.empty()) return false;
+
+            value = values.front();
+            values.pop_front();
+            return true;
+        }
+
+        void Close()
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                closed = true;
+            }
+            condition.notify_all();
+        }
+
+        void Abort()
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                closed = true;
+                values.clear();
+            }
+            condition.notify_all();
+        }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::deque<T> values;
+        bool closed = false;
+    };
+
+    //--------------------------------------------------------------------------
+    // @brief k 番目の DPMS で 1 組を DP して視差画像を作る
+    //--------------------------------------------------------------------------
+    void match(int k, Job& job)
+    {
+        std::unique_ptr<DPMS>& dpms = matchers[k];
+
+        if(!dpms)
+        {
+            dpms.reset(new DPMS(job.left, job.right, threadPool));
+            if(configure) configure(*dpms);
+        }
+        else
+        {
+            dpms->setImages(job.left, job.right);
+        }
+
+        dpms->dp(skip, weight, rowRange, threshold, maxDisparity);
+        dpms->getDisparity(job.disparity);
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief マニフェストの相対パスをディレクトリからのパスにする
+    //--------------------------------------------------------------------------
+    static std::string resolve(const std::string& directory, const std::string& path)
+    {
+        bool absolute = path[0] == '/' || path[0] == '\\' || path.find(':') != std::string::npos;
+        return absolute ? path : directory + path;
+    }
+
+    // 全ての組で共有するスレッドプール (DPMS より先に作り, 後に破棄する)
+    ThreadPool threadPool;
+
+    // 同時に DP する組ごとの DPMS
+    std::vector<std::unique_ptr<DPMS> > matchers;
+
+    // 使い回す画像の組
+    std::vector<std::unique_ptr<Job> > jobs;
+};
+
+
+#endif
@@ -0,0 +1,322 @@
+﻿//==============================================================================
+//
+// StereoStream
+//
+//  動画 (連番の画像) のステレオマッチング
+//
+//==============================================================================
+#ifndef _STEREO_STREAM_H_
+#define _STEREO_STREAM_H_
+
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DPMS.h"
+#include "miImage/miPlane.h"
+
+//------------------------------------------------------------------------------
+//
+// 動画のステレオマッチング
+//
+//  フレームごとに DPMS を作らずに, DP テーブル・マッチング結果・エッジ画像などの領域を使い回す.
+//  画像は 2 組を交互に使い, フレーム N の DP の間に読み込みスレッドでフレーム N+1 を読み込む.
+//  読み込みスレッドは Run() の間 1 つだけ作り, フレームごとに読み込みを頼む.
+//  フレームごとに視差 (対応点までの画素数) の画像をコールバックに渡す.
+//  getDPMS().temporal を true にすると, 前のフレームから変わっていない走査線は DP を省く.
+//------------------------------------------------------------------------------
+class StereoStream
+{
+public:
+
+    // パラメタ (DPMS::dp() の引数)
+    int    skip         = 8;  // 飛び越し量
+    double weight       = 13; // コストの重みパラメータ
+    int    rowRange     = 4;  // コスト計算時に参照する上下の画素数
+    int    threshold    = 80; // コスト計算時に上下の画素の参照を打ち切る閾値
+    int    maxDisparity = 40; // 想定する最大の視差
+
+    //--------------------------------------------------------------------------
+    // @brief フレームを読み込む関数
+    //   frame 番目のフレームを left, right に読み込む. フレームがなければ false を返す.
+    //   DP と並行して別のスレッドから呼ばれる
+    //--------------------------------------------------------------------------
+    typedef std::function<bool(int frame, mi::Image& left, mi::Image& right)> FrameSource;
+
+    //--------------------------------------------------------------------------
+    // @brief 視差画像を受け取る関数
+    //   disparity は次のフレームで書き換わる
+    //--------------------------------------------------------------------------
+    typedef std::function<void(int frame, const mi::Plane16& disparity)> FrameCallback;
+
+
+    //--------------------------------------------------------------------------
+    // @brief コンストラクタ
+    // @param width, height フレームの大きさ (違う大きさのフレームは領域を確保し直す)
+    // @param threads       スレッド数
+    //--------------------------------------------------------------------------
+    StereoStream(int width, int height, int threads = std::thread::hardware_concurrency())
+        : frames{ { mi::Image(24, width, height), mi::Image(24, width, height) },
+                  { mi::Image(24, width, height), mi::Image(24, width, height) } }
+        , dpms(frames[0].left, frames[0].right, threads)
+        , disparity(width, height)
+    {
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief コンストラクタ (領域は最初のフレームの大きさで確保する)
+    // @param threads スレッド数
+    //--------------------------------------------------------------------------
+    explicit StereoStream(int threads = std::thread::hardware_concurrency())
+        : StereoStream(0, 0, threads)
+    {
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief フレームがなくなるまでステレオマッチングする
+    // @param source   フレームを読み込む関数
+    // @param callback 視差画像を受け取る関数
+    // @return 処理したフレーム数
+    //--------------------------------------------------------------------------
+    int Run(FrameSource source, FrameCallback callback)
+    {
+        // DP やコールバックが例外を投げても, Loader のデストラクタが読み込みを待ってから終わる
+        Loader loader(source);
+
+        loader.Request(0, frames[0]);
+        bool loaded = loader.Wait();
+
+        int frame = 0;
+
+        while(loaded)
+        {
+            Frame& current = frames[frame % 2];
+            Frame& next    = frames[(frame + 1) % 2];
+
+            // 次のフレームの読み込みを DP と重ねる
+            loader.Request(frame + 1, next);
+
+            dpms.setImages(current.left, current.right);
+            dpms.dp(skip, weight, rowRange, threshold, maxDisparity);
+
+            dpms.getDisparity(disparity);
+
+            if(callback)
+            {
+                callback(frame, disparity);
+            }
+
+            // 読み込みで投げられた例外はここで投げ直す
+            loaded = loader.Wait();
+            frame++;
+        }
+
+        return frame;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 連番の画像ファイルを読み込む関数を作る
+    // @param leftFormat  左画像のファイル名 ("left_%04d.bmp" のように番号を printf の書式で書く)
+    // @param rightFormat 右画像のファイル名
+    // @param first       最初の番号
+    //   左画像のファイルが開けなくなったら終わる.
+    //   書式に整数の変換 (%d, %04d など) がちょうど 1 つでなければ "Invalid Format" を投げる
+    //--------------------------------------------------------------------------
+    static FrameSource FileSequence(const std::string& leftFormat, const std::string& rightFormat, int first = 0)
+    {
+        for(const std::string& text : { leftFormat, rightFormat })
+        {
+            if(!isNumberFormat(text))
+            {
+                std::cerr << "Error: File name needs exactly one integer conversion (" << text << ")" << std::endl;
+                throw "Invalid Format";
+            }
+        }
+
+        return [=](int frame, mi::Image& left, mi::Image& right) {
+
+            std::string leftName  = format(leftFormat,  first + frame);
+            std::string rightName = format(rightFormat, first + frame);
+
+            if(!std::ifstream(leftName.c_str()).good())
+            {
+                return false;
+            }
+
+            left.Load(leftName.c_str());
+            right.Load(rightName.c_str());
+            return true;
+        };
+    }
+
+    //--------------------------------------------------------------------------
+    // Getter
+    //--------------------------------------------------------------------------
+    DPMS& getDPMS() { return dpms; }
+    const mi::Plane16& getDisparity() const { return disparity; }
+
+private:
+
+    // 左右の画像
+    struct Frame {
+        mi::Image left;
+        mi::Image right;
+    };
+
+    //--------------------------------------------------------------------------
+    // 次のフレームを読み込むスレッド
+    //   Request() で読み込むフレームを渡し, Wait() で読み込みが終わるのを待つ
+    //--------------------------------------------------------------------------
+    class Loader
+    {
+    public:
+        explicit Loader(FrameSource& source)
+            : source(source)
+            , thread([this]{ loop(); })
+        {
+        }
+
+        // 頼んだ読み込みが終わるのを待ってから終わる
+        ~Loader()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            condition.notify_all();
+            thread.join();
+        }
+
+        Loader(const Loader&) = delete;
+        Loader& operator=(const Loader&) = delete;
+
+        // frame 番目のフレームを target に読み込む
+        void Request(int frame, Frame& target)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                requested = frame;
+                this->target = &target;
+                pending = true;
+                done    = false;
+            }
+            condition.notify_all();
+        }
+
+        // 読み込みが終わるのを待つ (フレームがあれば true. 読み込みの例外は投げ直す)
+        bool Wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]{ return done; });
+
+            if(error)
+            {
+                std::exception_ptr e = error;
+                error = nullptr;
+                std::rethrow_exception(e);
+            }
+            return loaded;
+        }
+
+    private:
+        void loop()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            while(true)
+            {
+                condition.wait(lock, [this]{ return stop || pending; });
+                if(!pending) return;
+                pending = false;
+
+                const int frame = requested;
+                Frame*    frameTarget = target;
+                lock.unlock();
+
+                bool result = false;
+                std::exception_ptr exception;
+                try {
+                    result = source(frame, frameTarget->left, frameTarget->right);
+                }
+                catch(...) {
+                    exception = std::current_exception();
+                }
+
+                lock.lock();
+                loaded = result;
+                error  = exception;
+                done   = true;
+                condition.notify_all();
+            }
+        }
+
+        FrameSource& source;
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        int    requested = 0;
+        Frame* target    = nullptr;
+        bool   pending   = false; // 読み込みを頼まれている
+        bool   done      = false; // 頼まれた読み込みが終わった
+        bool   loaded    = false;
+        bool   stop      = false;
+        std::exception_ptr error;
+
+        std::thread thread; // 最後に初期化する
+    };
+
+    //--------------------------------------------------------------------------
+    // @brief 整数の変換 (%d, %04d, %i, %u, %x など) がちょうど 1 つの printf の書式か
+    //   "%%" は数えない. 文字列など他の変換があれば false
+    //--------------------------------------------------------------------------
+    static bool isNumberFormat(const std::string& text)
+    {
+        int conversions = 0;
+
+        for(size_t i=0; i<text.size(); i++)
+        {
+            if(text[i] != '%') continue;
+
+            if(++i < text.size() && text[i] == '%') continue;
+
+            while(i < text.size() && std::string("-+ #0").find(text[i]) != std::string::npos) i++;
+            while(i < text.size() && text[i] >= '0' && text[i] <= '9') i++;
+
+            if(i >= text.size() || std::string("diuxXo").find(text[i]) == std::string::npos)
+            {
+                return false;
+            }
+            conversions++;
+        }
+        return conversions == 1;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 番号を書式に埋め込む (isNumberFormat() の書式)
+    //--------------------------------------------------------------------------
+    static std::string format(const std::string& text, int number)
+    {
+        std::vector<char> buffer(text.size() + 32);
+        std::snprintf(buffer.data(), buffer.size(), text.c_str(), number);
+        return buffer.data();
+    }
+
+    // 交互に使う画像 (DP 中に次のフレームを読み込む)
+    Frame frames[2];
+
+    // ステレオマッチング
+    DPMS dpms;
+
+    // 視差画像
+    mi::Plane16 disparity;
+};
+
+
+#endif
@@ -0,0 +1,166 @@
+﻿//==============================================================================
+//
+// Task Graph
+//
+//  依存関係つきのタスクを ThreadPool で実行する
+//
+//==============================================================================
+#ifndef _TASK_GRAPH_H_
+#define _TASK_GRAPH_H_
+
+#include <atomic>
+#include <deque>
+#include <vector>
+
+#include "ThreadPool.h"
+
+//------------------------------------------------------------------------------
+//
+// Task Graph
+//
+//  Add() でタスクを追加し, Depend() で依存関係を設定してから Run() を呼ぶ.
+//  タスクは依存する全てのタスクが終わった時点でスレッドプールに追加される.
+//  終了は Wait() で待つ (このグラフのタスクだけを待つので, プールを共有する他の処理は待たない).
+//  Clear() してもノードの領域は残すので, 同じ形のグラフを作り直すときはヒープを使わない.
+//------------------------------------------------------------------------------
+class TaskGraph
+{
+public:
+
+    //--------------------------------------------------------------------------
+    // @brief タスクを追加する
+    // @param task タスク (引数はスレッド番号. ThreadPoolTask に入れる)
+    // @return     タスクの番号
+    //--------------------------------------------------------------------------
+    template<class F>
+    int Add(F&& task)
+    {
+        if(count == (int)nodes.size())
+        {
+            nodes.emplace_back();
+        }
+
+        Node& node = nodes[count];
+        node.task = ThreadPoolTask(std::forward<F>(task));
+        node.children.clear();
+        node.nParents = 0;
+
+        return count++;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 依存関係を設定する
+    // @param task   後から実行するタスクの番号
+    // @param parent 先に実行するタスクの番号 (負の数なら何もしない)
+    //--------------------------------------------------------------------------
+    void Depend(int task, int parent)
+    {
+        if(parent < 0 || parent == task) return;
+
+        std::vector<int>& children = nodes[parent].children;
+
+        // 続けて同じ依存関係を追加した場合は無視する
+        if(!children.empty() && children.back() == task) return;
+
+        children.push_back(task);
+        nodes[task].nParents++;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 依存するタスクのないタスクからスレッドプールに追加する
+    // @param threadPool 実行するスレッドプール
+    //--------------------------------------------------------------------------
+    void Run(ThreadPool& threadPool)
+    {
+        pool = &threadPool;
+
+        // 先に全ての残り数を設定しておく (実行中のタスクが減らすため)
+        for(int i=0; i<count; i++)
+        {
+            nodes[i].pending = nodes[i].nParents;
+        }
+        latch.Add(count);
+
+        for(int i=0; i<count; i++)
+        {
+            if(nodes[i].nParents == 0)
+            {
+                request(i);
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief Run() したタスクが全て終わるのを待つ (ワーカースレッドから呼ばないこと)
+    //--------------------------------------------------------------------------
+    void Wait()
+    {
+        latch.Wait();
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 全てのタスクを削除する (実行中に呼ばないこと)
+    //   ノードと依存関係の配列の領域は次の Add() で使い回す
+    //--------------------------------------------------------------------------
+    void Clear()
+    {
+        for(int i=0; i<count; i++)
+        {
+            nodes[i].task = ThreadPoolTask();
+        }
+        count = 0;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief タスク数を返す
+    //--------------------------------------------------------------------------
+    int Size() const
+    {
+        return count;
+    }
+
+private:
+
+    struct Node {
+        ThreadPoolTask task;
+        std::vector<int> children;  // このタスクに依存するタスク
+        int nParents = 0;           // 依存するタスクの数
+        std::atomic<int> pending{0};// 終わっていない依存するタスクの数
+    };
+
+    // タスク (要素のアドレスが変わらないように deque を使う. 先頭の count 個を使う)
+    std::deque<Node> nodes;
+    int count = 0;
+
+    // 実行するスレッドプール
+    ThreadPool* pool = nullptr;
+
+    // 終わっていないタスク (依存するタスクを追加し終えてから減らす)
+    TaskLatch latch;
+
+    //--------------------------------------------------------------------------
+    // @brief タスクをスレッドプールに追加する
+    //--------------------------------------------------------------------------
+    void request(int i)
+    {
+        pool->Request([this,i](int id){
+
+            Node& node = nodes[i];
+
+            node.task(id);
+
+            // 依存するタスクが全て終わったものを追加
+            for(int child : node.children)
+            {
+                if(--nodes[child].pending == 0)
+                {
+                    request(child);
+                }
+            }
+
+            latch.Done();
+        });
+    }
+};
+
+#endif
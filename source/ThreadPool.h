@@ -2,19 +2,240 @@
 //
 // Thread Pool
 //
+//  スレッドごとのタスクキューを持ち, 空になったら他のスレッドから盗む
+//
 //==============================================================================
 #ifndef _THREAD_POOL_H_
 #define _THREAD_POOL_H_
 
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 
-#include <map>
-#include <queue>
+#include <algorithm>
+#include <memory>
 #include <vector>
-#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "DPProfile.h"
+
+//------------------------------------------------------------------------------
+//
+// Thread Pool Task
+//
+//  void(int) で呼び出せる関数オブジェクトを保持する.
+//  小さな関数オブジェクト (ラムダのキャプチャが数個程度) はヒープを使わずに内部に持つ.
+//------------------------------------------------------------------------------
+class ThreadPoolTask
+{
+public:
+
+    // 内部に持てる関数オブジェクトの大きさ (TaskLatch のポインタを加えても収まるようにする)
+    static const size_t BUFFER_SIZE = 64;
+
+    ThreadPoolTask() {}
+
+    //--------------------------------------------------------------------------
+    // @brief コンストラクタ
+    // @param task タスク (引数はスレッド番号)
+    //--------------------------------------------------------------------------
+    template<class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, ThreadPoolTask>::value>::type>
+    ThreadPoolTask(F&& task)
+    {
+        typedef typename std::decay<F>::type Functor;
+        construct<Functor>(std::forward<F>(task),
+                           std::integral_constant<bool, IsInline<Functor>::value>());
+    }
+
+    ThreadPoolTask(ThreadPoolTask&& other) noexcept
+    {
+        moveFrom(other);
+    }
+
+    ThreadPoolTask& operator=(ThreadPoolTask&& other) noexcept
+    {
+        if(this != &other)
+        {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    ThreadPoolTask(const ThreadPoolTask&) = delete;
+    ThreadPoolTask& operator=(const ThreadPoolTask&) = delete;
+
+    ~ThreadPoolTask()
+    {
+        reset();
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief タスクの実行
+    // @param id スレッド番号
+    //--------------------------------------------------------------------------
+    void operator()(int id)
+    {
+        ops->invoke(buffer, id);
+    }
+
+    explicit operator bool() const
+    {
+        return ops != nullptr;
+    }
+
+private:
+
+    // 関数オブジェクトの操作
+    struct Ops {
+        void (*invoke)(void* buffer, int id);
+        void (*move)(void* dst, void* src);    // src から dst に移して src を破棄する
+        void (*destroy)(void* buffer);
+    };
+
+    template<class Functor>
+    struct IsInline : std::integral_constant<bool,
+        sizeof(Functor) <= BUFFER_SIZE &&
+        alignof(Functor) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible<Functor>::value> {};
+
+    // 内部に持つ場合
+    template<class Functor>
+    struct InlineOps {
+        static void invoke(void* buffer, int id) { (*static_cast<Functor*>(buffer))(id); }
+        static void move(void* dst, void* src)
+        {
+            Functor* f = static_cast<Functor*>(src);
+            new (dst) Functor(std::move(*f));
+            f->~Functor();
+        }
+        static void destroy(void* buffer) { static_cast<Functor*>(buffer)->~Functor(); }
+        static const Ops* Get() { static const Ops ops = { invoke, move, destroy }; return &ops; }
+    };
 
+    // ヒープに持つ場合 (buffer にはポインタを入れる)
+    template<class Functor>
+    struct HeapOps {
+        static Functor*& ptr(void* buffer) { return *static_cast<Functor**>(buffer); }
+        static void invoke(void* buffer, int id) { (*ptr(buffer))(id); }
+        static void move(void* dst, void* src) { new (dst) Functor*(ptr(src)); }
+        static void destroy(void* buffer) { delete ptr(buffer); }
+        static const Ops* Get() { static const Ops ops = { invoke, move, destroy }; return &ops; }
+    };
+
+    template<class Functor, class F>
+    void construct(F&& task, std::true_type)
+    {
+        new (buffer) Functor(std::forward<F>(task));
+        ops = InlineOps<Functor>::Get();
+    }
+
+    template<class Functor, class F>
+    void construct(F&& task, std::false_type)
+    {
+        new (buffer) Functor*(new Functor(std::forward<F>(task)));
+        ops = HeapOps<Functor>::Get();
+    }
+
+    void moveFrom(ThreadPoolTask& other)
+    {
+        ops = other.ops;
+        if(ops) ops->move(buffer, other.buffer);
+        other.ops = nullptr;
+    }
+
+    void reset()
+    {
+        if(ops) ops->destroy(buffer);
+        ops = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char buffer[BUFFER_SIZE];
+    const Ops* ops = nullptr;
+};
+
+
+//------------------------------------------------------------------------------
+//
+// Task Latch
+//
+//  ThreadPool::Request(latch, task) で追加したタスクが全て終わるのを待つ.
+//  プール全体の Join() と違い, 同じプールに他のスレッドが追加したタスクは待たないので,
+//  プールを共有する別の DPM や画像処理と足並みがそろわない.
+//  Wait() から戻った後は (タスクが Done() を呼び終えているので) 破棄してよい.
+//------------------------------------------------------------------------------
+class TaskLatch
+{
+public:
+
+    TaskLatch() {}
+
+    TaskLatch(const TaskLatch&) = delete;
+    TaskLatch& operator=(const TaskLatch&) = delete;
+
+    //--------------------------------------------------------------------------
+    // @brief 待つタスクの数を増やす
+    //--------------------------------------------------------------------------
+    void Add(int n = 1)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        count += n;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief タスクが 1 つ終わった
+    //   mutex の中で数を減らして通知するので, Wait() が戻るのは通知し終えた後になる
+    //--------------------------------------------------------------------------
+    void Done()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if(--count == 0)
+        {
+            condition.notify_all();
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 全てのタスクが終わるのを待つ (ワーカースレッドから呼ばないこと)
+    //--------------------------------------------------------------------------
+    void Wait()
+    {
+        DP_PROFILE_START(joinStart);
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while(count > 0)
+        {
+            condition.wait(lock);
+        }
+
+        DP_PROFILE_ELAPSED(JoinWaitNs, joinStart);
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+    int count = 0;
+};
+
+
+//------------------------------------------------------------------------------
+//
+// Thread Pool
+//
+//  * ワーカースレッドから追加したタスクは自分のキューの末尾に入れ, 末尾から取り出す.
+//  * 外部から追加したタスクは順番にワーカーのキューに振り分ける.
+//  * 自分のキューが空のときは他のワーカーのキューの先頭から盗む.
+//  * Join() は追加されてから終わっていないタスク数が 0 になるのを待つ.
+//    複数の外部スレッドが同じプールにタスクを追加して Join() してもよい
+//    (それぞれ, 呼んだ後に初めてタスク数が 0 になった時点で戻る).
+//    他のスレッドのタスクまで待たないように, 自分が追加したタスクだけを待つ場合は TaskLatch を使う.
+//------------------------------------------------------------------------------
 class ThreadPool
 {
 public:
@@ -22,76 +243,37 @@ public:
     // @brief コンストラクタ
     // @param nThreads スレッド数
     //--------------------------------------------------------------------------
-    ThreadPool(int nThreads_ = std::thread::hardware_concurrency()) : nThreads(nThreads_)
+    ThreadPool(int nThreads_ = std::thread::hardware_concurrency())
+        : nThreads(std::max(1, nThreads_))
+        , workers(new Worker[nThreads])
     {
-        // スレッド内の処理
-        auto worker = [](ThreadPool& threadPool)
-        {
-            std::function<void(int)> task;
-            
-            while(true)
-            {
-                {
-                    std::unique_lock<std::mutex> lock(threadPool.mutexTaskQueue);
-                    
-                    // タスクが入るまで待機状態
-                    while(threadPool.taskQueue.empty() && !threadPool.isDestruct)
-                    {
-                        // アイドル状態のスレッド数を1つ増やす
-                        threadPool.nIdleThreads++;
-                        
-                        // 全スレッドアイドル状態なら Join によるブロッキング解除
-                        if(threadPool.nIdleThreads == threadPool.nThreads)
-                        {
-                            threadPool.conditionThreadPoolJoin.notify_all();
-                        }
-
-                        // スレッドを待機状態にする
-                        threadPool.condition.wait(lock);
-                        
-                        // アイドル状態のスレッド数を1つ減らす
-                        threadPool.nIdleThreads--;
-                    }
-                    
-                    // 終了処理
-                    if(threadPool.taskQueue.empty() || threadPool.isDestruct)
-                    {
-                        return;
-                    }
-                    
-                    // タスク取り出し
-                    task = threadPool.taskQueue.front();
-                    threadPool.taskQueue.pop();
-                }
-                
-                // タスクの実行
-                task(threadPool.thread_map[std::this_thread::get_id()]);
-            }
-        };
-        
         // スレッド生成
         for(int i=0; i<nThreads; i++)
         {
-            std::thread thread = std::thread(worker, std::ref(*this));
-            thread_map[thread.get_id()] = i;
-            threads.push_back(std::move(thread));
+            threads.push_back(std::thread([this,i]{ work(i); }));
         }
     }
-    
+
     //--------------------------------------------------------------------------
     // @brief デストラクタ
     //--------------------------------------------------------------------------
     ~ThreadPool()
     {
         // 終了フラグ
-        isDestruct = true;
-        
+        {
+            std::unique_lock<std::mutex> lock(mutexSleep);
+            isDestruct = true;
+        }
+
         // 全スレッドに通知
         condition.notify_all();
-        
+
         // Join に通知
+        {
+            std::unique_lock<std::mutex> lock(mutexJoin);
+        }
         conditionThreadPoolJoin.notify_all();
-        
+
         // スレッド後始末
         for(int i = 0;i<threads.size(); i++)
         {
@@ -102,17 +284,48 @@ public:
 
     //--------------------------------------------------------------------------
     // @brief タスクを追加する
+    // @param task タスク (引数はスレッド番号)
     //--------------------------------------------------------------------------
-    void Request(std::function<void(int)> task)
+    template<class F>
+    void Request(F&& task)
     {
-        {
-            std::unique_lock<std::mutex> lock(mutexTaskQueue);
+        nPendingTasks++;
+        DP_PROFILE_COUNT(TasksQueued, 1);
+
+        // ワーカースレッドからなら自分のキュー, 外部からなら順番に振り分ける
+        int i = current().pool == this ? current().id : (int)(nextWorker++ % nThreads);
 
-            taskQueue.push(task);
+        {
+            std::unique_lock<std::mutex> lock(workers[i].mutex);
+            workers[i].tasks.PushBack(ThreadPoolTask(std::forward<F>(task)));
         }
-        
+
+        nQueuedTasks++;
+
         // 待機スレッドのどれか 1 つに通知して待機解除
-        condition.notify_one();
+        // (待機に入る途中のスレッドが通知を取りこぼさないように mutex を通す)
+        if(nSleepingThreads > 0)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutexSleep);
+            }
+            condition.notify_one();
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief latch で終わりを待つタスクを追加する
+    // @param latch タスクが終わったら Done() を呼ぶラッチ
+    // @param task  タスク (引数はスレッド番号)
+    //--------------------------------------------------------------------------
+    template<class F>
+    void Request(TaskLatch& latch, F&& task)
+    {
+        latch.Add();
+        Request([&latch, f = std::forward<F>(task)](int id) mutable {
+            f(id);
+            latch.Done();
+        });
     }
 
     //--------------------------------------------------------------------------
@@ -122,7 +335,7 @@ public:
     {
         return nIdleThreads == nThreads;
     }
-    
+
     //--------------------------------------------------------------------------
     // @brief 全スレッド数を返す
     //--------------------------------------------------------------------------
@@ -138,53 +351,223 @@ public:
     {
         return nIdleThreads;
     }
-    
+
     //--------------------------------------------------------------------------
     // @brief スレッドプール内の処理が全て終了するのを待機する
+    //   (ワーカースレッドから呼ばないこと)
+    //   他のスレッドが追加したタスクも待つが, 一度でもタスク数が 0 になれば戻るので,
+    //   他のスレッドが次々にタスクを追加しても待ち続けることはない
     //--------------------------------------------------------------------------
     void Join()
     {
-        std::mutex mutex;
-        std::unique_lock<std::mutex> lock(mutex);
-        
-        // タスクが空かつ全スレッドがアイドル状態になるまで待つ
-        while(!IsAllThreadIdle() || !taskQueue.empty())
+        DP_PROFILE_START(joinStart);
+        std::unique_lock<std::mutex> lock(mutexJoin);
+
+        // 追加されたタスクが全て終わるまで待つ
+        const uint64_t drained = nDrained;
+        while(nPendingTasks > 0 && nDrained == drained && !isDestruct)
         {
-            if(isDestruct) break;
-            
             conditionThreadPoolJoin.wait(lock);
         }
+
+        DP_PROFILE_ELAPSED(JoinWaitNs, joinStart);
     }
-    
+
 private:
-    
-    // task queue
-    std::queue<std::function<void(int)> > taskQueue;
-    
-    // mutex for task queue
-    std::mutex mutexTaskQueue;
-    
-    // task queue 用の状態変数
-    std::condition_variable condition;
-    
-    // スレッド
-    std::vector<std::thread> threads;
-    
-    // スレッド番号
-    std::map<std::thread::id, int> thread_map;
-    
+
+    //--------------------------------------------------------------------------
+    // タスクのリングバッファ
+    //   満杯になったら 2 倍に広げ, 縮めない (定常状態ではヒープを使わない)
+    //--------------------------------------------------------------------------
+    class TaskQueue {
+    public:
+        bool Empty() const { return count == 0; }
+
+        void PushBack(ThreadPoolTask&& task)
+        {
+            if(count == ring.size()) grow();
+            ring[(head + count) % ring.size()] = std::move(task);
+            count++;
+        }
+
+        ThreadPoolTask PopBack()
+        {
+            count--;
+            return std::move(ring[(head + count) % ring.size()]);
+        }
+
+        ThreadPoolTask PopFront()
+        {
+            ThreadPoolTask task = std::move(ring[head]);
+            head = (head + 1) % ring.size();
+            count--;
+            return task;
+        }
+
+    private:
+        void grow()
+        {
+            std::vector<ThreadPoolTask> larger(std::max<size_t>(16, ring.size() * 2));
+            for(size_t i=0; i<count; i++)
+            {
+                larger[i] = std::move(ring[(head + i) % ring.size()]);
+            }
+            ring.swap(larger);
+            head = 0;
+        }
+
+        std::vector<ThreadPoolTask> ring;
+        size_t head  = 0;
+        size_t count = 0;
+    };
+
+    // ワーカーごとのタスクキュー
+    struct Worker {
+        std::mutex mutex;
+        TaskQueue tasks;
+    };
+
+    // 実行中のスレッドが属するスレッドプールとスレッド番号
+    struct Current {
+        ThreadPool* pool = nullptr;
+        int id = -1;
+    };
+
+    static Current& current()
+    {
+        static thread_local Current c;
+        return c;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief スレッド内の処理
+    // @param id スレッド番号
+    //--------------------------------------------------------------------------
+    void work(int id)
+    {
+        current().pool = this;
+        current().id   = id;
+
+        while(true)
+        {
+            ThreadPoolTask task;
+
+            if(pop(id, task) || steal(id, task))
+            {
+                // タスクの実行
+                DP_PROFILE_COUNT(TasksExecuted, 1);
+                task(id);
+
+                // 全てのタスクが終わったら Join によるブロッキング解除
+                if(--nPendingTasks == 0)
+                {
+                    {
+                        std::unique_lock<std::mutex> lock(mutexJoin);
+                        nDrained++;
+                    }
+                    conditionThreadPoolJoin.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutexSleep);
+
+            // タスクが入るまで待機状態
+            nSleepingThreads++;
+            nIdleThreads++;
+
+            DP_PROFILE_START(sleepStart);
+
+            while(nQueuedTasks == 0 && !isDestruct)
+            {
+                condition.wait(lock);
+            }
+
+            DP_PROFILE_ELAPSED(IdleNs, sleepStart);
+
+            nIdleThreads--;
+            nSleepingThreads--;
+
+            // 終了処理
+            if(isDestruct)
+            {
+                return;
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 自分のキューの末尾から取り出す
+    //--------------------------------------------------------------------------
+    bool pop(int id, ThreadPoolTask& task)
+    {
+        Worker& worker = workers[id];
+        std::unique_lock<std::mutex> lock(worker.mutex);
+
+        if(worker.tasks.Empty()) return false;
+
+        task = worker.tasks.PopBack();
+        nQueuedTasks--;
+        return true;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 他のワーカーのキューの先頭から盗む
+    //--------------------------------------------------------------------------
+    bool steal(int id, ThreadPoolTask& task)
+    {
+        for(int k=1; k<nThreads && nQueuedTasks > 0; k++)
+        {
+            Worker& victim = workers[(id + k) % nThreads];
+            std::unique_lock<std::mutex> lock(victim.mutex);
+
+            if(victim.tasks.Empty()) continue;
+
+            task = victim.tasks.PopFront();
+            nQueuedTasks--;
+            DP_PROFILE_COUNT(TasksStolen, 1);
+            return true;
+        }
+        return false;
+    }
+
     // スレッド数
     int nThreads;
-    
+
+    // ワーカーごとのタスクキュー
+    std::unique_ptr<Worker[]> workers;
+
+    // スレッド
+    std::vector<std::thread> threads;
+
+    // 外部から追加したタスクを入れるキューの番号
+    std::atomic<unsigned int> nextWorker{0};
+
+    // キューに入っているタスク数
+    std::atomic<int> nQueuedTasks{0};
+
+    // 追加されてから終わっていないタスク数
+    std::atomic<int> nPendingTasks{0};
+
+    // 待機状態のスレッド数
+    std::atomic<int> nSleepingThreads{0};
+
     // アイドル状態のスレッド数
-    int nIdleThreads = 0;
+    std::atomic<int> nIdleThreads{0};
+
+    // 待機用の mutex と状態変数
+    std::mutex mutexSleep;
+    std::condition_variable condition;
 
-    // スレッドプールの処理が終わるまで待機させるための状態変数
+    // スレッドプールの処理が終わるまで待機させるための mutex と状態変数
+    std::mutex mutexJoin;
     std::condition_variable conditionThreadPoolJoin;
-    
-    
+
+    // タスク数が 0 になった回数 (mutexJoin で守る)
+    uint64_t nDrained = 0;
+
     // スレッドプールが破棄されるフラグ
-    bool isDestruct = false;
+    std::atomic<bool> isDestruct{false};
 };
 
-#endif
\ No newline at end of file
+#endif
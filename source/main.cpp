@@ -7,6 +7,9 @@
 
 #include "DPMS.h"
 #include "DPMF.h"
+#include "StereoStream.h"
+#include "StereoBatch.h"
+#include "miImage/miImageCodec.h"
 
 //-----------------------------------------------------------------------------
 // @brief ステレオマッチングして処理にかかった時間を print する
@@ -51,6 +54,53 @@ void Stereo(int i = 1)
     stereo.Save("depth_stereo.bmp");
 }
 
+//-----------------------------------------------------------------------------
+// @brief 連番の画像をステレオマッチングして, 視差を 16bit の PGM で保存する
+// @param leftFormat  左画像のファイル名 (例: "input/left_%04d.bmp")
+// @param rightFormat 右画像のファイル名
+//-----------------------------------------------------------------------------
+void StereoSequence(const char* leftFormat, const char* rightFormat)
+{
+    // 領域は最初のフレームの大きさで確保される
+    StereoStream stream(8);
+
+    auto start = std::chrono::system_clock::now();
+
+    int frames = stream.Run(StereoStream::FileSequence(leftFormat, rightFormat),
+                            [](int frame, const mi::Plane16& disparity) {
+        char fileName[64];
+        snprintf(fileName, sizeof(fileName), "depth_stereo_%04d.pgm", frame);
+        mi::SavePlane(fileName, disparity);
+    });
+
+    auto end = std::chrono::system_clock::now();
+
+    std::cout << frames << " frames, elapsed time = ";
+    std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(end-start).count();
+    std::cout << " msec." << std::endl;
+}
+
+//-----------------------------------------------------------------------------
+// @brief マニフェストに書いた画像の組をまとめてステレオマッチングする
+// @param manifest 1 行に "左画像 右画像 視差画像の保存先" を書いたファイル
+//-----------------------------------------------------------------------------
+void StereoManifest(const char* manifest)
+{
+    std::vector<StereoBatch::Pair> pairs = StereoBatch::ReadManifest(manifest);
+
+    StereoBatch batch(8);
+
+    auto start = std::chrono::system_clock::now();
+
+    size_t done = batch.Run(pairs);
+
+    auto end = std::chrono::system_clock::now();
+
+    std::cout << done << " pairs, elapsed time = ";
+    std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(end-start).count();
+    std::cout << " msec." << std::endl;
+}
+
 //-----------------------------------------------------------------------------
 // @brief フュージョンして処理にかかった時間を print する
 // @param i 計測回数
@@ -99,6 +149,37 @@ void Fusion(int i = 1)
 //-----------------------------------------------------------------------------
 int main(int argc, char* argv[])
 {
+    const std::string mode = argc > 1 ? argv[1] : "";
+
+    // 読み込めないファイルなどは詳細を標準エラーに出してから文字列を投げる
+    try
+    {
+        // 連番の画像: --sequence left_%04d.bmp right_%04d.bmp
+        if(mode == "--sequence" && argc == 4)
+        {
+            StereoSequence(argv[2], argv[3]);
+            return 0;
+        }
+
+        // 画像の組の一覧: --manifest pairs.txt
+        if(mode == "--manifest" && argc == 3)
+        {
+            StereoManifest(argv[2]);
+            return 0;
+        }
+    }
+    catch(const char* error)
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    if(!mode.empty())
+    {
+        std::cerr << "usage: " << argv[0] << " [--sequence left_%04d.bmp right_%04d.bmp | --manifest pairs.txt]" << std::endl;
+        return 1;
+    }
+
     Stereo();
 
     return 0;
@@ -0,0 +1,77 @@
+﻿//==============================================================================
+//
+// 作業領域のアリーナ
+//
+//==============================================================================
+#include "miArena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// bytes バイトを切り出す
+//   今のブロックに入らなければ次のブロックを, なければ新しいブロックを使う
+//------------------------------------------------------------------------------
+void* Arena::Allocate(size_t bytes, size_t alignment) {
+
+    for(;;) {
+        while(current < blocks.size()) {
+            Block& block = blocks[current];
+
+            uintptr_t base    = (uintptr_t)block.data.get();
+            size_t    aligned = (size_t)(((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+
+            if(aligned + bytes <= block.size) {
+                offset = aligned + bytes;
+                return block.data.get() + aligned;
+            }
+
+            current++;
+            offset = 0;
+        }
+
+        size_t size = std::max(blockSize, bytes + alignment);
+        blocks.push_back({ std::unique_ptr<char[]>(new char[size]), size });
+        current = blocks.size() - 1;
+        offset  = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+// 切り出す位置を mark まで戻す
+//------------------------------------------------------------------------------
+void Arena::Rewind(const Mark& mark) {
+
+    current = mark.block;
+    offset  = mark.offset;
+
+    // 全体を戻したら, 次は 1 つのブロックに収まるようにまとめる
+    if(current == 0 && offset == 0 && blocks.size() > 1) {
+        size_t size = Capacity();
+        blocks.clear();
+        blocks.push_back({ std::unique_ptr<char[]>(new char[size]), size });
+    }
+}
+
+//------------------------------------------------------------------------------
+// 確保しているブロックの合計
+//------------------------------------------------------------------------------
+size_t Arena::Capacity() const {
+    size_t size = 0;
+    for(const Block& block : blocks) {
+        size += block.size;
+    }
+    return size;
+}
+
+//------------------------------------------------------------------------------
+// このスレッドのアリーナ
+//------------------------------------------------------------------------------
+Arena& Arena::Local() {
+    static thread_local Arena arena;
+    return arena;
+}
+
+}
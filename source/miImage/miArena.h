@@ -0,0 +1,112 @@
+﻿//==============================================================================
+//
+// 作業領域のアリーナ
+//
+//==============================================================================
+#ifndef _MI_ARENA_H_
+#define _MI_ARENA_H_
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 作業領域のアリーナ
+//
+//  呼び出しの間だけ使う配列を, 確保したブロックの先頭から順に切り出す (bump allocator).
+//  Scope を抜けると切り出す位置を戻すだけで, ブロックは解放せずに次の呼び出しで使い回す.
+//  ブロックが複数に分かれたら, 全体を戻したときに 1 つのブロックにまとめ直すので,
+//  同じ大きさの処理を繰り返す定常状態ではヒープを確保しない.
+//
+//  1 つのアリーナは 1 つのスレッドからだけ使うこと (スレッドごとのものは Local()).
+//------------------------------------------------------------------------------
+class Arena {
+public:
+
+    // 切り出す位置
+    struct Mark {
+        size_t block;
+        size_t offset;
+    };
+
+    //--------------------------------------------------------------------------
+    // Scope
+    //   コンストラクタからデストラクタまでに切り出した領域をまとめて戻す
+    //--------------------------------------------------------------------------
+    class Scope {
+    public:
+        explicit Scope(Arena& arena) : arena(arena), mark(arena.GetMark()) {}
+        ~Scope() { arena.Rewind(mark); }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Arena& arena;
+        Mark   mark;
+    };
+
+    explicit Arena(size_t blockSize = 64 * 1024) : blockSize(blockSize) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    //--------------------------------------------------------------------------
+    // @brief bytes バイトを切り出す (内容は不定)
+    //--------------------------------------------------------------------------
+    void* Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+    //--------------------------------------------------------------------------
+    // @brief T の配列を切り出す (値は不定. デストラクタは呼ばれない)
+    //--------------------------------------------------------------------------
+    template<class T>
+    T* Allocate(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena holds only trivially destructible types");
+        return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 現在の切り出す位置
+    //--------------------------------------------------------------------------
+    Mark GetMark() const { return { current, offset }; }
+
+    //--------------------------------------------------------------------------
+    // @brief 切り出す位置を mark まで戻す
+    //   先頭まで戻したときにブロックが分かれていれば 1 つにまとめる
+    //--------------------------------------------------------------------------
+    void Rewind(const Mark& mark);
+
+    //--------------------------------------------------------------------------
+    // @brief 全て戻す
+    //--------------------------------------------------------------------------
+    void Reset() { Rewind({ 0, 0 }); }
+
+    //--------------------------------------------------------------------------
+    // @brief 確保しているブロックの合計 [byte]
+    //--------------------------------------------------------------------------
+    size_t Capacity() const;
+
+    //--------------------------------------------------------------------------
+    // @brief このスレッドのアリーナ
+    //--------------------------------------------------------------------------
+    static Arena& Local();
+
+private:
+
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    size_t blockSize;
+    std::vector<Block> blocks;
+    size_t current = 0;  // 切り出し中のブロック
+    size_t offset  = 0;  // そのブロックの先頭からの位置
+};
+
+}
+
+#endif
@@ -0,0 +1,192 @@
+﻿//==============================================================================
+//
+// Bilateral Grid
+//
+//  Chen, Paris, Durand の bilateral grid による Bilateral フィルタの近似.
+//  画素を (x, y, 輝度) の粗い格子に足し込み, 格子を Gaussian でぼかしてから
+//  元の画素の位置で補間して取り出す. 計算量がフィルタサイズに依らない.
+//
+//==============================================================================
+#ifndef _MI_BILATERAL_GRID_H_
+#define _MI_BILATERAL_GRID_H_
+
+#include "miImage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// Bilateral Grid
+//
+//  チャンネルごとに格子を持ち, guide の同じチャンネルの値で重み付けする.
+//  格子の間隔はそれぞれの sigma で, ぼかしは 1 間隔分 (二項係数 1 4 6 4 1).
+//------------------------------------------------------------------------------
+class BilateralGrid {
+public:
+
+    //--------------------------------------------------------------------------
+    // @brief 格子を作る
+    // @param guide      重みを決める画像 (部分画像でもよい)
+    // @param source     平滑化する画像 (guide と同じ大きさ. Slice() の出力と重ならないこと)
+    // @param sigma      空間方向の標準偏差
+    // @param sigma2     輝度方向の標準偏差
+    //--------------------------------------------------------------------------
+    BilateralGrid(const ImageView& guide, const ImageView& source, double sigma, double sigma2)
+        : guide(guide)
+        , source(source)
+        , spaceStep((float)std::max(1.0, sigma))
+        , rangeStep((float)std::max(1.0, sigma2))
+    {
+        sizeX = (int)((guide.Width()  - 1) / spaceStep) + 2 + 2*PAD;
+        sizeY = (int)((guide.Height() - 1) / spaceStep) + 2 + 2*PAD;
+        sizeZ = (int)(255 / rangeStep) + 2 + 2*PAD;
+
+        for(int c=0; c<CHANNELS; c++) {
+            cells[c].assign((size_t)sizeX * sizeY * sizeZ, Cell());
+            splat(source, c);
+            blur(cells[c]);
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief [y0,y1) 行を格子から取り出して output に書き込む
+    //--------------------------------------------------------------------------
+    void Slice(const ImageView& output, int y0, int y1) const
+    {
+        const int W = guide.Width();
+
+        for(int iY=y0; iY<y1; iY++) {
+
+            const RGB* g = guide.Row(iY);
+            const RGB* s = source.Row(iY);
+            RGB* out     = output.Row(iY);
+
+            for(int iX=0; iX<W; iX++) {
+                out[iX].r = slice(0, iX, iY, g[iX].r, s[iX].r);
+                out[iX].g = slice(1, iX, iY, g[iX].g, s[iX].g);
+                out[iX].b = slice(2, iX, iY, g[iX].b, s[iX].b);
+            }
+        }
+    }
+
+private:
+
+    static const int CHANNELS = 3;
+
+    // ぼかしで参照する外側の格子数
+    static const int PAD = 2;
+
+    // 値と重みの合計
+    struct Cell {
+        float value  = 0;
+        float weight = 0;
+    };
+
+    inline size_t index(int x, int y, int z) const {
+        return ((size_t)z * sizeY + y) * sizeX + x;
+    }
+
+    unsigned char channel(const RGB& p, int c) const {
+        return c == 0 ? p.r : c == 1 ? p.g : p.b;
+    }
+
+    // 画素を一番近い格子に足し込む
+    void splat(const ImageView& source, int c)
+    {
+        const int W = guide.Width();
+        const int H = guide.Height();
+
+        for(int iY=0; iY<H; iY++) {
+            int gy = (int)(iY / spaceStep + 0.5f) + PAD;
+
+            const RGB* g   = guide.Row(iY);
+            const RGB* src = source.Row(iY);
+
+            for(int iX=0; iX<W; iX++) {
+                int gx = (int)(iX / spaceStep + 0.5f) + PAD;
+                int gz = (int)(channel(g[iX], c) / rangeStep + 0.5f) + PAD;
+
+                Cell& cell = cells[c][index(gx, gy, gz)];
+                cell.value  += channel(src[iX], c);
+                cell.weight += 1;
+            }
+        }
+    }
+
+    // 3方向に 1 4 6 4 1 でぼかす (外側 PAD 個の格子は参照するだけ)
+    void blur(std::vector<Cell>& grid)
+    {
+        std::vector<Cell> temp(grid.size());
+
+        const int    size[3]   = { sizeX, sizeY, sizeZ };
+        const size_t stride[3] = { 1, (size_t)sizeX, (size_t)sizeX * sizeY };
+
+        for(int axis=0; axis<3; axis++) {
+
+            const size_t s = stride[axis];
+
+            for(int z=0; z<sizeZ; z++) {
+                for(int y=0; y<sizeY; y++) {
+                    for(int x=0; x<sizeX; x++) {
+
+                        int      p = axis == 0 ? x : axis == 1 ? y : z;
+                        size_t   i = index(x, y, z);
+                        Cell&    t = temp[i];
+
+                        if(p < PAD || p >= size[axis] - PAD) {
+                            t = grid[i];
+                            continue;
+                        }
+
+                        const Cell* g = &grid[i];
+                        t.value  = (g[-2*s].value  + 4*g[-s].value  + 6*g[0].value  + 4*g[s].value  + g[2*s].value)  / 16;
+                        t.weight = (g[-2*s].weight + 4*g[-s].weight + 6*g[0].weight + 4*g[s].weight + g[2*s].weight) / 16;
+                    }
+                }
+            }
+
+            grid.swap(temp);
+        }
+    }
+
+    // (x, y, v) の位置を 8 近傍の格子から補間する (重みがなければ入力の画素 src を返す)
+    unsigned char slice(int c, int x, int y, unsigned char v, unsigned char src) const
+    {
+        float fx = x / spaceStep + PAD;
+        float fy = y / spaceStep + PAD;
+        float fz = v / rangeStep + PAD;
+
+        int ix = (int)fx, iy = (int)fy, iz = (int)fz;
+        float tx = fx - ix, ty = fy - iy, tz = fz - iz;
+
+        float value = 0, weight = 0;
+
+        for(int k=0; k<8; k++) {
+            int dx = k & 1, dy = (k >> 1) & 1, dz = k >> 2;
+            float w = (dx ? tx : 1-tx) * (dy ? ty : 1-ty) * (dz ? tz : 1-tz);
+
+            const Cell& cell = cells[c][index(ix+dx, iy+dy, iz+dz)];
+            value  += w * cell.value;
+            weight += w * cell.weight;
+        }
+
+        if(weight <= 0) return src;
+
+        return (unsigned char)std::max(0.0f, std::min(255.0f, value / weight));
+    }
+
+    ImageView guide;
+    ImageView source;
+    float spaceStep;  // 空間方向の格子の間隔
+    float rangeStep;  // 輝度方向の格子の間隔
+    int sizeX, sizeY, sizeZ;
+
+    std::vector<Cell> cells[CHANNELS];
+};
+
+}
+
+#endif
@@ -7,6 +7,9 @@
 
 #include <iostream>
 #include <fstream>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
 
 namespace mi {
 
@@ -17,16 +20,9 @@ namespace mi {
 // 空のBitmapを作成する
 Bitmap::Bitmap(int bit, int width, int height) {
 
-    _header.bitmapInfoHeader.biBitCount = bit;
-    _header.bitmapInfoHeader.biWidth    = width;
-    _header.bitmapInfoHeader.biHeight   = height;
+    SetHeader(bit, width, height);
 
     _pixels = new RGBQUAD[width * height];
-    
-    // パレットをグレースケールで生成
-    for(auto i=0; i<sizeof(_palette)/sizeof(_palette[0]); i++) {
-        _palette[i].r = _palette[i].g = _palette[i].b = i;
-    }
 }
 
 // ファイルからBitmapを作成する
@@ -51,38 +47,9 @@ Bitmap::~Bitmap() {
 //------------------------------------------------------------------------------
 void Bitmap::Read(const char* fileName) {
 
-    // ファイルを開く
-    std::ifstream readFile(fileName, std::ios::binary);
-    if(!readFile.is_open()) {
-        std::cerr<<"Error: Cant File Open"<<std::endl;
-        throw "File Open Error";
-    }
-
-    // ヘッダを読み込む
-    ReadWindowsBitmapHeader(readFile);
-
-    // Bitmapファイルかチェック
-    if(_header.bitmapFileHeader.bfType != ('B'|('M'<<8))){
-        std::cerr<<"Error: This is not Bitmap Image"<<std::endl;
-        throw "File Open Error";
-    }
-
-    // Windows Bitmap がチェック (biSizeが40ならWindowsBitmap)
-    if(_header.bitmapInfoHeader.biSize != 40 &&
-       _header.bitmapInfoHeader.biSize !=108 &&
-       _header.bitmapInfoHeader.biSize !=124 ) {
-        std::cerr<<"Error: This is not Windows Bitmap"<<std::endl;
-        throw "File Open Error";
-    }
-    
-    // 8,24,32bitではない場合
-    if( Bit()!=8 && Bit()!=24 && Bit()!=32 ) {
-        std::cerr<<"Error: Not Supported Bitmap"<<std::endl;
-        throw "File Open Error";
-    }
-
-    // パレットの読み込み
-    ReadBitmapPalette(readFile);
+    // ファイルを開いてヘッダとパレットを読み込む
+    std::ifstream readFile;
+    Open(readFile, fileName);
 
     // 領域の再確保
     int width = _header.bitmapInfoHeader.biWidth;
@@ -148,6 +115,152 @@ void Bitmap::CopyFromImage(Image& image){
 }
 
 
+//------------------------------------------------------------------------------
+// ファイルを image に直接読み込む
+//   1行ずつ読み込んで image の行に変換するので, 画素を Bitmap に持たない
+//------------------------------------------------------------------------------
+void Bitmap::Load(const char* fileName, Image& image) {
+
+    Bitmap bitmap;
+    std::ifstream file;
+    bitmap.Open(file, fileName);
+
+    const int byte   = bitmap.Bit()/8;
+    const int width  = bitmap.Width();
+    const int height = abs(bitmap.Height());
+
+    // 画像のサイズが違ったら再確保
+    if(image.Width() != width || image.Height() != height) {
+        image = Image(bitmap.Bit(), width, height);
+    }
+
+    RGB* data = image.data;
+    const RGBQUAD* palette = bitmap._palette;
+
+    bitmap.ReadRows(file, [&](int iY, const unsigned char* src) {
+        RGB* dst = data + iY*width;
+
+        if(byte == 1) {
+            for(int iX=0; iX<width; iX++) {
+                const RGBQUAD& color = palette[src[iX]];
+                dst[iX].r = color.r;
+                dst[iX].g = color.g;
+                dst[iX].b = color.b;
+            }
+            return;
+        }
+
+        for(int iX=0; iX<width; iX++, src+=byte) {
+            dst[iX].r = src[2];
+            dst[iX].g = src[1];
+            dst[iX].b = src[0];
+        }
+    });
+}
+
+
+//------------------------------------------------------------------------------
+// image をファイルに直接書き込む
+//------------------------------------------------------------------------------
+void Bitmap::Save(const char* fileName, const ImageView& image) {
+
+    Bitmap bitmap;
+    bitmap.SetHeader(image.Bit(), image.Width(), image.Height());
+
+    const int byte  = bitmap.Bit()/8;
+    const int width = image.Width();
+
+    // ファイルを開く
+    std::ofstream file(fileName, std::ios::binary | std::ios::trunc | std::ios::out);
+
+    // ヘッダとパレットを書き込む
+    bitmap.WriteWindowsBitmapHeader(file);
+    bitmap.WriteBitmapPalette(file);
+
+    // 画素の書き込み (8bit はグレースケールのパレットの番号として B を書く)
+    bitmap.WriteRows(file, [&](int iY, unsigned char* dst) {
+        const RGB* src = image.Row(iY);
+
+        if(byte == 1) {
+            for(int iX=0; iX<width; iX++) {
+                dst[iX] = src[iX].b;
+            }
+            return;
+        }
+
+        for(int iX=0; iX<width; iX++, dst+=byte) {
+            dst[0] = src[iX].b;
+            dst[1] = src[iX].g;
+            dst[2] = src[iX].r;
+        }
+    });
+
+    file.close();
+}
+
+
+//------------------------------------------------------------------------------
+// ヘッダとパレットを設定する
+//------------------------------------------------------------------------------
+void Bitmap::SetHeader(int bit, int width, int height) {
+
+    _header.bitmapInfoHeader.biBitCount = bit;
+    _header.bitmapInfoHeader.biWidth    = width;
+    _header.bitmapInfoHeader.biHeight   = height;
+
+    // パレットをグレースケールで生成
+    for(auto i=0; i<sizeof(_palette)/sizeof(_palette[0]); i++) {
+        _palette[i].r = _palette[i].g = _palette[i].b = i;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// ファイルを開いてヘッダとパレットを読み込み, 画素の先頭に移動する
+//------------------------------------------------------------------------------
+void Bitmap::Open(std::ifstream& file, const char* fileName) {
+
+    // ファイルを開く
+    file.open(fileName, std::ios::binary);
+    if(!file.is_open()) {
+        std::cerr<<"Error: Cant File Open"<<std::endl;
+        throw "File Open Error";
+    }
+
+    // ヘッダを読み込む
+    ReadWindowsBitmapHeader(file);
+
+    // Bitmapファイルかチェック
+    if(_header.bitmapFileHeader.bfType != ('B'|('M'<<8))){
+        std::cerr<<"Error: This is not Bitmap Image"<<std::endl;
+        throw "File Open Error";
+    }
+
+    // Windows Bitmap がチェック (biSizeが40ならWindowsBitmap)
+    if(_header.bitmapInfoHeader.biSize != 40 &&
+       _header.bitmapInfoHeader.biSize !=108 &&
+       _header.bitmapInfoHeader.biSize !=124 ) {
+        std::cerr<<"Error: This is not Windows Bitmap"<<std::endl;
+        throw "File Open Error";
+    }
+    
+    // 8,24,32bitではない場合
+    if( Bit()!=8 && Bit()!=24 && Bit()!=32 ) {
+        std::cerr<<"Error: Not Supported Bitmap"<<std::endl;
+        throw "File Open Error";
+    }
+
+    // パレットの読み込み
+    ReadBitmapPalette(file);
+
+    // 画素の先頭へ移動する (パレットとの間に隙間がある場合がある)
+    //   パレットより前を指すファイル (bfOffBits を 54 のままにした 8bit など) は移動しない
+    if(_header.bitmapFileHeader.bfOffBits > (unsigned int)file.tellg()) {
+        file.seekg(_header.bitmapFileHeader.bfOffBits);
+    }
+}
+
+
 //------------------------------------------------------------------------------
 // ヘッダを読み込む
 //------------------------------------------------------------------------------
@@ -219,18 +332,19 @@ void Bitmap::ReadWindowsBitmapHeader(std::ifstream& file) {
 //------------------------------------------------------------------------------
 void Bitmap::WriteWindowsBitmapHeader(std::ofstream& file) {
 
-    auto byte  = Bit()/8;  // 1画素のByte数
     auto width = Width();  // 画像の幅
     auto height= Height(); // 画像の高さ
 
-    auto imageSize = (byte*width + (byte*Width())%4) * height;
+    auto imageSize = RowBytes() * height;              // パディングを含む画素のByte数
+    auto colors    = 0x01ff & (0x01 << Bit());         // パレットの色数 (8bit は 256, それ以外は 0)
+    auto offset    = 14 + 40 + colors*sizeof(RGBQUAD); // ファイルの先頭から画素までのByte数
 
     // ヘッダに書き込む値を設定
     _header.bitmapFileHeader.bfType = 'B'|('M'<<8);
-    _header.bitmapFileHeader.bfSize = 54 + imageSize;
+    _header.bitmapFileHeader.bfSize = offset + imageSize;
     _header.bitmapFileHeader.bfReserved1 = 0;
     _header.bitmapFileHeader.bfReserved2 = 0;
-    _header.bitmapFileHeader.bfSize = 54 + imageSize;
+    _header.bitmapFileHeader.bfOffBits   = offset;
 
     _header.bitmapInfoHeader.biSize         = 40;
     _header.bitmapInfoHeader.biWidth        = width;
@@ -240,7 +354,7 @@ void Bitmap::WriteWindowsBitmapHeader(std::ofstream& file) {
     _header.bitmapInfoHeader.biSizeImage    = imageSize;
     _header.bitmapInfoHeader.biXPixPerMeter = 3780;
     _header.bitmapInfoHeader.biYPixPerMeter = 3780;
-    _header.bitmapInfoHeader.biClrUsed      = 0x01ff & (0x01 << Bit());
+    _header.bitmapInfoHeader.biClrUsed      = colors;
     _header.bitmapInfoHeader.biClrImportant = 0;
 
 
@@ -272,7 +386,13 @@ void Bitmap::WriteWindowsBitmapHeader(std::ofstream& file) {
 //------------------------------------------------------------------------------
 void Bitmap::ReadBitmapPalette(std::ifstream& file) {
      // 24,32bitのときは biClrUsed=0 なので実際は読み込まないのと同じ
-     file.read((char*)_palette, _header.bitmapInfoHeader.biClrUsed*sizeof(RGBQUAD));
+     // 8bit で biClrUsed=0 の場合は 256 色ある
+     unsigned int colors = _header.bitmapInfoHeader.biClrUsed;
+     if(colors == 0 && Bit() == 8) {
+         colors = 256;
+     }
+     colors = std::min(colors, (unsigned int)(sizeof(_palette)/sizeof(_palette[0])));
+     file.read((char*)_palette, colors*sizeof(RGBQUAD));
 }
 
 //------------------------------------------------------------------------------
@@ -290,41 +410,25 @@ void Bitmap::ReadBitmapImage(std::ifstream& file) {
 
     auto byte  = Bit()/8;              // 1画素のByte数
     auto width = Width();              // 画像の幅
-    auto height= Height();             // 画像の高さ
-
-    const int readWidth   = byte * width;      // 横1ラインのサイズ
-    const int paddingSize = (4-readWidth%4)%4; // 横のサイズ4byteに揃えるための大きさ
-
-    int iX, iY, padding = 0;
 
-    // height が 正の数なら左下から読み込む
-    if(height > 0) {
-        // 読み込み
-        for(iY=height-1; iY>=0; iY--){
+    ReadRows(file, [&](int iY, const unsigned char* src) {
+        RGBQUAD* dst = _pixels + width*iY;
 
-            // 1行分読み込み
-            for(iX=0; iX<width; iX++){
-                file.read((char*)&_pixels[width*iY + iX], byte);
+        // 8bit はパレットの色にする
+        if(byte == 1) {
+            for(int iX=0; iX<width; iX++) {
+                dst[iX] = _palette[src[iX]];
             }
-
-            // 4byteに揃えるための部分をから読みして飛ばす
-            file.read((char*)&padding, paddingSize);
+            return;
         }
-    }
-    //  そうでなければ左上から読み込む
-    else {
-        // 読み込み
-        for(iY=0; iY<-height; iY++){
-
-            // 1行分読み込み
-            for(iX=0; iX<width; iX++){
-                file.read((char*)&_pixels[width*iY + iX], byte);
-            }
 
-            // 4byteに揃えるための部分をから読みして飛ばす
-            file.read((char*)&padding, paddingSize);
-        }        
-    }
+        for(int iX=0; iX<width; iX++, src+=byte) {
+            dst[iX].b = src[0];
+            dst[iX].g = src[1];
+            dst[iX].r = src[2];
+            if(byte == 4) dst[iX].reserved = src[3];
+        }
+    });
 }
 
 
@@ -334,24 +438,67 @@ void Bitmap::ReadBitmapImage(std::ifstream& file) {
 void Bitmap::WriteBitmapImage(std::ofstream& file) {
 
     auto byte  = Bit()/8;              // 1画素のByte数
-    auto height= Height();             // 画像の高さ 
     auto width = Width();              // 画像の幅
 
-    auto writeWidth  = byte * width;      // 横1ラインのサイズ
-    auto paddingSize = (4-writeWidth%4)%4; // 横のサイズ4byteに揃えるための大きさ
+    WriteRows(file, [&](int iY, unsigned char* dst) {
+        const RGBQUAD* src = _pixels + width*iY;
+
+        // 8bit はグレースケールのパレットの番号として B を書く
+        if(byte == 1) {
+            for(int iX=0; iX<width; iX++) {
+                dst[iX] = src[iX].b;
+            }
+            return;
+        }
+
+        for(int iX=0; iX<width; iX++, dst+=byte) {
+            dst[0] = src[iX].b;
+            dst[1] = src[iX].g;
+            dst[2] = src[iX].r;
+            if(byte == 4) dst[3] = src[iX].reserved;
+        }
+    });
+}
+
+
+//------------------------------------------------------------------------------
+// 1行ずつ読み込む
+//   1行 (パディングを含む) を 1 回で読み込む
+//------------------------------------------------------------------------------
+template<class RowFunction>
+void Bitmap::ReadRows(std::ifstream& file, RowFunction row) {
 
-    int iX, iY, padding = 0;
+    const int height = Height();
+    const int rows   = abs(height);
 
-    // 書き込み
-    for(iY=height-1; iY>=0; iY--){
+    std::vector<unsigned char> buffer(RowBytes());
 
-        // 1行分書き込み
-        for(iX=0; iX<width; iX++){
-            file.write((char*)&_pixels[width*iY + iX], byte);
+    for(int i=0; i<rows; i++) {
+        file.read((char*)buffer.data(), buffer.size());
+
+        // 途中で終わっているファイルは残りを 0 にする
+        if(!file) {
+            std::fill(buffer.begin() + (size_t)file.gcount(), buffer.end(), 0);
         }
 
-        // 4byteに揃えるため0で埋める
-        file.write((char*)&padding, paddingSize);
+        // height が 正の数なら左下から並んでいる
+        row(height > 0 ? rows-1-i : i, buffer.data());
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// 1行ずつ書き込む
+//   左下から, 1行 (0 で埋めたパディングを含む) を 1 回で書き込む
+//------------------------------------------------------------------------------
+template<class RowFunction>
+void Bitmap::WriteRows(std::ofstream& file, RowFunction row) {
+
+    std::vector<unsigned char> buffer(RowBytes(), 0);
+
+    for(int iY=Height()-1; iY>=0; iY--) {
+        row(iY, buffer.data());
+        file.write((char*)buffer.data(), buffer.size());
     }
 }
 
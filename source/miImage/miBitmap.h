@@ -49,6 +49,18 @@ public:
     void CopyToImage(Image& image);
     void CopyFromImage(Image& image);
 
+
+    //--------------------------------------------------------------------------
+    // @brief ファイルを image に直接読み込む (Bitmap に画素を持たない)
+    //   image の大きさが違う場合は作り直す
+    //--------------------------------------------------------------------------
+    static void Load(const char* fileName, Image& image);
+
+    //--------------------------------------------------------------------------
+    // @brief image をファイルに直接書き込む (部分画像でもよい)
+    //--------------------------------------------------------------------------
+    static void Save(const char* fileName, const ImageView& image);
+
 private:
     // 使えないようにする
     Bitmap(){};
@@ -100,6 +112,16 @@ private:
     // 画素データ
     RGBQUAD* _pixels = nullptr;
 
+    //--------------------------------------------------------------------------
+    // ヘッダとパレットを設定する (パレットはグレースケール)
+    //--------------------------------------------------------------------------
+    void SetHeader(int bit, int width, int height);
+
+    //--------------------------------------------------------------------------
+    // ファイルを開いてヘッダとパレットを読み込み, 画素の先頭に移動する
+    //--------------------------------------------------------------------------
+    void Open(std::ifstream& file, const char* fileName);
+
     //--------------------------------------------------------------------------
     // WindowsBitmapheader の読み込み・書き込み
     //--------------------------------------------------------------------------
@@ -117,6 +139,17 @@ private:
     //--------------------------------------------------------------------------
     void ReadBitmapImage(std::ifstream& file);
     void WriteBitmapImage(std::ofstream& file);
+
+    //--------------------------------------------------------------------------
+    // 1行ずつ読み込み・書き込み
+    //   ファイルの行の順に, 画像の行番号 iY と 1 行分のデータ (パディングを含む) を
+    //   row(iY, bytes) に渡す. 下から並んだ (biHeight が正の) ファイルも上から並べる
+    //--------------------------------------------------------------------------
+    template<class RowFunction> void ReadRows(std::ifstream& file, RowFunction row);
+    template<class RowFunction> void WriteRows(std::ofstream& file, RowFunction row);
+
+    // ファイルの 1 行のバイト数 (4byte に揃えるためのパディングを含む)
+    int RowBytes() { return (Bit()/8 * Width() + 3) / 4 * 4; }
 };
 
 }
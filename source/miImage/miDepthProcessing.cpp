@@ -4,11 +4,16 @@
 //
 //==============================================================================
 #include "miDepthProcessing.h"
+#include "miHistogramMedian.h"
+#include "miBilateralGrid.h"
+#include "miArena.h"
 
 #include <vector>
 #include <thread>
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <memory>
 
 namespace mi {
 
@@ -64,25 +69,36 @@ struct dRGB {
 //------------------------------------------------------------------------------
 LogisticFilter::LogisticFilter(Image& image, double paramA, double paramB) {
 
+    PointOperation operation = Operation(paramA, paramB);
+
+    // 処理本体
+    Processing = [&](int start, int length) {
+        operation(image.data + start, length);
+    };
+
+    // Processingの処理をおこなう
+    Run(image, std::thread::hardware_concurrency());
+}
+
+PointOperation LogisticFilter::Operation(double paramA, double paramB) {
+
     // 参照テーブル
-    unsigned char LUT[256];
+    std::shared_ptr<unsigned char> table(new unsigned char[256], std::default_delete<unsigned char[]>());
+    unsigned char* LUT = table.get();
 
     // 参照テーブル作成
     for(int i=0; i<256; i++) {
         LUT[i] = (unsigned char)( 255/(1+exp(-paramA*(i-paramB))) );
     }
 
-    // 処理本体
-    Processing = [&](int start, int length) {
-        for(int i=start; i<start+length; i++) {
-            image.data[i].r = LUT[image.data[i].r];
-            image.data[i].g = LUT[image.data[i].g];
-            image.data[i].b = LUT[image.data[i].b];
+    return [table](RGB* pixels, int length) {
+        const unsigned char* LUT = table.get();
+        for(int i=0; i<length; i++) {
+            pixels[i].r = LUT[pixels[i].r];
+            pixels[i].g = LUT[pixels[i].g];
+            pixels[i].b = LUT[pixels[i].b];
         }
     };
-
-    // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
 }
 
 
@@ -90,71 +106,137 @@ LogisticFilter::LogisticFilter(Image& image, double paramA, double paramB) {
 // MedianTS フィルタ 時間方向を含めたメディアンフィルタ
 //------------------------------------------------------------------------------
 MedianTSFilter::MedianTSFilter(Image& image,
-                               std::vector<Image> inputs, int filterSize) {
+                               const std::vector<Image>& inputs, int filterSize,
+                               MedianMethod method) {
+
+    int halfSize = filterSize/2;
+
+    // 入力 (出力が入力のどれかと同じ画像ならそれだけコピー)
+    ImagePool::Buffer copy;
+    std::vector<ImageView> frames;
+
+    for(auto& images : inputs) {
+        if(&images == &image) {
+            if(!copy) copy = ImagePool::Shared().Copy(image);
+            frames.push_back(*copy);
+        }
+        else {
+            frames.push_back(images.View());
+        }
+    }
+
+    if(method == MEDIAN_AUTO) {
+        method = HistogramMedian::IsFaster(filterSize, (int)inputs.size())
+               ? MEDIAN_HISTOGRAM : MEDIAN_SORT;
+    }
+
+    // ヒストグラムによるメディアン
+    // 全フレームを同じ列ヒストグラムに入れるので, 各フレームの画素は行の移動で 1 回ずつ足し引きされる
+    if(method == MEDIAN_HISTOGRAM) {
+        TileProcessing = [&](int x0, int y0, int x1, int y1) {
+            HistogramMedian median(frames, filterSize);
+            median.Process(image, x0, y0, x1, y1);
+        };
+
+        RunTiled(image, halfSize);
+        return;
+    }
 
     // 画像処理本体
-    Processing = [&](int start, int length) {
+    TileProcessing = [&](int x0, int y0, int x1, int y1) {
 
-        int halfSize = filterSize/2;
+        const int W = image.Width();
+        const int H = image.Height();
         int sqrSize  = filterSize*filterSize;
 
-        unsigned char* R = new unsigned char[sqrSize*inputs.size()];
-        unsigned char* G = new unsigned char[sqrSize*inputs.size()];
-        unsigned char* B = new unsigned char[sqrSize*inputs.size()];
+        Arena& arena = Arena::Local();
+        Arena::Scope scope(arena);
+
+        unsigned char* R = arena.Allocate<unsigned char>(sqrSize*inputs.size());
+        unsigned char* G = arena.Allocate<unsigned char>(sqrSize*inputs.size());
+        unsigned char* B = arena.Allocate<unsigned char>(sqrSize*inputs.size());
 
-        for(int i=start; i<start+length; i++) {
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+        for(int iY=y0; iY<y1; iY++) {
+            for(int iX=x0; iX<x1; iX++) {
 
-            int pixelCount = 0;
+                int pixelCount = 0;
 
-            for(int j=0; j<sqrSize; j++){
-                int jX = iX + j%filterSize - halfSize;
-                int jY = iY + j/filterSize - halfSize;
+                for(int dy=0; dy<filterSize; dy++) {
+                    int jY = iY + dy - halfSize;
+                    if(jY<0 || jY>=H) continue;
 
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
+                    for(int dx=0; dx<filterSize; dx++) {
+                        int jX = iX + dx - halfSize;
+                        if(jX<0 || jX>=W) continue;
 
-                for(auto& images : inputs) {
-                    R[pixelCount] = images.pixel[jX][jY].r;
-                    G[pixelCount] = images.pixel[jX][jY].g;
-                    B[pixelCount] = images.pixel[jX][jY].b;
-                    pixelCount++;
+                        for(const ImageView& images : frames) {
+                            const RGB& src = images(jX, jY);
+                            R[pixelCount] = src.r;
+                            G[pixelCount] = src.g;
+                            B[pixelCount] = src.b;
+                            pixelCount++;
+                        }
+                    }
                 }
-            }
 
-            std::sort(R, R+pixelCount);
-            std::sort(G, G+pixelCount);
-            std::sort(B, B+pixelCount);
+                // 中央の値だけわかればよい
+                int k = pixelCount/2;
+                std::nth_element(R, R+k, R+pixelCount);
+                std::nth_element(G, G+k, G+pixelCount);
+                std::nth_element(B, B+k, B+pixelCount);
 
-            image.pixel[iX][iY].r = R[pixelCount/2];
-            image.pixel[iX][iY].g = G[pixelCount/2];
-            image.pixel[iX][iY].b = B[pixelCount/2];
+                RGB& dst = image.data[iY*W + iX];
+                dst.r = R[k];
+                dst.g = G[k];
+                dst.b = B[k];
+            }
         }
-
-        delete[] R;
-        delete[] G;
-        delete[] B;
     };
 
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunTiled(image, halfSize);
 }
 
 
 //------------------------------------------------------------------------------
 // Trilateral フィルタ
 //------------------------------------------------------------------------------
-TrilateralFilter::TrilateralFilter(Image& image, Image& reference,
-                            int filterSize, double sigma, double sigma2) {
+TrilateralFilter::TrilateralFilter(const ImageView& source, const ImageView& reference, const ImageView& image,
+                            int filterSize, double sigma, double sigma2,
+                            BilateralMethod method) {
 
     int halfSize = filterSize/2;
 
+    // 入力 (出力と重なるならコピー)
+    ImagePool::Buffer buffer;
+    const ImageView copy = Source(source, image, buffer);
+
+    // 参照画像 (入力と同じならそのコピーを使い, 出力と重なるならコピー)
+    ImagePool::Buffer referenceCopy;
+    ImageView guide = copy;
+    if(reference.data != source.data || reference.Stride() != source.Stride()) {
+        guide = Source(reference, image, referenceCopy);
+    }
+
+    // bilateral grid による近似 (reference で重み付けする)
+    if(method == BILATERAL_GRID) {
+        BilateralGrid grid(guide, copy, sigma, sigma2);
+
+        TileProcessing = [&](int x0, int y0, int x1, int y1){
+            grid.Slice(image, y0, y1);
+        };
+
+        RunTiled(image, 0);
+        return;
+    }
+
     // パラメータ
     double sig = 2 * sigma * sigma;
     double sig2= 2 * sigma2 * sigma2;
 
-    // マスクの生成
-    double* LUT = new double[filterSize*filterSize];
+    // マスクの生成 (作業領域はこのスレッドのアリーナから借りる)
+    Arena::Scope scope(Arena::Local());
+    double* LUT = Arena::Local().Allocate<double>(filterSize*filterSize);
 
     for(int i=0; i<filterSize*filterSize; i++) {
         int iX = i%filterSize-halfSize;
@@ -162,49 +244,64 @@ TrilateralFilter::TrilateralFilter(Image& image, Image& reference,
         LUT[ i ] = exp(-(iX*iX+iY*iY)/sig);
     }
 
-    // コピー
-    Image copy = image;
+    // 参照画像の輝度差の重み (差は RGB の引き算なので 256 で折り返した値で引く)
+    double rangeLUT[256];
+
+    for(int i=0; i<256; i++) {
+        double d = i;
+        rangeLUT[i] = exp( d*d / -sig2 );
+    }
 
     // 処理本体
-    Processing = [&](int start, int length){
+    TileProcessing = [&](int x0, int y0, int x1, int y1){
 
-        for(int i=start; i<start + length; i++) {
+        const int W = image.Width();
+        const int H = image.Height();
 
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+        for(int iY=y0; iY<y1; iY++) {
+            for(int iX=x0; iX<x1; iX++) {
 
-            dRGB sum; // ピクセルとの計算結果合計値
-            dRGB div; // 正規化用のフィルタ値合計
+                RGB& center = guide(iX, iY);
 
-            for(int j=0; j<filterSize*filterSize; j++) {
-                int jX = iX + j%filterSize - halfSize;
-                int jY = iY + j/filterSize - halfSize;
+                dRGB sum; // ピクセルとの計算結果合計値
+                dRGB div; // 正規化用のフィルタ値合計
 
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
+                for(int dy=0; dy<filterSize; dy++) {
+                    int jY = iY + dy - halfSize;
+                    if(jY<0 || jY>=H) continue;
 
-                dRGB diff   = reference.pixel[iX][iY] - reference.pixel[jX][jY];
-                dRGB weight = dRGB::exp( diff*diff / -sig2 );
-                dRGB filter = weight * LUT[j];
+                    RGB* ref = guide.Row(jY);
+                    RGB* src = copy.Row(jY);
+                    const double* mask = LUT + dy*filterSize;
 
-                sum += filter * copy.pixel[jX][jY];
-                div += filter;
-            }
+                    for(int dx=0; dx<filterSize; dx++) {
+                        int jX = iX + dx - halfSize;
+                        if(jX<0 || jX>=W) continue;
 
-            image.pixel[iX][iY] = RGB(sum.r/div.r, sum.g/div.g, sum.b/div.b);
+                        RGB  diff = center - ref[jX];
+                        dRGB weight(rangeLUT[diff.r], rangeLUT[diff.g], rangeLUT[diff.b]);
+                        dRGB filter = weight * mask[dx];
+
+                        sum += filter * src[jX];
+                        div += filter;
+                    }
+                }
+
+                image(iX, iY) = RGB(sum.r/div.r, sum.g/div.g, sum.b/div.b);
+            }
         }
     };
 
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
-
-    delete[] LUT;
+    RunTiled(image, halfSize);
 }
 
 //------------------------------------------------------------------------------
 // Quadrilateral フィルタ
 //------------------------------------------------------------------------------
 QuadrilateralFilter::QuadrilateralFilter(Image& image,
-                Image color, Image laser, Image camera, int filterSize) {
+                const Image& colorImage, const Image& laserImage, const Image& cameraImage,
+                int filterSize) {
 
     int halfSize = filterSize/2;
 
@@ -217,10 +314,19 @@ QuadrilateralFilter::QuadrilateralFilter(Image& image,
     double sig3= sigma3 * sigma3;
 
     // カラー画像をモノクロ化
-    mi::Monochrome::Process(color);
+    ImagePool::Buffer colorBuffer = ImagePool::Shared().Copy(colorImage.View());
+    mi::Monochrome::Process(*colorBuffer);
+    const Image& color = *colorBuffer;
     
     // カメラ画像のノイズ除去
-    mi::MedianFilter::Process(camera, 5);
+    ImagePool::Buffer cameraBuffer = ImagePool::Shared().Acquire(cameraImage.Bit(), cameraImage.Width(), cameraImage.Height());
+    mi::MedianFilter::Process(cameraImage, *cameraBuffer, 5);
+    const Image& camera = *cameraBuffer;
+    
+    // レーザ画像 (出力と同じ画像ならコピー)
+    ImagePool::Buffer laserBuffer;
+    if(&laserImage == &image) laserBuffer = ImagePool::Shared().Copy(laserImage.View());
+    const Image& laser = laserBuffer ? *laserBuffer : laserImage;
 
     // ヒストグラム
 //    mi::HistgramEqualization::Process(laser);
@@ -228,77 +334,121 @@ QuadrilateralFilter::QuadrilateralFilter(Image& image,
 //    laser.Save("histgram_laser.bmp");
 //    camera.Save("histgram_camera.bmp");
     
-    Image sub = image;
-    
+    ImagePool::Buffer subBuffer = ImagePool::Shared().Acquire(image.Bit(), image.Width(), image.Height());
+    Image& sub = *subBuffer;
     
-    // 処理本体
-    Processing = [&](int start, int length) {
+    // 重みの参照テーブル
+    //   画素値の差は RGB の引き算 (256 で折り返す) なので 0~255 の整数で引ける
+    //   カメラとカラーの差は積で使うので組み合わせごとに持つ
+    struct LaserWeight { double a, b; };      // exp(l^2/-sig2), 1-exp(l^2/-sig3)
+    struct EdgeWeight  { double weight, oneMinusWeight, a, b; };
 
-        for(int i=start; i<start+length; i++) {
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+    Arena::Scope scope(Arena::Local());
+    LaserWeight* laserLUT = Arena::Local().Allocate<LaserWeight>(256);
+    EdgeWeight*  edgeLUT  = Arena::Local().Allocate<EdgeWeight>(256*256);
 
-            dRGB sumA; // ピクセルとの計算結果合計値
-            dRGB sumB;
-            dRGB div;  // 正規化用のフィルタ値合計
-            
-            dRGB suA;
-            dRGB suB;
+    for(int i=0; i<256; i++) {
+        double l = (double)i / 255;
+        laserLUT[i].a = std::exp(l*l/-sig2);
+        laserLUT[i].b = 1.0 - std::exp(l*l/-sig3);
+    }
 
-            for(int j=0; j<filterSize*filterSize; j++) {
-                int jX = iX + j%filterSize - halfSize;
-                int jY = iY + j/filterSize - halfSize;
+    for(int i=0; i<256; i++) {
+        for(int j=0; j<256; j++) {
+            double edge = ((double)i / 255) * ((double)j / 255);
+            EdgeWeight& e = edgeLUT[i*256 + j];
+            e.weight         = 1.0 - std::exp(edge/-sig);
+            e.oneMinusWeight = 1.0 - e.weight;
+            e.a              = std::exp(edge/-sig2);
+            e.b              = std::exp(edge/-sig3);
+        }
+    }
+    
+    // 処理本体
+    TileProcessing = [&](int x0, int y0, int x1, int y1) {
 
-                if( jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
-                
-                dRGB one(1,1,1);
+        const int W = image.Width();
+        const int H = image.Height();
 
-                dRGB laserDiff = dRGB::abs(laser.pixel[iX][iY] - laser.pixel[jX][jY]) / 255;
-                dRGB colorDiff = dRGB::abs(color.pixel[iX][iY] - color.pixel[jX][jY]) / 255;
-                dRGB cameraDiff= dRGB::abs(camera.pixel[iX][iY]- camera.pixel[jX][jY])/ 255;
-                //dRGB camLsrDiff = dRGB::abs(camera.pixel[iX][iY]-laser.pixel[iX][iY]) / 255;
+        for(int iY=y0; iY<y1; iY++) {
+            for(int iX=x0; iX<x1; iX++) {
 
-                
-                // カラーとカメラのが両方ともエッジを検出しないと weight が小さくなる
-                // 両方ともエッジを検出すると weight が大きくなる
-                dRGB weight = one - dRGB::exp(cameraDiff*colorDiff/-sig);
+                const int i = iY*W + iX;
 
-                // レーザとカメラのエッジを検出しない画素からの色
-                dRGB a = dRGB::exp(laserDiff*laserDiff/-sig2) * dRGB::exp(cameraDiff*colorDiff/-sig2);
+                dRGB sumA; // ピクセルとの計算結果合計値
+                dRGB sumB;
+                dRGB div;  // 正規化用のフィルタ値合計
                 
-                // レーザのエッジを検出し、カメラのエッジを検出しない画素からの色
-                dRGB b = (one - dRGB::exp(laserDiff*laserDiff/-sig3)) * dRGB::exp(cameraDiff*colorDiff/-sig3);
-                
-
-                sumA += a * laser.pixel[jX][jY] * (one-weight);
-                sumB += b * laser.pixel[jX][jY] * weight;
-                div += a*(one-weight) + b*weight;
+                dRGB suA;
+                dRGB suB;
+
+                for(int dy=0; dy<filterSize; dy++) {
+                    int jY = iY + dy - halfSize;
+                    if(jY<0 || jY>=H) continue;
+
+                    for(int dx=0; dx<filterSize; dx++) {
+                        int jX = iX + dx - halfSize;
+                        if(jX<0 || jX>=W) continue;
+
+                        const int j = jY*W + jX;
+                        
+                        // カメラ画像とカラー画像の差 (index), レーザ画像の差
+                        const RGB cameraDiff = camera.data[i] - camera.data[j];
+                        const RGB colorDiff  = color.data[i]  - color.data[j];
+                        const RGB laserDiff  = laser.data[i]  - laser.data[j];
+
+                        const EdgeWeight* edge[3] = {
+                            &edgeLUT[cameraDiff.r*256 + colorDiff.r],
+                            &edgeLUT[cameraDiff.g*256 + colorDiff.g],
+                            &edgeLUT[cameraDiff.b*256 + colorDiff.b],
+                        };
+                        const LaserWeight* lsr[3] = {
+                            &laserLUT[laserDiff.r], &laserLUT[laserDiff.g], &laserLUT[laserDiff.b],
+                        };
+
+                        // カラーとカメラのが両方ともエッジを検出しないと weight が小さくなる
+                        // 両方ともエッジを検出すると weight が大きくなる
+                        dRGB weight(edge[0]->weight, edge[1]->weight, edge[2]->weight);
+                        dRGB oneMinusWeight(edge[0]->oneMinusWeight, edge[1]->oneMinusWeight, edge[2]->oneMinusWeight);
+
+                        // レーザとカメラのエッジを検出しない画素からの色
+                        dRGB a(lsr[0]->a * edge[0]->a, lsr[1]->a * edge[1]->a, lsr[2]->a * edge[2]->a);
+                        
+                        // レーザのエッジを検出し、カメラのエッジを検出しない画素からの色
+                        dRGB b(lsr[0]->b * edge[0]->b, lsr[1]->b * edge[1]->b, lsr[2]->b * edge[2]->b);
+                        
+
+                        sumA += a * laser.data[j] * oneMinusWeight;
+                        sumB += b * laser.data[j] * weight;
+                        div += a*oneMinusWeight + b*weight;
+                        
+                        suA += a * oneMinusWeight;
+                        suB += b * weight;
+                    }
+                }
                 
-                suA += a * (one-weight);
-                suB += b * weight;
-            }
-            
-            dRGB sum = (sumA+sumB) / div;
+                dRGB sum = (sumA+sumB) / div;
 
-            image.pixel[iX][iY].r = sum.r;
-            image.pixel[iX][iY].g = sum.g;
-            image.pixel[iX][iY].b = sum.b;
+                image.data[i].r = sum.r;
+                image.data[i].g = sum.g;
+                image.data[i].b = sum.b;
 
-            dRGB sA = sumA / div;
-            dRGB sB = sumB / div;
+                dRGB sA = sumA / div;
+                dRGB sB = sumB / div;
 
-            //dRGB sA = suA/div*255.0;//sumA / div;
-            //dRGB sB = suB/div*255.0;//sumB / div;
+                //dRGB sA = suA/div*255.0;//sumA / div;
+                //dRGB sB = suB/div*255.0;//sumB / div;
  
-            sub.pixel[iX][iY].r = sA.r;
-            sub.pixel[iX][iY].g = sB.g;
-            sub.pixel[iX][iY].b = sB.b;
+                sub.data[i].r = sA.r;
+                sub.data[i].g = sB.g;
+                sub.data[i].b = sB.b;
+            }
         }
     };
     
 
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunTiled(image, halfSize);
     
     
     sub.Save("depth_output_sub.bmp");
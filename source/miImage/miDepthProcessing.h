@@ -21,6 +21,7 @@ public:
     static void Process(Image& image, double paramA, double paramB) {
         LogisticFilter filter(image, paramA, paramB);
     }
+    static PointOperation Operation(double paramA, double paramB);
 };
 
 
@@ -29,23 +30,46 @@ public:
 //------------------------------------------------------------------------------
 class MedianTSFilter : IImageProcessing {
 public:
-    MedianTSFilter(Image& image, std::vector<Image> inputs, int filterSize);
-    static void Process(Image& image, std::vector<Image> inputs, int filterSize) {
-        MedianTSFilter filter(image, inputs, filterSize);
+    MedianTSFilter(Image& image, const std::vector<Image>& inputs, int filterSize,
+                   MedianMethod method = MEDIAN_AUTO);
+    static void Process(Image& image, const std::vector<Image>& inputs, int filterSize,
+                        MedianMethod method = MEDIAN_AUTO) {
+        MedianTSFilter filter(image, inputs, filterSize, method);
     }
 };
 
     
 //------------------------------------------------------------------------------
 // Trilateral フィルタ
+//   ImageView を渡す場合は source, reference, image が同じ大きさであること
 //------------------------------------------------------------------------------
 class TrilateralFilter : IImageProcessing {
 public:
-    TrilateralFilter(Image& image, Image& reference,
-                     int filterSize, double sigma, double sigma2);
-    static void Process(Image& image, Image& reference,
-                        int filterSize, double sigma, double sigma2) {
-        TrilateralFilter filter(image, reference, filterSize, sigma, sigma2);
+    TrilateralFilter(const ImageView& source, const ImageView& reference, const ImageView& image,
+                     int filterSize, double sigma, double sigma2,
+                     BilateralMethod method = BILATERAL_EXACT);
+    TrilateralFilter(const Image& source, const Image& reference, Image& image,
+                     int filterSize, double sigma, double sigma2,
+                     BilateralMethod method = BILATERAL_EXACT)
+        : TrilateralFilter(source.View(), reference.View(), Output(source, image), filterSize, sigma, sigma2, method) {}
+    TrilateralFilter(Image& image, const Image& reference,
+                     int filterSize, double sigma, double sigma2,
+                     BilateralMethod method = BILATERAL_EXACT)
+        : TrilateralFilter(image, reference, image, filterSize, sigma, sigma2, method) {}
+    static void Process(Image& image, const Image& reference,
+                        int filterSize, double sigma, double sigma2,
+                        BilateralMethod method = BILATERAL_EXACT) {
+        TrilateralFilter filter(image, reference, filterSize, sigma, sigma2, method);
+    }
+    static void Process(const Image& source, const Image& reference, Image& image,
+                        int filterSize, double sigma, double sigma2,
+                        BilateralMethod method = BILATERAL_EXACT) {
+        TrilateralFilter filter(source, reference, image, filterSize, sigma, sigma2, method);
+    }
+    static void Process(const ImageView& source, const ImageView& reference, const ImageView& image,
+                        int filterSize, double sigma, double sigma2,
+                        BilateralMethod method = BILATERAL_EXACT) {
+        TrilateralFilter filter(source, reference, image, filterSize, sigma, sigma2, method);
     }
 };
 
@@ -55,8 +79,10 @@ public:
 //------------------------------------------------------------------------------
 class QuadrilateralFilter : IImageProcessing {
 public:
-    QuadrilateralFilter(Image& image, Image color, Image laser, Image camera, int filterSize);
-    static void Process(Image& image, Image& color, Image& laser, Image& camera, int filterSize) {
+    QuadrilateralFilter(Image& image, const Image& color, const Image& laser, const Image& camera,
+                        int filterSize);
+    static void Process(Image& image, const Image& color, const Image& laser, const Image& camera,
+                        int filterSize) {
         QuadrilateralFilter filter(image, color, laser, camera, filterSize);
     }
 };
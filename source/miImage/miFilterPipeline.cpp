@@ -0,0 +1,140 @@
+﻿//==============================================================================
+//
+// フィルタのパイプライン
+//
+//==============================================================================
+#include "miFilterPipeline.h"
+
+#include <algorithm>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 画素ごとの処理を追加する
+//   直前に追加したのが画素ごとの処理ならまとめる
+//------------------------------------------------------------------------------
+FilterPipeline& FilterPipeline::Point(PointOperation operation) {
+
+    if(steps.empty() || steps.back().stage) {
+        steps.push_back(Step());
+    }
+    steps.back().points.push_back(operation);
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+// 近傍を参照する処理を追加する
+//------------------------------------------------------------------------------
+FilterPipeline& FilterPipeline::Filter(Stage stage) {
+
+    if(steps.empty() || steps.back().stage) {
+        steps.push_back(Step());
+    }
+    steps.back().stage = stage;
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+// 追加した処理を全て消す
+//------------------------------------------------------------------------------
+void FilterPipeline::Clear() {
+    steps.clear();
+}
+
+//------------------------------------------------------------------------------
+// input に処理を順に掛けて output に書き込む
+//------------------------------------------------------------------------------
+void FilterPipeline::Process(const Image& input, Image& output) {
+
+    // 作業用の画像 (交互に使う)
+    ImagePool::Buffer buffers[2];
+    int current = -1; // 現在の画像が入っている作業用の画像 (-1 は input か output)
+
+    auto acquire = [&](int i) -> Image& {
+        if(!buffers[i]) buffers[i] = pool.Acquire(input.Bit(), input.Width(), input.Height());
+        return *buffers[i];
+    };
+
+    const Image* image = &input;
+
+    for(size_t i=0; i<steps.size(); i++) {
+
+        const Step& step = steps[i];
+        const bool  last = i + 1 == steps.size();
+
+        // 画素ごとの処理
+        // 最後なら出力へのコピーと一緒に, 作業用の画像ならその場で,
+        // そうでなければ次の入力へのコピーと一緒に掛ける
+        if(!step.points.empty()) {
+            Image* target;
+
+            if(last && !step.stage) {
+                target = &output;
+            }
+            else if(current >= 0) {
+                target = buffers[current].Get();
+            }
+            else {
+                current = 0;
+                target  = &acquire(current);
+            }
+
+            applyPoints(*image, *target, step.points);
+            image = target;
+        }
+
+        // 近傍を参照する処理
+        if(step.stage) {
+            Image* target;
+
+            if(last) {
+                target  = &output;
+                current = -1;
+            }
+            else {
+                current = current == 0 ? 1 : 0;
+                target  = &acquire(current);
+            }
+
+            step.stage(*image, *target);
+            image = target;
+        }
+    }
+
+    // 処理がない
+    if(image != &output) {
+        applyPoints(*image, output, std::vector<PointOperation>());
+    }
+}
+
+//------------------------------------------------------------------------------
+// source に画素ごとの処理を掛けて image に書き込む
+//   行のタイルごとにコピーしてから全ての処理を掛けるので, キャッシュに載ったまま処理できる
+//------------------------------------------------------------------------------
+void FilterPipeline::applyPoints(const Image& source, Image& image,
+                                 const std::vector<PointOperation>& points) {
+
+    if(&source != &image &&
+       (image.Width() != source.Width() || image.Height() != source.Height())) {
+        image = Image(source.Bit(), source.Width(), source.Height());
+    }
+
+    TileProcessing = [&](int x0, int y0, int x1, int y1) {
+
+        const int W      = image.Width();
+        const int length = (y1 - y0) * W;
+        RGB* pixels      = image.data + y0 * W;
+
+        if(&source != &image) {
+            std::copy(source.data + y0 * W, source.data + y1 * W, pixels);
+        }
+
+        for(const PointOperation& point : points) {
+            point(pixels, length);
+        }
+    };
+
+    RunTiled(image, 0);
+}
+
+}
@@ -0,0 +1,80 @@
+﻿//==============================================================================
+//
+// フィルタのパイプライン
+//
+//==============================================================================
+#ifndef _MI_FILTER_PIPELINE_H_
+#define _MI_FILTER_PIPELINE_H_
+
+#include "miImageProcessing.h"
+#include "miImagePool.h"
+
+#include <functional>
+#include <vector>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// フィルタのパイプライン
+//
+//  処理を順に掛ける. 途中の画像は 2 枚の作業用の画像を交互に使い, フレームをまたいで使い回す.
+//  続けて追加した画素ごとの処理はまとめて, 行のタイルごとに 1 回で掛ける.
+//  近傍を参照する処理の前の画素ごとの処理は, その処理の入力を作るコピーと一緒に掛け,
+//  最後の画素ごとの処理は出力へのコピーと一緒に掛ける.
+//  近傍を参照する処理は画像全体を受け取るので, その前の画素ごとの処理とは融合しない
+//  (画像全体を読み書きするのは, 近傍を参照する処理と, その前にまとめた画素ごとの処理につき 1 回ずつ).
+//
+//  mi::FilterPipeline pipeline;
+//  pipeline.Point(mi::Monochrome::Operation())
+//          .Filter([](const mi::Image& src, mi::Image& dst){ mi::MedianFilter::Process(src, dst, 5); })
+//          .Point(mi::GammaCollection::Operation(2.2));
+//  pipeline.Process(input, output);
+//------------------------------------------------------------------------------
+class FilterPipeline : IImageProcessing {
+public:
+
+    // 近傍を参照する処理 (source を読んで image に書く)
+    typedef std::function<void(const Image& source, Image& image)> Stage;
+
+    //--------------------------------------------------------------------------
+    // @brief 画素ごとの処理を追加する
+    //--------------------------------------------------------------------------
+    FilterPipeline& Point(PointOperation operation);
+
+    //--------------------------------------------------------------------------
+    // @brief 近傍を参照する処理を追加する
+    //--------------------------------------------------------------------------
+    FilterPipeline& Filter(Stage stage);
+
+    //--------------------------------------------------------------------------
+    // @brief 追加した処理を全て消す
+    //--------------------------------------------------------------------------
+    void Clear();
+
+    //--------------------------------------------------------------------------
+    // @brief input に処理を順に掛けて output に書き込む
+    // @param input  入力画像
+    // @param output 出力画像 (input と同じ画像でもよい. 大きさが違えば作り直す)
+    //--------------------------------------------------------------------------
+    void Process(const Image& input, Image& output);
+
+private:
+
+    // 画素ごとの処理をまとめて掛けてから, 近傍を参照する処理を掛ける
+    struct Step {
+        std::vector<PointOperation> points;
+        Stage stage;
+    };
+
+    // source に画素ごとの処理を掛けて image に書き込む (同じ画像ならその場で)
+    void applyPoints(const Image& source, Image& image, const std::vector<PointOperation>& points);
+
+    std::vector<Step> steps;
+
+    // 途中の画像
+    ImagePool pool;
+};
+
+}
+
+#endif
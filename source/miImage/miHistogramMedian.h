@@ -0,0 +1,200 @@
+﻿//==============================================================================
+//
+// ヒストグラムによるメディアン
+//
+//  Perreault-Hebert の O(1) メディアンフィルタ.
+//  列ごとのヒストグラムを行の移動で更新し, 窓のヒストグラムは列のヒストグラムの
+//  加減算で横に移動させるので, 1画素あたりの計算量がフィルタサイズに依らない.
+//
+//==============================================================================
+#ifndef _MI_HISTOGRAM_MEDIAN_H_
+#define _MI_HISTOGRAM_MEDIAN_H_
+
+#include "miImage.h"
+#include "miArena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// ヒストグラムによるメディアン
+//
+//  複数の画像 (時間方向) をまとめて 1 つのヒストグラムに入れられる.
+//  中央値は値を並べたときの (画素数/2) 番目で, ソートした場合と一致する.
+//------------------------------------------------------------------------------
+class HistogramMedian {
+public:
+
+    //--------------------------------------------------------------------------
+    // @brief コンストラクタ
+    // @param frames     入力画像 (全て同じ大きさ. 部分画像でもよい. 参照するので使い終わるまで残すこと)
+    // @param filterSize フィルタサイズ
+    //--------------------------------------------------------------------------
+    HistogramMedian(const std::vector<ImageView>& frames, int filterSize)
+        : frames(frames)
+        , width(frames[0].Width())
+        , height(frames[0].Height())
+        , lo(filterSize/2)
+        , hi(filterSize - 1 - filterSize/2)
+    {
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 並べ替えよりヒストグラムの方が速い窓の大きさか
+    // @param filterSize フィルタサイズ
+    // @param nFrames    フレーム数
+    //--------------------------------------------------------------------------
+    static bool IsFaster(int filterSize, int nFrames)
+    {
+        return filterSize * filterSize * nFrames >= SORT_LIMIT;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief [x0,x1) x [y0,y1) の中央値を output に書き込む
+    //   列ヒストグラムはこのスレッドのアリーナから借りる
+    //--------------------------------------------------------------------------
+    void Process(const ImageView& output, int x0, int y0, int x1, int y1)
+    {
+        if(x0 >= x1 || y0 >= y1) return;
+
+        // 窓に入る列の範囲
+        const int c0 = std::max(0, x0 - lo);
+        const int c1 = std::min(width, x1 + hi);
+
+        Arena& arena = Arena::Local();
+        Arena::Scope scope(arena);
+
+        const size_t nColumns = (size_t)(c1 - c0) * CHANNELS;
+        columns = arena.Allocate<Histogram<uint16_t> >(nColumns);
+        std::uninitialized_fill(columns, columns + nColumns, Histogram<uint16_t>());
+        Histogram<uint32_t> kernel[CHANNELS];
+
+        // 最初の行の列ヒストグラム
+        for(int jY=std::max(0, y0-lo); jY<=std::min(height-1, y0+hi); jY++) {
+            addRow(jY, c0, c1, 1);
+        }
+
+        for(int iY=y0; iY<y1; iY++) {
+
+            // 列ヒストグラムを 1 行下に移動
+            if(iY > y0) {
+                if(iY-1-lo >= 0)     addRow(iY-1-lo, c0, c1, -1);
+                if(iY+hi   < height) addRow(iY+hi,   c0, c1,  1);
+            }
+
+            // 窓のヒストグラムを作る
+            for(int c=0; c<CHANNELS; c++) kernel[c].Clear();
+
+            for(int jX=std::max(0, x0-lo); jX<=std::min(width-1, x0+hi); jX++) {
+                for(int c=0; c<CHANNELS; c++) kernel[c].Add(column(jX, c0, c));
+            }
+
+            RGB* out = output.Row(iY);
+
+            for(int iX=x0; iX<x1; iX++) {
+
+                out[iX].r = (unsigned char)kernel[0].Median();
+                out[iX].g = (unsigned char)kernel[1].Median();
+                out[iX].b = (unsigned char)kernel[2].Median();
+
+                // 窓を 1 列右に移動
+                if(iX+1 < x1) {
+                    if(iX-lo >= 0) {
+                        for(int c=0; c<CHANNELS; c++) kernel[c].Sub(column(iX-lo, c0, c));
+                    }
+                    if(iX+1+hi < width) {
+                        for(int c=0; c<CHANNELS; c++) kernel[c].Add(column(iX+1+hi, c0, c));
+                    }
+                }
+            }
+        }
+    }
+
+private:
+
+    static const int CHANNELS = 3;
+
+    // 窓の画素数がこれより少なければ並べ替えの方が速い
+    static const int SORT_LIMIT = 9;
+
+    //--------------------------------------------------------------------------
+    // ヒストグラム (上位4bit の粗いビンと 8bit の細かいビン)
+    //--------------------------------------------------------------------------
+    template<typename T>
+    struct Histogram {
+        T coarse[16];
+        T fine[256];
+        uint32_t count;
+
+        Histogram() { Clear(); }
+
+        void Clear() {
+            std::fill(coarse, coarse+16, (T)0);
+            std::fill(fine, fine+256, (T)0);
+            count = 0;
+        }
+
+        void Insert(unsigned char v, int n) {
+            coarse[v>>4] += (T)n;
+            fine[v]      += (T)n;
+            count        += n;
+        }
+
+        template<typename U> void Add(const Histogram<U>& h) {
+            for(int i=0; i<16; i++)  coarse[i] += h.coarse[i];
+            for(int i=0; i<256; i++) fine[i]   += h.fine[i];
+            count += h.count;
+        }
+
+        template<typename U> void Sub(const Histogram<U>& h) {
+            for(int i=0; i<16; i++)  coarse[i] -= h.coarse[i];
+            for(int i=0; i<256; i++) fine[i]   -= h.fine[i];
+            count -= h.count;
+        }
+
+        // 値を並べたときの count/2 番目
+        int Median() const {
+            uint32_t k   = count / 2;
+            uint32_t sum = 0;
+
+            int c = 0;
+            while(c < 15 && sum + coarse[c] <= k) sum += coarse[c++];
+
+            int v = c * 16;
+            while(v < c*16 + 15 && sum + fine[v] <= k) sum += fine[v++];
+
+            return v;
+        }
+    };
+
+    // 列 jX のヒストグラム
+    inline Histogram<uint16_t>& column(int jX, int c0, int c) {
+        return columns[(size_t)(jX - c0) * CHANNELS + c];
+    }
+
+    // 行 jY の画素を列ヒストグラムに加える (n = -1 で取り除く)
+    void addRow(int jY, int c0, int c1, int n) {
+        for(const ImageView& frame : frames) {
+            const RGB* row = frame.Row(jY);
+            for(int jX=c0; jX<c1; jX++) {
+                column(jX, c0, 0).Insert(row[jX].r, n);
+                column(jX, c0, 1).Insert(row[jX].g, n);
+                column(jX, c0, 2).Insert(row[jX].b, n);
+            }
+        }
+    }
+
+    const std::vector<ImageView>& frames;
+    int width, height;
+    int lo, hi; // 窓の上(左)・下(右)の画素数
+
+    Histogram<uint16_t>* columns = nullptr; // Process() の間だけ有効
+};
+
+}
+
+#endif
@@ -5,7 +5,15 @@
 //==============================================================================
 #include "miImage.h"
 
-#include "miBitmap.h"
+#include "miImageCodec.h"
+#include "miArena.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
 
 namespace mi {
 
@@ -25,7 +33,6 @@ Image::Image() {
 }
 
 Image::~Image() {
-    delete[] data;
 }
     
 Image::Image(const Image& copied) {
@@ -35,24 +42,80 @@ Image::Image(const Image& copied) {
 }
     
 Image& Image::operator=(const Image& copied) {
-    Initialize(copied.Bit(), copied.Width(), copied.Height());
+    if(this == &copied) {
+        return *this;
+    }
+
+    // 同じ大きさなら確保し直さない (この画像の ImageView が有効なまま残る)
+    if(width != copied.Width() || height != copied.Height()) {
+        Initialize(copied.Bit(), copied.Width(), copied.Height());
+    }
+    bit = copied.Bit();
     std::copy(copied.data, copied.data+copied.Size(), data);
     return *this;
 }
 
+Image::Image(Image&& moved) noexcept {
+    swap(moved);
+}
+
+Image& Image::operator=(Image&& moved) noexcept {
+    if(this != &moved) {
+        // 今の画素データはムーブ元に渡して, ムーブ元の破棄で解放する
+        swap(moved);
+        moved.width = moved.height = moved.size = 0;
+        moved.bindPixel();
+    }
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+// 画素データを入れ替える
+//------------------------------------------------------------------------------
+void Image::swap(Image& other) noexcept {
+    std::swap(bit,      other.bit);
+    std::swap(data,     other.data);
+    std::swap(buffer,   other.buffer);
+    std::swap(width,    other.width);
+    std::swap(height,   other.height);
+    std::swap(size,     other.size);
+    std::swap(capacity, other.capacity);
+
+    bindPixel();
+    other.bindPixel();
+}
+
+Image::Image(const ImageView& view) {
+    Initialize(view.Bit(), view.Width(), view.Height());
+    for(int iY=0; iY<height; iY++) {
+        std::copy(view.Row(iY), view.Row(iY)+width, data+iY*width);
+    }
+}
+
+Image& Image::operator=(const ImageView& view) {
+
+    // 大きさが違えば作り直す (view がこの画像の一部でもよいように先にコピーする)
+    if(width != view.Width() || height != view.Height()) {
+        return *this = Image(view);
+    }
+
+    bit = view.Bit();
+    if(view.data != data) {
+        for(int iY=0; iY<height; iY++) {
+            std::copy(view.Row(iY), view.Row(iY)+width, data+iY*width);
+        }
+    }
+    return *this;
+}
+
 
 //--------------------------------------------------------------------------
 // 読み込み
 //--------------------------------------------------------------------------
 void Image::Load(const char* fileName) {
 
-    Bitmap bitmap(fileName);
-
-    // 画像のサイズが違ったら再確保
-    if(width != bitmap.Width() || height != bitmap.Height()) {
-        Initialize(bitmap.Bit(), bitmap.Width(), bitmap.Height());
-    }
-    bitmap.CopyToImage(*this);
+    // 拡張子から形式を選ぶ (画像のサイズが違ったら再確保する)
+    ImageCodec::Find(fileName).Read(fileName, *this);
 }
 
 
@@ -61,68 +124,178 @@ void Image::Load(const char* fileName) {
 //--------------------------------------------------------------------------
 void Image::Save(const char* fileName) {
 
-    Bitmap bitmap(bit, width, height);
-    bitmap.CopyFromImage(*this);
-    bitmap.Write(fileName);
+    // 拡張子から形式を選ぶ
+    ImageCodec::Find(fileName).Write(fileName, *this);
 }
     
     
 //--------------------------------------------------------------------------
 // サイズ変更
+//   新しい領域に元の画素から直接書き込む
 //--------------------------------------------------------------------------
 void Image::Resize(int width, int height) {
 
-    // コピー
-    Image copy = *this;
-    
-    // 大きさ変更
-    Initialize(Bit(), width, height);
-    
-    // 縮小処理
-    double scaleX = (double)(width - 1) / ( copy.Width() - 1);
-    double scaleY = (double)(height- 1) / ( copy.Height()- 1);
-    
-    for(int i=0; i<Size(); i++) {
-        int iX = i % Width();
-        int iY = i / Width();
-        int jX = (int)(iX / scaleX);
-        int jY = (int)(iY / scaleY);
-        pixel[iX][iY] = copy.pixel[jX][jY];
+    Image resized(bit, width, height);
+
+    ResizeArea(View(), resized.data, width, height);
+
+    swap(resized);
+}
+
+
+//--------------------------------------------------------------------------
+// 面積平均による拡大縮小
+//   出力の画素が覆う元の画素を, 覆う面積 (端は端数) で重み付けして平均する
+//--------------------------------------------------------------------------
+namespace {
+
+// 出力の 1 画素が覆う元の画素の範囲と重み
+struct AreaSpan {
+    int first;
+    int last;
+    const float* weight; // weight[i - first]
+};
+
+// 範囲と重みは arena から切り出す
+const AreaSpan* AreaSpans(Arena& arena, int source, int resized) {
+
+    AreaSpan* spans = arena.Allocate<AreaSpan>(resized);
+    double scale = (double)source / resized;
+
+    // 1 画素が覆う元の画素は高々 ceil(scale)+1 個
+    const int maxSpan = (int)std::ceil(scale) + 1;
+    float* weights = arena.Allocate<float>((size_t)resized * maxSpan);
+
+    for(int i=0; i<resized; i++) {
+        double begin = i * scale;
+        double end   = (i + 1) * scale;
+
+        AreaSpan& span = spans[i];
+        span.first = std::min(source-1, (int)begin);
+        span.last  = std::max(span.first, std::min(source-1, (int)std::ceil(end) - 1));
+
+        float* weight = weights + (size_t)i * maxSpan;
+        for(int j=span.first; j<=span.last; j++) {
+            double covered = std::min(end, j + 1.0) - std::max(begin, (double)j);
+            weight[j - span.first] = (float)(std::max(0.0, covered) / scale);
+        }
+        span.weight = weight;
     }
+    return spans;
 }
-    
+
+}
+
+void ResizeArea(const ImageView& source, RGB* resized, int width, int height) {
+
+    if(width <= 0 || height <= 0 || source.Width() <= 0 || source.Height() <= 0) {
+        return;
+    }
+
+    // 作業領域はこのスレッドのアリーナから借りる
+    Arena& arena = Arena::Local();
+    Arena::Scope scope(arena);
+
+    const AreaSpan* spansX = AreaSpans(arena, source.Width(), width);
+    const AreaSpan* spansY = AreaSpans(arena, source.Height(), height);
+
+    // 縦方向に平均した 1 行 (RGB の順)
+    float* row = arena.Allocate<float>(source.Width() * 3);
+
+    for(int iY=0; iY<height; iY++) {
+        const AreaSpan& spanY = spansY[iY];
+
+        std::fill(row, row + source.Width() * 3, 0.0f);
+        for(int j=spanY.first; j<=spanY.last; j++) {
+            const RGB* src = source.Row(j);
+            float w = spanY.weight[j - spanY.first];
+            for(int iX=0; iX<source.Width(); iX++) {
+                row[iX*3 + 0] += w * src[iX].r;
+                row[iX*3 + 1] += w * src[iX].g;
+                row[iX*3 + 2] += w * src[iX].b;
+            }
+        }
+
+        RGB* dst = resized + iY * width;
+        for(int iX=0; iX<width; iX++) {
+            const AreaSpan& spanX = spansX[iX];
+            float r = 0, g = 0, b = 0;
+            for(int j=spanX.first; j<=spanX.last; j++) {
+                float w = spanX.weight[j - spanX.first];
+                r += w * row[j*3 + 0];
+                g += w * row[j*3 + 1];
+                b += w * row[j*3 + 2];
+            }
+            dst[iX] = RGB(std::min(255.0f, r + 0.5f), std::min(255.0f, g + 0.5f), std::min(255.0f, b + 0.5f));
+        }
+    }
+}
+
+void Resize(const ImageView& source, Image& resized, int width, int height) {
+
+    // 同じ大きさなら確保し直さない (resized の ImageView が有効なまま残る)
+    if(resized.Width() != width || resized.Height() != height) {
+        resized = Image(source.Bit(), width, height);
+    }
+    ResizeArea(source, resized.Data(), width, height);
+}
+
 
 //--------------------------------------------------------------------------
 // 切り抜き
+//   画素をコピーせずに参照するなら View() を使う
 //--------------------------------------------------------------------------
 void Image::Clip(int x, int y, int width, int height) {
-    
-    // コピー
-    Image copy = *this;
-    
-    // 大きさ変更
-    Initialize(Bit(), width, height);
-
-    // コピー作業
-    for(int i=0; i<Height(); i++) {
-        int iImage = i*Width();
-        int iCopy  = (i+y)*copy.Width() + x;
-        std::copy(&copy.data[iCopy], &copy.data[iCopy]+width, &data[iImage]);
+
+    ImageView view = View(x, y, width, height);
+
+    Image clipped(bit, view.Width(), view.Height());
+
+    for(int i=0; i<view.Height(); i++) {
+        std::copy(view.Row(i), view.Row(i)+view.Width(), clipped.data + i*view.Width());
+    }
+
+    swap(clipped);
+}
+
+
+//--------------------------------------------------------------------------
+// 部分画像
+//--------------------------------------------------------------------------
+ImageView Image::View() {
+    return ImageView(*this);
+}
+
+ImageView Image::View() const {
+    return ImageView(*this);
+}
+
+ImageView Image::View(int x, int y, int width, int height) {
+    return View().Clip(x, y, width, height);
+}
+
+//--------------------------------------------------------------------------
+// 確保しておく
+//--------------------------------------------------------------------------
+void Image::Reserve(int size) {
+
+    if(size <= capacity) {
+        return;
     }
+
+    std::unique_ptr<unsigned char[]> previous = std::move(buffer);
+    RGB* pixels = data;
+
+    allocate(size);
+    std::copy(pixels, pixels + this->size, data);
+    bindPixel();
 }
 
 //--------------------------------------------------------------------------
 // 初期化する
-//
-//   MEMO: data がすでに確保された領域がある場合リークするので自分で解放すること
+//   確保済みの領域に収まれば使い回す (画素値は前のまま)
 //--------------------------------------------------------------------------
 void Image::Initialize(int bit, int width, int height) {
-    
-    // すでにデータがあったら削除しておく
-    if(data!=nullptr) {
-        delete[] data;
-        data = nullptr;
-    }
 
     // 初期化処理
     this->bit   = bit;
@@ -130,11 +303,72 @@ void Image::Initialize(int bit, int width, int height) {
     this->height= height;
 
     size = width * height;
-    data = new RGB[size];
+    if(size > capacity || data == nullptr) {
+        allocate(size);
+    }
+
+    bindPixel();
+}
+
+//--------------------------------------------------------------------------
+// 画素 size 個分の領域を確保し直す
+//   先頭を揃える分だけ多めに確保する
+//--------------------------------------------------------------------------
+void Image::allocate(int size) {
+
+    size_t bytes = (size_t)size * sizeof(RGB) + ALIGNMENT;
+    buffer.reset(new unsigned char[bytes]);
+
+    uintptr_t address = reinterpret_cast<uintptr_t>(buffer.get());
+    address = (address + ALIGNMENT - 1) & ~(uintptr_t)(ALIGNMENT - 1);
 
+    data = reinterpret_cast<RGB*>(address);
+    std::uninitialized_fill(data, data + size, RGB());
+
+    capacity = size;
+}
+
+//--------------------------------------------------------------------------
+// pixel を data に合わせる
+//--------------------------------------------------------------------------
+void Image::bindPixel() {
     pixel.sizeX = width;
     pixel.sizeY = height;
     pixel.data  = data;
 }
 
+
+//--------------------------------------------------------------------------
+// 部分画像を返す
+//--------------------------------------------------------------------------
+ImageView ImageView::Clip(int x, int y, int width, int height) const {
+
+    // 画像の外は切り詰める
+    int x0 = std::max(0, std::min(x, this->width));
+    int y0 = std::max(0, std::min(y, this->height));
+    int x1 = std::max(x0, std::min(x + width,  this->width));
+    int y1 = std::max(y0, std::min(y + height, this->height));
+
+    return ImageView(Row(y0) + x0, x1 - x0, y1 - y0, stride, bit);
+}
+
+
+//--------------------------------------------------------------------------
+// other と画素データが重なるか
+//--------------------------------------------------------------------------
+bool ImageView::Overlaps(const ImageView& other) const {
+
+    if(Size() == 0 || other.Size() == 0) {
+        return false;
+    }
+
+    // 先頭の行の先頭から最後の行の末尾までの範囲で比べる
+    const RGB* begin      = data;
+    const RGB* end        = Row(height-1) + width;
+    const RGB* otherBegin = other.data;
+    const RGB* otherEnd   = other.Row(other.height-1) + other.width;
+
+    return begin < otherEnd && otherBegin < end;
+}
+
 }
@@ -6,8 +6,13 @@
 #ifndef _MI_IMAGE_H_
 #define _MI_IMAGE_H_
 
+#include <cstddef>
+#include <memory>
+
 namespace mi {
 
+class ImageView;
+
 //------------------------------------------------------------------------------
 // 汎用ピクセル型
 //------------------------------------------------------------------------------
@@ -93,15 +98,23 @@ public:
 
 //------------------------------------------------------------------------------
 // 汎用画像型
+//
+//  画素データの先頭は ALIGNMENT バイト境界に揃えて確保する.
+//  小さい画像にするときや Reserve() した大きさまでは確保し直さない.
+//  ムーブは画素データを付け替えるだけなので, 戻り値や std::vector<Image> でもコピーしない
+//  (ムーブ元は空の画像になり, ムーブ元・先の ImageView は無効になる).
 //------------------------------------------------------------------------------
 class Image {
 public:
-    int bit;                 // bit数
+    // 画素データの先頭を揃えるバイト数
+    static const int ALIGNMENT = 64;
+
+    int bit = 24;            // bit数
     RGB* data = nullptr;     // 画素データ
     PixelArray2D<RGB> pixel; // 画素データを2次元配列でアクセス
 
     //--------------------------------------------------------------------------
-    // コンストラクタ / デストラクタ / コピーコンストラクタ
+    // コンストラクタ / デストラクタ / コピー / ムーブ
     //--------------------------------------------------------------------------
     Image(const char* filename);
     Image(int bit, int width, int height);
@@ -109,6 +122,15 @@ public:
     ~Image();
     Image(const Image& copied);
     Image& operator=(const Image& copied);
+    Image(Image&& moved) noexcept;
+    Image& operator=(Image&& moved) noexcept;
+
+    // 画素データを入れ替える
+    void swap(Image& other) noexcept;
+
+    // view の画素をコピーする (代入は同じ大きさなら確保し直さない)
+    explicit Image(const ImageView& view);
+    Image& operator=(const ImageView& view);
 
     //--------------------------------------------------------------------------
     // 読み込み / 書き込み
@@ -117,11 +139,23 @@ public:
     void Save(const char* fileName);
     
     //--------------------------------------------------------------------------
-    // サイズ変更
+    // サイズ変更 (面積平均. 縮小しても細い線やテクスチャが欠けない)
     //--------------------------------------------------------------------------
     void Resize(int width, int height);
     void Clip(int x, int y, int width, int height);
 
+    //--------------------------------------------------------------------------
+    // 画素 size 個分まで確保し直さずに使えるように確保しておく (画素はそのまま)
+    //--------------------------------------------------------------------------
+    void Reserve(int size);
+
+    //--------------------------------------------------------------------------
+    // 部分画像 (画素はコピーしない)
+    //--------------------------------------------------------------------------
+    ImageView View();
+    ImageView View() const;
+    ImageView View(int x, int y, int width, int height);
+
     //--------------------------------------------------------------------------
     // Getter
     //--------------------------------------------------------------------------
@@ -129,20 +163,109 @@ public:
     int Width()  const { return width; }
     int Height() const { return height; }
     int Size()   const { return size; }
+    int Capacity() const { return capacity; }
 
     RGB* Data() { return data; }
     PixelArray2D<RGB>& Pixel() { return pixel; };
 
 private:
 
-    // 初期化する
+    // 大きさを変える (確保済みの領域に収まれば確保し直さない. 画素値は不定)
     void Initialize(int bit, int width, int height);
 
+    // 画素 size 個分の領域を確保し直す (画素は 0 で初期化する)
+    void allocate(int size);
+
+    // pixel を data に合わせる
+    void bindPixel();
+
+    std::unique_ptr<unsigned char[]> buffer; // 確保した領域 (data はこの中の揃えた位置)
+
+    int width    = 0;  // 幅
+    int height   = 0;  // 高さ
+    int size     = 0;  // 画素総数
+    int capacity = 0;  // 確保済みの画素数
+};
+
+inline void swap(Image& a, Image& b) noexcept { a.swap(b); }
+
+
+//------------------------------------------------------------------------------
+// 画像の一部を参照する型
+//
+//  画素データを持たず, 左上の画素へのポインタと 1 行の画素数 (stride) だけを持つ.
+//  Clip() は画素をコピーしないので, 大きな画像の一部 (ROI) をそのままフィルタや DPM に渡せる.
+//  元の画像が確保し直されると無効になる (同じ大きさの画像の代入や Load() では確保し直さない).
+//------------------------------------------------------------------------------
+class ImageView {
+public:
+    RGB* data = nullptr; // 左上の画素
+
+    ImageView() {}
+    ImageView(RGB* data, int width, int height, int stride, int bit = 24)
+        : data(data), bit(bit), width(width), height(height), stride(stride) {}
+
+    // 画像全体
+    ImageView(Image& image)
+        : ImageView(image.data, image.Width(), image.Height(), image.Width(), image.Bit()) {}
+
+    // const な画像の全体 (入力に使う. 書き込まないこと)
+    //   const な画像がフィルタの出力 (const ImageView&) に渡らないように explicit にする.
+    //   入力に渡すときは image.View() を使う
+    explicit ImageView(const Image& image)
+        : ImageView(image.data, image.Width(), image.Height(), image.Width(), image.Bit()) {}
+
+    //--------------------------------------------------------------------------
+    // @brief 部分画像を返す (画素はコピーしない)
+    // @param x, y          左上の座標
+    // @param width, height 大きさ (はみ出す分は切り詰める)
+    //--------------------------------------------------------------------------
+    ImageView Clip(int x, int y, int width, int height) const;
+
+    //--------------------------------------------------------------------------
+    // Getter
+    //--------------------------------------------------------------------------
+    int Bit()    const { return bit; }
+    int Width()  const { return width; }
+    int Height() const { return height; }
+    int Stride() const { return stride; }
+    int Size()   const { return width * height; }
+
+    // 行が隙間なく並んでいるか (Image の data と同じように 1 次元で扱える)
+    bool IsContiguous() const { return stride == width || height <= 1; }
+
+    // iY 行目の先頭の画素
+    RGB* Row(int iY) const { return data + (ptrdiff_t)iY * stride; }
+
+    // (iX, iY) の画素
+    RGB& operator()(int iX, int iY) const { return data[(ptrdiff_t)iY * stride + iX]; }
+
+    // other と画素データが重なるか
+    bool Overlaps(const ImageView& other) const;
+
+private:
+    int bit    = 24; // bit数
     int width  = 0;  // 幅
     int height = 0;  // 高さ
-    int size   = 0;  // 画素総数
+    int stride = 0;  // 1行の画素数
 };
 
+
+//------------------------------------------------------------------------------
+// @brief 面積平均で拡大縮小する
+// @param source        元の画像 (部分画像でもよい)
+// @param resized       書き込み先 (width x height の画素)
+// @param width, height 書き込む大きさ
+//   source と resized は重ならないこと
+//------------------------------------------------------------------------------
+void ResizeArea(const ImageView& source, RGB* resized, int width, int height);
+
+//------------------------------------------------------------------------------
+// @brief 面積平均で拡大縮小した画像を resized に書き込む
+//   大きさが同じなら resized を確保し直さない (ピラミッドの各段に毎フレーム書き込める)
+//------------------------------------------------------------------------------
+void Resize(const ImageView& source, Image& resized, int width, int height);
+
 }
 
 #endif
@@ -0,0 +1,171 @@
+﻿//==============================================================================
+//
+// 画像の形式ごとの読み書き
+//
+//==============================================================================
+#include "miImageCodec.h"
+#include "miBitmap.h"
+#include "miNetpbm.h"
+#include "miRawImage.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace mi {
+
+namespace {
+
+//------------------------------------------------------------------------------
+// Windows Bitmap (8,24,32bit の Image のみ)
+//------------------------------------------------------------------------------
+class BitmapCodec : public ImageCodec {
+public:
+    using ImageCodec::Read;
+    using ImageCodec::Write;
+
+    void Read(const char* fileName, Image& image) { Bitmap::Load(fileName, image); }
+    void Write(const char* fileName, const ImageView& image) { Bitmap::Save(fileName, image); }
+};
+
+//------------------------------------------------------------------------------
+// 登録された形式 (拡張子は小文字で持つ)
+//------------------------------------------------------------------------------
+struct Registry {
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<ImageCodec> > codecs;
+    std::shared_ptr<ImageCodec> bitmap = std::make_shared<BitmapCodec>();
+
+    Registry() {
+        std::shared_ptr<ImageCodec> pnm = std::make_shared<PnmCodec>();
+        codecs[".bmp"] = bitmap;
+        codecs[".pgm"] = pnm;
+        codecs[".ppm"] = pnm;
+        codecs[".pnm"] = pnm;
+        codecs[".pfm"] = std::make_shared<PfmCodec>();
+        codecs[".raw"] = std::make_shared<RawImageCodec>();
+    }
+
+    static Registry& Instance() {
+        static Registry registry;
+        return registry;
+    }
+};
+
+// 小文字にする
+std::string ToLower(const char* text) {
+    std::string result(text);
+    for(char& c : result) c = (char)std::tolower((unsigned char)c);
+    return result;
+}
+
+}
+
+
+//------------------------------------------------------------------------------
+// 対応していない読み書き (形式ごとに対応するものだけ置き換える)
+//------------------------------------------------------------------------------
+void ImageCodec::Read(const char* fileName, Image& image)          { NotSupported(fileName); }
+void ImageCodec::Read(const char* fileName, Plane8& plane)         { NotSupported(fileName); }
+void ImageCodec::Read(const char* fileName, Plane16& plane)        { NotSupported(fileName); }
+void ImageCodec::Read(const char* fileName, PlaneF& plane)         { NotSupported(fileName); }
+void ImageCodec::Write(const char* fileName, const ImageView& image){ NotSupported(fileName); }
+void ImageCodec::Write(const char* fileName, const Plane8& plane)  { NotSupported(fileName); }
+void ImageCodec::Write(const char* fileName, const Plane16& plane) { NotSupported(fileName); }
+void ImageCodec::Write(const char* fileName, const PlaneF& plane)  { NotSupported(fileName); }
+
+void ImageCodec::NotSupported(const char* fileName) {
+    std::cerr<<"Error: Not Supported Format ("<<fileName<<")"<<std::endl;
+    throw "Not Supported Format";
+}
+
+
+//------------------------------------------------------------------------------
+// ファイルを開く
+//------------------------------------------------------------------------------
+void ImageCodec::Open(std::ifstream& file, const char* fileName) {
+    file.open(fileName, std::ios::binary);
+    if(!file.is_open()) {
+        std::cerr<<"Error: Cant File Open"<<std::endl;
+        throw "File Open Error";
+    }
+}
+
+void ImageCodec::Open(std::ofstream& file, const char* fileName) {
+    file.open(fileName, std::ios::binary | std::ios::trunc | std::ios::out);
+    if(!file.is_open()) {
+        std::cerr<<"Error: Cant File Open"<<std::endl;
+        throw "File Open Error";
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// ヘッダの大きさを確かめる
+//   幅 x 高さ x 画素のバイト数を 64bit で計算し, RGB の Image に収まる大きさまでにする
+//------------------------------------------------------------------------------
+void ImageCodec::CheckSize(uint64_t width, uint64_t height, uint64_t pixelBytes) {
+
+    const uint64_t limit = INT_MAX / sizeof(RGB);
+
+    if(width > limit || height > limit || width * height * pixelBytes > limit) {
+        std::cerr<<"Error: Image Too Large"<<std::endl;
+        throw "File Open Error";
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// バイト順
+//------------------------------------------------------------------------------
+bool ImageCodec::IsLittleEndian() {
+    const unsigned short one = 1;
+    return *reinterpret_cast<const unsigned char*>(&one) == 1;
+}
+
+void ImageCodec::SwapBytes(void* data, size_t count, size_t size) {
+    unsigned char* bytes = static_cast<unsigned char*>(data);
+    for(size_t i=0; i<count; i++, bytes+=size) {
+        std::reverse(bytes, bytes + size);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// 形式を登録する
+//------------------------------------------------------------------------------
+void ImageCodec::Register(const char* extension, std::shared_ptr<ImageCodec> codec) {
+
+    Registry& registry = Registry::Instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    registry.codecs[ToLower(extension)] = codec;
+}
+
+
+//------------------------------------------------------------------------------
+// ファイル名の拡張子から形式を探す
+//------------------------------------------------------------------------------
+ImageCodec& ImageCodec::Find(const char* fileName) {
+
+    Registry& registry = Registry::Instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    const char* dot   = std::strrchr(fileName, '.');
+    const char* slash = std::strpbrk(dot ? dot : fileName, "/\\");
+
+    if(dot && !slash) {
+        auto found = registry.codecs.find(ToLower(dot));
+        if(found != registry.codecs.end()) {
+            return *found->second;
+        }
+    }
+    return *registry.bitmap;
+}
+
+}
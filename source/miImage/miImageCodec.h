@@ -0,0 +1,95 @@
+﻿//==============================================================================
+//
+// 画像の形式ごとの読み書き
+//
+//==============================================================================
+#ifndef _MI_IMAGE_CODEC_H_
+#define _MI_IMAGE_CODEC_H_
+
+#include "miImage.h"
+#include "miPlane.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 画像の形式ごとの読み書き
+//
+//  拡張子ごとに Register() で登録しておき, Find() でファイル名から探す.
+//  Image::Load() / Save() はこれを使う. 登録されていない拡張子は Bitmap として扱う.
+//  1 チャンネルの画像 (16bit / float の深度画像など) は量子化せずに読み書きできる.
+//  形式が対応していない読み書きは "Not Supported Format" を投げる.
+//------------------------------------------------------------------------------
+class ImageCodec {
+public:
+    virtual ~ImageCodec() {}
+
+    //--------------------------------------------------------------------------
+    // @brief 読み込み (image / plane の大きさが違う場合は作り直す)
+    //--------------------------------------------------------------------------
+    virtual void Read(const char* fileName, Image& image);
+    virtual void Read(const char* fileName, Plane8& plane);
+    virtual void Read(const char* fileName, Plane16& plane);
+    virtual void Read(const char* fileName, PlaneF& plane);
+
+    //--------------------------------------------------------------------------
+    // @brief 書き込み
+    //--------------------------------------------------------------------------
+    virtual void Write(const char* fileName, const ImageView& image);
+    virtual void Write(const char* fileName, const Plane8& plane);
+    virtual void Write(const char* fileName, const Plane16& plane);
+    virtual void Write(const char* fileName, const PlaneF& plane);
+
+    //--------------------------------------------------------------------------
+    // @brief extension (".pgm" など. 大文字小文字は区別しない) の形式を登録する
+    //   同じ拡張子が登録済みなら置き換える
+    //--------------------------------------------------------------------------
+    static void Register(const char* extension, std::shared_ptr<ImageCodec> codec);
+
+    //--------------------------------------------------------------------------
+    // @brief fileName の拡張子の形式を返す (見つからなければ Bitmap)
+    //--------------------------------------------------------------------------
+    static ImageCodec& Find(const char* fileName);
+
+    //--------------------------------------------------------------------------
+    // @brief ヘッダの大きさ (画素あたり pixelBytes バイト) が Image に収まらなければ
+    //   "File Open Error" を投げる (形式ごとのヘッダの読み込みで呼ぶ)
+    //--------------------------------------------------------------------------
+    static void CheckSize(uint64_t width, uint64_t height, uint64_t pixelBytes);
+
+protected:
+    // 対応していない読み書き
+    static void NotSupported(const char* fileName);
+
+    // ファイルを開く (開けなければ "File Open Error" を投げる)
+    static void Open(std::ifstream& file, const char* fileName);
+    static void Open(std::ofstream& file, const char* fileName);
+
+    // 実行している環境がリトルエンディアンか
+    static bool IsLittleEndian();
+
+    // size バイトの値 count 個のバイト順を入れ替える
+    static void SwapBytes(void* data, size_t count, size_t size);
+};
+
+
+//------------------------------------------------------------------------------
+// @brief 拡張子から形式を選んで 1 チャンネルの画像を読み書きする
+//------------------------------------------------------------------------------
+template<class T> void LoadPlane(const char* fileName, Plane<T>& plane)
+{
+    ImageCodec::Find(fileName).Read(fileName, plane);
+}
+
+template<class T> void SavePlane(const char* fileName, const Plane<T>& plane)
+{
+    ImageCodec::Find(fileName).Write(fileName, plane);
+}
+
+}
+
+#endif
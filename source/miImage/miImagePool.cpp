@@ -0,0 +1,98 @@
+﻿//==============================================================================
+//
+// 画像バッファの使い回し
+//
+//==============================================================================
+#include "miImagePool.h"
+
+#include <algorithm>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 借りた画像を移す
+//------------------------------------------------------------------------------
+ImagePool::Buffer& ImagePool::Buffer::operator=(Buffer&& other) {
+    if(this != &other) {
+        Release();
+        pool  = other.pool;
+        image = std::move(other.image);
+        other.pool = nullptr;
+    }
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+// プールに返す
+//------------------------------------------------------------------------------
+void ImagePool::Buffer::Release() {
+    if(pool && image) {
+        pool->release(std::move(image));
+    }
+    pool  = nullptr;
+    image = nullptr;
+}
+
+//------------------------------------------------------------------------------
+// 画像を借りる
+//   同じ大きさの画像があればそれを, なければ新しく確保して返す
+//------------------------------------------------------------------------------
+ImagePool::Buffer ImagePool::Acquire(int bit, int width, int height) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // 最近返されたものほどキャッシュに残っているので後ろから探す
+        for(size_t i=images.size(); i-- > 0; ) {
+            Image& image = *images[i];
+            if(image.Width() == width && image.Height() == height && image.Bit() == bit) {
+                std::unique_ptr<Image> found = std::move(images[i]);
+                images.erase(images.begin() + i);
+                return Buffer(this, std::move(found));
+            }
+        }
+    }
+
+    return Buffer(this, std::unique_ptr<Image>(new Image(bit, width, height)));
+}
+
+//------------------------------------------------------------------------------
+// image のコピーを借りる
+//------------------------------------------------------------------------------
+ImagePool::Buffer ImagePool::Copy(const ImageView& image) {
+    Buffer buffer = Acquire(image.Bit(), image.Width(), image.Height());
+    for(int iY=0; iY<image.Height(); iY++) {
+        std::copy(image.Row(iY), image.Row(iY) + image.Width(), buffer->data + iY*image.Width());
+    }
+    return buffer;
+}
+
+//------------------------------------------------------------------------------
+// 取っておいた画像を全て解放する
+//------------------------------------------------------------------------------
+void ImagePool::Clear() {
+    std::unique_lock<std::mutex> lock(mutex);
+    images.clear();
+}
+
+//------------------------------------------------------------------------------
+// フィルタの作業用に共有するプール
+//------------------------------------------------------------------------------
+ImagePool& ImagePool::Shared() {
+    static ImagePool pool;
+    return pool;
+}
+
+//------------------------------------------------------------------------------
+// 返却された画像を取っておく (多すぎる場合は古いものから捨てる)
+//------------------------------------------------------------------------------
+void ImagePool::release(std::unique_ptr<Image> image) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    images.push_back(std::move(image));
+
+    if((int)images.size() > MAX_IMAGES) {
+        images.erase(images.begin());
+    }
+}
+
+}
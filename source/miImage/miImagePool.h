@@ -0,0 +1,87 @@
+﻿//==============================================================================
+//
+// 画像バッファの使い回し
+//
+//==============================================================================
+#ifndef _MI_IMAGE_POOL_H_
+#define _MI_IMAGE_POOL_H_
+
+#include "miImage.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 画像バッファのプール
+//
+//  フレームごとに作業用の画像を確保し直さないように, 返却された画像を取っておく.
+//  Acquire() で借りた Buffer は破棄されるとプールに返る.
+//------------------------------------------------------------------------------
+class ImagePool {
+public:
+
+    //--------------------------------------------------------------------------
+    // 借りた画像 (破棄されるとプールに返る)
+    //--------------------------------------------------------------------------
+    class Buffer {
+    public:
+        Buffer() {}
+        Buffer(Buffer&& other) : pool(other.pool), image(std::move(other.image)) { other.pool = nullptr; }
+        Buffer& operator=(Buffer&& other);
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+        ~Buffer() { Release(); }
+
+        Image& operator*()  const { return *image; }
+        Image* operator->() const { return image.get(); }
+        Image* Get()        const { return image.get(); }
+        explicit operator bool() const { return image != nullptr; }
+
+        // プールに返す
+        void Release();
+
+    private:
+        friend class ImagePool;
+        Buffer(ImagePool* pool, std::unique_ptr<Image> image) : pool(pool), image(std::move(image)) {}
+
+        ImagePool* pool = nullptr;
+        std::unique_ptr<Image> image;
+    };
+
+    // プールに取っておく画像の最大数
+    static const int MAX_IMAGES = 16;
+
+    //--------------------------------------------------------------------------
+    // @brief 画像を借りる (画素値は不定)
+    //--------------------------------------------------------------------------
+    Buffer Acquire(int bit, int width, int height);
+
+    //--------------------------------------------------------------------------
+    // @brief image のコピーを借りる (部分画像なら隙間なく詰めてコピーする)
+    //--------------------------------------------------------------------------
+    Buffer Copy(const ImageView& image);
+
+    //--------------------------------------------------------------------------
+    // @brief 取っておいた画像を全て解放する
+    //--------------------------------------------------------------------------
+    void Clear();
+
+    //--------------------------------------------------------------------------
+    // @brief フィルタの作業用に共有するプール
+    //--------------------------------------------------------------------------
+    static ImagePool& Shared();
+
+private:
+
+    void release(std::unique_ptr<Image> image);
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Image> > images;
+};
+
+}
+
+#endif
@@ -4,18 +4,175 @@
 //
 //==============================================================================
 #include "miImageProcessing.h"
+#include "miHistogramMedian.h"
+#include "miBilateralGrid.h"
+#include "miArena.h"
+#include "../ThreadPool.h"
 
 #include <thread>
 #include <functional>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <cmath>
+#include <cstdlib>
+#include <vector>
 
 namespace mi {
 
+namespace {
+
+// 設定されたスレッドプール
+ThreadPool* sharedThreadPool = nullptr;
+
+//------------------------------------------------------------------------------
+// 分割実行の状態
+//   実行されずに残ったタスクが後から参照するのでヒープに置く
+//------------------------------------------------------------------------------
+struct RunState {
+    const std::function<void(int)>* chunk;  // 分割の番号を受け取る処理
+    int nChunks;
+
+    std::atomic<int> next{0};   // 次に処理する分割の番号
+    std::atomic<int> done{0};   // 処理が終わった分割の数
+
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    // 残っている分割を処理する
+    void Work() {
+        int i;
+        while((i = next++) < nChunks) {
+            (*chunk)(i);
+
+            if(++done == nChunks) {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.notify_all();
+            }
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// nChunks 個の分割を threadPool と呼び出し元で処理して, 終わるまで待つ
+//------------------------------------------------------------------------------
+void RunChunks(ThreadPool& threadPool, int nChunks, const std::function<void(int)>& chunk) {
+    
+    if(nChunks <= 0) {
+        return;
+    }
+    
+    auto state = std::make_shared<RunState>();
+    state->chunk   = &chunk;
+    state->nChunks = nChunks;
+    
+    // 呼び出し元も処理するので手伝うタスクは 1 つ少なくてよい
+    int nTasks = std::min(nChunks, threadPool.GetNumThread()) - 1;
+    
+    for(int i=0; i<nTasks; i++) {
+        threadPool.Request([state](int id){ state->Work(); });
+    }
+    
+    // 呼び出し元でも処理する (スレッドプールのタスクから呼ばれても止まらない)
+    state->Work();
+    
+    // 他のスレッドで処理中の分割を待つ
+    // (スレッドプール全体の Join() は DPM など他の処理も待ってしまうので使わない)
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while(state->done < state->nChunks) {
+        state->condition.wait(lock);
+    }
+}
+
+//------------------------------------------------------------------------------
+// src の [y0,y1) 行に 1次元フィルタを掛けて, 転置して dst に書き込む
+//   dst は src の縦横を入れ替えた大きさ. 2回掛けると縦横両方向に掛けたことになる
+//   rowFilter(in, out, width) の in は左右に pad 画素の 0 が付いている
+//   Pixel は画素の型 (ImageView なら RGB, Plane<T> なら T)
+//   作業領域はこのスレッドのアリーナから借りる
+//------------------------------------------------------------------------------
+template<class Pixel, class Source, class Destination, class RowFilter>
+void TransposedRowPass(const Source& src, Destination& dst, int y0, int y1, int pad, RowFilter rowFilter) {
+    
+    const int W = src.Width();
+    const int rows = y1 - y0;
+    
+    Arena& arena = Arena::Local();
+    Arena::Scope scope(arena);
+    
+    // 端の外側を 0 で埋めた行
+    Pixel* padded = arena.Allocate<Pixel>(W + 2*pad);
+    std::uninitialized_fill(padded, padded + W + 2*pad, Pixel());
+    
+    // タイル全体の結果 (転置で dst の行ごとにまとめて書き込む)
+    Pixel* result = arena.Allocate<Pixel>((size_t)rows * W);
+    std::uninitialized_fill(result, result + (size_t)rows * W, Pixel());
+    
+    for(int iY=y0; iY<y1; iY++) {
+        std::copy(src.Row(iY), src.Row(iY) + W, padded + pad);
+        rowFilter(padded + pad, result + (size_t)(iY-y0)*W, W);
+    }
+    
+    for(int iX=0; iX<W; iX++) {
+        Pixel* out = dst.Row(iX) + y0;
+        for(int i=0; i<rows; i++) {
+            out[i] = result[(size_t)i*W + iX];
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Gaussian フィルタの 1次元のマスク (合計を 1 にする)
+//   マスクは arena から切り出す
+//------------------------------------------------------------------------------
+const double* GaussianMask(Arena& arena, int filterSize, double sigma) {
+    
+    int halfSize = filterSize/2;
+    
+    double* LUT = arena.Allocate<double>(filterSize);
+    double DIV = 0;
+    
+    for(int i=0; i<filterSize; i++) {
+        int j = i - halfSize;
+        LUT[i] = exp( -j*j / sigma );
+        DIV += LUT[i];
+    }
+    for(int i=0; i<filterSize; i++) {
+        LUT[i] /= DIV;
+    }
+    
+    return LUT;
+}
+
+}
+
+//------------------------------------------------------------------------------
+// 画像処理を実行するスレッドプールを設定する
+// threadPool: スレッドプール (nullptr で既定のスレッドプール)
+//------------------------------------------------------------------------------
+void IImageProcessing::SetThreadPool(ThreadPool* threadPool) {
+    sharedThreadPool = threadPool;
+}
+
+//------------------------------------------------------------------------------
+// 画像処理を実行するスレッドプールを返す
+//------------------------------------------------------------------------------
+ThreadPool& IImageProcessing::GetThreadPool() {
+    if(sharedThreadPool) {
+        return *sharedThreadPool;
+    }
+
+    // 最初に使うときに生成する
+    static ThreadPool defaultThreadPool;
+    return defaultThreadPool;
+}
+
 //------------------------------------------------------------------------------
 // 画像処理を分割実行する
 // image     : 処理する画像
-// numThreads: スレッド数
+// numThreads: 分割数
 //------------------------------------------------------------------------------
 void IImageProcessing::Run(Image& image, int numThreads) {
     
@@ -24,23 +181,139 @@ void IImageProcessing::Run(Image& image, int numThreads) {
         numThreads = 1;
     }
     
-    // スレッドオブジェクトを生成
-    std::thread* threads = new std::thread[numThreads];
+    // 1スレッドの場合はスレッドプールを使わない (ディザ化のように順番に処理する必要がある)
+    if(numThreads <= 1) {
+        Processing(0, image.Size());
+        return;
+    }
+    
+    int grainSize = (image.Size() + numThreads - 1) / numThreads;
+    
+    Run(image, GetThreadPool(), grainSize);
+}
+
+//------------------------------------------------------------------------------
+// 画像処理を分割実行する
+// image     : 処理する画像
+// threadPool: 実行するスレッドプール
+// grainSize : 1タスクで処理する画素数
+//------------------------------------------------------------------------------
+void IImageProcessing::Run(Image& image, ThreadPool& threadPool, int grainSize) {
+    
+    grainSize = std::max(1, grainSize);
+    
+    int size    = image.Size();
+    int nChunks = (size + grainSize - 1) / grainSize;
+    
+    RunChunks(threadPool, nChunks, [&](int i) {
+        int start = i * grainSize;
+        Processing(start, std::min(grainSize, size - start));
+    });
+}
+
+//------------------------------------------------------------------------------
+// 画像処理をタイルに分割して実行する
+// width, height: 処理する画像の大きさ
+// pixelBytes   : 1画素のバイト数
+// halo         : フィルタの半径
+//------------------------------------------------------------------------------
+void IImageProcessing::RunTiled(int width, int height, int pixelBytes, int halo) {
+    
+    ThreadPool& threadPool = GetThreadPool();
+    int numThreads = threadPool.GetNumThread();
+    
+    // 1スレッドの場合は画像全体を 1 タイルとして処理する
+    if(numThreads <= 1 || height <= 1) {
+        TileProcessing(0, 0, width, height);
+        return;
+    }
+    
+    // 上下の近傍を含めた入出力がL2キャッシュ (256KB を想定) に収まる行数
+    const int cacheSize = 256 * 1024;
+    int rowBytes   = std::max(1, width) * pixelBytes * 2;
+    int tileHeight = cacheSize / rowBytes - 2 * halo;
+    
+    // 負荷を分散できるようにスレッドあたり 4 タイル以上にする
+    int maxHeight = (height + 4*numThreads - 1) / (4*numThreads);
+    tileHeight = std::max(1, std::min(tileHeight, maxHeight));
     
-    // スレッドを生成して画像処理を実行する
-    for(int i=0; i<numThreads; i++){
-        int length = image.Size() / numThreads;
-        int start  = i*length;
-        threads[i] = std::thread(Processing,start,length);
+    RunTiled(width, height, threadPool, tileHeight);
+}
+
+//------------------------------------------------------------------------------
+// 画像処理をタイルに分割して実行する
+//   タイルは画像の幅全体で, 空いたスレッドから順に取っていく
+// width, height: 処理する画像の大きさ
+// threadPool   : 実行するスレッドプール
+// tileHeight   : 1タイルの行数
+//------------------------------------------------------------------------------
+void IImageProcessing::RunTiled(int width, int height, ThreadPool& threadPool, int tileHeight) {
+    
+    tileHeight = std::max(1, tileHeight);
+    
+    int nChunks = width > 0 ? (height + tileHeight - 1) / tileHeight : 0;
+    
+    RunChunks(threadPool, nChunks, [&](int i) {
+        int y0 = i * tileHeight;
+        TileProcessing(0, y0, width, std::min(height, y0 + tileHeight));
+    });
+}
+
+//------------------------------------------------------------------------------
+// 近傍を参照するフィルタの入力を返す
+//   入力を読みながら出力を書くので, 画素データが重なる場合だけコピーする
+// source: 入力画像
+// image : 出力画像
+// copy  : コピーを借りた場合の格納先
+//------------------------------------------------------------------------------
+ImageView IImageProcessing::Source(const ImageView& source, const ImageView& image, ImagePool::Buffer& copy) {
+    
+    if(source.Overlaps(image)) {
+        copy = ImagePool::Shared().Copy(source);
+        return *copy;
     }
     
-    // 各スレッドの終了処理
-    for(int i=0; i<numThreads; i++){
-        threads[i].join();
+    return source;
+}
+
+//------------------------------------------------------------------------------
+// 近傍を参照するフィルタの出力を返す
+// source: 入力画像
+// image : 出力画像 (大きさが違えば作り直す)
+//------------------------------------------------------------------------------
+ImageView IImageProcessing::Output(const Image& source, Image& image) {
+    
+    if(image.Width() != source.Width() || image.Height() != source.Height()) {
+        image = Image(source.Bit(), source.Width(), source.Height());
     }
     
-    // スレッドオブジェクトを破棄
-    delete[] threads;
+    return image;
+}
+
+//------------------------------------------------------------------------------
+// 画素ごとの処理を掛ける
+//   隙間なく並んだ画像はまとめて, 部分画像は 1 行ずつ operation に渡す
+// operation: 画素ごとの処理
+// image    : 処理する画像
+//------------------------------------------------------------------------------
+void IImageProcessing::Apply(const PointOperation& operation, const ImageView& image) {
+    
+    struct PointProcessing : IImageProcessing {
+        PointProcessing(const PointOperation& operation, const ImageView& image) {
+            TileProcessing = [&](int x0, int y0, int x1, int y1) {
+                if(image.IsContiguous()) {
+                    operation(image.Row(y0), (y1 - y0) * image.Width());
+                    return;
+                }
+                for(int iY=y0; iY<y1; iY++) {
+                    operation(image.Row(iY), image.Width());
+                }
+            };
+            RunTiled(image, 0);
+        }
+    };
+    
+    PointProcessing processing(operation, image);
 }
 
 //------------------------------------------------------------------------------
@@ -48,20 +321,27 @@ void IImageProcessing::Run(Image& image, int numThreads) {
 //------------------------------------------------------------------------------
 Monochrome::Monochrome(Image& image) {
     
+    PointOperation operation = Operation();
+    
     // 画像処理本体
     Processing = [&](int start, int length) {
-        
-        for(int i=start; i<start+length; i++) {
-            int Y = (int)(0.299*image.data[i].r + 0.587*image.data[i].g + 0.114*image.data[i].b);
-            image.data[i].r = (unsigned char)Y;
-            image.data[i].g = (unsigned char)Y;
-            image.data[i].b = (unsigned char)Y;
-        }
+        operation(image.data + start, length);
     };
     
     // Processingの処理をおこなう
     Run(image, std::thread::hardware_concurrency());
 }
+
+PointOperation Monochrome::Operation() {
+    return [](RGB* pixels, int length) {
+        for(int i=0; i<length; i++) {
+            int Y = (int)(0.299*pixels[i].r + 0.587*pixels[i].g + 0.114*pixels[i].b);
+            pixels[i].r = (unsigned char)Y;
+            pixels[i].g = (unsigned char)Y;
+            pixels[i].b = (unsigned char)Y;
+        }
+    };
+}
     
 //------------------------------------------------------------------------------
 // ディザ化処理
@@ -106,230 +386,408 @@ DitheringErrorDiffusion::DitheringErrorDiffusion(Image& image) {
 //------------------------------------------------------------------------------
 Binarize::Binarize(Image &image, int threshold) {
 
+    PointOperation operation = Operation(threshold);
+    
     // 画像処理本体
     Processing = [&](int start, int length) {
-        
-        for(int i=start; i<start+length; i++) {
-            int Y = (int)(0.299*image.data[i].r + 0.587*image.data[i].g + 0.114*image.data[i].b);
+        operation(image.data + start, length);
+    };
+    
+    // Processingの処理をおこなう
+    Run(image, std::thread::hardware_concurrency());
+}
+
+PointOperation Binarize::Operation(int threshold) {
+    return [threshold](RGB* pixels, int length) {
+        for(int i=0; i<length; i++) {
+            int Y = (int)(0.299*pixels[i].r + 0.587*pixels[i].g + 0.114*pixels[i].b);
             if(Y > threshold) {
-                image.data[i] = RGB(255,255,255);
+                pixels[i] = RGB(255,255,255);
             }
             else {
-                image.data[i] = RGB(0,0,0);
+                pixels[i] = RGB(0,0,0);
             }
         }
     };
-    
-    // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
 }
 
 //------------------------------------------------------------------------------
 // メディアンフィルタ
 //------------------------------------------------------------------------------
-MedianFilter::MedianFilter(Image& image, int filterSize) {
+MedianFilter::MedianFilter(const ImageView& source, const ImageView& image, int filterSize, MedianMethod method) {
     
-    // コピー
-    Image copy = image;
+    // 入力 (出力と重なるならコピー)
+    ImagePool::Buffer buffer;
+    const ImageView copy = Source(source, image, buffer);
+    
+    int halfSize = filterSize/2;
+    
+    if(method == MEDIAN_AUTO) {
+        method = HistogramMedian::IsFaster(filterSize, 1) ? MEDIAN_HISTOGRAM : MEDIAN_SORT;
+    }
+    
+    // ヒストグラムによるメディアン
+    if(method == MEDIAN_HISTOGRAM) {
+        std::vector<ImageView> frames(1, copy);
+        
+        TileProcessing = [&](int x0, int y0, int x1, int y1) {
+            HistogramMedian median(frames, filterSize);
+            median.Process(image, x0, y0, x1, y1);
+        };
+        
+        RunTiled(image, halfSize);
+        return;
+    }
     
     // 画像処理本体
-    Processing = [&](int start, int length) {
+    TileProcessing = [&](int x0, int y0, int x1, int y1) {
         
-        int halfSize = filterSize/2;
+        const int W = image.Width();
+        const int H = image.Height();
         int sqrSize  = filterSize*filterSize;
         
-        int* R = new int[sqrSize];
-        int* G = new int[sqrSize];
-        int* B = new int[sqrSize];
+        Arena& arena = Arena::Local();
+        Arena::Scope scope(arena);
+        
+        unsigned char* R = arena.Allocate<unsigned char>(sqrSize);
+        unsigned char* G = arena.Allocate<unsigned char>(sqrSize);
+        unsigned char* B = arena.Allocate<unsigned char>(sqrSize);
 
-        for(int i=start; i<start+length; i++) {
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+        for(int iY=y0; iY<y1; iY++) {
+            for(int iX=x0; iX<x1; iX++) {
 
-            int pixelCount = 0;
+                int pixelCount = 0;
 
-            for(int j=0; j<sqrSize; j++){
-                int jX = iX + j%filterSize - halfSize;
-                int jY = iY + j/filterSize - halfSize;
+                for(int dy=0; dy<filterSize; dy++) {
+                    int jY = iY + dy - halfSize;
+                    if(jY<0 || jY>=H) continue;
                     
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
+                    const RGB* src = copy.Row(jY);
+                    
+                    for(int dx=0; dx<filterSize; dx++) {
+                        int jX = iX + dx - halfSize;
+                        if(jX<0 || jX>=W) continue;
+                        
+                        R[pixelCount] = src[jX].r;
+                        G[pixelCount] = src[jX].g;
+                        B[pixelCount] = src[jX].b;
+                        pixelCount++;
+                    }
+                }
+                
+                // 中央の値だけわかればよい
+                int k = pixelCount/2;
+                std::nth_element(R, R+k, R+pixelCount);
+                std::nth_element(G, G+k, G+pixelCount);
+                std::nth_element(B, B+k, B+pixelCount);
                 
-                R[pixelCount] = copy.pixel[jX][jY].r;
-                G[pixelCount] = copy.pixel[jX][jY].g;
-                B[pixelCount] = copy.pixel[jX][jY].b;
-                pixelCount++;
+                RGB& dst = image(iX, iY);
+                dst.r = R[k];
+                dst.g = G[k];
+                dst.b = B[k];
             }
-            
-            std::sort(R, R+pixelCount);
-            std::sort(G, G+pixelCount);
-            std::sort(B, B+pixelCount);
-            
-            image.pixel[iX][iY].r = R[pixelCount/2];
-            image.pixel[iX][iY].g = G[pixelCount/2];
-            image.pixel[iX][iY].b = B[pixelCount/2];
         }
-        
-        delete[] R;
-        delete[] G;
-        delete[] B;
     };
     
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunTiled(image, halfSize);
 }
     
 //------------------------------------------------------------------------------
 // 平均化フィルタ
 //------------------------------------------------------------------------------
-AverageFilter::AverageFilter(Image& image, int filterSize) {
+AverageFilter::AverageFilter(const ImageView& source, const ImageView& image, int filterSize) {
 
     int halfSize = filterSize/2;
     
-    // 縦横の走査をわけるための値
-    int horizontal = 0; // 横方向走査時には1, そうでなければ0
-    int vertical   = 0; // 縦方向走査時には1, そうでなければ0
+    // 横方向に掛けた結果 (縦横を入れ替えて持つ)
+    // 一度 transposed に書き出すので source と image が同じ画像でもよい
+    ImagePool::Buffer transposed = ImagePool::Shared().Acquire(source.Bit(), source.Height(), source.Width());
     
-    // 宣言
-    Image copy(image.Bit(), image.Width(), image.Height());
+    // 入出力
+    ImageView src = source;
+    ImageView dst = *transposed;
     
     // 処理本体
-    Processing = [&](int start, int length){
+    // 窓の合計を 1 画素ずつずらしながら更新する (窓の大きさに依らない)
+    TileProcessing = [&](int x0, int y0, int x1, int y1){
         
-        for(int i=start; i<start + length; i++) {
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+        TransposedRowPass<RGB>(src, dst, y0, y1, halfSize, [&](const RGB* in, RGB* out, int width) {
             
-            double R=0, G=0, B=0;
+            int R=0, G=0, B=0;
             
             for(int j=0; j<filterSize; j++) {
-                int jX = iX + (j-halfSize) * horizontal;
-                int jY = iY + (j-halfSize) * vertical;
-                
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
-                
-                R += copy.pixel[jX][iY].r;
-                G += copy.pixel[jX][iY].g;
-                B += copy.pixel[jX][iY].b;
+                R += in[j-halfSize].r;
+                G += in[j-halfSize].g;
+                B += in[j-halfSize].b;
             }
             
-            image.pixel[iX][iY] = RGB(R/filterSize, G/filterSize, B/filterSize);
-        }
+            for(int iX=0; iX<width; iX++) {
+                out[iX] = RGB((double)R/filterSize, (double)G/filterSize, (double)B/filterSize);
+                
+                if(iX+1 < width) {
+                    const RGB& add = in[iX+1 + filterSize-1 - halfSize];
+                    const RGB& sub = in[iX - halfSize];
+                    R += add.r - sub.r;
+                    G += add.g - sub.g;
+                    B += add.b - sub.b;
+                }
+            }
+        });
     };
 
-    // 横方向 ----
-    // コピー
-    std::copy(image.data, image.data+image.Size(), copy.data);
-    
     // 横方向
-    horizontal = 1;
-    vertical   = 0;
-        
-    // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
-    
+    RunTiled(source, 0);
     
-    // 縦方向 ----
-    // コピー
-    std::copy(image.data, image.data+image.Size(), copy.data);
-    
-    // 縦方向
-    horizontal = 0;
-    vertical   = 1;
-        
-    // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    // 縦方向 (転置した画像の横方向)
+    src = *transposed;
+    dst = image;
+    RunTiled(*transposed, 0);
 }
 
 //------------------------------------------------------------------------------
 // Gaussian フィルタ
 //------------------------------------------------------------------------------
-GaussianFilter::GaussianFilter(Image& image, int filterSize, double sigma) {
+GaussianFilter::GaussianFilter(const ImageView& source, const ImageView& image, int filterSize, double sigma) {
     
     int halfSize = filterSize/2;
     
-    // マスクの生成
-    double* LUT = new double[filterSize];
-    double  DIV = 0;
+    // マスクの生成 (作業領域はこのスレッドのアリーナから借りる)
+    Arena::Scope scope(Arena::Local());
+    const double* LUT = GaussianMask(Arena::Local(), filterSize, sigma);
     
-    for(int i=0; i<filterSize; i++) {
-        int j = i - halfSize;
-        LUT[i] = exp( -j*j / sigma );
-        DIV += LUT[i];
-    }
-    for(int i=0; i<filterSize; i++) {
-        LUT[i] /= DIV;
-    }
-    
-    // 縦横の走査をわけるための値
-    int horizontal = 0; // 横方向走査時には1, そうでなければ0
-    int vertical   = 0; // 縦方向走査時には1, そうでなければ0
+    // 横方向に掛けた結果 (縦横を入れ替えて持つ)
+    // 一度 transposed に書き出すので source と image が同じ画像でもよい
+    ImagePool::Buffer transposed = ImagePool::Shared().Acquire(source.Bit(), source.Height(), source.Width());
     
-    // 宣言
-    Image copy(image.Bit(), image.Width(), image.Height());
+    // 入出力
+    ImageView src = source;
+    ImageView dst = *transposed;
     
     // 処理本体
-    Processing = [&](int start, int length){
+    TileProcessing = [&](int x0, int y0, int x1, int y1){
         
-        for(int i=start; i<start + length; i++) {
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+        TransposedRowPass<RGB>(src, dst, y0, y1, halfSize, [&](const RGB* in, RGB* out, int width) {
             
-            double R=0, G=0, B=0;
-            
-            for(int j=0; j<filterSize; j++) {
-                int jX = iX + (j-halfSize)*horizontal;
-                int jY = iY + (j-halfSize)*vertical;
+            for(int iX=0; iX<width; iX++) {
+                
+                const RGB* window = in + iX - halfSize;
+                double R=0, G=0, B=0;
                 
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
+                for(int j=0; j<filterSize; j++) {
+                    R += window[j].r * LUT[j];
+                    G += window[j].g * LUT[j];
+                    B += window[j].b * LUT[j];
+                }
                 
-                R += copy.pixel[jX][jY].r * LUT[j];
-                G += copy.pixel[jX][jY].g * LUT[j];
-                B += copy.pixel[jX][jY].b * LUT[j];
+                out[iX] = RGB(R, G, B);
+            }
+        });
+    };
+    
+    // 横方向
+    RunTiled(source, 0);
+    
+    // 縦方向 (転置した画像の横方向)
+    src = *transposed;
+    dst = image;
+    RunTiled(*transposed, 0);
+}
+    
+//------------------------------------------------------------------------------
+// メディアンフィルタ (1 チャンネルの画像)
+//------------------------------------------------------------------------------
+template<class T>
+MedianFilter::MedianFilter(const Plane<T>& source, Plane<T>& image, int filterSize) {
+    
+    // 入力 (出力と同じ画像ならコピー)
+    Plane<T> copied;
+    const Plane<T>* src = &source;
+    if(&source == &image) {
+        copied = source;
+        src = &copied;
+    }
+    image.Initialize(src->Width(), src->Height());
+    
+    int halfSize = filterSize/2;
+    
+    // 画像処理本体
+    TileProcessing = [&](int x0, int y0, int x1, int y1) {
+        
+        const int W = src->Width();
+        const int H = src->Height();
+        
+        Arena& arena = Arena::Local();
+        Arena::Scope scope(arena);
+        
+        T* values = arena.Allocate<T>(filterSize*filterSize);
+        
+        for(int iY=y0; iY<y1; iY++) {
+            for(int iX=x0; iX<x1; iX++) {
+                
+                int count = 0;
+                
+                for(int dy=0; dy<filterSize; dy++) {
+                    int jY = iY + dy - halfSize;
+                    if(jY<0 || jY>=H) continue;
+                    
+                    const T* row = src->Row(jY);
+                    
+                    for(int dx=0; dx<filterSize; dx++) {
+                        int jX = iX + dx - halfSize;
+                        if(jX<0 || jX>=W) continue;
+                        values[count++] = row[jX];
+                    }
+                }
+                
+                int k = count/2;
+                std::nth_element(values, values+k, values+count);
+                image(iX, iY) = values[k];
             }
-            
-            image.pixel[iX][iY] = RGB(R, G, B);
         }
     };
     
-    // コピー
-    std::copy(image.data, image.data+image.Size(), copy.data);
+    RunTiled(image, halfSize);
+}
+
+//------------------------------------------------------------------------------
+// 平均化フィルタ (1 チャンネルの画像)
+//------------------------------------------------------------------------------
+template<class T>
+AverageFilter::AverageFilter(const Plane<T>& source, Plane<T>& image, int filterSize) {
+    
+    int halfSize = filterSize/2;
+    
+    // 横方向に掛けた結果 (縦横を入れ替えて持つ)
+    Plane<T> transposed(source.Height(), source.Width());
+    image.Initialize(source.Width(), source.Height());
+    
+    // 入出力
+    const Plane<T>* src = &source;
+    Plane<T>*       dst = &transposed;
+    
+    // 窓の合計を 1 画素ずつずらしながら更新する
+    TileProcessing = [&](int x0, int y0, int x1, int y1){
         
+        TransposedRowPass<T>(*src, *dst, y0, y1, halfSize, [&](const T* in, T* out, int width) {
+            
+            double sum = 0;
+            for(int j=0; j<filterSize; j++) {
+                sum += in[j-halfSize];
+            }
+            
+            for(int iX=0; iX<width; iX++) {
+                out[iX] = (T)(sum / filterSize);
+                
+                if(iX+1 < width) {
+                    sum += in[iX+1 + filterSize-1 - halfSize];
+                    sum -= in[iX - halfSize];
+                }
+            }
+        });
+    };
+    
     // 横方向
-    horizontal = 1;
-    vertical   = 0;
+    RunTiled(source, 0);
+    
+    // 縦方向 (転置した画像の横方向)
+    src = &transposed;
+    dst = &image;
+    RunTiled(transposed, 0);
+}
 
-    // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+//------------------------------------------------------------------------------
+// Gaussian フィルタ (1 チャンネルの画像)
+//------------------------------------------------------------------------------
+template<class T>
+GaussianFilter::GaussianFilter(const Plane<T>& source, Plane<T>& image, int filterSize, double sigma) {
+    
+    int halfSize = filterSize/2;
+    
+    // マスクの生成 (作業領域はこのスレッドのアリーナから借りる)
+    Arena::Scope scope(Arena::Local());
+    const double* LUT = GaussianMask(Arena::Local(), filterSize, sigma);
     
+    // 横方向に掛けた結果 (縦横を入れ替えて持つ)
+    Plane<T> transposed(source.Height(), source.Width());
+    image.Initialize(source.Width(), source.Height());
     
-    // コピー
-    std::copy(image.data, image.data+image.Size(), copy.data);
+    // 入出力
+    const Plane<T>* src = &source;
+    Plane<T>*       dst = &transposed;
+    
+    // 処理本体
+    TileProcessing = [&](int x0, int y0, int x1, int y1){
         
+        TransposedRowPass<T>(*src, *dst, y0, y1, halfSize, [&](const T* in, T* out, int width) {
+            
+            for(int iX=0; iX<width; iX++) {
+                
+                const T* window = in + iX - halfSize;
+                double v = 0;
+                
+                for(int j=0; j<filterSize; j++) {
+                    v += window[j] * LUT[j];
+                }
+                
+                out[iX] = (T)v;
+            }
+        });
+    };
+    
     // 横方向
-    horizontal = 0;
-    vertical   = 1;
-        
-    // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunTiled(source, 0);
     
-    delete[] LUT;
+    // 縦方向 (転置した画像の横方向)
+    src = &transposed;
+    dst = &image;
+    RunTiled(transposed, 0);
 }
+
+// 1 チャンネルの画像のフィルタの実体
+template MedianFilter::MedianFilter(const Plane8&,  Plane8&,  int);
+template MedianFilter::MedianFilter(const Plane16&, Plane16&, int);
+template MedianFilter::MedianFilter(const PlaneF&,  PlaneF&,  int);
+template AverageFilter::AverageFilter(const Plane8&,  Plane8&,  int);
+template AverageFilter::AverageFilter(const Plane16&, Plane16&, int);
+template AverageFilter::AverageFilter(const PlaneF&,  PlaneF&,  int);
+template GaussianFilter::GaussianFilter(const Plane8&,  Plane8&,  int, double);
+template GaussianFilter::GaussianFilter(const Plane16&, Plane16&, int, double);
+template GaussianFilter::GaussianFilter(const PlaneF&,  PlaneF&,  int, double);
     
 //------------------------------------------------------------------------------
 // Bilateral フィルタ
 //------------------------------------------------------------------------------
-BilateralFilter::BilateralFilter(Image& image, int filterSize, double sigma, double sigma2) {
+BilateralFilter::BilateralFilter(const ImageView& source, const ImageView& image, int filterSize,
+                                 double sigma, double sigma2, BilateralMethod method) {
     
     struct dRGB { double r=0, g=0, b=0; };
     
     int halfSize = filterSize/2;
     
+    // 入力 (出力と重なるならコピー)
+    ImagePool::Buffer buffer;
+    const ImageView copy = Source(source, image, buffer);
+    
+    // bilateral grid による近似
+    if(method == BILATERAL_GRID) {
+        BilateralGrid grid(copy, copy, sigma, sigma2);
+        
+        TileProcessing = [&](int x0, int y0, int x1, int y1){
+            grid.Slice(image, y0, y1);
+        };
+        
+        RunTiled(image, 0);
+        return;
+    }
+    
     // パラメータ
     double sig = 2 * sigma * sigma;
     double sig2= 2 * sigma2 * sigma2;
     
-    // マスクの生成
-    double* LUT = new double[filterSize*filterSize];
+    // マスクの生成 (作業領域はこのスレッドのアリーナから借りる)
+    Arena::Scope scope(Arena::Local());
+    double* LUT = Arena::Local().Allocate<double>(filterSize*filterSize);
     
     for(int i=0; i<filterSize*filterSize; i++) {
         int iX = i%filterSize-halfSize;
@@ -337,69 +795,75 @@ BilateralFilter::BilateralFilter(Image& image, int filterSize, double sigma, dou
         LUT[ i ] = exp(-(iX*iX+iY*iY)/sig);
     }
     
-    // コピー
-    Image copy = image;
+    // 輝度差の重み (差は -255~255 の整数なので絶対値で引く)
+    double rangeLUT[256];
+    
+    for(int i=0; i<256; i++) {
+        double d = i;
+        rangeLUT[i] = exp( -d*d / sig2 );
+    }
 
     // 処理本体
-    Processing = [&](int start, int length){
-            
-        for(int i=start; i<start + length; i++) {
-
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+    TileProcessing = [&](int x0, int y0, int x1, int y1){
+        
+        const int W = image.Width();
+        const int H = image.Height();
+        
+        for(int iY=y0; iY<y1; iY++) {
+            for(int iX=x0; iX<x1; iX++) {
                 
-            dRGB sum; // ピクセルとの計算結果合計値
-            dRGB div; // 正規化用のフィルタ値合計
+                const RGB& center = copy(iX, iY);
                 
-            for(int j=0; j<filterSize*filterSize; j++) {
-
-                int jX = iX + j%filterSize - halfSize;
-                int jY = iY + j/filterSize - halfSize;
+                dRGB sum; // ピクセルとの計算結果合計値
+                dRGB div; // 正規化用のフィルタ値合計
                 
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
+                for(int dy=0; dy<filterSize; dy++) {
+                    int jY = iY + dy - halfSize;
+                    if(jY<0 || jY>=H) continue;
                     
-                dRGB lateral, filter;
+                    const RGB* src = copy.Row(jY);
+                    const double* mask = LUT + dy*filterSize;
                     
-                lateral.r = (copy.pixel[iX][iY].r - copy.pixel[jX][jY].r);
-                lateral.g = (copy.pixel[iX][iY].g - copy.pixel[jX][jY].g);
-                lateral.b = (copy.pixel[iX][iY].b - copy.pixel[jX][jY].b);
-                    
-                lateral.r = exp( -lateral.r*lateral.r / sig2 );
-                lateral.g = exp( -lateral.g*lateral.g / sig2 );
-                lateral.b = exp( -lateral.b*lateral.b / sig2 );
+                    for(int dx=0; dx<filterSize; dx++) {
+                        int jX = iX + dx - halfSize;
+                        if(jX<0 || jX>=W) continue;
                         
-                filter.r = LUT[j] * lateral.r;
-                filter.g = LUT[j] * lateral.g;
-                filter.b = LUT[j] * lateral.b;
-                    
-                sum.r += filter.r * copy.pixel[jX][jY].r;
-                sum.g += filter.g * copy.pixel[jX][jY].g;
-                sum.b += filter.b * copy.pixel[jX][jY].b;
-                    
-                div.r += filter.r;
-                div.g += filter.g;
-                div.b += filter.b;
+                        dRGB filter;
+                        
+                        filter.r = mask[dx] * rangeLUT[std::abs(center.r - src[jX].r)];
+                        filter.g = mask[dx] * rangeLUT[std::abs(center.g - src[jX].g)];
+                        filter.b = mask[dx] * rangeLUT[std::abs(center.b - src[jX].b)];
+                        
+                        sum.r += filter.r * src[jX].r;
+                        sum.g += filter.g * src[jX].g;
+                        sum.b += filter.b * src[jX].b;
+                        
+                        div.r += filter.r;
+                        div.g += filter.g;
+                        div.b += filter.b;
+                    }
+                }
+                
+                RGB& dst = image(iX, iY);
+                dst.r = (unsigned char)std::max(0.0,std::min(255.0,sum.r/div.r));
+                dst.g = (unsigned char)std::max(0.0,std::min(255.0,sum.g/div.g));
+                dst.b = (unsigned char)std::max(0.0,std::min(255.0,sum.b/div.b));
             }
-            
-            image.pixel[iX][iY].r = (unsigned char)std::max(0.0,std::min(255.0,sum.r/div.r));
-            image.pixel[iX][iY].g = (unsigned char)std::max(0.0,std::min(255.0,sum.g/div.g));
-            image.pixel[iX][iY].b = (unsigned char)std::max(0.0,std::min(255.0,sum.b/div.b));
         }
     };
     
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
-    
-    delete[] LUT;
+    RunTiled(image, halfSize);
 }
     
 //------------------------------------------------------------------------------
 // Sobel フィルタ
 //------------------------------------------------------------------------------
-SobelFilter::SobelFilter(Image& image) {
+SobelFilter::SobelFilter(const ImageView& source, const ImageView& image) {
     
-    // コピー
-    Image copy = image;
+    // 入力 (出力と重なるならコピー)
+    ImagePool::Buffer buffer;
+    const ImageView copy = Source(source, image, buffer);
     
     int horizontal_kernel[] = {
         -1, 0, 1,
@@ -418,49 +882,61 @@ SobelFilter::SobelFilter(Image& image) {
 
     
     // 画像処理本体
-    Processing = [&](int start, int length) {
+    TileProcessing = [&](int x0, int y0, int x1, int y1) {
         
-        for(int i=start; i<start+length; i++) {
-            
-            int iX = i%image.Width();
-            int iY = i/image.Width();
+        const int W = image.Width();
+        const int H = image.Height();
+        
+        // 入出力の先頭と 1 行の画素数
+        const RGB* in   = copy.data;
+        RGB* out        = image.data;
+        const int inStride  = copy.Stride();
+        const int outStride = image.Stride();
+        
+        for(int iY=y0; iY<y1; iY++) {
+            for(int iX=x0; iX<x1; iX++) {
 
-            int rh=0, gh=0, bh=0;
-            int rv=0, gv=0, bv=0;
+                int rh=0, gh=0, bh=0;
+                int rv=0, gv=0, bv=0;
 
-            for(int j=0; j<9; j++) {
-                int jX = iX + dx[j];
-                int jY = iY + dy[j];
+                for(int j=0; j<9; j++) {
+                    int jX = iX + dx[j];
+                    int jY = iY + dy[j];
 
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
-                
-                rh += copy.pixel[jX][jY].r * horizontal_kernel[j];
-                gh += copy.pixel[jX][jY].g * horizontal_kernel[j];
-                bh += copy.pixel[jX][jY].b * horizontal_kernel[j];
+                    if(jX<0 || jX>=W || jY<0 || jY>=H) continue;
+                    
+                    const RGB& src = in[jY*inStride + jX];
+                    
+                    rh += src.r * horizontal_kernel[j];
+                    gh += src.g * horizontal_kernel[j];
+                    bh += src.b * horizontal_kernel[j];
 
-                rv += copy.pixel[jX][jY].r * vertical_kernel[j];
-                gv += copy.pixel[jX][jY].g * vertical_kernel[j];
-                bv += copy.pixel[jX][jY].b * vertical_kernel[j];
+                    rv += src.r * vertical_kernel[j];
+                    gv += src.g * vertical_kernel[j];
+                    bv += src.b * vertical_kernel[j];
+                }
+                
+                RGB& dst = out[iY*outStride + iX];
+                dst.r = (unsigned char)sqrt((double)(rv*rv + rh*rh));
+                dst.g = (unsigned char)sqrt((double)(gv*gv + gh*gh));
+                dst.b = (unsigned char)sqrt((double)(bv*bv + bh*bh));
             }
-            
-            image.pixel[iX][iY].r = (unsigned char)sqrt((double)(rv*rv + rh*rh));
-            image.pixel[iX][iY].g = (unsigned char)sqrt((double)(gv*gv + gh*gh));
-            image.pixel[iX][iY].b = (unsigned char)sqrt((double)(bv*bv + bh*bh));
         }
     };
     
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunTiled(image, 1);
 }
 
 
 //------------------------------------------------------------------------------
 // Laplacian フィルタ
 //------------------------------------------------------------------------------
-LaplacianFilter::LaplacianFilter(Image& image) {
+LaplacianFilter::LaplacianFilter(const ImageView& source, const ImageView& image) {
 
-    // コピー
-    Image copy = image;
+    // 入力 (出力と重なるならコピー)
+    ImagePool::Buffer buffer;
+    const ImageView copy = Source(source, image, buffer);
 
     int kernel[] = {
         1,  1, 1,
@@ -473,34 +949,45 @@ LaplacianFilter::LaplacianFilter(Image& image) {
 
 
     // 画像処理本体
-    Processing = [&](int start, int length) {
+    TileProcessing = [&](int x0, int y0, int x1, int y1) {
 
-        for(int i=start; i<start+length; i++) {
+        const int W = image.Width();
+        const int H = image.Height();
+        
+        // 入出力の先頭と 1 行の画素数
+        const RGB* in   = copy.data;
+        RGB* out        = image.data;
+        const int inStride  = copy.Stride();
+        const int outStride = image.Stride();
+        
+        for(int iY=y0; iY<y1; iY++) {
+            for(int iX=x0; iX<x1; iX++) {
 
-            int iX = i%image.Width();
-            int iY = i/image.Width();
+                int r=0, g=0, b=0;
 
-            int r=0, g=0, b=0;
+                for(int j=0; j<9; j++) {
+                    int jX = iX + dx[j];
+                    int jY = iY + dy[j];
 
-            for(int j=0; j<9; j++) {
-                int jX = iX + dx[j];
-                int jY = iY + dy[j];
+                    if(jX<0 || jX>=W || jY<0 || jY>=H) continue;
+                    
+                    const RGB& src = in[jY*inStride + jX];
+                    
+                    r += src.r * kernel[j];
+                    g += src.g * kernel[j];
+                    b += src.b * kernel[j];
+                }
 
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
-                
-                r += copy.pixel[jX][jY].r * kernel[j];
-                g += copy.pixel[jX][jY].g * kernel[j];
-                b += copy.pixel[jX][jY].b * kernel[j];
+                RGB& dst = out[iY*outStride + iX];
+                dst.r = (unsigned char)std::min(std::max(r,0),255);
+                dst.g = (unsigned char)std::min(std::max(g,0),255);
+                dst.b = (unsigned char)std::min(std::max(b,0),255);
             }
-
-            image.pixel[iX][iY].r = (unsigned char)std::min(std::max(r,0),255);
-            image.pixel[iX][iY].g = (unsigned char)std::min(std::max(g,0),255);
-            image.pixel[iX][iY].b = (unsigned char)std::min(std::max(b,0),255);
         }
     };
 
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunTiled(image, 1);
 }
 
     
@@ -601,24 +1088,34 @@ AlphaBlend::AlphaBlend(Image& image, const Image& blend, double alpha) {
 //------------------------------------------------------------------------------
 GammaCollection::GammaCollection(Image& image, double param) {
     
-    unsigned char LUT[256];
-    
-    for(int i=0; i<256; i++) {
-        LUT[i] = (unsigned char)(255*pow(i/255.0,1.0/param));
-    }
+    PointOperation operation = Operation(param);
     
     // ガンマ補正処理
     Processing = [&](int start, int length) {
-        for(int i=start; i<start+length; i++) {
-            
-            image.data[i].r = LUT[image.data[i].r];
-            image.data[i].g = LUT[image.data[i].g];
-            image.data[i].b = LUT[image.data[i].b];
-        }
+        operation(image.data + start, length);
     };
 
     // Processingの処理をおこなう
     Run(image, std::thread::hardware_concurrency());
 }
 
+PointOperation GammaCollection::Operation(double param) {
+    
+    std::shared_ptr<unsigned char> table(new unsigned char[256], std::default_delete<unsigned char[]>());
+    unsigned char* LUT = table.get();
+    
+    for(int i=0; i<256; i++) {
+        LUT[i] = (unsigned char)(255*pow(i/255.0,1.0/param));
+    }
+    
+    return [table](RGB* pixels, int length) {
+        const unsigned char* LUT = table.get();
+        for(int i=0; i<length; i++) {
+            pixels[i].r = LUT[pixels[i].r];
+            pixels[i].g = LUT[pixels[i].g];
+            pixels[i].b = LUT[pixels[i].b];
+        }
+    };
+}
+
 }
\ No newline at end of file
@@ -7,10 +7,21 @@
 #define _MI_IMAGE_PROCESSING_H_
 
 #include "miImage.h"
+#include "miImagePool.h"
+#include "miPlane.h"
 #include <functional>
 
+class ThreadPool;
+
 namespace mi {
 
+//------------------------------------------------------------------------------
+// 画素ごとの処理 (pixels から length 画素をその場で書き換える)
+//   近傍を参照しない処理はこの形でも提供し, FilterPipeline で他の処理とまとめられる
+//------------------------------------------------------------------------------
+typedef std::function<void(RGB* pixels, int length)> PointOperation;
+
+
 //------------------------------------------------------------------------------
 // 画像処理インターフェイスクラス
 //
@@ -19,6 +30,17 @@ namespace mi {
 // コンストラクタで Processing に画像処理の関数を代入する。その後 Run() を呼ぶ
 //------------------------------------------------------------------------------
 class IImageProcessing {
+public:
+    // 画像処理を実行するスレッドプールを設定する (nullptr で既定のスレッドプールに戻す)
+    // DPM と同時に使う場合は DPM のスレッドプールを設定するとコアを奪い合わない
+    static void SetThreadPool(ThreadPool* threadPool);
+
+    // 画像処理を実行するスレッドプールを返す
+    static ThreadPool& GetThreadPool();
+
+    // 画素ごとの処理を image に掛ける (部分画像でもよい)
+    static void Apply(const PointOperation& operation, const ImageView& image);
+
 protected:
     // 継承を強制する
     IImageProcessing(){}
@@ -27,8 +49,39 @@ protected:
     // 第一引数に Image型メンバdataの開始番号, 第二引数に開始から終了までの長さが渡される
     std::function<void(int, int)> Processing;
     
+    // 画像処理関数 (タイル)
+    // 処理する範囲 [x0,x1) x [y0,y1) が渡される. 近傍を参照するフィルタはこちらを使う
+    std::function<void(int, int, int, int)> TileProcessing;
+    
     // 画像処理を分割実行する
     void Run(Image& image, int numThreads);
+
+    // 画像処理を grainSize 画素ずつに分割して threadPool で実行する
+    void Run(Image& image, ThreadPool& threadPool, int grainSize);
+    
+    // TileProcessing を行単位のタイルに分割して実行する
+    // halo: フィルタの半径 (タイルの大きさを決めるときに上下に参照する行を含める)
+    void RunTiled(const ImageView& image, int halo) {
+        RunTiled(image.Width(), image.Height(), (int)sizeof(RGB), halo);
+    }
+    template<class T> void RunTiled(const Plane<T>& plane, int halo) {
+        RunTiled(plane.Width(), plane.Height(), (int)sizeof(T), halo);
+    }
+    void RunTiled(int width, int height, int pixelBytes, int halo);
+    
+    // TileProcessing を tileHeight 行ずつのタイルに分割して threadPool で実行する
+    void RunTiled(const ImageView& image, ThreadPool& threadPool, int tileHeight) {
+        RunTiled(image.Width(), image.Height(), threadPool, tileHeight);
+    }
+    void RunTiled(int width, int height, ThreadPool& threadPool, int tileHeight);
+    
+    // 近傍を参照するフィルタの入力を返す
+    // source と image の画素データが重なるなら source のコピーを copy に借りて返す
+    static ImageView Source(const ImageView& source, const ImageView& image, ImagePool::Buffer& copy);
+    
+    // 近傍を参照するフィルタの出力を返す
+    // image の大きさが source と違う場合は作り直す
+    static ImageView Output(const Image& source, Image& image);
 };
 
     
@@ -41,6 +94,7 @@ public:
     static void Process(Image& image) {
         Monochrome filter(image);
     }
+    static PointOperation Operation();
 };
 
     
@@ -65,17 +119,52 @@ public:
     static void Process(Image& image, int threshold) {
         Binarize filter(image,threshold);
     }
+    static PointOperation Operation(int threshold);
+};
+
+
+//------------------------------------------------------------------------------
+// メディアンの求め方
+//------------------------------------------------------------------------------
+enum MedianMethod {
+    MEDIAN_AUTO,      // 窓の画素数で選ぶ
+    MEDIAN_SORT,      // 画素ごとに窓の値を並べ替える
+    MEDIAN_HISTOGRAM, // 列ごとのヒストグラムを更新する (窓の大きさに依らない)
 };
 
 
+//------------------------------------------------------------------------------
+// 近傍を参照するフィルタ (メディアン, 平均化, Gaussian, Bilateral, Sobel, Laplacian)
+//
+//  (source, image) に ImageView を渡すと部分画像をコピーせずに処理する.
+//  このとき image は source と同じ大きさであること. Image を渡すと image の大きさを合わせる.
+//  どちらも source と image が同じ画素 (重なる部分画像) でもよい.
+//  メディアン, 平均化, Gaussian は 1 チャンネルの画像 (Plane8, Plane16, PlaneF) も処理できる.
+//------------------------------------------------------------------------------
+
+
 //------------------------------------------------------------------------------
 // メディアンフィルタ
 //------------------------------------------------------------------------------
 class MedianFilter : IImageProcessing {
 public:
-    MedianFilter(Image& image, int filterSize);
-    static void Process(Image& image, int filterSize) {
-    MedianFilter filter(image,filterSize);
+    MedianFilter(const ImageView& source, const ImageView& image, int filterSize, MedianMethod method = MEDIAN_AUTO);
+    MedianFilter(const Image& source, Image& image, int filterSize, MedianMethod method = MEDIAN_AUTO)
+        : MedianFilter(source.View(), Output(source, image), filterSize, method) {}
+    MedianFilter(Image& image, int filterSize, MedianMethod method = MEDIAN_AUTO)
+        : MedianFilter(image, image, filterSize, method) {}
+    static void Process(Image& image, int filterSize, MedianMethod method = MEDIAN_AUTO) {
+    MedianFilter filter(image,filterSize,method);
+    }
+    static void Process(const Image& source, Image& image, int filterSize, MedianMethod method = MEDIAN_AUTO) {
+        MedianFilter filter(source,image,filterSize,method);
+    }
+    static void Process(const ImageView& source, const ImageView& image, int filterSize, MedianMethod method = MEDIAN_AUTO) {
+        MedianFilter filter(source,image,filterSize,method);
+    }
+    template<class T> MedianFilter(const Plane<T>& source, Plane<T>& image, int filterSize);
+    template<class T> static void Process(const Plane<T>& source, Plane<T>& image, int filterSize) {
+        MedianFilter filter(source,image,filterSize);
     }
 };
 
@@ -85,10 +174,23 @@ public:
 //------------------------------------------------------------------------------
 class AverageFilter : IImageProcessing {
 public:
-    AverageFilter(Image& image, int filterSize);
+    AverageFilter(const ImageView& source, const ImageView& image, int filterSize);
+    AverageFilter(const Image& source, Image& image, int filterSize)
+        : AverageFilter(source.View(), Output(source, image), filterSize) {}
+    AverageFilter(Image& image, int filterSize) : AverageFilter(image, image, filterSize) {}
     static void Process(Image& image, int filterSize) {
         AverageFilter filter(image,filterSize);
     }
+    static void Process(const Image& source, Image& image, int filterSize) {
+        AverageFilter filter(source,image,filterSize);
+    }
+    static void Process(const ImageView& source, const ImageView& image, int filterSize) {
+        AverageFilter filter(source,image,filterSize);
+    }
+    template<class T> AverageFilter(const Plane<T>& source, Plane<T>& image, int filterSize);
+    template<class T> static void Process(const Plane<T>& source, Plane<T>& image, int filterSize) {
+        AverageFilter filter(source,image,filterSize);
+    }
 };
     
     
@@ -97,20 +199,59 @@ public:
 //------------------------------------------------------------------------------
 class GaussianFilter : IImageProcessing {
 public:
-    GaussianFilter(Image& image, int filterSize, double sigma);
+    GaussianFilter(const ImageView& source, const ImageView& image, int filterSize, double sigma);
+    GaussianFilter(const Image& source, Image& image, int filterSize, double sigma)
+        : GaussianFilter(source.View(), Output(source, image), filterSize, sigma) {}
+    GaussianFilter(Image& image, int filterSize, double sigma)
+        : GaussianFilter(image, image, filterSize, sigma) {}
     static void Process(Image& image, int filterSize, double sigma) {
         GaussianFilter filter(image, filterSize, sigma);
     }
+    static void Process(const Image& source, Image& image, int filterSize, double sigma) {
+        GaussianFilter filter(source, image, filterSize, sigma);
+    }
+    static void Process(const ImageView& source, const ImageView& image, int filterSize, double sigma) {
+        GaussianFilter filter(source, image, filterSize, sigma);
+    }
+    template<class T> GaussianFilter(const Plane<T>& source, Plane<T>& image, int filterSize, double sigma);
+    template<class T> static void Process(const Plane<T>& source, Plane<T>& image, int filterSize, double sigma) {
+        GaussianFilter filter(source, image, filterSize, sigma);
+    }
 };
     
+//------------------------------------------------------------------------------
+// Bilateral 系フィルタの計算方法
+//------------------------------------------------------------------------------
+enum BilateralMethod {
+    BILATERAL_EXACT, // 窓の全ての画素から計算する
+    BILATERAL_GRID,  // bilateral grid で近似する (窓の大きさに依らない. 大きなフィルタ向け)
+};
+
+
 //------------------------------------------------------------------------------
 // Bilateral フィルタ
 //------------------------------------------------------------------------------
 class BilateralFilter : IImageProcessing {
 public:
-    BilateralFilter(Image& image, int filterSize, double sigma, double sigma2);
-    static void Process(Image& image, int filterSize, double sigma, double sigma2) {
-        BilateralFilter filter(image, filterSize, sigma, sigma2);
+    BilateralFilter(const ImageView& source, const ImageView& image, int filterSize, double sigma, double sigma2,
+                    BilateralMethod method = BILATERAL_EXACT);
+    BilateralFilter(const Image& source, Image& image, int filterSize, double sigma, double sigma2,
+                    BilateralMethod method = BILATERAL_EXACT)
+        : BilateralFilter(source.View(), Output(source, image), filterSize, sigma, sigma2, method) {}
+    BilateralFilter(Image& image, int filterSize, double sigma, double sigma2,
+                    BilateralMethod method = BILATERAL_EXACT)
+        : BilateralFilter(image, image, filterSize, sigma, sigma2, method) {}
+    static void Process(Image& image, int filterSize, double sigma, double sigma2,
+                        BilateralMethod method = BILATERAL_EXACT) {
+        BilateralFilter filter(image, filterSize, sigma, sigma2, method);
+    }
+    static void Process(const Image& source, Image& image, int filterSize, double sigma, double sigma2,
+                        BilateralMethod method = BILATERAL_EXACT) {
+        BilateralFilter filter(source, image, filterSize, sigma, sigma2, method);
+    }
+    static void Process(const ImageView& source, const ImageView& image, int filterSize, double sigma, double sigma2,
+                        BilateralMethod method = BILATERAL_EXACT) {
+        BilateralFilter filter(source, image, filterSize, sigma, sigma2, method);
     }
 };
     
@@ -119,10 +260,18 @@ public:
 //------------------------------------------------------------------------------
 class SobelFilter : IImageProcessing {
 public:
-    SobelFilter(Image& image);
+    SobelFilter(const ImageView& source, const ImageView& image);
+    SobelFilter(const Image& source, Image& image) : SobelFilter(source.View(), Output(source, image)) {}
+    SobelFilter(Image& image) : SobelFilter(image, image) {}
     static void Process(Image& image) {
         SobelFilter filter(image);
     }
+    static void Process(const Image& source, Image& image) {
+        SobelFilter filter(source, image);
+    }
+    static void Process(const ImageView& source, const ImageView& image) {
+        SobelFilter filter(source, image);
+    }
 };
 
 //------------------------------------------------------------------------------
@@ -130,10 +279,18 @@ public:
 //------------------------------------------------------------------------------
 class LaplacianFilter : IImageProcessing {
 public:
-    LaplacianFilter(Image& image);
+    LaplacianFilter(const ImageView& source, const ImageView& image);
+    LaplacianFilter(const Image& source, Image& image) : LaplacianFilter(source.View(), Output(source, image)) {}
+    LaplacianFilter(Image& image) : LaplacianFilter(image, image) {}
     static void Process(Image& image) {
         LaplacianFilter filter(image);
     }
+    static void Process(const Image& source, Image& image) {
+        LaplacianFilter filter(source, image);
+    }
+    static void Process(const ImageView& source, const ImageView& image) {
+        LaplacianFilter filter(source, image);
+    }
 };
     
 //------------------------------------------------------------------------------
@@ -178,6 +335,7 @@ public:
     static void Process (Image& image, double param) {
         GammaCollection filter(image, param);
     }
+    static PointOperation Operation(double param);
 };
 
 }
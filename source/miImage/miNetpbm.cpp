@@ -0,0 +1,405 @@
+﻿//==============================================================================
+//
+// PGM / PPM / PFM を読み書きするクラス
+//
+//==============================================================================
+#include "miNetpbm.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace mi {
+
+namespace {
+
+//------------------------------------------------------------------------------
+// ヘッダ (PNM の値は最大値, PFM の値はスケール)
+//------------------------------------------------------------------------------
+struct Header {
+    std::string magic;
+    int    width  = 0;
+    int    height = 0;
+    double value  = 0;
+};
+
+//------------------------------------------------------------------------------
+// 空白とコメントを飛ばして次の値を読む (値の後の空白 1 文字まで読む)
+//------------------------------------------------------------------------------
+std::string ReadToken(std::ifstream& file) {
+
+    std::string token;
+    int c;
+
+    while((c = file.get()) != EOF) {
+        if(c == '#' && token.empty()) {
+            while((c = file.get()) != EOF && c != '\n');
+            continue;
+        }
+        if(std::isspace(c)) {
+            if(!token.empty()) break;
+            continue;
+        }
+        token += (char)c;
+    }
+    return token;
+}
+
+//------------------------------------------------------------------------------
+// ヘッダを読み込む
+//------------------------------------------------------------------------------
+Header ReadHeader(std::ifstream& file) {
+
+    Header header;
+    header.magic  = ReadToken(file);
+    header.width  = std::atoi(ReadToken(file).c_str());
+    header.height = std::atoi(ReadToken(file).c_str());
+    header.value  = std::atof(ReadToken(file).c_str());
+
+    if(header.width <= 0 || header.height <= 0) {
+        std::cerr<<"Error: Invalid Image Size"<<std::endl;
+        throw "File Open Error";
+    }
+
+    // 1行の読み込み領域も int で計算するので, チャンネル数と画素のバイト数まで含めて確かめる
+    const bool pfm      = header.magic == "PF" || header.magic == "Pf";
+    const int  channels = header.magic == "P6" || header.magic == "PF" ? 3 : 1;
+    const int  bytes    = pfm ? 4 : header.value > 255 ? 2 : 1;
+    ImageCodec::CheckSize(header.width, header.height, channels * bytes);
+
+    return header;
+}
+
+//------------------------------------------------------------------------------
+// PNM のヘッダを読み込む (P5, P6 のみ)
+//------------------------------------------------------------------------------
+Header ReadPnmHeader(std::ifstream& file) {
+
+    Header header = ReadHeader(file);
+
+    if(header.magic != "P5" && header.magic != "P6") {
+        std::cerr<<"Error: This is not binary PGM/PPM Image"<<std::endl;
+        throw "File Open Error";
+    }
+    if(header.value < 1 || header.value > 65535) {
+        std::cerr<<"Error: Invalid Max Value"<<std::endl;
+        throw "File Open Error";
+    }
+    return header;
+}
+
+//------------------------------------------------------------------------------
+// PFM のヘッダを読み込む
+//------------------------------------------------------------------------------
+Header ReadPfmHeader(std::ifstream& file) {
+
+    Header header = ReadHeader(file);
+
+    if(header.magic != "PF" && header.magic != "Pf") {
+        std::cerr<<"Error: This is not PFM Image"<<std::endl;
+        throw "File Open Error";
+    }
+    return header;
+}
+
+//------------------------------------------------------------------------------
+// 1行読み込む (途中で終わっているファイルは残りを 0 にする)
+//------------------------------------------------------------------------------
+void ReadRow(std::ifstream& file, void* row, size_t bytes) {
+
+    file.read((char*)row, bytes);
+    if(!file) {
+        std::memset((char*)row + file.gcount(), 0, bytes - (size_t)file.gcount());
+    }
+}
+
+// 0.0~1.0 を 0~255 にする
+inline unsigned char ToByte(float value) {
+    return (unsigned char)std::max(0.0f, std::min(255.0f, value * 255.0f + 0.5f));
+}
+
+// ファイル名の拡張子が extension か (大文字小文字は区別しない)
+bool HasExtension(const char* fileName, const char* extension) {
+
+    const char* dot = std::strrchr(fileName, '.');
+    if(!dot || std::strlen(dot) != std::strlen(extension)) return false;
+
+    for(int i=0; dot[i]; i++) {
+        if(std::tolower((unsigned char)dot[i]) != extension[i]) return false;
+    }
+    return true;
+}
+
+}
+
+
+//------------------------------------------------------------------------------
+// PGM / PPM を image に読み込む
+//------------------------------------------------------------------------------
+void PnmCodec::Read(const char* fileName, Image& image) {
+
+    std::ifstream file;
+    Open(file, fileName);
+
+    const Header header   = ReadPnmHeader(file);
+    const int    width    = header.width;
+    const int    height   = header.height;
+    const int    maxValue = (int)header.value;
+    const int    channels = header.magic == "P6" ? 3 : 1;
+    const int    bytes    = maxValue > 255 ? 2 : 1;
+
+    // 画像のサイズが違ったら再確保
+    if(image.Width() != width || image.Height() != height) {
+        image = Image(channels == 3 ? 24 : 8, width, height);
+    }
+
+    std::vector<unsigned char> buffer(width * channels * bytes);
+
+    for(int iY=0; iY<height; iY++) {
+        ReadRow(file, buffer.data(), buffer.size());
+
+        RGB* dst = image.data + iY * width;
+
+        for(int iX=0; iX<width; iX++) {
+            unsigned char value[3];
+
+            for(int c=0; c<channels; c++) {
+                const unsigned char* src = &buffer[(iX * channels + c) * bytes];
+                int v = bytes == 2 ? (src[0] << 8 | src[1]) : src[0];
+
+                // 最大値が 255 でなければ 0~255 に直す
+                if(maxValue != 255) v = (v * 255 + maxValue / 2) / maxValue;
+                value[c] = (unsigned char)std::min(v, 255);
+            }
+
+            if(channels == 3) dst[iX] = RGB(value[0], value[1], value[2]);
+            else              dst[iX] = RGB(value[0], value[0], value[0]);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// P5 を値のまま plane に読み込む
+//------------------------------------------------------------------------------
+void PnmCodec::Read(const char* fileName, Plane8& plane)  { ReadPlane(fileName, plane); }
+void PnmCodec::Read(const char* fileName, Plane16& plane) { ReadPlane(fileName, plane); }
+
+template<class T> void PnmCodec::ReadPlane(const char* fileName, Plane<T>& plane) {
+
+    std::ifstream file;
+    Open(file, fileName);
+
+    const Header header   = ReadPnmHeader(file);
+    const int    width    = header.width;
+    const int    height   = header.height;
+    const int    bytes    = header.value > 255 ? 2 : 1;
+
+    // 1 チャンネルで, 値が T に収まるものだけ
+    if(header.magic != "P5" || bytes > (int)sizeof(T)) {
+        NotSupported(fileName);
+    }
+
+    plane.Initialize(width, height);
+
+    std::vector<unsigned char> buffer(width * bytes);
+
+    for(int iY=0; iY<height; iY++) {
+        ReadRow(file, buffer.data(), buffer.size());
+
+        T* dst = plane.Row(iY);
+        for(int iX=0; iX<width; iX++) {
+            const unsigned char* src = &buffer[iX * bytes];
+            dst[iX] = (T)(bytes == 2 ? (src[0] << 8 | src[1]) : src[0]);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// image を PGM (R のみ) / PPM で書き込む
+//------------------------------------------------------------------------------
+void PnmCodec::Write(const char* fileName, const ImageView& image) {
+
+    const bool gray   = HasExtension(fileName, ".pgm");
+    const int  width  = image.Width();
+    const int  height = image.Height();
+
+    std::ofstream file;
+    Open(file, fileName);
+
+    file << (gray ? "P5" : "P6") << "\n" << width << " " << height << "\n255\n";
+
+    std::vector<unsigned char> buffer(width * (gray ? 1 : 3));
+
+    for(int iY=0; iY<height; iY++) {
+        const RGB* src = image.Row(iY);
+        unsigned char* dst = buffer.data();
+
+        for(int iX=0; iX<width; iX++) {
+            *dst++ = src[iX].r;
+            if(gray) continue;
+            *dst++ = src[iX].g;
+            *dst++ = src[iX].b;
+        }
+
+        file.write((const char*)buffer.data(), buffer.size());
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// plane を P5 で書き込む
+//------------------------------------------------------------------------------
+void PnmCodec::Write(const char* fileName, const Plane8& plane)  { WritePlane(fileName, plane, 255); }
+void PnmCodec::Write(const char* fileName, const Plane16& plane) { WritePlane(fileName, plane, 65535); }
+
+template<class T> void PnmCodec::WritePlane(const char* fileName, const Plane<T>& plane, int maxValue) {
+
+    const int width  = plane.Width();
+    const int height = plane.Height();
+    const int bytes  = maxValue > 255 ? 2 : 1;
+
+    std::ofstream file;
+    Open(file, fileName);
+
+    file << "P5\n" << width << " " << height << "\n" << maxValue << "\n";
+
+    std::vector<unsigned char> buffer(width * bytes);
+
+    for(int iY=0; iY<height; iY++) {
+        const T* src = plane.Row(iY);
+
+        // 16bit はビッグエンディアン
+        for(int iX=0; iX<width; iX++) {
+            if(bytes == 2) {
+                buffer[iX * 2 + 0] = (unsigned char)(src[iX] >> 8);
+                buffer[iX * 2 + 1] = (unsigned char)(src[iX] & 0xff);
+            }
+            else {
+                buffer[iX] = (unsigned char)src[iX];
+            }
+        }
+
+        file.write((const char*)buffer.data(), buffer.size());
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// PFM を image に読み込む (0.0~1.0 を 0~255 にする)
+//------------------------------------------------------------------------------
+void PfmCodec::Read(const char* fileName, Image& image) {
+
+    std::ifstream file;
+    Open(file, fileName);
+
+    const Header header   = ReadPfmHeader(file);
+    const int    width    = header.width;
+    const int    height   = header.height;
+    const int    channels = header.magic == "PF" ? 3 : 1;
+    const bool   swap     = (header.value < 0) != IsLittleEndian();
+
+    // 画像のサイズが違ったら再確保
+    if(image.Width() != width || image.Height() != height) {
+        image = Image(channels == 3 ? 24 : 8, width, height);
+    }
+
+    std::vector<float> buffer(width * channels);
+
+    // 下の行から並んでいる
+    for(int iY=height-1; iY>=0; iY--) {
+        ReadRow(file, buffer.data(), buffer.size() * sizeof(float));
+        if(swap) SwapBytes(buffer.data(), buffer.size(), sizeof(float));
+
+        RGB* dst = image.data + iY * width;
+        const float* src = buffer.data();
+
+        for(int iX=0; iX<width; iX++, src+=channels) {
+            if(channels == 3) dst[iX] = RGB(ToByte(src[0]), ToByte(src[1]), ToByte(src[2]));
+            else              dst[iX] = RGB(ToByte(src[0]), ToByte(src[0]), ToByte(src[0]));
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Pf を値のまま plane に読み込む
+//------------------------------------------------------------------------------
+void PfmCodec::Read(const char* fileName, PlaneF& plane) {
+
+    std::ifstream file;
+    Open(file, fileName);
+
+    const Header header = ReadPfmHeader(file);
+    const int    width  = header.width;
+    const int    height = header.height;
+    const bool   swap   = (header.value < 0) != IsLittleEndian();
+
+    if(header.magic != "Pf") {
+        NotSupported(fileName);
+    }
+
+    plane.Initialize(width, height);
+
+    // 下の行から並んでいる
+    for(int iY=height-1; iY>=0; iY--) {
+        ReadRow(file, plane.Row(iY), width * sizeof(float));
+        if(swap) SwapBytes(plane.Row(iY), width, sizeof(float));
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// image を PF で書き込む (0~255 を 0.0~1.0 にする)
+//------------------------------------------------------------------------------
+void PfmCodec::Write(const char* fileName, const ImageView& image) {
+
+    const int width  = image.Width();
+    const int height = image.Height();
+
+    std::ofstream file;
+    Open(file, fileName);
+
+    // スケールが負ならリトルエンディアン
+    file << "PF\n" << width << " " << height << "\n" << (IsLittleEndian() ? "-1.0" : "1.0") << "\n";
+
+    std::vector<float> buffer(width * 3);
+
+    for(int iY=height-1; iY>=0; iY--) {
+        const RGB* src = image.Row(iY);
+
+        for(int iX=0; iX<width; iX++) {
+            buffer[iX * 3 + 0] = src[iX].r / 255.0f;
+            buffer[iX * 3 + 1] = src[iX].g / 255.0f;
+            buffer[iX * 3 + 2] = src[iX].b / 255.0f;
+        }
+
+        file.write((const char*)buffer.data(), buffer.size() * sizeof(float));
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// plane を Pf で書き込む
+//------------------------------------------------------------------------------
+void PfmCodec::Write(const char* fileName, const PlaneF& plane) {
+
+    const int width  = plane.Width();
+    const int height = plane.Height();
+
+    std::ofstream file;
+    Open(file, fileName);
+
+    file << "Pf\n" << width << " " << height << "\n" << (IsLittleEndian() ? "-1.0" : "1.0") << "\n";
+
+    for(int iY=height-1; iY>=0; iY--) {
+        file.write((const char*)plane.Row(iY), width * sizeof(float));
+    }
+}
+
+}
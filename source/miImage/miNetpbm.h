@@ -0,0 +1,59 @@
+﻿//==============================================================================
+//
+// PGM / PPM / PFM を読み書きするクラス
+//
+//==============================================================================
+#ifndef _MI_NETPBM_H_
+#define _MI_NETPBM_H_
+
+#include "miImageCodec.h"
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// PGM (P5) / PPM (P6) を読み書きするクラス
+//
+//  Image: P6 はカラー, P5 はグレースケールとして読む. 16bit の値は 8bit に丸める.
+//         拡張子が .pgm なら R を P5 で, それ以外は P6 で書き込む.
+//  Plane8 / Plane16: P5 の値をそのまま読み書きする (Plane16 は最大値 65535 で書き込む)
+//------------------------------------------------------------------------------
+class PnmCodec : public ImageCodec {
+public:
+    using ImageCodec::Read;
+    using ImageCodec::Write;
+
+    void Read(const char* fileName, Image& image);
+    void Read(const char* fileName, Plane8& plane);
+    void Read(const char* fileName, Plane16& plane);
+
+    void Write(const char* fileName, const ImageView& image);
+    void Write(const char* fileName, const Plane8& plane);
+    void Write(const char* fileName, const Plane16& plane);
+
+private:
+    template<class T> void ReadPlane(const char* fileName, Plane<T>& plane);
+    template<class T> void WritePlane(const char* fileName, const Plane<T>& plane, int maxValue);
+};
+
+
+//------------------------------------------------------------------------------
+// PFM (float) を読み書きするクラス
+//
+//  PlaneF: Pf (1 チャンネル) をそのまま読み書きする. 深度画像を量子化せずに保存できる.
+//  Image:  PF / Pf を 0.0~1.0 を 0~255 として読み, PF で書き込む.
+//------------------------------------------------------------------------------
+class PfmCodec : public ImageCodec {
+public:
+    using ImageCodec::Read;
+    using ImageCodec::Write;
+
+    void Read(const char* fileName, Image& image);
+    void Read(const char* fileName, PlaneF& plane);
+
+    void Write(const char* fileName, const ImageView& image);
+    void Write(const char* fileName, const PlaneF& plane);
+};
+
+}
+
+#endif
@@ -0,0 +1,93 @@
+﻿//==============================================================================
+//
+// 1 チャンネルの画像
+//
+//==============================================================================
+#include "miPlane.h"
+
+#include <type_traits>
+
+namespace mi {
+
+// vector<Plane> や PlanarImage が確保し直すときにコピーせずムーブするため
+static_assert(std::is_nothrow_move_constructible<Plane8>::value, "Plane must be nothrow movable");
+static_assert(std::is_nothrow_move_constructible<PlanarImage>::value, "PlanarImage must be nothrow movable");
+
+//------------------------------------------------------------------------------
+// image をチャンネルごとに分けて作る
+//------------------------------------------------------------------------------
+PlanarImage::PlanarImage(const ImageView& image) {
+    Split(image, *this);
+}
+
+//------------------------------------------------------------------------------
+// image をチャンネルごとに分ける
+//------------------------------------------------------------------------------
+void Split(const ImageView& image, PlanarImage& planar) {
+
+    const int W = image.Width();
+    const int H = image.Height();
+
+    planar.r.Initialize(W, H);
+    planar.g.Initialize(W, H);
+    planar.b.Initialize(W, H);
+
+    for(int iY=0; iY<H; iY++) {
+        const RGB* src = image.Row(iY);
+        unsigned char* r = planar.r.Row(iY);
+        unsigned char* g = planar.g.Row(iY);
+        unsigned char* b = planar.b.Row(iY);
+
+        for(int iX=0; iX<W; iX++) {
+            r[iX] = src[iX].r;
+            g[iX] = src[iX].g;
+            b[iX] = src[iX].b;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// チャンネルごとに分けた画像を image に書き込む
+//------------------------------------------------------------------------------
+void Merge(const PlanarImage& planar, const ImageView& image) {
+
+    const int W = std::min(image.Width(),  planar.Width());
+    const int H = std::min(image.Height(), planar.Height());
+
+    for(int iY=0; iY<H; iY++) {
+        const unsigned char* r = planar.r.Row(iY);
+        const unsigned char* g = planar.g.Row(iY);
+        const unsigned char* b = planar.b.Row(iY);
+        RGB* dst = image.Row(iY);
+
+        for(int iX=0; iX<W; iX++) {
+            dst[iX].r = r[iX];
+            dst[iX].g = g[iX];
+            dst[iX].b = b[iX];
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// image の 1 チャンネルを取り出す
+//------------------------------------------------------------------------------
+void ExtractChannel(const ImageView& image, int channel, Plane8& plane) {
+
+    const int W = image.Width();
+    const int H = image.Height();
+
+    plane.Initialize(W, H);
+
+    for(int iY=0; iY<H; iY++) {
+        const RGB* src = image.Row(iY);
+        unsigned char* dst = plane.Row(iY);
+
+        switch(channel) {
+        case 0:  for(int iX=0; iX<W; iX++) dst[iX] = src[iX].r; break;
+        case 1:  for(int iX=0; iX<W; iX++) dst[iX] = src[iX].g; break;
+        default: for(int iX=0; iX<W; iX++) dst[iX] = src[iX].b; break;
+        }
+    }
+}
+
+}
@@ -0,0 +1,175 @@
+﻿//==============================================================================
+//
+// 1 チャンネルの画像
+//
+//==============================================================================
+#ifndef _MI_PLANE_H_
+#define _MI_PLANE_H_
+
+#include "miImage.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 1 チャンネルの画像 (輝度画像, 16bit / float の深度画像など)
+//
+//  各行の先頭を ALIGNMENT バイト境界に揃えて確保する. stride は 1 行の要素数.
+//  T は unsigned char, uint16_t, float を想定している.
+//------------------------------------------------------------------------------
+template<class T> class Plane {
+public:
+    // 行の先頭を揃えるバイト数
+    static const int ALIGNMENT = 64;
+
+    //--------------------------------------------------------------------------
+    // コンストラクタ / コピー / ムーブ
+    //--------------------------------------------------------------------------
+    Plane() {}
+    Plane(int width, int height) { Initialize(width, height); }
+    Plane(const Plane& copied) { *this = copied; }
+    Plane(Plane&& moved) noexcept { *this = std::move(moved); }
+
+    Plane& operator=(const Plane& copied)
+    {
+        if(this != &copied) {
+            Initialize(copied.width, copied.height);
+            for(int iY=0; iY<height; iY++) {
+                std::copy(copied.Row(iY), copied.Row(iY) + width, Row(iY));
+            }
+        }
+        return *this;
+    }
+
+    Plane& operator=(Plane&& moved) noexcept
+    {
+        if(this != &moved) {
+            buffer  = std::move(moved.buffer);
+            data    = moved.data;
+            width   = moved.width;
+            height  = moved.height;
+            stride  = moved.stride;
+            moved.data  = nullptr;
+            moved.width = moved.height = moved.stride = 0;
+        }
+        return *this;
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 大きさを変える (同じ大きさなら確保し直さない. 値は不定)
+    //--------------------------------------------------------------------------
+    void Initialize(int width, int height)
+    {
+        if(data && this->width == width && this->height == height) {
+            return;
+        }
+
+        const int perLine = ALIGNMENT / (int)sizeof(T);
+
+        this->width  = width;
+        this->height = height;
+        this->stride = (width + perLine - 1) / perLine * perLine;
+
+        // 先頭を揃える分だけ多めに確保する
+        size_t bytes = (size_t)stride * height * sizeof(T) + ALIGNMENT;
+        buffer.reset(new unsigned char[bytes]);
+
+        uintptr_t address = reinterpret_cast<uintptr_t>(buffer.get());
+        address = (address + ALIGNMENT - 1) & ~(uintptr_t)(ALIGNMENT - 1);
+        data = reinterpret_cast<T*>(address);
+    }
+
+    //--------------------------------------------------------------------------
+    // @brief 全ての画素を value にする
+    //--------------------------------------------------------------------------
+    void Fill(T value)
+    {
+        for(int iY=0; iY<height; iY++) {
+            std::fill(Row(iY), Row(iY) + width, value);
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // Getter
+    //--------------------------------------------------------------------------
+    int Width()  const { return width; }
+    int Height() const { return height; }
+    int Stride() const { return stride; }
+    int Size()   const { return width * height; }
+
+    // iY 行目の先頭
+    T*       Row(int iY)       { return data + (ptrdiff_t)iY * stride; }
+    const T* Row(int iY) const { return data + (ptrdiff_t)iY * stride; }
+
+    // (iX, iY) の画素
+    T&       operator()(int iX, int iY)       { return Row(iY)[iX]; }
+    const T& operator()(int iX, int iY) const { return Row(iY)[iX]; }
+
+private:
+    std::unique_ptr<unsigned char[]> buffer; // 確保した領域 (data はこの中の揃えた位置)
+    T* data = nullptr;
+
+    int width  = 0; // 幅
+    int height = 0; // 高さ
+    int stride = 0; // 1行の要素数
+};
+
+typedef Plane<unsigned char> Plane8;
+typedef Plane<uint16_t>      Plane16;
+typedef Plane<float>         PlaneF;
+
+
+//------------------------------------------------------------------------------
+// チャンネルごとに分けて持つ画像 (planar)
+//
+//  1 チャンネルだけ使う処理は Image の 1/3 の帯域で読める
+//------------------------------------------------------------------------------
+struct PlanarImage {
+    Plane8 r, g, b;
+
+    PlanarImage() {}
+    PlanarImage(const ImageView& image);
+
+    int Width()  const { return r.Width(); }
+    int Height() const { return r.Height(); }
+};
+
+
+//------------------------------------------------------------------------------
+// @brief image をチャンネルごとに分ける (planar の大きさは image に合わせる)
+//------------------------------------------------------------------------------
+void Split(const ImageView& image, PlanarImage& planar);
+
+//------------------------------------------------------------------------------
+// @brief チャンネルごとに分けた画像を image に書き込む (image は planar と同じ大きさ)
+//------------------------------------------------------------------------------
+void Merge(const PlanarImage& planar, const ImageView& image);
+
+//------------------------------------------------------------------------------
+// @brief image の 1 チャンネルを取り出す (0:R 1:G 2:B)
+//------------------------------------------------------------------------------
+void ExtractChannel(const ImageView& image, int channel, Plane8& plane);
+
+//------------------------------------------------------------------------------
+// @brief plane の値に scale を掛けて image の RGB 全てに書き込む (範囲外は 0~255 に丸める)
+//   深度画像の確認用. image は plane と同じ大きさ
+//------------------------------------------------------------------------------
+template<class T> void ToGray(const Plane<T>& plane, const ImageView& image, double scale = 1.0)
+{
+    for(int iY=0; iY<plane.Height(); iY++) {
+        const T* src = plane.Row(iY);
+        RGB* dst = image.Row(iY);
+        for(int iX=0; iX<plane.Width(); iX++) {
+            double v = std::max(0.0, std::min(255.0, src[iX] * scale));
+            dst[iX] = RGB(v, v, v);
+        }
+    }
+}
+
+}
+
+#endif
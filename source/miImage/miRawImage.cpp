@@ -0,0 +1,232 @@
+﻿//==============================================================================
+//
+// ヘッダ付きの無圧縮画像を読み書きするクラス
+//
+//==============================================================================
+#include "miRawImage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace mi {
+
+static_assert(sizeof(RawImageCodec::Header) == 64, "raw image header must be 64 bytes");
+static_assert(sizeof(RGB) == 3, "raw image rows are read directly into RGB rows");
+
+namespace {
+
+// 1行のバイト数を 64 byte の倍数にする
+inline uint32_t AlignedStride(size_t bytes) {
+    return (uint32_t)((bytes + 63) / 64 * 64);
+}
+
+// 1行読み込む (途中で終わっているファイルは残りを 0 にする)
+void ReadRow(std::ifstream& file, void* row, size_t bytes) {
+
+    file.read((char*)row, bytes);
+    if(!file) {
+        std::memset((char*)row + file.gcount(), 0, bytes - (size_t)file.gcount());
+    }
+}
+
+}
+
+
+//------------------------------------------------------------------------------
+// ヘッダを読み込んで画素の先頭に移動する
+//------------------------------------------------------------------------------
+RawImageCodec::Header RawImageCodec::ReadHeader(std::ifstream& file) {
+
+    Header header;
+    file.read((char*)&header, sizeof(header));
+
+    if(!file || std::memcmp(header.magic, "MIRW", 4) != 0) {
+        std::cerr<<"Error: This is not Raw Image"<<std::endl;
+        throw "File Open Error";
+    }
+
+    if(!IsLittleEndian()) {
+        SwapBytes(&header.version, 7, sizeof(uint32_t));
+    }
+
+    // 1行のバイト数は 32bit を超えることがあるので 64bit で比べる
+    const uint64_t bytes[] = { 1, 2, 4 };
+    if(header.version != 1 || header.type > FLOAT32 ||
+       (header.channels != 1 && header.channels != 3) ||
+       header.stride < (uint64_t)header.width * header.channels * bytes[header.type]) {
+        std::cerr<<"Error: Not Supported Raw Image"<<std::endl;
+        throw "File Open Error";
+    }
+    CheckSize(header.width, header.height, header.channels * bytes[header.type]);
+
+    file.seekg(header.offset);
+    return header;
+}
+
+
+//------------------------------------------------------------------------------
+// ヘッダを書き込む (1行のバイト数は 64 byte の倍数にする)
+//------------------------------------------------------------------------------
+void RawImageCodec::WriteHeader(std::ofstream& file, Header header) {
+
+    const uint32_t bytes[] = { 1, 2, 4 };
+    header.stride = AlignedStride((size_t)header.width * header.channels * bytes[header.type]);
+
+    if(!IsLittleEndian()) {
+        SwapBytes(&header.version, 7, sizeof(uint32_t));
+    }
+    file.write((const char*)&header, sizeof(header));
+}
+
+
+//------------------------------------------------------------------------------
+// image に読み込む
+//------------------------------------------------------------------------------
+void RawImageCodec::Read(const char* fileName, Image& image) {
+
+    std::ifstream file;
+    Open(file, fileName);
+
+    const Header header = ReadHeader(file);
+    const int    width  = header.width;
+    const int    height = header.height;
+
+    if(header.type != UINT8) {
+        NotSupported(fileName);
+    }
+
+    const int    bit    = header.channels == 3 ? 24 : 8;
+
+    // 画像のサイズかチャンネル数が違ったら再確保
+    if(image.Width() != width || image.Height() != height || image.Bit() != bit) {
+        image = Image(bit, width, height);
+    }
+
+    std::vector<unsigned char> buffer(header.stride);
+
+    for(int iY=0; iY<height; iY++) {
+        RGB* dst = image.data + iY * width;
+
+        // 3 チャンネルは行をそのまま読み込む
+        if(header.channels == 3) {
+            ReadRow(file, dst, width * sizeof(RGB));
+            file.ignore(header.stride - width * sizeof(RGB));
+            continue;
+        }
+
+        ReadRow(file, buffer.data(), header.stride);
+        for(int iX=0; iX<width; iX++) {
+            dst[iX] = RGB(buffer[iX], buffer[iX], buffer[iX]);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// plane に読み込む
+//------------------------------------------------------------------------------
+void RawImageCodec::Read(const char* fileName, Plane8& plane)  { ReadPlane(fileName, plane, UINT8); }
+void RawImageCodec::Read(const char* fileName, Plane16& plane) { ReadPlane(fileName, plane, UINT16); }
+void RawImageCodec::Read(const char* fileName, PlaneF& plane)  { ReadPlane(fileName, plane, FLOAT32); }
+
+template<class T> void RawImageCodec::ReadPlane(const char* fileName, Plane<T>& plane, Type type) {
+
+    std::ifstream file;
+    Open(file, fileName);
+
+    const Header header = ReadHeader(file);
+    const int    width  = header.width;
+    const int    height = header.height;
+
+    if(header.type != (uint32_t)type || header.channels != 1) {
+        NotSupported(fileName);
+    }
+
+    plane.Initialize(width, height);
+
+    // 1行のバイト数が同じなら全ての行を 1 回で読み込む
+    if(header.stride == plane.Stride() * sizeof(T)) {
+        ReadRow(file, plane.Row(0), (size_t)header.stride * height);
+    }
+    else {
+        for(int iY=0; iY<height; iY++) {
+            ReadRow(file, plane.Row(iY), width * sizeof(T));
+            file.ignore(header.stride - width * sizeof(T));
+        }
+    }
+
+    if(!IsLittleEndian() && sizeof(T) > 1) {
+        for(int iY=0; iY<height; iY++) {
+            SwapBytes(plane.Row(iY), width, sizeof(T));
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// image を書き込む (8bit x 3 チャンネル)
+//------------------------------------------------------------------------------
+void RawImageCodec::Write(const char* fileName, const ImageView& image) {
+
+    std::ofstream file;
+    Open(file, fileName);
+
+    Header header;
+    header.width    = image.Width();
+    header.height   = image.Height();
+    header.channels = 3;
+    header.type     = UINT8;
+    WriteHeader(file, header);
+
+    const size_t rowBytes = image.Width() * sizeof(RGB);
+    const std::vector<char> padding(AlignedStride(rowBytes) - rowBytes, 0);
+
+    for(int iY=0; iY<image.Height(); iY++) {
+        file.write((const char*)image.Row(iY), rowBytes);
+        file.write(padding.data(), padding.size());
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// plane を書き込む
+//------------------------------------------------------------------------------
+void RawImageCodec::Write(const char* fileName, const Plane8& plane)  { WritePlane(fileName, plane, UINT8); }
+void RawImageCodec::Write(const char* fileName, const Plane16& plane) { WritePlane(fileName, plane, UINT16); }
+void RawImageCodec::Write(const char* fileName, const PlaneF& plane)  { WritePlane(fileName, plane, FLOAT32); }
+
+template<class T> void RawImageCodec::WritePlane(const char* fileName, const Plane<T>& plane, Type type) {
+
+    std::ofstream file;
+    Open(file, fileName);
+
+    Header header;
+    header.width    = plane.Width();
+    header.height   = plane.Height();
+    header.channels = 1;
+    header.type     = type;
+    WriteHeader(file, header);
+
+    const size_t rowBytes = plane.Width() * sizeof(T);
+    const std::vector<char> padding(AlignedStride(rowBytes) - rowBytes, 0);
+
+    // Plane の行の隙間は値が不定なので書き込まずに 0 で埋める
+    std::vector<T> buffer(IsLittleEndian() ? 0 : plane.Width());
+
+    for(int iY=0; iY<plane.Height(); iY++) {
+        const T* row = plane.Row(iY);
+
+        if(!IsLittleEndian()) {
+            std::copy(row, row + plane.Width(), buffer.begin());
+            SwapBytes(buffer.data(), buffer.size(), sizeof(T));
+            row = buffer.data();
+        }
+
+        file.write((const char*)row, rowBytes);
+        file.write(padding.data(), padding.size());
+    }
+}
+
+}
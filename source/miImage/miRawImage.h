@@ -0,0 +1,67 @@
+﻿//==============================================================================
+//
+// ヘッダ付きの無圧縮画像を読み書きするクラス
+//
+//==============================================================================
+#ifndef _MI_RAW_IMAGE_H_
+#define _MI_RAW_IMAGE_H_
+
+#include "miImageCodec.h"
+
+#include <cstdint>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// ヘッダ付きの無圧縮画像 (.raw) を読み書きするクラス
+//
+//  64 byte のヘッダの後に, 上の行から画素を並べる (リトルエンディアン).
+//  各行は 64 byte の倍数 (stride) に揃えてあり, Plane のメモリと同じ並びになるので
+//  Plane は 1 回の read で読める. ファイルをそのままメモリに割り当てても行の先頭が揃う.
+//
+//  Image: 8bit x 3 チャンネル (1 チャンネルはグレースケールとして読む)
+//  Plane8 / Plane16 / PlaneF: 同じ型のファイルを値のまま読み書きする
+//------------------------------------------------------------------------------
+class RawImageCodec : public ImageCodec {
+public:
+    using ImageCodec::Read;
+    using ImageCodec::Write;
+
+    // 画素の型
+    enum Type { UINT8 = 0, UINT16 = 1, FLOAT32 = 2 };
+
+    // ヘッダ (64 byte)
+    struct Header {
+        char     magic[4] = { 'M', 'I', 'R', 'W' };
+        uint32_t version  = 1;
+        uint32_t width    = 0;
+        uint32_t height   = 0;
+        uint32_t channels = 1;
+        uint32_t type     = UINT8;
+        uint32_t stride   = 0;  // 1行のバイト数
+        uint32_t offset   = 64; // 画素の先頭の位置
+        uint32_t reserved[8] = {};
+    };
+
+    void Read(const char* fileName, Image& image);
+    void Read(const char* fileName, Plane8& plane);
+    void Read(const char* fileName, Plane16& plane);
+    void Read(const char* fileName, PlaneF& plane);
+
+    void Write(const char* fileName, const ImageView& image);
+    void Write(const char* fileName, const Plane8& plane);
+    void Write(const char* fileName, const Plane16& plane);
+    void Write(const char* fileName, const PlaneF& plane);
+
+private:
+    // ヘッダの読み込み・書き込み (画素の先頭に移動する)
+    Header ReadHeader(std::ifstream& file);
+    void   WriteHeader(std::ofstream& file, Header header);
+
+    template<class T> void ReadPlane(const char* fileName, Plane<T>& plane, Type type);
+    template<class T> void WritePlane(const char* fileName, const Plane<T>& plane, Type type);
+};
+
+}
+
+#endif